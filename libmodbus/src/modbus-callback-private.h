@@ -0,0 +1,49 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_CALLBACK_PRIVATE_H
+#define MODBUS_CALLBACK_PRIVATE_H
+
+#include "modbus.h"
+
+typedef struct {
+    /* Addresses [start, end[ */
+    int start;
+    int end;
+    modbus_mapping_read_cb read;
+    modbus_mapping_write_cb write;
+    void *user_data;
+} _modbus_callback_t;
+
+typedef struct {
+    /* Sorted by address, without overlap */
+    _modbus_callback_t *callbacks;
+    int nb_callbacks;
+    int max_callbacks;
+} _modbus_callback_table_t;
+
+struct _modbus_callbacks {
+    _modbus_callback_table_t tables[MODBUS_TABLE_INPUT_REGISTERS + 1];
+};
+
+struct _modbus_callbacks *_modbus_callbacks_new(void);
+void _modbus_callbacks_free(struct _modbus_callbacks *callbacks);
+/* Fails with EINVAL when the range overlaps a callback range of the table */
+int _modbus_callbacks_add(struct _modbus_callbacks *callbacks,
+                          modbus_table_t table,
+                          int start,
+                          int nb,
+                          modbus_mapping_read_cb read_cb,
+                          modbus_mapping_write_cb write_cb,
+                          void *user_data);
+/* Returns the first callback range of the table overlapping the nb addresses
+   from addr or NULL */
+const _modbus_callback_t *_modbus_callbacks_find(const struct _modbus_callbacks *callbacks,
+                                                 modbus_table_t table,
+                                                 int addr,
+                                                 int nb);
+
+#endif /* MODBUS_CALLBACK_PRIVATE_H */
@@ -0,0 +1,120 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Callback ranges of a mapping (MODBUS_MAPPING_CALLBACKS): the values of an
+ * address interval are provided by the application on request. The intervals
+ * of a table are kept in a sorted array so a request is dispatched with a
+ * binary search.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "modbus-callback-private.h"
+
+struct _modbus_callbacks *_modbus_callbacks_new(void)
+{
+    struct _modbus_callbacks *callbacks;
+
+    callbacks = (struct _modbus_callbacks *) calloc(1, sizeof(struct _modbus_callbacks));
+    if (callbacks == NULL) {
+        errno = ENOMEM;
+    }
+
+    return callbacks;
+}
+
+void _modbus_callbacks_free(struct _modbus_callbacks *callbacks)
+{
+    int table;
+
+    if (callbacks == NULL) {
+        return;
+    }
+
+    for (table = 0; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+        free(callbacks->tables[table].callbacks);
+    }
+    free(callbacks);
+}
+
+/* Index of the first callback range ending after the address */
+static int lower_bound(const _modbus_callback_table_t *t, int addr)
+{
+    int low = 0;
+    int high = t->nb_callbacks;
+
+    while (low < high) {
+        int mid = (low + high) / 2;
+
+        if (t->callbacks[mid].end <= addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+int _modbus_callbacks_add(struct _modbus_callbacks *callbacks,
+                          modbus_table_t table,
+                          int start,
+                          int nb,
+                          modbus_mapping_read_cb read_cb,
+                          modbus_mapping_write_cb write_cb,
+                          void *user_data)
+{
+    _modbus_callback_table_t *t = &callbacks->tables[table];
+    int i;
+    int j;
+
+    i = lower_bound(t, start);
+    if (i < t->nb_callbacks && t->callbacks[i].start < start + nb) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (t->nb_callbacks == t->max_callbacks) {
+        int max_callbacks = t->max_callbacks ? t->max_callbacks * 2 : 4;
+        _modbus_callback_t *array;
+
+        array = (_modbus_callback_t *) realloc(t->callbacks,
+                                               max_callbacks * sizeof(_modbus_callback_t));
+        if (array == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        t->callbacks = array;
+        t->max_callbacks = max_callbacks;
+    }
+
+    for (j = t->nb_callbacks; j > i; j--) {
+        t->callbacks[j] = t->callbacks[j - 1];
+    }
+    t->callbacks[i].start = start;
+    t->callbacks[i].end = start + nb;
+    t->callbacks[i].read = read_cb;
+    t->callbacks[i].write = write_cb;
+    t->callbacks[i].user_data = user_data;
+    t->nb_callbacks++;
+
+    return 0;
+}
+
+const _modbus_callback_t *_modbus_callbacks_find(const struct _modbus_callbacks *callbacks,
+                                                 modbus_table_t table,
+                                                 int addr,
+                                                 int nb)
+{
+    const _modbus_callback_table_t *t = &callbacks->tables[table];
+    int i = lower_bound(t, addr);
+
+    if (i < t->nb_callbacks && t->callbacks[i].start < addr + nb) {
+        return &t->callbacks[i];
+    }
+
+    return NULL;
+}
@@ -0,0 +1,24 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_CRC_PRIVATE_H
+#define MODBUS_CRC_PRIVATE_H
+
+#include <stdint.h>
+
+/* The CRC of a message is _modbus_crc16_update(0xFFFF, msg, msg_length), the
+ * low order byte is sent first. The value returned for a part of the message
+ * can be updated with the following bytes. */
+uint16_t _modbus_crc16_update(uint16_t crc, const uint8_t *buffer, int buffer_length);
+
+/* Implementations, exposed for the tests */
+uint16_t _modbus_crc16_bytewise(uint16_t crc, const uint8_t *buffer, int buffer_length);
+uint16_t _modbus_crc16_slicing8(uint16_t crc, const uint8_t *buffer, int buffer_length);
+/* Falls back to slicing-by-8 when the CPU has no carry-less multiplication */
+uint16_t _modbus_crc16_clmul(uint16_t crc, const uint8_t *buffer, int buffer_length);
+int _modbus_crc16_has_clmul(void);
+
+#endif /* MODBUS_CRC_PRIVATE_H */
@@ -0,0 +1,472 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Read planner: the points of a device profile are sorted by table and address
+ * then swept from the lowest address, each point joins the current request
+ * while the request stays within MODBUS_MAX_READ_* values and the unused
+ * values skipped to reach the point don't exceed the max gap. This greedy
+ * sweep gives the minimal number of requests for the allowed gap.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modbus-private.h"
+#include "modbus-planner.h"
+
+typedef struct {
+    modbus_point_t point;
+    /* Number of bits or registers of the point */
+    int width;
+    double value;
+    /* Request reading the point */
+    int request;
+} _modbus_plan_point_t;
+
+/* Sort key of a point */
+typedef struct {
+    int function;
+    int addr;
+    int index;
+} _modbus_plan_key_t;
+
+typedef struct {
+    int function;
+    int addr;
+    int nb;
+    /* Range of the points of the request in the sorted keys */
+    int first;
+    int nb_points;
+    /* 0 once read, errno of the last failure otherwise */
+    int error;
+} _modbus_plan_request_t;
+
+struct _modbus_planner {
+    modbus_t *ctx;
+    _modbus_plan_point_t *points;
+    int nb_points;
+    int max_points;
+    /* Unused registers read to save a request */
+    int max_gap;
+    /* FALSE when the points have changed since the last plan */
+    int planned;
+    _modbus_plan_key_t *keys;
+    _modbus_plan_request_t *requests;
+    int nb_requests;
+    uint8_t bits[MODBUS_MAX_READ_BITS];
+    uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+};
+
+static int is_bit_table(int function)
+{
+    return function == MODBUS_FC_READ_COILS || function == MODBUS_FC_READ_DISCRETE_INPUTS;
+}
+
+static int max_nb_values(int function)
+{
+    return is_bit_table(function) ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS;
+}
+
+/* A register takes as many bytes in a response as 16 bits */
+static int max_gap_values(const modbus_planner_t *planner, int function)
+{
+    return is_bit_table(function) ? planner->max_gap * 16 : planner->max_gap;
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+    const _modbus_plan_key_t *ka = a;
+    const _modbus_plan_key_t *kb = b;
+
+    if (ka->function != kb->function) {
+        return ka->function - kb->function;
+    }
+    if (ka->addr != kb->addr) {
+        return ka->addr - kb->addr;
+    }
+    return ka->index - kb->index;
+}
+
+/* Returns the 32 bit value of two registers in the order of the point */
+static uint32_t get_uint32(const uint16_t *src, int order)
+{
+    uint32_t a, b, c, d;
+
+    a = (src[0] >> 8) & 0xFF;
+    b = (src[0] >> 0) & 0xFF;
+    c = (src[1] >> 8) & 0xFF;
+    d = (src[1] >> 0) & 0xFF;
+
+    switch (order) {
+    case MODBUS_POINT_DCBA:
+        return (d << 24) | (c << 16) | (b << 8) | (a << 0);
+    case MODBUS_POINT_BADC:
+        return (b << 24) | (a << 16) | (d << 8) | (c << 0);
+    case MODBUS_POINT_CDAB:
+        return (c << 24) | (d << 16) | (a << 8) | (b << 0);
+    case MODBUS_POINT_ABCD:
+    default:
+        return (a << 24) | (b << 16) | (c << 8) | (d << 0);
+    }
+}
+
+static uint16_t get_uint16(const uint16_t *src, int order)
+{
+    if (order == MODBUS_POINT_DCBA || order == MODBUS_POINT_BADC) {
+        return (uint16_t) ((src[0] << 8) | (src[0] >> 8));
+    }
+    return src[0];
+}
+
+static float get_float(const uint16_t *src, int order)
+{
+    switch (order) {
+    case MODBUS_POINT_DCBA:
+        return modbus_get_float_dcba(src);
+    case MODBUS_POINT_BADC:
+        return modbus_get_float_badc(src);
+    case MODBUS_POINT_CDAB:
+        return modbus_get_float_cdab(src);
+    case MODBUS_POINT_ABCD:
+    default:
+        return modbus_get_float_abcd(src);
+    }
+}
+
+static double decode_point(const modbus_planner_t *planner,
+                           const _modbus_plan_point_t *p,
+                           int offset)
+{
+    const uint16_t *src = planner->registers + offset;
+
+    switch (p->point.type) {
+    case MODBUS_POINT_BIT:
+        return planner->bits[offset];
+    case MODBUS_POINT_INT16:
+        return (int16_t) get_uint16(src, p->point.order);
+    case MODBUS_POINT_UINT32:
+        return get_uint32(src, p->point.order);
+    case MODBUS_POINT_INT32:
+        return (int32_t) get_uint32(src, p->point.order);
+    case MODBUS_POINT_FLOAT:
+        return get_float(src, p->point.order);
+    case MODBUS_POINT_UINT16:
+    default:
+        return get_uint16(src, p->point.order);
+    }
+}
+
+/* Groups the points in requests */
+static int plan(modbus_planner_t *planner)
+{
+    _modbus_plan_key_t *keys;
+    _modbus_plan_request_t *requests;
+    _modbus_plan_request_t *r = NULL;
+    int i;
+
+    if (planner->planned) {
+        return 0;
+    }
+
+    keys = (_modbus_plan_key_t *) realloc(
+        planner->keys, (planner->nb_points + 1) * sizeof(_modbus_plan_key_t));
+    if (keys == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    planner->keys = keys;
+
+    /* No more requests than points */
+    requests = (_modbus_plan_request_t *) realloc(
+        planner->requests, (planner->nb_points + 1) * sizeof(_modbus_plan_request_t));
+    if (requests == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    planner->requests = requests;
+
+    for (i = 0; i < planner->nb_points; i++) {
+        keys[i].function = planner->points[i].point.function;
+        keys[i].addr = planner->points[i].point.addr;
+        keys[i].index = i;
+    }
+    qsort(keys, planner->nb_points, sizeof(_modbus_plan_key_t), compare_keys);
+
+    planner->nb_requests = 0;
+    for (i = 0; i < planner->nb_points; i++) {
+        _modbus_plan_point_t *p = &planner->points[keys[i].index];
+        int end = p->point.addr + p->width;
+
+        if (r != NULL && r->function == p->point.function &&
+            end - r->addr <= max_nb_values(r->function) &&
+            p->point.addr - (r->addr + r->nb) <= max_gap_values(planner, r->function)) {
+            if (end > r->addr + r->nb) {
+                r->nb = end - r->addr;
+            }
+            r->nb_points++;
+        } else {
+            r = &requests[planner->nb_requests++];
+            r->function = p->point.function;
+            r->addr = p->point.addr;
+            r->nb = p->width;
+            r->first = i;
+            r->nb_points = 1;
+            r->error = EAGAIN;
+        }
+        p->request = planner->nb_requests - 1;
+    }
+
+    planner->planned = TRUE;
+    return 0;
+}
+
+modbus_planner_t *modbus_planner_new(modbus_t *ctx)
+{
+    modbus_planner_t *planner;
+
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    planner = (modbus_planner_t *) calloc(1, sizeof(modbus_planner_t));
+    if (planner == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    planner->ctx = ctx;
+
+    return planner;
+}
+
+/* Adds a point read from the slave of the context. Returns the index of the
+   point or -1 if the point is invalid. */
+int modbus_planner_add_point(modbus_planner_t *planner, const modbus_point_t *point)
+{
+    _modbus_plan_point_t *p;
+    int width;
+
+    if (planner == NULL || point == NULL || point->function < MODBUS_FC_READ_COILS ||
+        point->function > MODBUS_FC_READ_INPUT_REGISTERS || point->order < MODBUS_POINT_ABCD ||
+        point->order > MODBUS_POINT_CDAB) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (point->type) {
+    case MODBUS_POINT_BIT:
+        width = is_bit_table(point->function) ? 1 : 0;
+        break;
+    case MODBUS_POINT_UINT16:
+    case MODBUS_POINT_INT16:
+        width = is_bit_table(point->function) ? 0 : 1;
+        break;
+    case MODBUS_POINT_UINT32:
+    case MODBUS_POINT_INT32:
+    case MODBUS_POINT_FLOAT:
+        width = is_bit_table(point->function) ? 0 : 2;
+        break;
+    default:
+        width = 0;
+        break;
+    }
+
+    if (width == 0 || point->addr < 0 || point->addr + width > 65536) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (planner->nb_points == planner->max_points) {
+        int max_points = planner->max_points ? planner->max_points * 2 : 16;
+        _modbus_plan_point_t *points;
+
+        points = (_modbus_plan_point_t *) realloc(
+            planner->points, max_points * sizeof(_modbus_plan_point_t));
+        if (points == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        planner->points = points;
+        planner->max_points = max_points;
+    }
+
+    p = &planner->points[planner->nb_points];
+    p->point = *point;
+    p->width = width;
+    p->value = 0;
+    p->request = -1;
+    planner->planned = FALSE;
+
+    return planner->nb_points++;
+}
+
+/* Unused registers (16 bits for the bit tables) a request may read to serve
+   the next point instead of a new request. It's 0 by default as some devices
+   reject the reads of unmapped addresses. */
+int modbus_planner_set_max_gap(modbus_planner_t *planner, int nb)
+{
+    if (planner == NULL || nb < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    planner->max_gap = nb;
+    planner->planned = FALSE;
+    return 0;
+}
+
+int modbus_planner_get_max_gap(modbus_planner_t *planner)
+{
+    if (planner == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return planner->max_gap;
+}
+
+int modbus_planner_get_nb_requests(modbus_planner_t *planner)
+{
+    if (planner == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (plan(planner) == -1) {
+        return -1;
+    }
+
+    return planner->nb_requests;
+}
+
+int modbus_planner_get_request(
+    modbus_planner_t *planner, int request, int *function, int *addr, int *nb)
+{
+    const _modbus_plan_request_t *r;
+
+    if (planner == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (plan(planner) == -1) {
+        return -1;
+    }
+
+    if (request < 0 || request >= planner->nb_requests) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    r = &planner->requests[request];
+    if (function != NULL) {
+        *function = r->function;
+    }
+    if (addr != NULL) {
+        *addr = r->addr;
+    }
+    if (nb != NULL) {
+        *nb = r->nb;
+    }
+    return 0;
+}
+
+/* Sends the requests of the plan and decodes the values of their points. All
+   the requests are sent even if some fail. Returns -1 with the errno of the
+   last failure if a request has failed, the values of its points are then
+   unavailable. */
+int modbus_planner_read(modbus_planner_t *planner)
+{
+    int last_error = 0;
+    int i;
+
+    if (planner == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (plan(planner) == -1) {
+        return -1;
+    }
+
+    for (i = 0; i < planner->nb_requests; i++) {
+        _modbus_plan_request_t *r = &planner->requests[i];
+        int rc;
+        int k;
+
+        switch (r->function) {
+        case MODBUS_FC_READ_COILS:
+            rc = modbus_read_bits(planner->ctx, r->addr, r->nb, planner->bits);
+            break;
+        case MODBUS_FC_READ_DISCRETE_INPUTS:
+            rc = modbus_read_input_bits(planner->ctx, r->addr, r->nb, planner->bits);
+            break;
+        case MODBUS_FC_READ_HOLDING_REGISTERS:
+            rc = modbus_read_registers(planner->ctx, r->addr, r->nb, planner->registers);
+            break;
+        case MODBUS_FC_READ_INPUT_REGISTERS:
+        default:
+            rc = modbus_read_input_registers(
+                planner->ctx, r->addr, r->nb, planner->registers);
+            break;
+        }
+
+        if (rc != r->nb) {
+            r->error = (rc == -1) ? errno : EMBBADDATA;
+            last_error = r->error;
+            continue;
+        }
+
+        r->error = 0;
+        for (k = r->first; k < r->first + r->nb_points; k++) {
+            _modbus_plan_point_t *p = &planner->points[planner->keys[k].index];
+
+            p->value = decode_point(planner, p, p->point.addr - r->addr);
+        }
+    }
+
+    if (last_error != 0) {
+        errno = last_error;
+        return -1;
+    }
+    return 0;
+}
+
+/* Gets the value of a point decoded by the last read. Returns -1 with the errno
+   of the request of the point if it has failed or EAGAIN if the point hasn't
+   been read yet. */
+int modbus_planner_get_value(modbus_planner_t *planner, int point, double *value)
+{
+    const _modbus_plan_point_t *p;
+    int error;
+
+    if (planner == NULL || point < 0 || point >= planner->nb_points || value == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    p = &planner->points[point];
+    error = planner->planned ? planner->requests[p->request].error : EAGAIN;
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+
+    *value = p->value;
+    return 0;
+}
+
+void modbus_planner_free(modbus_planner_t *planner)
+{
+    if (planner == NULL) {
+        return;
+    }
+
+    free(planner->points);
+    free(planner->keys);
+    free(planner->requests);
+    free(planner);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_PLANNER_H
+#define MODBUS_PLANNER_H
+
+#include "modbus.h"
+
+MODBUS_BEGIN_DECLS
+
+/* Reads a set of scattered points of a slave with the minimal number of
+   requests then decodes the value of each point */
+typedef struct _modbus_planner modbus_planner_t;
+
+/* Coil or discrete input */
+#define MODBUS_POINT_BIT    0
+#define MODBUS_POINT_UINT16 1
+#define MODBUS_POINT_INT16  2
+/* The types below are stored in two registers */
+#define MODBUS_POINT_UINT32 3
+#define MODBUS_POINT_INT32  4
+#define MODBUS_POINT_FLOAT  5
+
+/* Order of the bytes of a value, A is the most significant byte and the
+   registers are read from left to right (see modbus_get_float_abcd). The 16
+   bit types only have their bytes swapped by DCBA and BADC. */
+#define MODBUS_POINT_ABCD 0
+#define MODBUS_POINT_DCBA 1
+#define MODBUS_POINT_BADC 2
+#define MODBUS_POINT_CDAB 3
+
+typedef struct {
+    /* MODBUS_FC_READ_* function of the table of the point */
+    int function;
+    int addr;
+    /* MODBUS_POINT_* type */
+    int type;
+    /* MODBUS_POINT_* byte order */
+    int order;
+} modbus_point_t;
+
+MODBUS_API modbus_planner_t *modbus_planner_new(modbus_t *ctx);
+MODBUS_API int modbus_planner_add_point(modbus_planner_t *planner,
+                                        const modbus_point_t *point);
+MODBUS_API int modbus_planner_set_max_gap(modbus_planner_t *planner, int nb);
+MODBUS_API int modbus_planner_get_max_gap(modbus_planner_t *planner);
+MODBUS_API int modbus_planner_get_nb_requests(modbus_planner_t *planner);
+MODBUS_API int modbus_planner_get_request(
+    modbus_planner_t *planner, int request, int *function, int *addr, int *nb);
+MODBUS_API int modbus_planner_read(modbus_planner_t *planner);
+MODBUS_API int modbus_planner_get_value(modbus_planner_t *planner, int point, double *value);
+MODBUS_API void modbus_planner_free(modbus_planner_t *planner);
+
+MODBUS_END_DECLS
+
+#endif /* MODBUS_PLANNER_H */
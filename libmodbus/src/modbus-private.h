@@ -37,6 +37,10 @@ MODBUS_BEGIN_DECLS
 
 #define _MODBUS_EXCEPTION_RSP_LENGTH 5
 
+/* Size of the receive buffer of a context, it holds several messages so all the
+ * bytes available on the link are read at once */
+#define _MODBUS_RX_BUFFER_LENGTH 1024
+
 /* Timeouts in microsecond (0.5 s) */
 #define _RESPONSE_TIMEOUT 500000
 #define _BYTE_TIMEOUT     500000
@@ -66,6 +70,48 @@ typedef struct _sft {
     int t_id;
 } sft_t;
 
+/* Maximum number of parts of a message sent in one call (header, data and
+ * checksum) */
+#define _MODBUS_MSG_PARTS_MAX 3
+
+typedef struct _msg_part {
+    const uint8_t *data;
+    int length;
+} msg_part_t;
+
+/* tab_bits and tab_input_bits store 8 bits per byte, in the order of the
+ * Modbus messages (the first bit is the LSB of the first byte) */
+#define MODBUS_MAPPING_PACKED_BITS (1 << 0)
+/* The 4 tables cover the 65536 addresses but only the ranges added by
+ * modbus_mapping_add_range() are valid. The values are stored in pages
+ * allocated on the first write (tab_* are NULL), they are accessed with
+ * modbus_mapping_get_bit() and friends. */
+#define MODBUS_MAPPING_SPARSE (1 << 1)
+/* The 4 tables are stored in a named shared memory region (see
+ * modbus_shm_header_t) so other processes can read and write the values */
+#define MODBUS_MAPPING_SHM (1 << 2)
+/* Some address ranges are served by callbacks, set by
+ * modbus_mapping_add_callback() on any kind of mapping */
+#define MODBUS_MAPPING_CALLBACKS (1 << 3)
+
+/* Private part of a mapping, kept out of modbus_mapping_t so the layout of the
+ * public structure doesn't change (a mapping built by hand has none). It's
+ * created by the constructors of the extended mappings and by
+ * modbus_mapping_add_callback(), and released by modbus_mapping_free(). */
+typedef struct _modbus_mapping_ext {
+    /* Public part, the key of the list of the private parts */
+    const modbus_mapping_t *mb_mapping;
+    /* MODBUS_MAPPING_* flags */
+    unsigned int flags;
+    /* Pages and valid ranges of a MODBUS_MAPPING_SPARSE mapping */
+    struct _modbus_sparse *sparse;
+    /* Region of a MODBUS_MAPPING_SHM mapping */
+    struct _modbus_shm *shm;
+    /* Ranges of a mapping with MODBUS_MAPPING_CALLBACKS */
+    struct _modbus_callbacks *callbacks;
+    struct _modbus_mapping_ext *next;
+} _modbus_mapping_ext_t;
+
 typedef struct _modbus_backend {
     unsigned int backend_type;
     unsigned int header_length;
@@ -77,7 +123,15 @@ typedef struct _modbus_backend {
     int (*build_response_basis)(sft_t *sft, uint8_t *rsp);
     int (*prepare_response_tid)(const uint8_t *req, int *req_length);
     int (*send_msg_pre)(uint8_t *req, int req_length);
+    /* Same as send_msg_pre for a message whose data is stored apart, returns the
+     * length of the checksum written in checksum (to send after the data) */
+    int (*send_msg_pre_data)(uint8_t *req,
+                             int req_length,
+                             const uint8_t *data,
+                             int data_length,
+                             uint8_t *checksum);
     ssize_t (*send)(modbus_t *ctx, const uint8_t *req, int req_length);
+    ssize_t (*send_parts)(modbus_t *ctx, const msg_part_t *parts, int nb_parts);
     int (*receive)(modbus_t *ctx, uint8_t *req);
     ssize_t (*recv)(modbus_t *ctx, uint8_t *rsp, int rsp_length);
     int (*check_integrity)(modbus_t *ctx, uint8_t *msg, const int msg_length);
@@ -91,6 +145,9 @@ typedef struct _modbus_backend {
     int (*flush)(modbus_t *ctx);
     int (*select)(modbus_t *ctx, fd_set *rset, struct timeval *tv, int msg_length);
     void (*free)(modbus_t *ctx);
+    /* Silence (us) ending a received frame or 0 when the end of a frame is
+     * deduced from its length, NULL when the length is always used */
+    int (*frame_silence)(modbus_t *ctx);
 } modbus_backend_t;
 
 struct _modbus {
@@ -101,16 +158,39 @@ struct _modbus {
     int debug;
     int error_recovery;
     int quirks;
+    /* Maximum number of pipelined requests */
+    int max_in_flight;
     struct timeval response_timeout;
     struct timeval byte_timeout;
     struct timeval indication_timeout;
     const modbus_backend_t *backend;
     void *backend_data;
+    /* Received bytes not consumed yet are stored in rx_buffer[rx_start, rx_end[ */
+    uint8_t rx_buffer[_MODBUS_RX_BUFFER_LENGTH];
+    int rx_start;
+    int rx_end;
+    /* Transactions of modbus_submit(), allocated at the first call */
+    struct _modbus_async *async;
+    /* Mappings indexed by unit ID set by modbus_set_units() or NULL */
+    modbus_mapping_t *const *units;
+    /* Private part of the last mapping of modbus_reply(), valid while the list
+     * of the private parts is at the same generation */
+    const modbus_mapping_t *mapping;
+    const _modbus_mapping_ext_t *mapping_ext;
+    unsigned int mapping_ext_generation;
 };
 
 void _modbus_init_common(modbus_t *ctx);
+void _modbus_reset_rx(modbus_t *ctx);
+void _modbus_free_async(modbus_t *ctx);
 void _error_print(modbus_t *ctx, const char *context);
 int _modbus_receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type);
+int _modbus_compute_msg_length(modbus_t *ctx,
+                               const uint8_t *msg,
+                               int available,
+                               msg_type_t msg_type);
+/* Monotonic clock */
+int64_t _modbus_get_time_us(void);
 
 #ifndef HAVE_STRLCPY
 size_t strlcpy(char *dest, const char *src, size_t dest_size);
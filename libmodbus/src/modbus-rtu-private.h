@@ -69,9 +69,33 @@ typedef struct _modbus_rtu {
     int rts_delay;
     int onebyte_time;
     void (*set_rts)(modbus_t *ctx, int on);
+    /* MODBUS_RTU_TURNAROUND_* */
+    int turnaround;
+    /* End of the turnaround delays busy-waited instead of slept (us) */
+    int turnaround_spin;
+#if HAVE_DECL_TIOCSRS485
+    /* RS-485 mode of the driver for the automatic turnaround: -1 not tried
+       yet, FALSE unavailable or TRUE enabled */
+    int rts_kernel;
+#endif
+#endif
+    /* MODBUS_RTU_FRAMING_* */
+    int framing;
+    /* Silence ending a frame (us), t3.5 computed from the baud rate when 0 */
+    int frame_silence;
+    /* Driver and USB adapter tuned to deliver the received bytes at once */
+    int low_latency;
+#if HAVE_DECL_TIOCSSERIAL
+    /* Settings to restore on close or -1 when unchanged */
+    int old_serial_flags;
+    int old_latency_timer;
 #endif
     /* To handle many slaves on the same link */
     int confirmation_to_ignore;
 } modbus_rtu_t;
 
+/* Sets a baud rate without Bxxx constant (termios2), fails with ENOTSUP when
+   not supported by the platform */
+int _modbus_rtu_set_custom_baud(int fd, int baud);
+
 #endif /* MODBUS_RTU_PRIVATE_H */
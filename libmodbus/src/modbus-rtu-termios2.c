@@ -0,0 +1,40 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Baud rates without Bxxx constant through the termios2 interface of Linux,
+ * kept apart from modbus-rtu.c because <asm/termbits.h> conflicts with
+ * <termios.h>.
+ */
+
+#include <errno.h>
+
+#if HAVE_DECL_TCSETS2 && HAVE_DECL_BOTHER
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+#endif
+
+/* Declared in modbus-rtu-private.h which includes <termios.h> */
+int _modbus_rtu_set_custom_baud(int fd, int baud);
+
+int _modbus_rtu_set_custom_baud(int fd, int baud)
+{
+#if HAVE_DECL_TCSETS2 && HAVE_DECL_BOTHER
+    struct termios2 tios;
+
+    if (ioctl(fd, TCGETS2, &tios) < 0) {
+        return -1;
+    }
+
+    tios.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tios.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    tios.c_ispeed = baud;
+    tios.c_ospeed = baud;
+
+    return ioctl(fd, TCSETS2, &tios);
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
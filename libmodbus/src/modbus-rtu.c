@@ -9,12 +9,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #ifndef _MSC_VER
 #include <unistd.h>
 #endif
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
 #include "modbus-private.h"
 #include <assert.h>
 
+#include "modbus-crc-private.h"
 #include "modbus-rtu-private.h"
 #include "modbus-rtu.h"
 
@@ -22,53 +27,13 @@
 #include <sys/ioctl.h>
 #endif
 
-#if HAVE_DECL_TIOCSRS485
+#if HAVE_DECL_TIOCSRS485 || HAVE_DECL_TIOCSSERIAL
 #include <linux/serial.h>
 #endif
 
-/* Table of CRC values for high-order byte */
-static const uint8_t table_crc_hi[] = {
-    0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1,
-    0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1,
-    0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1,
-    0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1,
-    0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
-    0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0,
-    0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1,
-    0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40,
-    0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
-    0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41,
-    0x01, 0xC0, 0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0,
-    0x80, 0x41, 0x00, 0xC1, 0x81, 0x40, 0x01, 0xC0, 0x80, 0x41, 0x01, 0xC0, 0x80, 0x41,
-    0x00, 0xC1, 0x81, 0x40};
-
-/* Table of CRC values for low-order byte */
-static const uint8_t table_crc_lo[] = {
-    0x00, 0xC0, 0xC1, 0x01, 0xC3, 0x03, 0x02, 0xC2, 0xC6, 0x06, 0x07, 0xC7, 0x05, 0xC5,
-    0xC4, 0x04, 0xCC, 0x0C, 0x0D, 0xCD, 0x0F, 0xCF, 0xCE, 0x0E, 0x0A, 0xCA, 0xCB, 0x0B,
-    0xC9, 0x09, 0x08, 0xC8, 0xD8, 0x18, 0x19, 0xD9, 0x1B, 0xDB, 0xDA, 0x1A, 0x1E, 0xDE,
-    0xDF, 0x1F, 0xDD, 0x1D, 0x1C, 0xDC, 0x14, 0xD4, 0xD5, 0x15, 0xD7, 0x17, 0x16, 0xD6,
-    0xD2, 0x12, 0x13, 0xD3, 0x11, 0xD1, 0xD0, 0x10, 0xF0, 0x30, 0x31, 0xF1, 0x33, 0xF3,
-    0xF2, 0x32, 0x36, 0xF6, 0xF7, 0x37, 0xF5, 0x35, 0x34, 0xF4, 0x3C, 0xFC, 0xFD, 0x3D,
-    0xFF, 0x3F, 0x3E, 0xFE, 0xFA, 0x3A, 0x3B, 0xFB, 0x39, 0xF9, 0xF8, 0x38, 0x28, 0xE8,
-    0xE9, 0x29, 0xEB, 0x2B, 0x2A, 0xEA, 0xEE, 0x2E, 0x2F, 0xEF, 0x2D, 0xED, 0xEC, 0x2C,
-    0xE4, 0x24, 0x25, 0xE5, 0x27, 0xE7, 0xE6, 0x26, 0x22, 0xE2, 0xE3, 0x23, 0xE1, 0x21,
-    0x20, 0xE0, 0xA0, 0x60, 0x61, 0xA1, 0x63, 0xA3, 0xA2, 0x62, 0x66, 0xA6, 0xA7, 0x67,
-    0xA5, 0x65, 0x64, 0xA4, 0x6C, 0xAC, 0xAD, 0x6D, 0xAF, 0x6F, 0x6E, 0xAE, 0xAA, 0x6A,
-    0x6B, 0xAB, 0x69, 0xA9, 0xA8, 0x68, 0x78, 0xB8, 0xB9, 0x79, 0xBB, 0x7B, 0x7A, 0xBA,
-    0xBE, 0x7E, 0x7F, 0xBF, 0x7D, 0xBD, 0xBC, 0x7C, 0xB4, 0x74, 0x75, 0xB5, 0x77, 0xB7,
-    0xB6, 0x76, 0x72, 0xB2, 0xB3, 0x73, 0xB1, 0x71, 0x70, 0xB0, 0x50, 0x90, 0x91, 0x51,
-    0x93, 0x53, 0x52, 0x92, 0x96, 0x56, 0x57, 0x97, 0x55, 0x95, 0x94, 0x54, 0x9C, 0x5C,
-    0x5D, 0x9D, 0x5F, 0x9F, 0x9E, 0x5E, 0x5A, 0x9A, 0x9B, 0x5B, 0x99, 0x59, 0x58, 0x98,
-    0x88, 0x48, 0x49, 0x89, 0x4B, 0x8B, 0x8A, 0x4A, 0x4E, 0x8E, 0x8F, 0x4F, 0x8D, 0x4D,
-    0x4C, 0x8C, 0x44, 0x84, 0x85, 0x45, 0x87, 0x47, 0x46, 0x86, 0x82, 0x42, 0x43, 0x83,
-    0x41, 0x81, 0x80, 0x40};
+#if HAVE_DECL_TIOCSSERIAL
+#include <limits.h>
+#endif
 
 /* Define the slave ID of the remote device to talk in master mode or set the
  * internal slave ID in slave mode */
@@ -115,18 +80,8 @@ static int _modbus_rtu_build_response_basis(sft_t *sft, uint8_t *rsp)
 
 static uint16_t crc16(uint8_t *buffer, uint16_t buffer_length)
 {
-    uint8_t crc_hi = 0xFF; /* high CRC byte initialized */
-    uint8_t crc_lo = 0xFF; /* low CRC byte initialized */
-    unsigned int i;        /* will index into CRC lookup */
-
-    /* pass through message buffer */
-    while (buffer_length--) {
-        i = crc_lo ^ *buffer++; /* calculate the CRC  */
-        crc_lo = crc_hi ^ table_crc_hi[i];
-        crc_hi = table_crc_lo[i];
-    }
-
-    return (crc_hi << 8 | crc_lo);
+    /* high and low CRC bytes initialized */
+    return _modbus_crc16_update(0xFFFF, buffer, buffer_length);
 }
 
 static int _modbus_rtu_prepare_response_tid(const uint8_t *req, int *req_length)
@@ -148,6 +103,20 @@ static int _modbus_rtu_send_msg_pre(uint8_t *req, int req_length)
     return req_length;
 }
 
+static int _modbus_rtu_send_msg_pre_data(uint8_t *req,
+                                         int req_length,
+                                         const uint8_t *data,
+                                         int data_length,
+                                         uint8_t *checksum)
+{
+    uint16_t crc = _modbus_crc16_update(crc16(req, req_length), data, data_length);
+
+    checksum[0] = crc & 0x00FF;
+    checksum[1] = crc >> 8;
+
+    return _MODBUS_RTU_CHECKSUM_LENGTH;
+}
+
 #if defined(_WIN32)
 
 /* This simple implementation is sort of a substitute of the select() call,
@@ -250,44 +219,186 @@ static void _modbus_rtu_ioctl_rts(modbus_t *ctx, int on)
     }
     ioctl(fd, TIOCMSET, &flags);
 }
+
+/* Waits until the deadline of the monotonic clock (us), the last
+   turnaround_spin microseconds are busy-waited because a sleeping thread is
+   woken up late by the scheduler */
+static void _modbus_rtu_wait_until(modbus_rtu_t *ctx_rtu, int64_t deadline)
+{
+    int64_t wakeup = deadline - ctx_rtu->turnaround_spin;
+    int64_t now = _modbus_get_time_us();
+
+    if (wakeup > now) {
+        struct timespec ts;
+
+#ifdef HAVE_CLOCK_NANOSLEEP
+        ts.tv_sec = wakeup / 1000000;
+        ts.tv_nsec = (long) (wakeup % 1000000) * 1000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+        }
+#else
+        ts.tv_sec = (wakeup - now) / 1000000;
+        ts.tv_nsec = (long) ((wakeup - now) % 1000000) * 1000;
+        nanosleep(&ts, NULL);
 #endif
+    }
 
-static ssize_t _modbus_rtu_send(modbus_t *ctx, const uint8_t *req, int req_length)
+    while (_modbus_get_time_us() < deadline) {
+    }
+}
+
+#if HAVE_DECL_TIOCSRS485
+/* Lets the driver toggle RTS around the transmissions (RS-485 mode). Its delays
+   are in milliseconds so they are rounded up, the driver switches when its
+   transmitter is empty. */
+static int _modbus_rtu_enable_kernel_rts(modbus_t *ctx)
+{
+    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+    struct serial_rs485 rs485conf;
+
+    if (ioctl(ctx->s, TIOCGRS485, &rs485conf) < 0) {
+        return -1;
+    }
+
+    rs485conf.flags |= SER_RS485_ENABLED;
+    if (ctx_rtu->rts == MODBUS_RTU_RTS_UP) {
+        rs485conf.flags |= SER_RS485_RTS_ON_SEND;
+        rs485conf.flags &= ~SER_RS485_RTS_AFTER_SEND;
+    } else {
+        rs485conf.flags &= ~SER_RS485_RTS_ON_SEND;
+        rs485conf.flags |= SER_RS485_RTS_AFTER_SEND;
+    }
+    rs485conf.delay_rts_before_send = (ctx_rtu->rts_delay + 999) / 1000;
+    rs485conf.delay_rts_after_send = (ctx_rtu->rts_delay + 999) / 1000;
+
+    return ioctl(ctx->s, TIOCSRS485, &rs485conf);
+}
+
+/* Gives the control of RTS back to the library, the RS-485 mode is kept when
+   it has been set by modbus_rtu_set_serial_mode */
+static void _modbus_rtu_reset_kernel_rts(modbus_t *ctx)
+{
+    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+
+    if (ctx_rtu->rts_kernel == TRUE && ctx->s >= 0 &&
+        ctx_rtu->serial_mode != MODBUS_RTU_RS485) {
+        struct serial_rs485 rs485conf;
+
+        if (ioctl(ctx->s, TIOCGRS485, &rs485conf) == 0) {
+            rs485conf.flags &= ~SER_RS485_ENABLED;
+            ioctl(ctx->s, TIOCSRS485, &rs485conf);
+        }
+    }
+    ctx_rtu->rts_kernel = -1;
+}
+#endif
+#endif
+
+static ssize_t _modbus_rtu_send_parts(modbus_t *ctx, const msg_part_t *parts, int nb_parts)
 {
 #if defined(_WIN32)
     modbus_rtu_t *ctx_rtu = ctx->backend_data;
+    uint8_t msg[MODBUS_RTU_MAX_ADU_LENGTH];
     DWORD n_bytes = 0;
-    return (WriteFile(ctx_rtu->w_ser.fd, req, req_length, &n_bytes, NULL))
+    int msg_length = 0;
+    int i;
+
+    /* No vectored write on a serial handle so the parts are gathered */
+    for (i = 0; i < nb_parts; i++) {
+        if (msg_length + parts[i].length > MODBUS_RTU_MAX_ADU_LENGTH) {
+            errno = EMBBADDATA;
+            return -1;
+        }
+        memcpy(msg + msg_length, parts[i].data, parts[i].length);
+        msg_length += parts[i].length;
+    }
+
+    return (WriteFile(ctx_rtu->w_ser.fd, msg, msg_length, &n_bytes, NULL))
                ? (ssize_t) n_bytes
                : -1;
 #else
+    struct iovec iov[_MODBUS_MSG_PARTS_MAX];
+    int i;
+
+    for (i = 0; i < nb_parts; i++) {
+        iov[i].iov_base = (void *) parts[i].data;
+        iov[i].iov_len = parts[i].length;
+    }
+
 #if HAVE_DECL_TIOCM_RTS
     modbus_rtu_t *ctx_rtu = ctx->backend_data;
     if (ctx_rtu->rts != MODBUS_RTU_RTS_NONE) {
         ssize_t size;
+        int msg_length = 0;
+
+#if HAVE_DECL_TIOCSRS485
+        if (ctx_rtu->rts_kernel == -1) {
+            ctx_rtu->rts_kernel = ctx_rtu->turnaround == MODBUS_RTU_TURNAROUND_AUTO &&
+                                  ctx_rtu->set_rts == _modbus_rtu_ioctl_rts &&
+                                  _modbus_rtu_enable_kernel_rts(ctx) == 0;
+            if (ctx->debug && ctx_rtu->rts_kernel) {
+                fprintf(stderr, "RTS signal toggled by the driver (RS-485 mode)\n");
+            }
+        }
+        if (ctx_rtu->rts_kernel) {
+            return writev(ctx->s, iov, nb_parts);
+        }
+#endif
 
         if (ctx->debug) {
             fprintf(stderr, "Sending request using RTS signal\n");
         }
 
+        for (i = 0; i < nb_parts; i++) {
+            msg_length += parts[i].length;
+        }
+
         ctx_rtu->set_rts(ctx, ctx_rtu->rts == MODBUS_RTU_RTS_UP);
-        usleep(ctx_rtu->rts_delay);
+        if (ctx_rtu->turnaround == MODBUS_RTU_TURNAROUND_SLEEP) {
+            usleep(ctx_rtu->rts_delay);
+
+            size = writev(ctx->s, iov, nb_parts);
+
+            usleep(ctx_rtu->onebyte_time * msg_length + ctx_rtu->rts_delay);
+        } else {
+            /* The delays are counted from absolute times so the duration of
+               the calls and the late wakeups don't add up */
+            int64_t start = _modbus_get_time_us() + ctx_rtu->rts_delay;
 
-        size = write(ctx->s, req, req_length);
+            _modbus_rtu_wait_until(ctx_rtu, start);
 
-        usleep(ctx_rtu->onebyte_time * req_length + ctx_rtu->rts_delay);
+            size = writev(ctx->s, iov, nb_parts);
+
+            /* The end of the transmission is known from the driver but not
+               before the estimated duration of the frame */
+            tcdrain(ctx->s);
+            _modbus_rtu_wait_until(ctx_rtu,
+                                   start +
+                                       (int64_t) ctx_rtu->onebyte_time * msg_length +
+                                       ctx_rtu->rts_delay);
+        }
         ctx_rtu->set_rts(ctx, ctx_rtu->rts != MODBUS_RTU_RTS_UP);
 
         return size;
     } else {
 #endif
-        return write(ctx->s, req, req_length);
+        return writev(ctx->s, iov, nb_parts);
 #if HAVE_DECL_TIOCM_RTS
     }
 #endif
 #endif
 }
 
+static ssize_t _modbus_rtu_send(modbus_t *ctx, const uint8_t *req, int req_length)
+{
+    msg_part_t part;
+
+    part.data = req;
+    part.length = req_length;
+
+    return _modbus_rtu_send_parts(ctx, &part, 1);
+}
+
 static int _modbus_rtu_receive(modbus_t *ctx, uint8_t *req)
 {
     int rc;
@@ -343,6 +454,31 @@ static int _modbus_rtu_pre_check_confirmation(modbus_t *ctx,
     }
 }
 
+/* The frames are delimited by a silence of 3.5 characters, fixed to 1750 us
+   above 19200 bauds (Modbus over serial line V1.02, 2.5.1.1) */
+static int _modbus_rtu_t35(const modbus_rtu_t *ctx_rtu)
+{
+    int nb_bits = 1 + ctx_rtu->data_bit + (ctx_rtu->parity == 'N' ? 0 : 1) +
+                  ctx_rtu->stop_bit;
+
+    if (ctx_rtu->baud > 19200) {
+        return 1750;
+    }
+
+    return (int) ((int64_t) 3500000 * nb_bits / ctx_rtu->baud) + 1;
+}
+
+static int _modbus_rtu_frame_silence(modbus_t *ctx)
+{
+    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+
+    if (ctx_rtu->framing != MODBUS_RTU_FRAMING_SILENCE) {
+        return 0;
+    }
+
+    return (ctx_rtu->frame_silence > 0) ? ctx_rtu->frame_silence : _modbus_rtu_t35(ctx_rtu);
+}
+
 /* The check_crc16 function shall return 0 if the message is ignored and the
    message length if the CRC is valid. Otherwise it shall return -1 and set
    errno to EMBBADCRC. */
@@ -354,7 +490,14 @@ static int _modbus_rtu_check_integrity(modbus_t *ctx, uint8_t *msg, const int ms
 
     /* Filter on the Modbus unit identifier (slave) in RTU mode to avoid useless
      * CRC computing. */
-    if (slave != ctx->slave && slave != MODBUS_BROADCAST_ADDRESS) {
+    if (ctx->units != NULL) {
+        if (ctx->units[slave] == NULL && slave != MODBUS_BROADCAST_ADDRESS) {
+            if (ctx->debug) {
+                printf("Request for slave %d ignored (no mapping)\n", slave);
+            }
+            return 0;
+        }
+    } else if (slave != ctx->slave && slave != MODBUS_BROADCAST_ADDRESS) {
         if (ctx->debug) {
             printf("Request for slave %d ignored (not %d)\n", slave, ctx->slave);
         }
@@ -376,7 +519,9 @@ static int _modbus_rtu_check_integrity(modbus_t *ctx, uint8_t *msg, const int ms
                     crc_calculated);
         }
 
-        if (ctx->error_recovery & MODBUS_ERROR_RECOVERY_PROTOCOL) {
+        /* A frame delimited by a silence has been received completely */
+        if ((ctx->error_recovery & MODBUS_ERROR_RECOVERY_PROTOCOL) &&
+            _modbus_rtu_frame_silence(ctx) == 0) {
             _modbus_rtu_flush(ctx);
         }
         errno = EMBBADCRC;
@@ -386,54 +531,12 @@ static int _modbus_rtu_check_integrity(modbus_t *ctx, uint8_t *msg, const int ms
 
 /* Sets up a serial port for RTU communications */
 #if defined(_WIN32)
-static int _modbus_rtu_connect(modbus_t *ctx)
+/* Applies the line settings of the context to the opened port */
+static int _modbus_rtu_setup_line(modbus_t *ctx)
 {
     DCB dcb;
     modbus_rtu_t *ctx_rtu = ctx->backend_data;
 
-    if (ctx->debug) {
-        printf("Opening %s at %d bauds (%c, %d, %d)\n",
-               ctx_rtu->device,
-               ctx_rtu->baud,
-               ctx_rtu->parity,
-               ctx_rtu->data_bit,
-               ctx_rtu->stop_bit);
-    }
-
-    /* Some references here:
-     * http://msdn.microsoft.com/en-us/library/aa450602.aspx
-     */
-    win32_ser_init(&ctx_rtu->w_ser);
-
-    /* ctx_rtu->device should contain a string like "COMxx:" xx being a decimal
-     * number */
-    ctx_rtu->w_ser.fd = CreateFileA(
-        ctx_rtu->device, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
-
-    /* Error checking */
-    if (ctx_rtu->w_ser.fd == INVALID_HANDLE_VALUE) {
-        if (ctx->debug) {
-            fprintf(stderr,
-                    "ERROR Can't open the device %s (LastError %d)\n",
-                    ctx_rtu->device,
-                    (int) GetLastError());
-        }
-        return -1;
-    }
-
-    /* Save params */
-    ctx_rtu->old_dcb.DCBlength = sizeof(DCB);
-    if (!GetCommState(ctx_rtu->w_ser.fd, &ctx_rtu->old_dcb)) {
-        if (ctx->debug) {
-            fprintf(stderr,
-                    "ERROR Error getting configuration (LastError %d)\n",
-                    (int) GetLastError());
-        }
-        CloseHandle(ctx_rtu->w_ser.fd);
-        ctx_rtu->w_ser.fd = INVALID_HANDLE_VALUE;
-        return -1;
-    }
-
     /* Build new configuration (starting from current settings) */
     dcb = ctx_rtu->old_dcb;
 
@@ -496,6 +599,60 @@ static int _modbus_rtu_connect(modbus_t *ctx)
                     "ERROR Error setting new configuration (LastError %d)\n",
                     (int) GetLastError());
         }
+        return -1;
+    }
+
+    return 0;
+}
+
+static int _modbus_rtu_connect(modbus_t *ctx)
+{
+    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+
+    if (ctx->debug) {
+        printf("Opening %s at %d bauds (%c, %d, %d)\n",
+               ctx_rtu->device,
+               ctx_rtu->baud,
+               ctx_rtu->parity,
+               ctx_rtu->data_bit,
+               ctx_rtu->stop_bit);
+    }
+
+    /* Some references here:
+     * http://msdn.microsoft.com/en-us/library/aa450602.aspx
+     */
+    win32_ser_init(&ctx_rtu->w_ser);
+
+    /* ctx_rtu->device should contain a string like "COMxx:" xx being a decimal
+     * number */
+    ctx_rtu->w_ser.fd = CreateFileA(
+        ctx_rtu->device, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+
+    /* Error checking */
+    if (ctx_rtu->w_ser.fd == INVALID_HANDLE_VALUE) {
+        if (ctx->debug) {
+            fprintf(stderr,
+                    "ERROR Can't open the device %s (LastError %d)\n",
+                    ctx_rtu->device,
+                    (int) GetLastError());
+        }
+        return -1;
+    }
+
+    /* Save params */
+    ctx_rtu->old_dcb.DCBlength = sizeof(DCB);
+    if (!GetCommState(ctx_rtu->w_ser.fd, &ctx_rtu->old_dcb)) {
+        if (ctx->debug) {
+            fprintf(stderr,
+                    "ERROR Error getting configuration (LastError %d)\n",
+                    (int) GetLastError());
+        }
+        CloseHandle(ctx_rtu->w_ser.fd);
+        ctx_rtu->w_ser.fd = INVALID_HANDLE_VALUE;
+        return -1;
+    }
+
+    if (_modbus_rtu_setup_line(ctx) < 0) {
         CloseHandle(ctx_rtu->w_ser.fd);
         ctx_rtu->w_ser.fd = INVALID_HANDLE_VALUE;
         return -1;
@@ -505,7 +662,7 @@ static int _modbus_rtu_connect(modbus_t *ctx)
 }
 #else
 
-static speed_t _get_termios_speed(int baud, int debug)
+static speed_t _get_termios_speed(int baud)
 {
     speed_t speed;
 
@@ -608,85 +765,163 @@ static speed_t _get_termios_speed(int baud, int debug)
         break;
 #endif
     default:
-        speed = B9600;
-        if (debug) {
-            fprintf(stderr, "WARNING Unknown baud rate %d (B9600 used)\n", baud);
-        }
+        /* Set with termios2 by the caller */
+        speed = B0;
     }
 
     return speed;
 }
 
-/* POSIX */
-static int _modbus_rtu_connect(modbus_t *ctx)
+#if HAVE_DECL_TIOCSSERIAL
+/* Path of the latency timer of the USB serial adapter of the device (FTDI
+   adapters deliver the received bytes every 16 ms by default) */
+static int _modbus_rtu_latency_timer_path(const char *device, char *path, size_t size)
 {
-    struct termios tios;
-    int flags;
-    speed_t speed;
-    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+    char real_path[PATH_MAX];
+    const char *name;
 
-    if (ctx->debug) {
-        printf("Opening %s at %d bauds (%c, %d, %d)\n",
-               ctx_rtu->device,
-               ctx_rtu->baud,
-               ctx_rtu->parity,
-               ctx_rtu->data_bit,
-               ctx_rtu->stop_bit);
+    if (realpath(device, real_path) == NULL) {
+        return -1;
     }
+    name = strrchr(real_path, '/');
+    name = (name != NULL) ? name + 1 : real_path;
+    snprintf(path, size, "/sys/class/tty/%s/device/latency_timer", name);
 
-    /* The O_NOCTTY flag tells UNIX that this program doesn't want
-       to be the "controlling terminal" for that port. If you
-       don't specify this then any input (such as keyboard abort
-       signals and so forth) will affect your process
+    return 0;
+}
 
-       Timeouts are ignored in canonical input mode or when the
-       NDELAY option is set on the file via open or fcntl */
-    flags = O_RDWR | O_NOCTTY | O_NDELAY | O_EXCL;
-#ifdef O_CLOEXEC
-    flags |= O_CLOEXEC;
-#endif
+static int _modbus_rtu_read_latency_timer(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    int value = -1;
 
-    ctx->s = open(ctx_rtu->device, flags);
-    if (ctx->s < 0) {
-        if (ctx->debug) {
-            fprintf(stderr,
-                    "ERROR Can't open the device %s (%s)\n",
-                    ctx_rtu->device,
-                    strerror(errno));
+    if (f != NULL) {
+        if (fscanf(f, "%d", &value) != 1) {
+            value = -1;
         }
-        return -1;
+        fclose(f);
     }
 
-    /* Save */
-    tcgetattr(ctx->s, &ctx_rtu->old_tios);
+    return value;
+}
 
-    memset(&tios, 0, sizeof(struct termios));
+static int _modbus_rtu_write_latency_timer(const char *path, int value)
+{
+    FILE *f = fopen(path, "w");
+    int rc;
 
-    /* C_ISPEED     Input baud (new interface)
-       C_OSPEED     Output baud (new interface)
-    */
+    if (f == NULL) {
+        return -1;
+    }
+    rc = fprintf(f, "%d\n", value);
+    if (fclose(f) != 0) {
+        rc = -1;
+    }
 
-    /* Set the baud rate */
+    return (rc < 0) ? -1 : 0;
+}
 
-    /*
-    On MacOS, constants of baud rates are equal to the integer in argument but
-    that's not the case under Linux so we have to find the corresponding
-    constant. Until the code is upgraded to termios2, the list of possible
-    values is limited (no 14400 for example).
-    */
-    if (9600 == B9600) {
-        speed = ctx_rtu->baud;
-    } else {
-        speed = _get_termios_speed(ctx_rtu->baud, ctx->debug);
-    }
+/* Asks the driver to deliver the received bytes at once (ASYNC_LOW_LATENCY)
+   and reduces the latency timer of a USB adapter to 1 ms, the previous
+   settings are restored by _modbus_rtu_disable_low_latency. Both are optional
+   so the failures are only reported in debug mode. */
+static void _modbus_rtu_enable_low_latency(modbus_t *ctx)
+{
+    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+    struct serial_struct serial;
+    char path[PATH_MAX + 64];
+    int value;
 
-    if ((cfsetispeed(&tios, speed) < 0) || (cfsetospeed(&tios, speed) < 0)) {
-        close(ctx->s);
-        ctx->s = -1;
-        return -1;
+    if (ioctl(ctx->s, TIOCGSERIAL, &serial) < 0) {
+        if (ctx->debug) {
+            fprintf(stderr, "WARNING Can't get the serial flags (%s)\n", strerror(errno));
+        }
+    } else if (!(serial.flags & ASYNC_LOW_LATENCY)) {
+        int old_flags = serial.flags;
+
+        serial.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(ctx->s, TIOCSSERIAL, &serial) == 0) {
+            ctx_rtu->old_serial_flags = old_flags;
+        } else if (ctx->debug) {
+            fprintf(stderr, "WARNING Can't set the low latency flag (%s)\n", strerror(errno));
+        }
     }
 
-    /* C_CFLAG      Control options
+    if (_modbus_rtu_latency_timer_path(ctx_rtu->device, path, sizeof(path)) == 0) {
+        value = _modbus_rtu_read_latency_timer(path);
+        if (value > 1) {
+            if (_modbus_rtu_write_latency_timer(path, 1) == 0) {
+                ctx_rtu->old_latency_timer = value;
+            } else if (ctx->debug) {
+                fprintf(stderr, "WARNING Can't write %s (%s)\n", path, strerror(errno));
+            }
+        }
+    }
+}
+
+static void _modbus_rtu_disable_low_latency(modbus_t *ctx)
+{
+    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+    char path[PATH_MAX + 64];
+
+    if (ctx_rtu->old_serial_flags != -1) {
+        struct serial_struct serial;
+
+        if (ioctl(ctx->s, TIOCGSERIAL, &serial) == 0) {
+            serial.flags = ctx_rtu->old_serial_flags;
+            ioctl(ctx->s, TIOCSSERIAL, &serial);
+        }
+        ctx_rtu->old_serial_flags = -1;
+    }
+
+    if (ctx_rtu->old_latency_timer != -1) {
+        if (_modbus_rtu_latency_timer_path(ctx_rtu->device, path, sizeof(path)) == 0) {
+            _modbus_rtu_write_latency_timer(path, ctx_rtu->old_latency_timer);
+        }
+        ctx_rtu->old_latency_timer = -1;
+    }
+}
+#endif
+
+/* POSIX */
+/* Applies the line settings of the context to the opened port */
+static int _modbus_rtu_setup_line(modbus_t *ctx)
+{
+    struct termios tios;
+    speed_t speed;
+    int custom_baud;
+    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+
+    memset(&tios, 0, sizeof(struct termios));
+
+    /* C_ISPEED     Input baud (new interface)
+       C_OSPEED     Output baud (new interface)
+    */
+
+    /* Set the baud rate */
+
+    /*
+    On MacOS, constants of baud rates are equal to the integer in argument but
+    that's not the case under Linux so we have to find the corresponding
+    constant. The other values (14400 or 250000 for example) are set with
+    termios2 once the port is configured, the line can't be set up when it
+    fails.
+    */
+    if (9600 == B9600) {
+        speed = ctx_rtu->baud;
+    } else {
+        speed = _get_termios_speed(ctx_rtu->baud);
+    }
+    custom_baud = (speed == B0);
+    if (custom_baud) {
+        speed = B9600;
+    }
+
+    if ((cfsetispeed(&tios, speed) < 0) || (cfsetospeed(&tios, speed) < 0)) {
+        return -1;
+    }
+
+    /* C_CFLAG      Control options
        CLOCAL       Local line - do not change "owner" of port
        CREAD        Enable receiver
     */
@@ -855,11 +1090,78 @@ static int _modbus_rtu_connect(modbus_t *ctx)
     tios.c_cc[VTIME] = 0;
 
     if (tcsetattr(ctx->s, TCSANOW, &tios) < 0) {
+        return -1;
+    }
+
+    if (custom_baud && _modbus_rtu_set_custom_baud(ctx->s, ctx_rtu->baud) < 0) {
+        if (ctx->debug) {
+            fprintf(stderr,
+                    "ERROR Can't set the baud rate %d (%s)\n",
+                    ctx_rtu->baud,
+                    strerror(errno));
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+static int _modbus_rtu_connect(modbus_t *ctx)
+{
+    int flags;
+    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+
+    if (ctx->debug) {
+        printf("Opening %s at %d bauds (%c, %d, %d)\n",
+               ctx_rtu->device,
+               ctx_rtu->baud,
+               ctx_rtu->parity,
+               ctx_rtu->data_bit,
+               ctx_rtu->stop_bit);
+    }
+
+    /* The O_NOCTTY flag tells UNIX that this program doesn't want
+       to be the "controlling terminal" for that port. If you
+       don't specify this then any input (such as keyboard abort
+       signals and so forth) will affect your process
+
+       Timeouts are ignored in canonical input mode or when the
+       NDELAY option is set on the file via open or fcntl */
+    flags = O_RDWR | O_NOCTTY | O_NDELAY | O_EXCL;
+#ifdef O_CLOEXEC
+    flags |= O_CLOEXEC;
+#endif
+
+    ctx->s = open(ctx_rtu->device, flags);
+    if (ctx->s < 0) {
+        if (ctx->debug) {
+            fprintf(stderr,
+                    "ERROR Can't open the device %s (%s)\n",
+                    ctx_rtu->device,
+                    strerror(errno));
+        }
+        return -1;
+    }
+
+    /* Save */
+    tcgetattr(ctx->s, &ctx_rtu->old_tios);
+
+    if (_modbus_rtu_setup_line(ctx) < 0) {
+        int saved_errno = errno;
+
+        tcsetattr(ctx->s, TCSANOW, &ctx_rtu->old_tios);
         close(ctx->s);
         ctx->s = -1;
+        errno = saved_errno;
         return -1;
     }
 
+#if HAVE_DECL_TIOCSSERIAL
+    if (ctx_rtu->low_latency) {
+        _modbus_rtu_enable_low_latency(ctx);
+    }
+#endif
+
     return 0;
 }
 #endif
@@ -992,6 +1294,9 @@ int modbus_rtu_set_rts(modbus_t *ctx, int mode)
 
         if (mode == MODBUS_RTU_RTS_NONE || mode == MODBUS_RTU_RTS_UP ||
             mode == MODBUS_RTU_RTS_DOWN) {
+#if HAVE_DECL_TIOCSRS485
+            _modbus_rtu_reset_kernel_rts(ctx);
+#endif
             ctx_rtu->rts = mode;
 
             /* Set the RTS bit in order to not reserve the RS485 bus */
@@ -1025,6 +1330,9 @@ int modbus_rtu_set_custom_rts(modbus_t *ctx, void (*set_rts)(modbus_t *ctx, int
     if (ctx->backend->backend_type == _MODBUS_BACKEND_TYPE_RTU) {
 #if HAVE_DECL_TIOCM_RTS
         modbus_rtu_t *ctx_rtu = ctx->backend_data;
+#if HAVE_DECL_TIOCSRS485
+        _modbus_rtu_reset_kernel_rts(ctx);
+#endif
         ctx_rtu->set_rts = set_rts;
         return 0;
 #else
@@ -1076,6 +1384,10 @@ int modbus_rtu_set_rts_delay(modbus_t *ctx, int us)
 #if HAVE_DECL_TIOCM_RTS
         modbus_rtu_t *ctx_rtu;
         ctx_rtu = (modbus_rtu_t *) ctx->backend_data;
+#if HAVE_DECL_TIOCSRS485
+        /* The delays of the driver are updated by the next request */
+        _modbus_rtu_reset_kernel_rts(ctx);
+#endif
         ctx_rtu->rts_delay = us;
         return 0;
 #else
@@ -1091,6 +1403,269 @@ int modbus_rtu_set_rts_delay(modbus_t *ctx, int us)
     }
 }
 
+int modbus_rtu_get_turnaround(modbus_t *ctx)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ctx->backend->backend_type == _MODBUS_BACKEND_TYPE_RTU) {
+#if HAVE_DECL_TIOCM_RTS
+        modbus_rtu_t *ctx_rtu = ctx->backend_data;
+        return ctx_rtu->turnaround;
+#else
+        if (ctx->debug) {
+            fprintf(stderr, "This function isn't supported on your platform\n");
+        }
+        errno = ENOTSUP;
+        return -1;
+#endif
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+/* Defines how the RTS signal is toggled around a request (MODBUS_RTU_TURNAROUND_*) */
+int modbus_rtu_set_turnaround(modbus_t *ctx, int mode)
+{
+    if (ctx == NULL || mode < MODBUS_RTU_TURNAROUND_SLEEP ||
+        mode > MODBUS_RTU_TURNAROUND_AUTO) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ctx->backend->backend_type == _MODBUS_BACKEND_TYPE_RTU) {
+#if HAVE_DECL_TIOCM_RTS
+        modbus_rtu_t *ctx_rtu = ctx->backend_data;
+#if HAVE_DECL_TIOCSRS485
+        _modbus_rtu_reset_kernel_rts(ctx);
+#endif
+        ctx_rtu->turnaround = mode;
+        return 0;
+#else
+        if (ctx->debug) {
+            fprintf(stderr, "This function isn't supported on your platform\n");
+        }
+        errno = ENOTSUP;
+        return -1;
+#endif
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+int modbus_rtu_get_turnaround_spin(modbus_t *ctx)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ctx->backend->backend_type == _MODBUS_BACKEND_TYPE_RTU) {
+#if HAVE_DECL_TIOCM_RTS
+        modbus_rtu_t *ctx_rtu = ctx->backend_data;
+        return ctx_rtu->turnaround_spin;
+#else
+        if (ctx->debug) {
+            fprintf(stderr, "This function isn't supported on your platform\n");
+        }
+        errno = ENOTSUP;
+        return -1;
+#endif
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+/* Defines the end of the turnaround delays which is busy-waited instead of
+   slept (0 by default), to release the line right after the last stop bit */
+int modbus_rtu_set_turnaround_spin(modbus_t *ctx, int us)
+{
+    if (ctx == NULL || us < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ctx->backend->backend_type == _MODBUS_BACKEND_TYPE_RTU) {
+#if HAVE_DECL_TIOCM_RTS
+        modbus_rtu_t *ctx_rtu = ctx->backend_data;
+        ctx_rtu->turnaround_spin = us;
+        return 0;
+#else
+        if (ctx->debug) {
+            fprintf(stderr, "This function isn't supported on your platform\n");
+        }
+        errno = ENOTSUP;
+        return -1;
+#endif
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+int modbus_rtu_get_framing(modbus_t *ctx)
+{
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ((modbus_rtu_t *) ctx->backend_data)->framing;
+}
+
+/* Defines how the end of a received frame is detected (MODBUS_RTU_FRAMING_*).
+   With the silence, the frames of any function are received and an incomplete
+   or corrupted frame is rejected a few character times after its last byte,
+   so the link isn't flushed after a response timeout. modbus_submit() isn't
+   available in this mode and modbus_pipeline() runs the transactions one by
+   one. */
+int modbus_rtu_set_framing(modbus_t *ctx, int mode)
+{
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU ||
+        (mode != MODBUS_RTU_FRAMING_LENGTH && mode != MODBUS_RTU_FRAMING_SILENCE)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ((modbus_rtu_t *) ctx->backend_data)->framing = mode;
+    return 0;
+}
+
+/* Returns the silence (us) ending a frame in MODBUS_RTU_FRAMING_SILENCE mode */
+int modbus_rtu_get_frame_silence(modbus_t *ctx)
+{
+    modbus_rtu_t *ctx_rtu;
+
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ctx_rtu = ctx->backend_data;
+    return (ctx_rtu->frame_silence > 0) ? ctx_rtu->frame_silence : _modbus_rtu_t35(ctx_rtu);
+}
+
+/* Overrides the silence ending a frame (t3.5 computed from the baud rate when
+   0), a USB adapter delivers the received bytes by packets so its latency
+   must be included */
+int modbus_rtu_set_frame_silence(modbus_t *ctx, int us)
+{
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU || us < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ((modbus_rtu_t *) ctx->backend_data)->frame_silence = us;
+    return 0;
+}
+
+int modbus_rtu_get_low_latency(modbus_t *ctx)
+{
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ((modbus_rtu_t *) ctx->backend_data)->low_latency;
+}
+
+/* Opt-in low latency mode (Linux): the driver delivers the received bytes at
+   once (ASYNC_LOW_LATENCY) and the latency timer of a USB adapter is set to
+   1 ms. The previous settings are restored on close. */
+int modbus_rtu_set_low_latency(modbus_t *ctx, int enable)
+{
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#if HAVE_DECL_TIOCSSERIAL
+    modbus_rtu_t *ctx_rtu = ctx->backend_data;
+
+    ctx_rtu->low_latency = enable ? TRUE : FALSE;
+    if (ctx->s >= 0) {
+        if (ctx_rtu->low_latency) {
+            _modbus_rtu_enable_low_latency(ctx);
+        } else {
+            _modbus_rtu_disable_low_latency(ctx);
+        }
+    }
+    return 0;
+#else
+    (void) enable;
+    if (ctx->debug) {
+        fprintf(stderr, "This function isn't supported on your platform\n");
+    }
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/* Changes the line settings of the context. On an open port, the new settings
+   are applied and the pending bytes discarded without closing the device, so
+   a scan of the baud rates and parities pays the opening of the port once. */
+int modbus_rtu_set_line(modbus_t *ctx, int baud, char parity, int data_bit, int stop_bit)
+{
+    modbus_rtu_t *ctx_rtu;
+
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (baud <= 0 || (parity != 'N' && parity != 'E' && parity != 'O') ||
+        data_bit < 5 || data_bit > 8 || stop_bit < 1 || stop_bit > 2) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ctx_rtu = ctx->backend_data;
+    ctx_rtu->baud = baud;
+    ctx_rtu->parity = parity;
+    ctx_rtu->data_bit = data_bit;
+    ctx_rtu->stop_bit = stop_bit;
+
+#if HAVE_DECL_TIOCM_RTS
+    {
+        int onebyte_time =
+            1000000 * (1 + data_bit + (parity == 'N' ? 0 : 1) + stop_bit) / baud;
+
+        /* The default RTS delay follows the duration of one byte */
+        if (ctx_rtu->rts_delay == ctx_rtu->onebyte_time) {
+            ctx_rtu->rts_delay = onebyte_time;
+        }
+        ctx_rtu->onebyte_time = onebyte_time;
+    }
+#endif
+
+    if (!_modbus_rtu_is_connected(ctx)) {
+        return 0;
+    }
+
+    if (ctx->debug) {
+        printf("Setting %s at %d bauds (%c, %d, %d)\n",
+               ctx_rtu->device,
+               ctx_rtu->baud,
+               ctx_rtu->parity,
+               ctx_rtu->data_bit,
+               ctx_rtu->stop_bit);
+    }
+
+    if (_modbus_rtu_setup_line(ctx) < 0) {
+        return -1;
+    }
+
+    /* The bytes received with the previous settings are meaningless */
+    _modbus_rtu_flush(ctx);
+
+    return 0;
+}
+
 static void _modbus_rtu_close(modbus_t *ctx)
 {
     /* Restore line settings and close file descriptor in RTU mode */
@@ -1110,6 +1685,14 @@ static void _modbus_rtu_close(modbus_t *ctx)
                 (int) GetLastError());
     }
 #else
+#if HAVE_DECL_TIOCM_RTS && HAVE_DECL_TIOCSRS485
+    _modbus_rtu_reset_kernel_rts(ctx);
+#endif
+#if HAVE_DECL_TIOCSSERIAL
+    if (ctx->s >= 0) {
+        _modbus_rtu_disable_low_latency(ctx);
+    }
+#endif
     if (ctx->s >= 0) {
         tcsetattr(ctx->s, TCSANOW, &ctx_rtu->old_tios);
         close(ctx->s);
@@ -1189,7 +1772,9 @@ const modbus_backend_t _modbus_rtu_backend = {
     _modbus_rtu_build_response_basis,
     _modbus_rtu_prepare_response_tid,
     _modbus_rtu_send_msg_pre,
+    _modbus_rtu_send_msg_pre_data,
     _modbus_rtu_send,
+    _modbus_rtu_send_parts,
     _modbus_rtu_receive,
     _modbus_rtu_recv,
     _modbus_rtu_check_integrity,
@@ -1199,7 +1784,8 @@ const modbus_backend_t _modbus_rtu_backend = {
     _modbus_rtu_close,
     _modbus_rtu_flush,
     _modbus_rtu_select,
-    _modbus_rtu_free
+    _modbus_rtu_free,
+    _modbus_rtu_frame_silence
 };
 
 // clang-format on
@@ -1282,6 +1868,21 @@ modbus_new_rtu(const char *device, int baud, char parity, int data_bit, int stop
 
     /* The delay before and after transmission when toggling the RTS pin */
     ctx_rtu->rts_delay = ctx_rtu->onebyte_time;
+
+    ctx_rtu->turnaround = MODBUS_RTU_TURNAROUND_SLEEP;
+    ctx_rtu->turnaround_spin = 0;
+#if HAVE_DECL_TIOCSRS485
+    ctx_rtu->rts_kernel = -1;
+#endif
+#endif
+
+    ctx_rtu->framing = MODBUS_RTU_FRAMING_LENGTH;
+    ctx_rtu->frame_silence = 0;
+
+    ctx_rtu->low_latency = FALSE;
+#if HAVE_DECL_TIOCSSERIAL
+    ctx_rtu->old_serial_flags = -1;
+    ctx_rtu->old_latency_timer = -1;
 #endif
 
     ctx_rtu->confirmation_to_ignore = FALSE;
@@ -22,6 +22,9 @@ modbus_new_rtu(const char *device, int baud, char parity, int data_bit, int stop
 #define MODBUS_RTU_RS232 0
 #define MODBUS_RTU_RS485 1
 
+MODBUS_API int
+modbus_rtu_set_line(modbus_t *ctx, int baud, char parity, int data_bit, int stop_bit);
+
 MODBUS_API int modbus_rtu_set_serial_mode(modbus_t *ctx, int mode);
 MODBUS_API int modbus_rtu_get_serial_mode(modbus_t *ctx);
 
@@ -38,6 +41,33 @@ MODBUS_API int modbus_rtu_set_custom_rts(modbus_t *ctx,
 MODBUS_API int modbus_rtu_set_rts_delay(modbus_t *ctx, int us);
 MODBUS_API int modbus_rtu_get_rts_delay(modbus_t *ctx);
 
+/* Relative sleeps around the write (default) */
+#define MODBUS_RTU_TURNAROUND_SLEEP 0
+/* Absolute sleeps, the end of the frame is waited with tcdrain */
+#define MODBUS_RTU_TURNAROUND_DRAIN 1
+/* RS-485 mode of the driver (TIOCSRS485) when available, DRAIN otherwise.
+   Only used when requested, the driver then owns RTS. */
+#define MODBUS_RTU_TURNAROUND_AUTO  2
+
+MODBUS_API int modbus_rtu_set_turnaround(modbus_t *ctx, int mode);
+MODBUS_API int modbus_rtu_get_turnaround(modbus_t *ctx);
+MODBUS_API int modbus_rtu_set_turnaround_spin(modbus_t *ctx, int us);
+MODBUS_API int modbus_rtu_get_turnaround_spin(modbus_t *ctx);
+
+/* End of a received frame deduced from its length (default) */
+#define MODBUS_RTU_FRAMING_LENGTH  0
+/* End of a received frame detected after a silence of the line (not supported
+   by modbus_submit, modbus_pipeline waits for each response) */
+#define MODBUS_RTU_FRAMING_SILENCE 1
+
+MODBUS_API int modbus_rtu_set_framing(modbus_t *ctx, int mode);
+MODBUS_API int modbus_rtu_get_framing(modbus_t *ctx);
+MODBUS_API int modbus_rtu_set_frame_silence(modbus_t *ctx, int us);
+MODBUS_API int modbus_rtu_get_frame_silence(modbus_t *ctx);
+
+MODBUS_API int modbus_rtu_set_low_latency(modbus_t *ctx, int enable);
+MODBUS_API int modbus_rtu_get_low_latency(modbus_t *ctx);
+
 MODBUS_END_DECLS
 
 #endif /* MODBUS_RTU_H */
@@ -0,0 +1,486 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Bus scheduler: periodic poll jobs share a context whose requests are sent one
+ * at a time, as on a half-duplex line. Among the released polls, the earliest
+ * deadline is served first, a write before a read of the same deadline (or
+ * before all the reads, see modbus_scheduler_set_write_first()). The released
+ * reads of the same slave with contiguous ranges are merged in a single request
+ * so the turnaround delays of the line are paid once.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "modbus-private.h"
+#include "modbus-scheduler.h"
+
+typedef struct {
+    modbus_job_t job;
+    /* Maximum number of values of a request of the function */
+    int max_nb;
+    /* Release time of the next poll, its deadline is one period later */
+    int64_t release;
+    /* TRUE when the poll is served by the current request */
+    int selected;
+    modbus_job_stats_t stats;
+} _modbus_sched_job_t;
+
+struct _modbus_scheduler {
+    modbus_t *ctx;
+    _modbus_sched_job_t *jobs;
+    int nb_jobs;
+    int max_jobs;
+    modbus_job_complete_t complete;
+    void *user_data;
+    volatile int stop_requested;
+    /* The released writes are served before the reads whatever the deadlines */
+    int write_first;
+    /* Time of the last reset of the statistics */
+    int64_t stats_start;
+    modbus_scheduler_stats_t stats;
+};
+
+static int is_write(int function)
+{
+    return function == MODBUS_FC_WRITE_SINGLE_COIL ||
+           function == MODBUS_FC_WRITE_SINGLE_REGISTER ||
+           function == MODBUS_FC_WRITE_MULTIPLE_COILS ||
+           function == MODBUS_FC_WRITE_MULTIPLE_REGISTERS;
+}
+
+/* Returns the maximum number of values of a request or -1 if the function
+   can't be scheduled */
+static int max_nb_values(int function)
+{
+    switch (function) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+        return MODBUS_MAX_READ_BITS;
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+        return MODBUS_MAX_READ_REGISTERS;
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+    case MODBUS_FC_WRITE_SINGLE_REGISTER:
+        return 1;
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+        return MODBUS_MAX_WRITE_BITS;
+    case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+        return MODBUS_MAX_WRITE_REGISTERS;
+    default:
+        return -1;
+    }
+}
+
+static int64_t deadline_of(const _modbus_sched_job_t *j)
+{
+    return j->release + (int64_t) j->job.period_ms * 1000;
+}
+
+static void reset_job_stats(modbus_job_stats_t *stats)
+{
+    memset(stats, 0, sizeof(modbus_job_stats_t));
+    stats->min_latency_us = UINT32_MAX;
+}
+
+static void sleep_us(int64_t delay)
+{
+#ifdef _WIN32
+    Sleep((DWORD) ((delay + 999) / 1000));
+#else
+    struct timespec request, remaining;
+
+    request.tv_sec = delay / 1000000;
+    request.tv_nsec = (long) (delay % 1000000) * 1000;
+    while (nanosleep(&request, &remaining) == -1 && errno == EINTR) {
+        request = remaining;
+    }
+#endif
+}
+
+modbus_scheduler_t *modbus_scheduler_new(modbus_t *ctx)
+{
+    modbus_scheduler_t *scheduler;
+
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    scheduler = (modbus_scheduler_t *) calloc(1, sizeof(modbus_scheduler_t));
+    if (scheduler == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    scheduler->ctx = ctx;
+    scheduler->stats_start = _modbus_get_time_us();
+
+    return scheduler;
+}
+
+/* Adds a periodic poll whose first poll is due at once. Returns the index of
+   the job passed to the complete callback or -1 if the job is invalid. */
+int modbus_scheduler_add_job(modbus_scheduler_t *scheduler, const modbus_job_t *job)
+{
+    _modbus_sched_job_t *j;
+    int max_nb;
+
+    if (scheduler == NULL || job == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    max_nb = max_nb_values(job->function);
+    if (max_nb == -1 || job->slave < 0 || job->slave > 255 || job->addr < 0 ||
+        job->nb < 1 || job->nb > max_nb || job->addr + job->nb > 65536 ||
+        job->period_ms == 0 || (is_write(job->function) ? job->src : job->dest) == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (scheduler->nb_jobs == scheduler->max_jobs) {
+        int max_jobs = scheduler->max_jobs ? scheduler->max_jobs * 2 : 8;
+        _modbus_sched_job_t *jobs;
+
+        jobs = (_modbus_sched_job_t *) realloc(scheduler->jobs,
+                                               max_jobs * sizeof(_modbus_sched_job_t));
+        if (jobs == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        scheduler->jobs = jobs;
+        scheduler->max_jobs = max_jobs;
+    }
+
+    j = &scheduler->jobs[scheduler->nb_jobs];
+    j->job = *job;
+    j->max_nb = max_nb;
+    j->release = _modbus_get_time_us();
+    j->selected = FALSE;
+    reset_job_stats(&j->stats);
+
+    return scheduler->nb_jobs++;
+}
+
+void modbus_scheduler_set_complete_callback(modbus_scheduler_t *scheduler,
+                                            modbus_job_complete_t complete,
+                                            void *user_data)
+{
+    if (scheduler == NULL) {
+        return;
+    }
+
+    scheduler->complete = complete;
+    scheduler->user_data = user_data;
+}
+
+/* Serves the released writes before the reads even when a read has an earlier
+   deadline, the reads may then overrun. Disabled by default, the writes only
+   win the ties. */
+void modbus_scheduler_set_write_first(modbus_scheduler_t *scheduler, int enable)
+{
+    if (scheduler == NULL) {
+        return;
+    }
+
+    scheduler->write_first = enable;
+}
+
+/* Returns TRUE when the poll of a must be served before the poll of b */
+static int precedes(const modbus_scheduler_t *scheduler,
+                    const _modbus_sched_job_t *a,
+                    const _modbus_sched_job_t *b)
+{
+    int a_write = is_write(a->job.function);
+
+    if (scheduler->write_first && a_write != is_write(b->job.function)) {
+        return a_write;
+    }
+    if (deadline_of(a) != deadline_of(b)) {
+        return deadline_of(a) < deadline_of(b);
+    }
+    if (a_write != is_write(b->job.function)) {
+        return a_write;
+    }
+
+    return a->job.priority > b->job.priority;
+}
+
+/* Returns the index of the first job to serve among the released ones or -1
+   if none is released */
+static int next_job(const modbus_scheduler_t *scheduler, int64_t now)
+{
+    int next = -1;
+    int i;
+
+    for (i = 0; i < scheduler->nb_jobs; i++) {
+        const _modbus_sched_job_t *j = &scheduler->jobs[i];
+
+        if (j->release <= now && (next == -1 || precedes(scheduler, j, &scheduler->jobs[next]))) {
+            next = i;
+        }
+    }
+
+    return next;
+}
+
+/* Selects the released reads of the slave of the first job whose ranges are
+   contiguous with its range, the range of the request is returned in addr and
+   nb */
+static void select_reads(
+    modbus_scheduler_t *scheduler, int first, int64_t now, int *addr, int *nb)
+{
+    const _modbus_sched_job_t *f = &scheduler->jobs[first];
+    int start = f->job.addr;
+    int end = f->job.addr + f->job.nb;
+    int added;
+    int i;
+
+    scheduler->jobs[first].selected = TRUE;
+    do {
+        added = FALSE;
+        for (i = 0; i < scheduler->nb_jobs; i++) {
+            _modbus_sched_job_t *j = &scheduler->jobs[i];
+            int new_start;
+            int new_end;
+
+            if (j->selected || j->release > now || j->job.slave != f->job.slave ||
+                j->job.function != f->job.function) {
+                continue;
+            }
+            /* Overlapping or adjacent */
+            if (j->job.addr > end || j->job.addr + j->job.nb < start) {
+                continue;
+            }
+            new_start = (j->job.addr < start) ? j->job.addr : start;
+            new_end = (j->job.addr + j->job.nb > end) ? j->job.addr + j->job.nb : end;
+            if (new_end - new_start > f->max_nb) {
+                continue;
+            }
+            start = new_start;
+            end = new_end;
+            j->selected = TRUE;
+            added = TRUE;
+        }
+    } while (added);
+
+    *addr = start;
+    *nb = end - start;
+}
+
+static void update_job_stats(modbus_job_stats_t *stats,
+                             int64_t latency,
+                             int overrun,
+                             int error)
+{
+    uint32_t value = (latency > UINT32_MAX) ? UINT32_MAX : (uint32_t) latency;
+
+    stats->nb_polls++;
+    if (error) {
+        stats->nb_errors++;
+    }
+    if (overrun) {
+        stats->nb_overruns++;
+    }
+    if (value < stats->min_latency_us) {
+        stats->min_latency_us = value;
+    }
+    if (value > stats->max_latency_us) {
+        stats->max_latency_us = value;
+    }
+    stats->sum_latency_us += value;
+}
+
+/* Waits for the release of the next poll then sends its request. Returns the
+   number of polls served by the request or -1 if no job is defined or the
+   request can't be sent (see modbus_pipeline). */
+int modbus_scheduler_run_once(modbus_scheduler_t *scheduler)
+{
+    union {
+        uint8_t bits[MODBUS_MAX_READ_BITS];
+        uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+    } values;
+    modbus_transaction_t t;
+    _modbus_sched_job_t *f;
+    int64_t now;
+    int64_t start;
+    int64_t end;
+    size_t size;
+    int nb_polls = 0;
+    int first;
+    int i;
+
+    if (scheduler == NULL || scheduler->nb_jobs == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    now = _modbus_get_time_us();
+    while ((first = next_job(scheduler, now)) == -1) {
+        int64_t release = scheduler->jobs[0].release;
+
+        for (i = 1; i < scheduler->nb_jobs; i++) {
+            if (scheduler->jobs[i].release < release) {
+                release = scheduler->jobs[i].release;
+            }
+        }
+        sleep_us(release - now);
+        now = _modbus_get_time_us();
+    }
+
+    f = &scheduler->jobs[first];
+    memset(&t, 0, sizeof(t));
+    t.slave = f->job.slave;
+    t.function = f->job.function;
+    if (is_write(f->job.function)) {
+        /* The values of other writes can't be sent in the same request */
+        f->selected = TRUE;
+        t.addr = f->job.addr;
+        t.nb = f->job.nb;
+        t.src = f->job.src;
+    } else {
+        select_reads(scheduler, first, now, &t.addr, &t.nb);
+        t.dest = &values;
+    }
+
+    start = _modbus_get_time_us();
+    if (modbus_pipeline(scheduler->ctx, &t, 1) == -1) {
+        for (i = 0; i < scheduler->nb_jobs; i++) {
+            scheduler->jobs[i].selected = FALSE;
+        }
+        return -1;
+    }
+    end = _modbus_get_time_us();
+    scheduler->stats.nb_requests++;
+    scheduler->stats.busy_us += end - start;
+
+    size = (t.function == MODBUS_FC_READ_COILS ||
+            t.function == MODBUS_FC_READ_DISCRETE_INPUTS)
+               ? sizeof(uint8_t)
+               : sizeof(uint16_t);
+    /* The complete callback can add jobs so they are accessed by index */
+    for (i = 0; i < scheduler->nb_jobs; i++) {
+        _modbus_sched_job_t *j = &scheduler->jobs[i];
+        int64_t deadline;
+        int rc = t.rc;
+
+        if (!j->selected) {
+            continue;
+        }
+        j->selected = FALSE;
+        if (i != first) {
+            scheduler->stats.nb_merged++;
+        }
+
+        if (rc != -1 && t.dest != NULL) {
+            memcpy(j->job.dest,
+                   (uint8_t *) &values + (j->job.addr - t.addr) * size,
+                   j->job.nb * size);
+            rc = j->job.nb;
+        }
+
+        deadline = deadline_of(j);
+        update_job_stats(&j->stats, start - j->release, end > deadline, rc == -1);
+        /* A late job is released again at once but the missed polls aren't
+           caught up */
+        j->release = (deadline < end) ? end : deadline;
+        nb_polls++;
+
+        if (scheduler->complete != NULL) {
+            errno = t.error;
+            scheduler->complete(scheduler, i, rc, scheduler->user_data);
+        }
+    }
+
+    return nb_polls;
+}
+
+/* Serves the jobs until modbus_scheduler_stop is called. Returns 0 when stopped
+   or -1 if a request can't be sent. */
+int modbus_scheduler_run(modbus_scheduler_t *scheduler)
+{
+    if (scheduler == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    scheduler->stop_requested = FALSE;
+    while (!scheduler->stop_requested) {
+        if (modbus_scheduler_run_once(scheduler) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Can be called by the complete callback or another thread, in the latter case
+   the scheduler stops after its current wait */
+void modbus_scheduler_stop(modbus_scheduler_t *scheduler)
+{
+    if (scheduler == NULL) {
+        return;
+    }
+
+    scheduler->stop_requested = TRUE;
+}
+
+int modbus_scheduler_get_job_stats(modbus_scheduler_t *scheduler,
+                                   int job,
+                                   modbus_job_stats_t *stats)
+{
+    if (scheduler == NULL || job < 0 || job >= scheduler->nb_jobs || stats == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *stats = scheduler->jobs[job].stats;
+    if (stats->nb_polls == 0) {
+        stats->min_latency_us = 0;
+    }
+
+    return 0;
+}
+
+void modbus_scheduler_get_stats(modbus_scheduler_t *scheduler,
+                                modbus_scheduler_stats_t *stats)
+{
+    if (scheduler == NULL || stats == NULL) {
+        return;
+    }
+
+    *stats = scheduler->stats;
+    stats->elapsed_us = _modbus_get_time_us() - scheduler->stats_start;
+}
+
+void modbus_scheduler_reset_stats(modbus_scheduler_t *scheduler)
+{
+    int i;
+
+    if (scheduler == NULL) {
+        return;
+    }
+
+    memset(&scheduler->stats, 0, sizeof(modbus_scheduler_stats_t));
+    for (i = 0; i < scheduler->nb_jobs; i++) {
+        reset_job_stats(&scheduler->jobs[i].stats);
+    }
+    scheduler->stats_start = _modbus_get_time_us();
+}
+
+void modbus_scheduler_free(modbus_scheduler_t *scheduler)
+{
+    if (scheduler == NULL) {
+        return;
+    }
+
+    free(scheduler->jobs);
+    free(scheduler);
+}
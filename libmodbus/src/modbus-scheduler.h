@@ -0,0 +1,84 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_SCHEDULER_H
+#define MODBUS_SCHEDULER_H
+
+#include "modbus.h"
+
+MODBUS_BEGIN_DECLS
+
+/* Periodic polling of slaves on a half-duplex line (RTU): one request at a time
+   is sent in earliest deadline first order */
+typedef struct _modbus_scheduler modbus_scheduler_t;
+
+typedef struct _modbus_job {
+    int slave;
+    /* MODBUS_FC_READ_* or MODBUS_FC_WRITE_* function */
+    int function;
+    int addr;
+    int nb;
+    /* Interval between two polls, a poll must be done before the next one is
+       released */
+    unsigned int period_ms;
+    /* Orders the jobs of same deadline, the highest first */
+    int priority;
+    /* Values sent by a write job */
+    const void *src;
+    /* Values updated by a read job */
+    void *dest;
+} modbus_job_t;
+
+typedef struct {
+    uint32_t nb_polls;
+    uint32_t nb_errors;
+    /* Polls completed after their deadline */
+    uint32_t nb_overruns;
+    /* Delay between the release of a poll and the sending of its request, the
+       jitter of the job is max_latency_us - min_latency_us */
+    uint32_t min_latency_us;
+    uint32_t max_latency_us;
+    uint64_t sum_latency_us;
+} modbus_job_stats_t;
+
+typedef struct {
+    uint32_t nb_requests;
+    /* Polls served by the request of another job */
+    uint32_t nb_merged;
+    /* The utilization of the bus is busy_us / elapsed_us */
+    uint64_t busy_us;
+    uint64_t elapsed_us;
+} modbus_scheduler_stats_t;
+
+/* Called after each poll of a job, rc is the result of the transaction (see
+   modbus_transaction_t) and errno is set when it's -1 */
+typedef void (*modbus_job_complete_t)(modbus_scheduler_t *scheduler,
+                                      int job,
+                                      int rc,
+                                      void *user_data);
+
+MODBUS_API modbus_scheduler_t *modbus_scheduler_new(modbus_t *ctx);
+MODBUS_API int modbus_scheduler_add_job(modbus_scheduler_t *scheduler,
+                                        const modbus_job_t *job);
+MODBUS_API void modbus_scheduler_set_complete_callback(modbus_scheduler_t *scheduler,
+                                                       modbus_job_complete_t complete,
+                                                       void *user_data);
+MODBUS_API void modbus_scheduler_set_write_first(modbus_scheduler_t *scheduler,
+                                                int enable);
+MODBUS_API int modbus_scheduler_run_once(modbus_scheduler_t *scheduler);
+MODBUS_API int modbus_scheduler_run(modbus_scheduler_t *scheduler);
+MODBUS_API void modbus_scheduler_stop(modbus_scheduler_t *scheduler);
+MODBUS_API int modbus_scheduler_get_job_stats(modbus_scheduler_t *scheduler,
+                                              int job,
+                                              modbus_job_stats_t *stats);
+MODBUS_API void modbus_scheduler_get_stats(modbus_scheduler_t *scheduler,
+                                           modbus_scheduler_stats_t *stats);
+MODBUS_API void modbus_scheduler_reset_stats(modbus_scheduler_t *scheduler);
+MODBUS_API void modbus_scheduler_free(modbus_scheduler_t *scheduler);
+
+MODBUS_END_DECLS
+
+#endif /* MODBUS_SCHEDULER_H */
@@ -0,0 +1,97 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_SERVER_PRIVATE_H
+#define MODBUS_SERVER_PRIVATE_H
+
+// clang-format off
+#if defined(HAVE_LINUX_IO_URING_H)
+# include <linux/io_uring.h>
+/* Multishot recv and provided buffer rings */
+# if defined(IORING_RECV_MULTISHOT) && defined(IORING_CQE_F_BUFFER)
+#  define USE_URING
+# endif
+#endif
+// clang-format on
+
+#include "modbus-private.h"
+#include "modbus-server.h"
+
+/* Each connection buffers the received requests and the responses not sent
+   yet, the transmit buffer always has room for a response before a request is
+   handled. */
+#define _MODBUS_SERVER_RX_LENGTH 1024
+#define _MODBUS_SERVER_TX_LENGTH 2048
+
+/* Number of events handled per wakeup */
+#define _MODBUS_SERVER_MAX_EVENTS 256
+
+typedef struct _modbus_server_conn {
+    int s;
+    /* Received bytes not handled yet are in rx_buffer[rx_start, rx_end[ */
+    int rx_start;
+    int rx_end;
+    /* Responses not sent yet are in tx_buffer[tx_start, tx_end[ */
+    int tx_start;
+    int tx_end;
+    /* TRUE while tx_buffer[tx_start, tx_end[ is sent asynchronously, the
+       transmit buffer can't be compacted */
+    int sending;
+#ifdef USE_URING
+    /* State of the multishot receive (0 none, 1 armed, 2 being cancelled) */
+    int recv_armed;
+    int closing;
+    /* Chain of the provided buffers received but not copied in rx_buffer yet
+       (-1 when empty), the first one is copied from held_offset */
+    int held_first;
+    int held_last;
+    int held_offset;
+#endif
+    struct _modbus_server_conn *prev;
+    struct _modbus_server_conn *next;
+    uint8_t rx_buffer[_MODBUS_SERVER_RX_LENGTH];
+    uint8_t tx_buffer[_MODBUS_SERVER_TX_LENGTH];
+} modbus_server_conn_t;
+
+struct _modbus_server {
+    /* Copy of the context of the user whose backend stores the responses in
+       the transmit buffer of the current connection instead of sending them */
+    modbus_t ctx;
+    modbus_backend_t backend;
+    modbus_mapping_t *mb_mapping;
+    /* Protects the mapping shared with other servers */
+    modbus_server_lock_t lock;
+    modbus_server_lock_t unlock;
+    void *lock_data;
+    int engine;
+    /* Listening socket */
+    int s;
+    /* FALSE while the process is out of file descriptors */
+    int accepting;
+    volatile int stop_requested;
+    int nb_connections;
+    modbus_server_conn_t *connections;
+    /* Connection of the request being handled */
+    modbus_server_conn_t *current;
+#if defined(HAVE_SYS_EPOLL_H)
+    int epfd;
+#endif
+#if !defined(_WIN32)
+    /* Written by modbus_server_stop to wake up the loop */
+    int wakeup[2];
+#endif
+};
+
+modbus_server_conn_t *_modbus_server_add_connection(modbus_server_t *server, int s);
+void _modbus_server_remove_connection(modbus_server_t *server, modbus_server_conn_t *conn);
+int _modbus_server_reply(modbus_server_t *server, modbus_server_conn_t *conn);
+
+#ifdef USE_URING
+int _modbus_server_uring_supported(void);
+int _modbus_server_run_uring(modbus_server_t *server);
+#endif
+
+#endif /* MODBUS_SERVER_PRIVATE_H */
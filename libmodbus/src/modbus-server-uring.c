@@ -0,0 +1,776 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * io_uring engine of the TCP server (Linux >= 6.0).
+ *
+ * Instead of waiting for readiness events and calling accept/recv/send for
+ * each connection, the operations are queued in the submission ring and their
+ * results read from the completion ring:
+ * - a multishot accept posts a completion per new connection,
+ * - a multishot recv per connection posts a completion per received chunk,
+ *   the kernel picks the destination in a ring of provided buffers so idle
+ *   connections don't own any receive memory,
+ * - a send per connection is queued when responses are pending.
+ * All the operations queued while handling a batch of completions are
+ * submitted by the single io_uring_enter call waiting for the next batch.
+ *
+ * The connections are closed when modbus_server_run returns.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "modbus-server-private.h"
+
+#ifdef USE_URING
+
+#define _URING_SQ_ENTRIES 2048
+#define _URING_CQ_ENTRIES 8192
+
+/* Provided buffers (power of 2), a request is never larger than a buffer */
+#define _URING_NB_BUFFERS   2048
+#define _URING_BUFFER_SIZE  1024
+#define _URING_BUFFER_GROUP 0
+
+/* The user data of an operation is the address of its connection (or of the
+   server) with the type of the operation in the low bits. The user data of
+   the cancellations is 0. */
+#define _URING_OP_ACCEPT 0
+#define _URING_OP_RECV   1
+#define _URING_OP_SEND   2
+#define _URING_OP_WAKEUP 3
+#define _URING_OP_MASK   3
+
+typedef struct {
+    int fd;
+    /* Submission ring */
+    unsigned int sq_entries;
+    unsigned int sq_mask;
+    unsigned int *sq_khead;
+    unsigned int *sq_ktail;
+    unsigned int sq_tail;
+    unsigned int to_submit;
+    struct io_uring_sqe *sqes;
+    /* Completion ring */
+    unsigned int cq_mask;
+    unsigned int *cq_khead;
+    unsigned int *cq_ktail;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+    /* Provided buffers */
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    unsigned short br_tail;
+    uint8_t *buffers;
+    int buffer_length[_URING_NB_BUFFERS];
+    int buffer_next[_URING_NB_BUFFERS];
+    /* Buffers not given back to the kernel */
+    int nb_held;
+    /* A recv ended because no buffer was available */
+    int starved;
+    /* Operations whose last completion hasn't been read */
+    int nb_pending;
+    /* errno of a failed submission */
+    int error;
+} uring_t;
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(uring_t *ring, unsigned int to_submit, unsigned int min_complete)
+{
+    int rc = (int) syscall(__NR_io_uring_enter,
+                           ring->fd,
+                           to_submit,
+                           min_complete,
+                           min_complete > 0 ? IORING_ENTER_GETEVENTS : 0,
+                           NULL,
+                           0);
+
+    if (rc >= 0) {
+        ring->to_submit -= rc;
+    }
+
+    return rc;
+}
+
+static int uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Checks once if the kernel supports the operations of the engine and the
+   ring of provided buffers (5.19, with the multishot accept). The multishot
+   recv has no probe flag: IORING_OP_SEND_ZC isn't used, it only stands for a
+   kernel >= 6.0 where both were added. */
+int _modbus_server_uring_supported(void)
+{
+    static int supported = -1;
+    struct io_uring_params p;
+    struct io_uring_probe *probe;
+    struct io_uring_buf_reg reg;
+    void *br = MAP_FAILED;
+    const int ops[] = {IORING_OP_ACCEPT,
+                       IORING_OP_RECV,
+                       IORING_OP_SEND,
+                       IORING_OP_POLL_ADD,
+                       IORING_OP_ASYNC_CANCEL,
+                       /* Kernel >= 6.0 (multishot recv) */
+                       IORING_OP_SEND_ZC};
+    size_t probe_size;
+    int fd;
+    int i;
+
+    if (supported != -1) {
+        return supported;
+    }
+
+    supported = 0;
+    memset(&p, 0, sizeof(p));
+    fd = uring_setup(4, &p);
+    if (fd < 0) {
+        return 0;
+    }
+
+    probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    probe = (struct io_uring_probe *) calloc(1, probe_size);
+    if (probe != NULL && uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        supported = 1;
+        for (i = 0; i < (int) (sizeof(ops) / sizeof(ops[0])); i++) {
+            if (ops[i] > probe->last_op ||
+                !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+                supported = 0;
+            }
+        }
+    }
+    free(probe);
+
+    if (supported) {
+        /* A ring of one buffer is registered */
+        br = mmap(NULL,
+                  sizeof(struct io_uring_buf),
+                  PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS,
+                  -1,
+                  0);
+        if (br == MAP_FAILED) {
+            supported = 0;
+        } else {
+            memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = (uint64_t) (uintptr_t) br;
+            reg.ring_entries = 1;
+            reg.bgid = _URING_BUFFER_GROUP;
+            supported = (uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0);
+        }
+    }
+    close(fd);
+    if (br != MAP_FAILED) {
+        munmap(br, sizeof(struct io_uring_buf));
+    }
+
+    return supported;
+}
+
+static void uring_free(uring_t *ring)
+{
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    if (ring->sq_ptr != NULL) {
+        munmap(ring->sq_ptr, ring->sq_size);
+    }
+    if (ring->br != NULL) {
+        munmap(ring->br, ring->br_size);
+    }
+    free(ring->buffers);
+    free(ring);
+}
+
+/* Gives the buffer back to the kernel */
+static void uring_recycle(uring_t *ring, int bid)
+{
+    struct io_uring_buf *buf = &ring->br->bufs[ring->br_tail & (_URING_NB_BUFFERS - 1)];
+
+    buf->addr = (uint64_t) (uintptr_t) (ring->buffers + bid * _URING_BUFFER_SIZE);
+    buf->len = _URING_BUFFER_SIZE;
+    buf->bid = bid;
+    ring->br_tail++;
+    __atomic_store_n(&ring->br->tail, ring->br_tail, __ATOMIC_RELEASE);
+}
+
+static uring_t *uring_new(void)
+{
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    uring_t *ring;
+    unsigned int *sq_array;
+    unsigned int i;
+
+    ring = (uring_t *) calloc(1, sizeof(uring_t));
+    if (ring == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = _URING_CQ_ENTRIES;
+    /* The ring is only used by the thread of modbus_server_run. Deferring the
+       task work until io_uring_enter (IORING_SETUP_DEFER_TASKRUN) was measured
+       slower: the received bytes wait for the next batch. */
+    p.flags |= IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+    ring->fd = uring_setup(_URING_SQ_ENTRIES, &p);
+    if (ring->fd < 0 && errno == EINVAL) {
+        /* Older kernel */
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = _URING_CQ_ENTRIES;
+        ring->fd = uring_setup(_URING_SQ_ENTRIES, &p);
+    }
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size) {
+            ring->sq_size = ring->cq_size;
+        }
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL,
+                        ring->sq_size,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        ring->fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        goto error;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL,
+                            ring->cq_size,
+                            PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE,
+                            ring->fd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            goto error;
+        }
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *) mmap(NULL,
+                                              ring->sqes_size,
+                                              PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_POPULATE,
+                                              ring->fd,
+                                              IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto error;
+    }
+
+    ring->sq_entries = p.sq_entries;
+    ring->sq_mask = *(unsigned int *) ((char *) ring->sq_ptr + p.sq_off.ring_mask);
+    ring->sq_khead = (unsigned int *) ((char *) ring->sq_ptr + p.sq_off.head);
+    ring->sq_ktail = (unsigned int *) ((char *) ring->sq_ptr + p.sq_off.tail);
+    ring->sq_tail = *ring->sq_ktail;
+    /* Entry i of the submission ring is always the i-th SQE */
+    sq_array = (unsigned int *) ((char *) ring->sq_ptr + p.sq_off.array);
+    for (i = 0; i < p.sq_entries; i++) {
+        sq_array[i] = i;
+    }
+
+    ring->cq_mask = *(unsigned int *) ((char *) ring->cq_ptr + p.cq_off.ring_mask);
+    ring->cq_khead = (unsigned int *) ((char *) ring->cq_ptr + p.cq_off.head);
+    ring->cq_ktail = (unsigned int *) ((char *) ring->cq_ptr + p.cq_off.tail);
+    ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ptr + p.cq_off.cqes);
+
+    /* Ring of provided buffers */
+    ring->br_size = _URING_NB_BUFFERS * sizeof(struct io_uring_buf);
+    ring->br = (struct io_uring_buf_ring *) mmap(NULL,
+                                                 ring->br_size,
+                                                 PROT_READ | PROT_WRITE,
+                                                 MAP_PRIVATE | MAP_ANONYMOUS,
+                                                 -1,
+                                                 0);
+    if (ring->br == MAP_FAILED) {
+        ring->br = NULL;
+        goto error;
+    }
+    ring->buffers = (uint8_t *) malloc(_URING_NB_BUFFERS * _URING_BUFFER_SIZE);
+    if (ring->buffers == NULL) {
+        errno = ENOMEM;
+        goto error;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) ring->br;
+    reg.ring_entries = _URING_NB_BUFFERS;
+    reg.bgid = _URING_BUFFER_GROUP;
+    if (uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        goto error;
+    }
+    for (i = 0; i < _URING_NB_BUFFERS; i++) {
+        uring_recycle(ring, i);
+    }
+
+    return ring;
+
+error : {
+    int saved_errno = errno;
+
+    uring_free(ring);
+    errno = saved_errno;
+}
+    return NULL;
+}
+
+/* Returns a cleared SQE, the queued entries are submitted when the ring is
+   full. Returns NULL and records the error if the submission fails. */
+static struct io_uring_sqe *uring_get_sqe(uring_t *ring)
+{
+    struct io_uring_sqe *sqe;
+
+    while (ring->sq_tail - __atomic_load_n(ring->sq_khead, __ATOMIC_ACQUIRE) >=
+           ring->sq_entries) {
+        if (uring_enter(ring, ring->to_submit, 0) < 0 && errno != EINTR &&
+            errno != EBUSY && errno != EAGAIN) {
+            ring->error = errno;
+            return NULL;
+        }
+    }
+
+    sqe = &ring->sqes[ring->sq_tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_tail++;
+    ring->to_submit++;
+    ring->nb_pending++;
+    __atomic_store_n(ring->sq_ktail, ring->sq_tail, __ATOMIC_RELEASE);
+
+    return sqe;
+}
+
+static void uring_arm_accept(uring_t *ring, modbus_server_t *server)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = server->s;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    /* Blocking sockets, io_uring waits for readiness itself */
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = (uintptr_t) server | _URING_OP_ACCEPT;
+}
+
+static void uring_arm_wakeup(uring_t *ring, modbus_server_t *server)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = server->wakeup[0];
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = (uintptr_t) server | _URING_OP_WAKEUP;
+}
+
+static void uring_arm_recv(uring_t *ring, modbus_server_conn_t *conn)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->s;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = _URING_BUFFER_GROUP;
+    sqe->user_data = (uintptr_t) conn | _URING_OP_RECV;
+    conn->recv_armed = 1;
+}
+
+static void uring_send(uring_t *ring, modbus_server_conn_t *conn)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->s;
+    sqe->addr = (uintptr_t) (conn->tx_buffer + conn->tx_start);
+    sqe->len = conn->tx_end - conn->tx_start;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uintptr_t) conn | _URING_OP_SEND;
+    conn->sending = TRUE;
+}
+
+/* Cancels the operation matching the user data or, depending on the flags, all
+   the operations on the descriptor or all the operations */
+static void uring_cancel(uring_t *ring, uint64_t user_data, int fd, unsigned int flags)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->addr = user_data;
+    sqe->cancel_flags = flags;
+    sqe->user_data = 0;
+}
+
+static void uring_hold(uring_t *ring, modbus_server_conn_t *conn, int bid, int length)
+{
+    ring->buffer_length[bid] = length;
+    ring->buffer_next[bid] = -1;
+    if (conn->held_first == -1) {
+        conn->held_first = bid;
+        conn->held_offset = 0;
+    } else {
+        ring->buffer_next[conn->held_last] = bid;
+    }
+    conn->held_last = bid;
+    ring->nb_held++;
+}
+
+static void uring_release(uring_t *ring, modbus_server_conn_t *conn)
+{
+    while (conn->held_first != -1) {
+        int bid = conn->held_first;
+
+        conn->held_first = ring->buffer_next[bid];
+        uring_recycle(ring, bid);
+        ring->nb_held--;
+    }
+}
+
+/* Copies the held bytes in the receive buffer while it has room */
+static void uring_feed(uring_t *ring, modbus_server_conn_t *conn)
+{
+    while (conn->held_first != -1 && conn->rx_end < _MODBUS_SERVER_RX_LENGTH) {
+        int bid = conn->held_first;
+        int length = ring->buffer_length[bid] - conn->held_offset;
+
+        if (length > _MODBUS_SERVER_RX_LENGTH - conn->rx_end) {
+            length = _MODBUS_SERVER_RX_LENGTH - conn->rx_end;
+        }
+        memcpy(conn->rx_buffer + conn->rx_end,
+               ring->buffers + bid * _URING_BUFFER_SIZE + conn->held_offset,
+               length);
+        conn->rx_end += length;
+        conn->held_offset += length;
+
+        if (conn->held_offset == ring->buffer_length[bid]) {
+            conn->held_first = ring->buffer_next[bid];
+            conn->held_offset = 0;
+            uring_recycle(ring, bid);
+            ring->nb_held--;
+        }
+    }
+}
+
+/* Closes the connection once its operations are completed */
+static void
+uring_close_connection(uring_t *ring, modbus_server_t *server, modbus_server_conn_t *conn)
+{
+    if (!conn->closing) {
+        conn->closing = TRUE;
+        uring_release(ring, conn);
+        if (conn->recv_armed || conn->sending) {
+            uring_cancel(ring, 0, conn->s, IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL);
+        }
+    }
+
+    if (conn->recv_armed || conn->sending) {
+        return;
+    }
+
+    _modbus_server_remove_connection(server, conn);
+    if (!server->accepting) {
+        /* A file descriptor is available again */
+        server->accepting = TRUE;
+        uring_arm_accept(ring, server);
+    }
+}
+
+/* Replies to the received requests and queues the responses, returns -1 when
+   the connection must be closed. */
+static int uring_process(uring_t *ring, modbus_server_t *server, modbus_server_conn_t *conn)
+{
+    for (;;) {
+        if (_modbus_server_reply(server, conn) == -1) {
+            return -1;
+        }
+        if (conn->held_first == -1 || conn->rx_end == _MODBUS_SERVER_RX_LENGTH) {
+            break;
+        }
+        uring_feed(ring, conn);
+    }
+
+    if (!conn->sending && conn->tx_start < conn->tx_end) {
+        uring_send(ring, conn);
+    }
+
+    if (conn->held_first != -1) {
+        /* The receive buffer is full, stops receiving until the responses
+           are sent */
+        if (conn->recv_armed == 1) {
+            uring_cancel(ring, (uintptr_t) conn | _URING_OP_RECV, -1, 0);
+            conn->recv_armed = 2;
+        }
+    } else if (conn->recv_armed == 0 && !ring->starved) {
+        uring_arm_recv(ring, conn);
+    }
+
+    return 0;
+}
+
+static void
+uring_handle_recv(uring_t *ring, modbus_server_t *server, struct io_uring_cqe *cqe)
+{
+    modbus_server_conn_t *conn =
+        (modbus_server_conn_t *) (uintptr_t) (cqe->user_data & ~(uint64_t) _URING_OP_MASK);
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        conn->recv_armed = 0;
+    }
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if (conn->closing || cqe->res <= 0) {
+            uring_recycle(ring, bid);
+        } else {
+            uring_hold(ring, conn, bid, cqe->res);
+        }
+    }
+
+    if (conn->closing) {
+        uring_close_connection(ring, server, conn);
+        return;
+    }
+
+    if (cqe->res == 0 ||
+        (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED)) {
+        /* Connection closed by the client or error */
+        uring_close_connection(ring, server, conn);
+        return;
+    }
+
+    if (cqe->res == -ENOBUFS) {
+        /* Received again when buffers are given back */
+        ring->starved = TRUE;
+    }
+
+    if (uring_process(ring, server, conn) == -1) {
+        uring_close_connection(ring, server, conn);
+    }
+}
+
+static void
+uring_handle_send(uring_t *ring, modbus_server_t *server, struct io_uring_cqe *cqe)
+{
+    modbus_server_conn_t *conn =
+        (modbus_server_conn_t *) (uintptr_t) (cqe->user_data & ~(uint64_t) _URING_OP_MASK);
+
+    conn->sending = FALSE;
+    if (conn->closing || cqe->res < 0) {
+        uring_close_connection(ring, server, conn);
+        return;
+    }
+
+    conn->tx_start += cqe->res;
+    if (conn->tx_start == conn->tx_end) {
+        conn->tx_start = conn->tx_end = 0;
+    }
+
+    /* Sends the rest and replies to the requests waiting for room */
+    if (uring_process(ring, server, conn) == -1) {
+        uring_close_connection(ring, server, conn);
+    }
+}
+
+static void
+uring_handle_accept(uring_t *ring, modbus_server_t *server, struct io_uring_cqe *cqe)
+{
+    modbus_server_conn_t *conn;
+
+    if (cqe->res >= 0) {
+        conn = _modbus_server_add_connection(server, cqe->res);
+        if (conn == NULL) {
+            close(cqe->res);
+        } else {
+            conn->recv_armed = 0;
+            conn->closing = FALSE;
+            conn->held_first = conn->held_last = -1;
+            conn->held_offset = 0;
+            uring_arm_recv(ring, conn);
+        }
+    } else if (server->ctx.debug) {
+        fprintf(stderr, "ERROR accept: %s\n", modbus_strerror(-cqe->res));
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        if (cqe->res == -EMFILE || cqe->res == -ENFILE) {
+            /* Accepted again when a connection is closed */
+            server->accepting = FALSE;
+        } else if (!server->stop_requested) {
+            uring_arm_accept(ring, server);
+        }
+    }
+}
+
+/* Handles the completions available, returns the number handled */
+static int uring_reap(uring_t *ring, modbus_server_t *server)
+{
+    unsigned int head = *ring->cq_khead;
+    unsigned int tail = __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE);
+    int n = 0;
+
+    while (head != tail) {
+        struct io_uring_cqe cqe = ring->cqes[head & ring->cq_mask];
+
+        /* Frees the entry first, handling it may wait for room in the
+           submission ring */
+        head++;
+        __atomic_store_n(ring->cq_khead, head, __ATOMIC_RELEASE);
+        n++;
+
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            ring->nb_pending--;
+        }
+
+        if (server == NULL || cqe.user_data == 0) {
+            /* Draining or cancellation */
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                uring_recycle(ring, cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            }
+        } else {
+            switch (cqe.user_data & _URING_OP_MASK) {
+            case _URING_OP_ACCEPT:
+                uring_handle_accept(ring, server, &cqe);
+                break;
+            case _URING_OP_RECV:
+                uring_handle_recv(ring, server, &cqe);
+                break;
+            case _URING_OP_SEND:
+                uring_handle_send(ring, server, &cqe);
+                break;
+            case _URING_OP_WAKEUP: {
+                char buf[16];
+
+                while (read(server->wakeup[0], buf, sizeof(buf)) > 0) {
+                }
+                if (!server->stop_requested) {
+                    uring_arm_wakeup(ring, server);
+                }
+            } break;
+            }
+        }
+
+        tail = __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE);
+    }
+
+    return n;
+}
+
+int _modbus_server_run_uring(modbus_server_t *server)
+{
+    uring_t *ring;
+    int rc = 0;
+
+    ring = uring_new();
+    if (ring == NULL) {
+        return -1;
+    }
+
+    server->accepting = TRUE;
+    uring_arm_wakeup(ring, server);
+    uring_arm_accept(ring, server);
+
+    while (!server->stop_requested && ring->error == 0) {
+        if (uring_enter(ring, ring->to_submit, 1) < 0 && errno != EINTR && errno != EBUSY) {
+            ring->error = errno;
+            break;
+        }
+
+        uring_reap(ring, server);
+
+        if (ring->starved && ring->nb_held < _URING_NB_BUFFERS) {
+            modbus_server_conn_t *conn;
+
+            ring->starved = FALSE;
+            for (conn = server->connections; conn != NULL; conn = conn->next) {
+                if (conn->recv_armed == 0 && conn->held_first == -1 && !conn->closing) {
+                    uring_arm_recv(ring, conn);
+                }
+            }
+        }
+    }
+
+    if (ring->error != 0) {
+        errno = ring->error;
+        rc = -1;
+    }
+
+    /* The buffers can't be released before the kernel is done with them */
+    ring->error = 0;
+    uring_cancel(ring, 0, -1, IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL);
+    while (ring->nb_pending > 0 && ring->error == 0) {
+        if (uring_enter(ring, ring->to_submit, 1) < 0 && errno != EINTR && errno != EBUSY) {
+            break;
+        }
+        uring_reap(ring, NULL);
+    }
+
+    while (server->connections != NULL) {
+        _modbus_server_remove_connection(server, server->connections);
+    }
+    server->accepting = TRUE;
+    server->stop_requested = FALSE;
+
+    uring_free(ring);
+
+    return rc;
+}
+
+#endif /* USE_URING */
@@ -0,0 +1,765 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Event-driven TCP server: the connections are non-blocking and handled by a
+ * single loop waiting for readiness events (epoll when available, poll
+ * otherwise) so the number of connections isn't limited by FD_SETSIZE and the
+ * cost of a wakeup doesn't depend on the number of idle connections. The
+ * io_uring engine is implemented in modbus-server-uring.c.
+ */
+
+// clang-format off
+#if defined(_WIN32)
+# define OS_WIN32
+/* WSAPoll is available since Windows Vista */
+# ifndef _WIN32_WINNT
+#   define _WIN32_WINNT 0x0600
+# endif
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+#include <sys/types.h>
+
+#if defined(_WIN32)
+# include <winsock2.h>
+# include <ws2tcpip.h>
+# define close closesocket
+#else
+# include <fcntl.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# if defined(HAVE_SYS_EPOLL_H)
+#  define USE_EPOLL
+#  include <sys/epoll.h>
+# else
+#  include <poll.h>
+# endif
+#endif
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+// clang-format on
+
+#include "modbus-server-private.h"
+#include "modbus-tcp-private.h"
+#include "modbus-tcp.h"
+
+#ifdef OS_WIN32
+/* No wakeup descriptor, the stop request is checked at this interval (ms) */
+#define _MODBUS_SERVER_POLL_INTERVAL 100
+#endif
+
+static int _server_would_block(void)
+{
+#ifdef OS_WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+static int _server_set_nonblocking(int s)
+{
+#ifdef OS_WIN32
+    u_long option = 1;
+
+    return (ioctlsocket(s, FIONBIO, &option) == 0) ? 0 : -1;
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+
+    if (flags == -1) {
+        return -1;
+    }
+    return fcntl(s, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+/* Backend send of the server context */
+static ssize_t _server_send(modbus_t *ctx, const uint8_t *req, int req_length)
+{
+    modbus_server_t *server = ctx->backend_data;
+    modbus_server_conn_t *conn = server->current;
+
+    if (conn->tx_end + req_length > _MODBUS_SERVER_TX_LENGTH) {
+        memmove(conn->tx_buffer,
+                conn->tx_buffer + conn->tx_start,
+                conn->tx_end - conn->tx_start);
+        conn->tx_end -= conn->tx_start;
+        conn->tx_start = 0;
+    }
+
+    if (conn->tx_end + req_length > _MODBUS_SERVER_TX_LENGTH) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    memcpy(conn->tx_buffer + conn->tx_end, req, req_length);
+    conn->tx_end += req_length;
+
+    return req_length;
+}
+
+static ssize_t _server_send_parts(modbus_t *ctx, const msg_part_t *parts, int nb_parts)
+{
+    ssize_t length = 0;
+    int i;
+
+    for (i = 0; i < nb_parts; i++) {
+        if (_server_send(ctx, parts[i].data, parts[i].length) == -1) {
+            return -1;
+        }
+        length += parts[i].length;
+    }
+
+    return length;
+}
+
+/* Backend flush of the server context, drops the requests received after the
+   current one */
+static int _server_flush(modbus_t *ctx)
+{
+    modbus_server_t *server = ctx->backend_data;
+    modbus_server_conn_t *conn = server->current;
+    int rc = conn->rx_end - conn->rx_start;
+
+    conn->rx_start = conn->rx_end = 0;
+
+    return rc;
+}
+
+modbus_server_t *modbus_server_new(modbus_t *ctx, modbus_mapping_t *mb_mapping)
+{
+    modbus_server_t *server;
+
+    /* The mapping can be NULL when the context has a mapping per unit */
+    if (ctx == NULL || (mb_mapping == NULL && ctx->units == NULL) ||
+        ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_TCP) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    server = (modbus_server_t *) malloc(sizeof(modbus_server_t));
+    if (server == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(server, 0, sizeof(modbus_server_t));
+
+    /* The settings (debug, slave, etc) of the context are used for all the
+       connections */
+    server->ctx = *ctx;
+    server->ctx.async = NULL;
+    server->backend = *ctx->backend;
+    server->backend.send = _server_send;
+    server->backend.send_parts = _server_send_parts;
+    server->backend.flush = _server_flush;
+    server->ctx.backend = &server->backend;
+    server->ctx.backend_data = server;
+    server->ctx.s = -1;
+    server->ctx.error_recovery = MODBUS_ERROR_RECOVERY_NONE;
+    /* modbus_reply waits for the response timeout before a flush, the other
+       connections must not be delayed */
+    server->ctx.response_timeout.tv_sec = 0;
+    server->ctx.response_timeout.tv_usec = 0;
+    _modbus_reset_rx(&server->ctx);
+
+    server->mb_mapping = mb_mapping;
+    server->engine = MODBUS_SERVER_ENGINE_POLL;
+    server->s = -1;
+    server->accepting = TRUE;
+
+#ifndef OS_WIN32
+    if (pipe(server->wakeup) == -1) {
+        free(server);
+        return NULL;
+    }
+    _server_set_nonblocking(server->wakeup[0]);
+    _server_set_nonblocking(server->wakeup[1]);
+    fcntl(server->wakeup[0], F_SETFD, FD_CLOEXEC);
+    fcntl(server->wakeup[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+#ifdef USE_EPOLL
+    {
+        struct epoll_event event;
+
+        server->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (server->epfd == -1) {
+            close(server->wakeup[0]);
+            close(server->wakeup[1]);
+            free(server);
+            return NULL;
+        }
+
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = server->wakeup;
+        if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->wakeup[0], &event) == -1) {
+            /* modbus_server_stop couldn't interrupt the wait */
+            int saved_errno = errno;
+
+            close(server->epfd);
+            close(server->wakeup[0]);
+            close(server->wakeup[1]);
+            free(server);
+            errno = saved_errno;
+            return NULL;
+        }
+    }
+#endif
+
+    return server;
+}
+
+/* Sets the listening socket (see modbus_tcp_listen) whose connections are
+   served, the socket is still owned by the caller. */
+int modbus_server_set_listen_socket(modbus_server_t *server, int s)
+{
+    if (server == NULL || s < 0 || server->s != -1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (_server_set_nonblocking(s) == -1) {
+        return -1;
+    }
+
+#ifdef USE_EPOLL
+    {
+        struct epoll_event event;
+
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = server;
+        if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, s, &event) == -1) {
+            return -1;
+        }
+    }
+#endif
+
+    server->s = s;
+
+    return 0;
+}
+
+/* Selects the engine waiting for the events of the connections, returns -1
+   and sets errno to ENOSYS if the engine isn't supported by the library or
+   the kernel (the current engine is kept). */
+int modbus_server_set_engine(modbus_server_t *server, modbus_server_engine_t engine)
+{
+    if (server == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (engine) {
+    case MODBUS_SERVER_ENGINE_POLL:
+        break;
+    case MODBUS_SERVER_ENGINE_URING:
+#ifdef USE_URING
+        if (!_modbus_server_uring_supported()) {
+            errno = ENOSYS;
+            return -1;
+        }
+        break;
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+
+    server->engine = engine;
+
+    return 0;
+}
+
+/* Sets the functions protecting the mapping when it's served by several servers
+   running in different threads (e.g. one per SO_REUSEPORT listening socket, see
+   modbus_tcp_set_reuse_port). */
+void modbus_server_set_lock(modbus_server_t *server,
+                            modbus_server_lock_t lock,
+                            modbus_server_lock_t unlock,
+                            void *user_data)
+{
+    if (server == NULL) {
+        return;
+    }
+
+    if (lock == NULL || unlock == NULL) {
+        lock = unlock = NULL;
+    }
+    server->lock = lock;
+    server->unlock = unlock;
+    server->lock_data = user_data;
+}
+
+/* Allocates the connection of an accepted socket, returns NULL if the socket
+   can't be used (closed by the caller) */
+modbus_server_conn_t *_modbus_server_add_connection(modbus_server_t *server, int s)
+{
+    modbus_server_conn_t *conn;
+
+    /* Pipelined responses must not wait for the ACK of the previous one */
+    if (_modbus_tcp_set_nodelay(s) == -1) {
+        if (server->ctx.debug) {
+            fprintf(stderr, "ERROR TCP_NODELAY on socket %d: %s\n", s, strerror(errno));
+        }
+        return NULL;
+    }
+
+    conn = (modbus_server_conn_t *) malloc(sizeof(modbus_server_conn_t));
+    if (conn == NULL) {
+        return NULL;
+    }
+    conn->s = s;
+    conn->rx_start = conn->rx_end = 0;
+    conn->tx_start = conn->tx_end = 0;
+    conn->sending = FALSE;
+
+    conn->prev = NULL;
+    conn->next = server->connections;
+    if (conn->next != NULL) {
+        conn->next->prev = conn;
+    }
+    server->connections = conn;
+    server->nb_connections++;
+
+    if (server->ctx.debug) {
+        printf("New connection on socket %d\n", s);
+    }
+
+    return conn;
+}
+
+/* Closes the socket of the connection and frees it */
+void _modbus_server_remove_connection(modbus_server_t *server, modbus_server_conn_t *conn)
+{
+    if (server->ctx.debug) {
+        printf("Connection closed on socket %d\n", conn->s);
+    }
+
+    /* Also removes the socket from the epoll set */
+    close(conn->s);
+
+    if (conn->prev != NULL) {
+        conn->prev->next = conn->next;
+    } else {
+        server->connections = conn->next;
+    }
+    if (conn->next != NULL) {
+        conn->next->prev = conn->prev;
+    }
+    server->nb_connections--;
+    free(conn);
+}
+
+static void _server_close_connection(modbus_server_t *server, modbus_server_conn_t *conn)
+{
+    _modbus_server_remove_connection(server, conn);
+
+    if (!server->accepting) {
+        /* A file descriptor is available again */
+#ifdef USE_EPOLL
+        struct epoll_event event;
+
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = server;
+        epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->s, &event);
+#endif
+        server->accepting = TRUE;
+    }
+}
+
+static void _server_accept(modbus_server_t *server)
+{
+    for (;;) {
+        modbus_server_conn_t *conn;
+        struct sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+        int s;
+
+#ifdef HAVE_ACCEPT4
+        s = accept4(
+            server->s, (struct sockaddr *) &addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        s = accept(server->s, (struct sockaddr *) &addr, &addrlen);
+#endif
+        if (s < 0) {
+            if (errno == EMFILE || errno == ENFILE) {
+                /* Stops polling the listening socket until a connection is
+                 * closed, it would be reported as ready forever */
+                if (server->ctx.debug) {
+                    fprintf(stderr, "ERROR accept: %s\n", modbus_strerror(errno));
+                }
+#ifdef USE_EPOLL
+                epoll_ctl(server->epfd, EPOLL_CTL_DEL, server->s, NULL);
+#endif
+                server->accepting = FALSE;
+            }
+            return;
+        }
+
+#ifndef HAVE_ACCEPT4
+        if (_server_set_nonblocking(s) == -1) {
+            close(s);
+            continue;
+        }
+#endif
+
+        conn = _modbus_server_add_connection(server, s);
+        if (conn == NULL) {
+            close(s);
+            continue;
+        }
+
+#ifdef USE_EPOLL
+        {
+            struct epoll_event event;
+
+            /* Edge-triggered, the connection is always read or written until
+             * the operation would block */
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            event.data.ptr = conn;
+            if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, s, &event) == -1) {
+                _modbus_server_remove_connection(server, conn);
+                continue;
+            }
+        }
+#endif
+    }
+}
+
+/* Replies to the complete requests of the connection while the transmit
+   buffer has room for a response. Returns 1 when requests are left because the
+   transmit buffer is full, 0 when more bytes are needed and -1 on invalid
+   request. */
+int _modbus_server_reply(modbus_server_t *server, modbus_server_conn_t *conn)
+{
+    modbus_t *ctx = &server->ctx;
+
+    server->current = conn;
+
+    for (;;) {
+        uint8_t *req = conn->rx_buffer + conn->rx_start;
+        int available = conn->rx_end - conn->rx_start;
+        int length;
+        int i;
+
+        if (available == 0) {
+            conn->rx_start = conn->rx_end = 0;
+            return 0;
+        }
+
+        length = _modbus_compute_msg_length(ctx, req, available, MSG_INDICATION);
+        if (length == -1) {
+            if (ctx->debug) {
+                fprintf(stderr, "ERROR invalid message length on socket %d\n", conn->s);
+            }
+            return -1;
+        }
+
+        if (length > available) {
+            /* Keeps room for the end of the request */
+            if (conn->rx_start > 0) {
+                memmove(conn->rx_buffer, req, available);
+                conn->rx_start = 0;
+                conn->rx_end = available;
+            }
+            return 0;
+        }
+
+        /* The responses being sent can't be moved to make room */
+        if ((conn->sending ? conn->tx_end : conn->tx_end - conn->tx_start) +
+                MODBUS_TCP_MAX_ADU_LENGTH >
+            _MODBUS_SERVER_TX_LENGTH) {
+            return 1;
+        }
+
+        if (ctx->debug) {
+            for (i = 0; i < length; i++)
+                printf("<%.2X>", req[i]);
+            printf("\n");
+        }
+
+        conn->rx_start += length;
+        /* The request is still in the buffer if the reply flushes the
+         * connection */
+        if (server->lock != NULL) {
+            /* Only the read functions leave the mapping unchanged */
+            int exclusive = (req[ctx->backend->header_length] >
+                             MODBUS_FC_READ_INPUT_REGISTERS);
+
+            server->lock(server->lock_data, exclusive);
+            modbus_reply(ctx, req, length, server->mb_mapping);
+            server->unlock(server->lock_data, exclusive);
+        } else {
+            modbus_reply(ctx, req, length, server->mb_mapping);
+        }
+    }
+}
+
+/* Sends the buffered responses, returns 1 when all have been sent, 0 if the
+   socket isn't writable anymore and -1 on error. */
+static int _server_send_responses(modbus_server_conn_t *conn)
+{
+    while (conn->tx_start < conn->tx_end) {
+        ssize_t rc = send(conn->s,
+                          (const char *) conn->tx_buffer + conn->tx_start,
+                          conn->tx_end - conn->tx_start,
+                          MSG_NOSIGNAL);
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return _server_would_block() ? 0 : -1;
+        }
+        conn->tx_start += rc;
+    }
+
+    conn->tx_start = conn->tx_end = 0;
+
+    return 1;
+}
+
+/* Handles the connection until it would block, returns -1 when the connection
+   must be closed. */
+static int _server_process(modbus_server_t *server, modbus_server_conn_t *conn)
+{
+    for (;;) {
+        int pending;
+        ssize_t rc;
+
+        pending = _modbus_server_reply(server, conn);
+        if (pending == -1) {
+            return -1;
+        }
+
+        rc = _server_send_responses(conn);
+        if (rc != 1) {
+            /* Resumed when the socket is writable */
+            return rc;
+        }
+
+        if (pending) {
+            continue;
+        }
+
+        rc = recv(conn->s,
+                  (char *) conn->rx_buffer + conn->rx_end,
+                  _MODBUS_SERVER_RX_LENGTH - conn->rx_end,
+                  0);
+        if (rc == 0) {
+            /* Connection closed by the client */
+            return -1;
+        }
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return _server_would_block() ? 0 : -1;
+        }
+        conn->rx_end += rc;
+    }
+}
+
+/* Serves the connections of the listening socket until modbus_server_stop is
+   called. Returns 0 when stopped or -1 if waiting for events fails. */
+int modbus_server_run(modbus_server_t *server)
+{
+#ifdef USE_EPOLL
+    struct epoll_event events[_MODBUS_SERVER_MAX_EVENTS];
+#else
+    struct pollfd *fds = NULL;
+    modbus_server_conn_t **conns = NULL;
+    int nb_allocated = 0;
+#endif
+    int rc = 0;
+
+    if (server == NULL || server->s == -1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#ifdef USE_URING
+    if (server->engine == MODBUS_SERVER_ENGINE_URING) {
+        return _modbus_server_run_uring(server);
+    }
+#endif
+
+    while (!server->stop_requested) {
+        int nfds;
+        int i;
+
+#ifdef USE_EPOLL
+        nfds = epoll_wait(server->epfd, events, _MODBUS_SERVER_MAX_EVENTS, -1);
+        if (nfds == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            rc = -1;
+            break;
+        }
+
+        for (i = 0; i < nfds; i++) {
+            void *ptr = events[i].data.ptr;
+
+            if (ptr == server) {
+                _server_accept(server);
+            } else if (ptr == server->wakeup) {
+                char buf[16];
+
+                while (read(server->wakeup[0], buf, sizeof(buf)) > 0) {
+                }
+            } else if (_server_process(server, ptr) == -1) {
+                _server_close_connection(server, ptr);
+            }
+        }
+#else
+        {
+            modbus_server_conn_t *conn;
+            int n = 0;
+
+            /* Listening socket, wakeup descriptor and connections */
+            if (nb_allocated < server->nb_connections + 2) {
+                nb_allocated = server->nb_connections + 2 + 64;
+                free(fds);
+                free(conns);
+                fds = (struct pollfd *) malloc(nb_allocated * sizeof(struct pollfd));
+                conns = (modbus_server_conn_t **) malloc(nb_allocated *
+                                                         sizeof(modbus_server_conn_t *));
+                if (fds == NULL || conns == NULL) {
+                    errno = ENOMEM;
+                    rc = -1;
+                    break;
+                }
+            }
+
+            if (server->accepting) {
+                fds[n].fd = server->s;
+                fds[n].events = POLLIN;
+                conns[n++] = NULL;
+            }
+#ifndef OS_WIN32
+            fds[n].fd = server->wakeup[0];
+            fds[n].events = POLLIN;
+            conns[n++] = NULL;
+#endif
+            for (conn = server->connections; conn != NULL; conn = conn->next) {
+                fds[n].fd = conn->s;
+                /* Only waits for writability when responses are pending */
+                fds[n].events = (conn->tx_start < conn->tx_end) ? POLLOUT : POLLIN;
+                conns[n++] = conn;
+            }
+
+#ifdef OS_WIN32
+            nfds = WSAPoll(fds, n, _MODBUS_SERVER_POLL_INTERVAL);
+#else
+            nfds = poll(fds, n, -1);
+#endif
+            if (nfds == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                rc = -1;
+                break;
+            }
+
+            for (i = 0; i < n && nfds > 0; i++) {
+                if (fds[i].revents == 0) {
+                    continue;
+                }
+                nfds--;
+
+                if (conns[i] != NULL) {
+                    if (_server_process(server, conns[i]) == -1) {
+                        _server_close_connection(server, conns[i]);
+                    }
+                } else if (fds[i].fd == server->s) {
+                    _server_accept(server);
+                }
+#ifndef OS_WIN32
+                else {
+                    char buf[16];
+
+                    while (read(server->wakeup[0], buf, sizeof(buf)) > 0) {
+                    }
+                }
+#endif
+            }
+        }
+#endif
+    }
+
+#ifndef USE_EPOLL
+    free(fds);
+    free(conns);
+#endif
+
+    server->stop_requested = FALSE;
+
+    return rc;
+}
+
+/* Requests modbus_server_run to return, can be called from a signal handler or
+   another thread. */
+void modbus_server_stop(modbus_server_t *server)
+{
+    if (server == NULL) {
+        return;
+    }
+
+    server->stop_requested = TRUE;
+#ifndef OS_WIN32
+    {
+        char c = 0;
+        ssize_t rc = write(server->wakeup[1], &c, 1);
+
+        (void) rc;
+    }
+#endif
+}
+
+int modbus_server_get_nb_connections(modbus_server_t *server)
+{
+    if (server == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return server->nb_connections;
+}
+
+/* Closes the connections, the listening socket is left open */
+void modbus_server_free(modbus_server_t *server)
+{
+    if (server == NULL) {
+        return;
+    }
+
+    while (server->connections != NULL) {
+        _server_close_connection(server, server->connections);
+    }
+
+#ifdef USE_EPOLL
+    close(server->epfd);
+#endif
+#ifndef OS_WIN32
+    close(server->wakeup[0]);
+    close(server->wakeup[1]);
+#endif
+    free(server);
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_SERVER_H
+#define MODBUS_SERVER_H
+
+#include "modbus.h"
+
+MODBUS_BEGIN_DECLS
+
+/* Event-driven TCP server serving a mapping to many connections */
+typedef struct _modbus_server modbus_server_t;
+
+typedef enum {
+    /* Readiness events: epoll when available, poll otherwise */
+    MODBUS_SERVER_ENGINE_POLL = 0,
+    /* io_uring completions (Linux >= 6.0) */
+    MODBUS_SERVER_ENGINE_URING
+} modbus_server_engine_t;
+
+/* Called before and after the mapping is accessed by a request, exclusive is
+   TRUE when the request can modify the mapping */
+typedef void (*modbus_server_lock_t)(void *user_data, int exclusive);
+
+MODBUS_API modbus_server_t *modbus_server_new(modbus_t *ctx, modbus_mapping_t *mb_mapping);
+MODBUS_API int modbus_server_set_listen_socket(modbus_server_t *server, int s);
+MODBUS_API int modbus_server_set_engine(modbus_server_t *server,
+                                        modbus_server_engine_t engine);
+MODBUS_API void modbus_server_set_lock(modbus_server_t *server,
+                                       modbus_server_lock_t lock,
+                                       modbus_server_lock_t unlock,
+                                       void *user_data);
+MODBUS_API int modbus_server_run(modbus_server_t *server);
+MODBUS_API void modbus_server_stop(modbus_server_t *server);
+MODBUS_API int modbus_server_get_nb_connections(modbus_server_t *server);
+MODBUS_API void modbus_server_free(modbus_server_t *server);
+
+MODBUS_END_DECLS
+
+#endif /* MODBUS_SERVER_H */
@@ -0,0 +1,48 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_SHM_PRIVATE_H
+#define MODBUS_SHM_PRIVATE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "modbus.h"
+
+struct _modbus_shm {
+    modbus_shm_header_t *header;
+    /* Name of the region created by the mapping, unlinked on close if it
+       still designates the region (dev and ino). NULL when the region was
+       opened. */
+    char *name;
+    dev_t dev;
+    ino_t ino;
+};
+
+/* Creates the region with zeroed tables and the permissions mode, fails with
+   EEXIST if a region of the same name exists unless replace is set. */
+struct _modbus_shm *_modbus_shm_create(const char *name,
+                                       unsigned int mode,
+                                       int replace,
+                                       const unsigned int start[4],
+                                       const unsigned int nb[4]);
+/* Maps the region created by another process, fails with EINVAL when the
+   header isn't valid */
+struct _modbus_shm *_modbus_shm_open(const char *name);
+void _modbus_shm_close(struct _modbus_shm *shm);
+void *_modbus_shm_table(const struct _modbus_shm *shm, modbus_table_t table);
+
+/* Fail with ETIMEDOUT when a writer holds the table for too long */
+int _modbus_shm_write_begin(struct _modbus_shm *shm, modbus_table_t table);
+void _modbus_shm_write_end(struct _modbus_shm *shm, modbus_table_t table);
+int _modbus_shm_read_begin(const struct _modbus_shm *shm,
+                           modbus_table_t table,
+                           uint32_t *generation);
+int _modbus_shm_read_retry(const struct _modbus_shm *shm,
+                           modbus_table_t table,
+                           uint32_t generation);
+
+#endif /* MODBUS_SHM_PRIVATE_H */
@@ -0,0 +1,364 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Storage of the shared memory mappings (MODBUS_MAPPING_SHM): the tables live
+ * in a POSIX shared memory object so processes other than the server update
+ * and read the values with plain memory accesses. Each table is protected by
+ * a sequence lock, its generation counter in the header of the region. A
+ * process dying in the middle of a write leaves the generation odd, the other
+ * writers and the readers give up after _MODBUS_SHM_TIMEOUT.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(HAVE_SYS_MMAN_H)
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "modbus-private.h"
+#include "modbus-shm-private.h"
+
+#if defined(HAVE_SYS_MMAN_H)
+
+/* The tables are aligned on cache lines */
+#define _MODBUS_SHM_ALIGN 64
+
+/* Time (us) a table can stay locked by a writer before the other writers and
+   the readers fail, far longer than the copy of the values of a request */
+#define _MODBUS_SHM_TIMEOUT 500000
+
+static size_t value_size(modbus_table_t table)
+{
+    return (table == MODBUS_TABLE_BITS || table == MODBUS_TABLE_INPUT_BITS)
+               ? sizeof(uint8_t)
+               : sizeof(uint16_t);
+}
+
+static size_t align(size_t size)
+{
+    return (size + _MODBUS_SHM_ALIGN - 1) & ~((size_t) _MODBUS_SHM_ALIGN - 1);
+}
+
+static struct _modbus_shm *shm_map(int fd, size_t size, const char *name)
+{
+    struct _modbus_shm *shm;
+    void *addr;
+
+    shm = (struct _modbus_shm *) calloc(1, sizeof(struct _modbus_shm));
+    if (shm == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (name != NULL) {
+        shm->name = strdup(name);
+        if (shm->name == NULL) {
+            free(shm);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        free(shm->name);
+        free(shm);
+        return NULL;
+    }
+    shm->header = (modbus_shm_header_t *) addr;
+
+    return shm;
+}
+
+struct _modbus_shm *_modbus_shm_create(const char *name,
+                                       unsigned int mode,
+                                       int replace,
+                                       const unsigned int start[4],
+                                       const unsigned int nb[4])
+{
+    struct _modbus_shm *shm;
+    modbus_shm_header_t *header;
+    struct stat st;
+    size_t offsets[4];
+    size_t size;
+    int table;
+    int fd;
+
+    size = align(sizeof(modbus_shm_header_t));
+    for (table = 0; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+        offsets[table] = size;
+        size += align(nb[table] * value_size(table));
+    }
+
+    /* The processes still mapping a previous region keep it until they open
+       the new one */
+    if (replace && shm_unlink(name) == -1 && errno != ENOENT) {
+        return NULL;
+    }
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, (mode_t) mode);
+    if (fd == -1) {
+        return NULL;
+    }
+    /* The object is filled with zeros */
+    if (ftruncate(fd, size) == -1 || fstat(fd, &st) == -1) {
+        int saved_errno = errno;
+
+        close(fd);
+        shm_unlink(name);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    shm = shm_map(fd, size, name);
+    close(fd);
+    if (shm == NULL) {
+        int saved_errno = errno;
+
+        shm_unlink(name);
+        errno = saved_errno;
+        return NULL;
+    }
+    shm->dev = st.st_dev;
+    shm->ino = st.st_ino;
+
+    header = shm->header;
+    header->version = MODBUS_SHM_VERSION;
+    header->size = size;
+    for (table = 0; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+        header->tables[table].start = start[table];
+        header->tables[table].nb = nb[table];
+        header->tables[table].offset = offsets[table];
+    }
+    /* Last, a process opening the region sees a complete header */
+    __atomic_store_n(&header->magic, MODBUS_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return shm;
+}
+
+struct _modbus_shm *_modbus_shm_open(const char *name)
+{
+    struct _modbus_shm *shm;
+    const modbus_shm_header_t *header;
+    struct stat st;
+    int table;
+    int fd;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == -1) {
+        int saved_errno = errno;
+
+        close(fd);
+        errno = saved_errno;
+        return NULL;
+    }
+    if ((size_t) st.st_size < sizeof(modbus_shm_header_t)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    shm = shm_map(fd, st.st_size, NULL);
+    close(fd);
+    if (shm == NULL) {
+        return NULL;
+    }
+
+    header = shm->header;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != MODBUS_SHM_MAGIC ||
+        header->version != MODBUS_SHM_VERSION || (off_t) header->size != st.st_size) {
+        _modbus_shm_close(shm);
+        errno = EINVAL;
+        return NULL;
+    }
+    for (table = 0; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+        const modbus_shm_table_t *t = &header->tables[table];
+
+        if (t->nb > 65536 || t->start + t->nb > 65536 || t->offset > header->size ||
+            t->nb * value_size(table) > header->size - t->offset) {
+            _modbus_shm_close(shm);
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    return shm;
+}
+
+void _modbus_shm_close(struct _modbus_shm *shm)
+{
+    if (shm == NULL) {
+        return;
+    }
+
+    munmap(shm->header, shm->header->size);
+    if (shm->name != NULL) {
+        /* The name may have been given to a new region replacing this one */
+        int fd = shm_open(shm->name, O_RDONLY, 0);
+
+        if (fd != -1) {
+            struct stat st;
+
+            if (fstat(fd, &st) == 0 && st.st_dev == shm->dev && st.st_ino == shm->ino) {
+                shm_unlink(shm->name);
+            }
+            close(fd);
+        }
+        free(shm->name);
+    }
+    free(shm);
+}
+
+void *_modbus_shm_table(const struct _modbus_shm *shm, modbus_table_t table)
+{
+    if (shm->header->tables[table].nb == 0) {
+        return NULL;
+    }
+
+    return (uint8_t *) shm->header + shm->header->tables[table].offset;
+}
+
+/* Waits for the end of the write in progress, returns FALSE when the table is
+   still written after _MODBUS_SHM_TIMEOUT (the writer is probably dead). The
+   deadline is only computed once the table is found locked. */
+static int wait_unlocked(int64_t *deadline)
+{
+    if (*deadline == 0) {
+        *deadline = _modbus_get_time_us() + _MODBUS_SHM_TIMEOUT;
+    } else if (_modbus_get_time_us() >= *deadline) {
+        return FALSE;
+    }
+    sched_yield();
+
+    return TRUE;
+}
+
+/* The writers of a table, in any process, are serialized by switching the
+   generation from even to odd */
+int _modbus_shm_write_begin(struct _modbus_shm *shm, modbus_table_t table)
+{
+    uint32_t *generation = &shm->header->tables[table].generation;
+    int64_t deadline = 0;
+    uint32_t value;
+
+    for (;;) {
+        value = __atomic_load_n(generation, __ATOMIC_RELAXED);
+        if (!(value & 1) && __atomic_compare_exchange_n(generation,
+                                                        &value,
+                                                        value + 1,
+                                                        FALSE,
+                                                        __ATOMIC_ACQUIRE,
+                                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+        if (!wait_unlocked(&deadline)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+    /* The odd generation is visible before the values */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void _modbus_shm_write_end(struct _modbus_shm *shm, modbus_table_t table)
+{
+    uint32_t *generation = &shm->header->tables[table].generation;
+
+    __atomic_store_n(
+        generation, __atomic_load_n(generation, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+int _modbus_shm_read_begin(const struct _modbus_shm *shm,
+                           modbus_table_t table,
+                           uint32_t *generation)
+{
+    int64_t deadline = 0;
+
+    for (;;) {
+        *generation =
+            __atomic_load_n(&shm->header->tables[table].generation, __ATOMIC_ACQUIRE);
+        if (!(*generation & 1)) {
+            return 0;
+        }
+        if (!wait_unlocked(&deadline)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+}
+
+int _modbus_shm_read_retry(const struct _modbus_shm *shm,
+                           modbus_table_t table,
+                           uint32_t generation)
+{
+    /* The values are read before the generation is checked again */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return (generation & 1) ||
+           __atomic_load_n(&shm->header->tables[table].generation, __ATOMIC_RELAXED) !=
+               generation;
+}
+
+#else
+
+struct _modbus_shm *_modbus_shm_create(const char *name,
+                                       unsigned int mode,
+                                       int replace,
+                                       const unsigned int start[4],
+                                       const unsigned int nb[4])
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+struct _modbus_shm *_modbus_shm_open(const char *name)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+void _modbus_shm_close(struct _modbus_shm *shm)
+{
+}
+
+void *_modbus_shm_table(const struct _modbus_shm *shm, modbus_table_t table)
+{
+    return NULL;
+}
+
+int _modbus_shm_write_begin(struct _modbus_shm *shm, modbus_table_t table)
+{
+    return 0;
+}
+
+void _modbus_shm_write_end(struct _modbus_shm *shm, modbus_table_t table)
+{
+}
+
+int _modbus_shm_read_begin(const struct _modbus_shm *shm,
+                           modbus_table_t table,
+                           uint32_t *generation)
+{
+    *generation = 0;
+    return 0;
+}
+
+int _modbus_shm_read_retry(const struct _modbus_shm *shm,
+                           modbus_table_t table,
+                           uint32_t generation)
+{
+    return FALSE;
+}
+
+#endif
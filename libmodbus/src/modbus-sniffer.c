@@ -0,0 +1,490 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Bus sniffer: the bytes received on a RTU line are decoded as a stream. A
+ * frame is recognized by its length, deduced from the function code as for a
+ * received message, and its CRC. After a request, a response of the same slave
+ * and function is expected. When the bytes don't start a valid frame (sniffer
+ * started in the middle of a frame, noise), they are discarded one by one until
+ * a frame is found. A frame of unknown function following a frame is delimited
+ * by the silence of the line.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modbus-crc-private.h"
+#include "modbus-private.h"
+#include "modbus-sniffer.h"
+
+/* Enough for the discarded bytes and a frame */
+#define SNIFFER_BUFFER_LENGTH (3 * MODBUS_RTU_MAX_ADU_LENGTH)
+
+#define SNIFFER_MAX_SLAVE 247
+
+struct _modbus_sniffer {
+    modbus_t *ctx;
+    uint8_t buffer[SNIFFER_BUFFER_LENGTH];
+    int length;
+    /* Number of bytes at the beginning of the buffer which don't start a frame */
+    int garbage;
+    /* Reception time of the last byte */
+    uint64_t time;
+    /* Request waiting for its response */
+    int pending;
+    int pending_slave;
+    int pending_function;
+    uint64_t pending_time;
+    modbus_sniffer_frame_cb frame_cb;
+    void *user_data;
+    volatile int stop_requested;
+    modbus_sniffer_stats_t stats;
+    modbus_sniffer_slave_stats_t slaves[SNIFFER_MAX_SLAVE + 1];
+};
+
+static void reset_slave_stats(modbus_sniffer_slave_stats_t *stats)
+{
+    memset(stats, 0, sizeof(modbus_sniffer_slave_stats_t));
+    stats->min_response_time_us = UINT32_MAX;
+}
+
+/* Functions whose frame length is known */
+static int is_known_function(int function)
+{
+    switch (function) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+    case MODBUS_FC_WRITE_SINGLE_REGISTER:
+    case MODBUS_FC_READ_EXCEPTION_STATUS:
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+    case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+    case MODBUS_FC_REPORT_SLAVE_ID:
+    case MODBUS_FC_MASK_WRITE_REGISTER:
+    case MODBUS_FC_WRITE_AND_READ_REGISTERS:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static int check_crc(const uint8_t *msg, int length)
+{
+    uint16_t crc = _modbus_crc16_update(0xFFFF, msg, length - 2);
+
+    return msg[length - 2] == (crc & 0xFF) && msg[length - 1] == (crc >> 8);
+}
+
+/* Returns the length of the frame at msg, 0 if more bytes are needed or -1 if
+   the bytes don't start such a frame */
+static int match_frame(modbus_sniffer_t *sniffer,
+                       const uint8_t *msg,
+                       int available,
+                       msg_type_t msg_type)
+{
+    int length;
+
+    if (msg_type == MSG_CONFIRMATION) {
+        if (msg[0] != sniffer->pending_slave) {
+            return -1;
+        }
+        if (available < 2) {
+            return 0;
+        }
+        if ((msg[1] & 0x7F) != sniffer->pending_function) {
+            return -1;
+        }
+    } else if (msg[0] > SNIFFER_MAX_SLAVE) {
+        return -1;
+    }
+
+    length = _modbus_compute_msg_length(sniffer->ctx, msg, available, msg_type);
+    if (length == -1) {
+        return -1;
+    }
+    if (length > available) {
+        return 0;
+    }
+
+    return check_crc(msg, length) ? length : -1;
+}
+
+static void report(modbus_sniffer_t *sniffer,
+                   int type,
+                   const uint8_t *msg,
+                   int length,
+                   uint32_t response_time)
+{
+    modbus_sniffed_frame_t frame;
+
+    if (sniffer->frame_cb == NULL) {
+        return;
+    }
+
+    frame.type = type;
+    frame.slave = (type == MODBUS_SNIFFER_GARBAGE) ? -1 : msg[0];
+    frame.function = (type == MODBUS_SNIFFER_GARBAGE) ? -1 : msg[1];
+    frame.data = msg;
+    frame.length = length;
+    frame.time_us = sniffer->time;
+    frame.response_time_us = response_time;
+    sniffer->frame_cb(sniffer, &frame, sniffer->user_data);
+}
+
+static void consume(modbus_sniffer_t *sniffer, int length)
+{
+    sniffer->length -= length;
+    memmove(sniffer->buffer, sniffer->buffer + length, sniffer->length);
+}
+
+static void drop_garbage(modbus_sniffer_t *sniffer)
+{
+    if (sniffer->garbage == 0) {
+        return;
+    }
+
+    sniffer->stats.nb_garbage_bytes += sniffer->garbage;
+    report(sniffer, MODBUS_SNIFFER_GARBAGE, sniffer->buffer, sniffer->garbage, 0);
+    consume(sniffer, sniffer->garbage);
+    sniffer->garbage = 0;
+}
+
+/* The pending request won't get a response */
+static void expire_request(modbus_sniffer_t *sniffer)
+{
+    if (sniffer->pending) {
+        sniffer->slaves[sniffer->pending_slave].nb_timeouts++;
+        sniffer->pending = FALSE;
+    }
+}
+
+static void take_frame(modbus_sniffer_t *sniffer, int type, int length)
+{
+    const uint8_t *msg;
+    uint32_t response_time = 0;
+
+    drop_garbage(sniffer);
+    msg = sniffer->buffer;
+
+    if (type == MODBUS_SNIFFER_RESPONSE) {
+        modbus_sniffer_slave_stats_t *stats = &sniffer->slaves[msg[0]];
+
+        /* The frames are timed by the reception of their last bytes */
+        response_time = (uint32_t) (sniffer->time - sniffer->pending_time);
+        stats->nb_responses++;
+        if (msg[1] & 0x80) {
+            stats->nb_exceptions++;
+        }
+        if (response_time < stats->min_response_time_us) {
+            stats->min_response_time_us = response_time;
+        }
+        if (response_time > stats->max_response_time_us) {
+            stats->max_response_time_us = response_time;
+        }
+        stats->sum_response_time_us += response_time;
+        sniffer->pending = FALSE;
+    } else {
+        expire_request(sniffer);
+        sniffer->slaves[msg[0]].nb_requests++;
+        /* No response to a broadcast */
+        if (msg[0] != MODBUS_BROADCAST_ADDRESS) {
+            sniffer->pending = TRUE;
+            sniffer->pending_slave = msg[0];
+            sniffer->pending_function = msg[1];
+            sniffer->pending_time = sniffer->time;
+        }
+    }
+
+    sniffer->stats.nb_frames++;
+    report(sniffer, type, msg, length, response_time);
+    consume(sniffer, length);
+}
+
+/* Decodes the frames of the buffer. After a silence, the remaining bytes can't
+   be completed by the next ones. Returns the number of frames. */
+static int decode(modbus_sniffer_t *sniffer, int silence)
+{
+    int nb_frames = 0;
+
+    while (sniffer->garbage < sniffer->length) {
+        const uint8_t *msg = sniffer->buffer + sniffer->garbage;
+        int available = sniffer->length - sniffer->garbage;
+        int rsp_length = -1;
+        int req_length;
+
+        if (sniffer->pending) {
+            rsp_length = match_frame(sniffer, msg, available, MSG_CONFIRMATION);
+            if (rsp_length > 0) {
+                take_frame(sniffer, MODBUS_SNIFFER_RESPONSE, rsp_length);
+                nb_frames++;
+                continue;
+            }
+        }
+
+        req_length = match_frame(sniffer, msg, available, MSG_INDICATION);
+        if (req_length > 0) {
+            take_frame(sniffer, MODBUS_SNIFFER_REQUEST, req_length);
+            nb_frames++;
+            continue;
+        }
+
+        if (silence) {
+            /* Frame of unknown function */
+            if (available >= 4 && msg[0] <= SNIFFER_MAX_SLAVE && check_crc(msg, available)) {
+                int is_response = sniffer->pending && msg[0] == sniffer->pending_slave &&
+                                  (msg[1] & 0x7F) == sniffer->pending_function;
+
+                take_frame(sniffer,
+                           is_response ? MODBUS_SNIFFER_RESPONSE : MODBUS_SNIFFER_REQUEST,
+                           available);
+                nb_frames++;
+                continue;
+            }
+        } else if (rsp_length == 0 || req_length == 0) {
+            /* Waits for the next bytes */
+            break;
+        } else if (sniffer->garbage == 0 && msg[0] <= SNIFFER_MAX_SLAVE &&
+                   available >= 2 && !is_known_function(msg[1] & 0x7F) &&
+                   available < MODBUS_RTU_MAX_ADU_LENGTH) {
+            /* After a frame, waits for the silence ending a frame of unknown
+               function */
+            break;
+        }
+
+        /* Resynchronization on the next byte */
+        sniffer->garbage++;
+        if (sniffer->garbage == MODBUS_RTU_MAX_ADU_LENGTH) {
+            drop_garbage(sniffer);
+        }
+    }
+
+    if (silence) {
+        drop_garbage(sniffer);
+    }
+
+    return nb_frames;
+}
+
+modbus_sniffer_t *modbus_sniffer_new(modbus_t *ctx)
+{
+    modbus_sniffer_t *sniffer;
+
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_RTU) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    sniffer = (modbus_sniffer_t *) calloc(1, sizeof(modbus_sniffer_t));
+    if (sniffer == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    sniffer->ctx = ctx;
+    modbus_sniffer_reset_stats(sniffer);
+
+    return sniffer;
+}
+
+void modbus_sniffer_set_frame_callback(modbus_sniffer_t *sniffer,
+                                       modbus_sniffer_frame_cb frame_cb,
+                                       void *user_data)
+{
+    if (sniffer == NULL) {
+        return;
+    }
+
+    sniffer->frame_cb = frame_cb;
+    sniffer->user_data = user_data;
+}
+
+/* Decodes the bytes received at time_us (monotonic clock) and reports the
+   complete frames. Returns the number of frames or -1. */
+int modbus_sniffer_feed(modbus_sniffer_t *sniffer,
+                        const uint8_t *data,
+                        int length,
+                        uint64_t time_us)
+{
+    int nb_frames = 0;
+
+    if (sniffer == NULL || length < 0 || (data == NULL && length > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sniffer->time = time_us;
+    sniffer->stats.nb_bytes += length;
+    while (length > 0) {
+        /* The decoding leaves less than 2 frames in the buffer */
+        int n = SNIFFER_BUFFER_LENGTH - sniffer->length;
+
+        if (n > length) {
+            n = length;
+        }
+        memcpy(sniffer->buffer + sniffer->length, data, n);
+        sniffer->length += n;
+        data += n;
+        length -= n;
+        nb_frames += decode(sniffer, FALSE);
+    }
+
+    return nb_frames;
+}
+
+/* To call when the line is silent at time_us: the remaining bytes end a frame
+   of unknown function or are discarded, and the request without response
+   after the response timeout of the context is counted as a timeout. Returns
+   the number of frames or -1. */
+int modbus_sniffer_flush(modbus_sniffer_t *sniffer, uint64_t time_us)
+{
+    uint32_t to_sec;
+    uint32_t to_usec;
+    int nb_frames;
+
+    if (sniffer == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    nb_frames = decode(sniffer, TRUE);
+
+    modbus_get_response_timeout(sniffer->ctx, &to_sec, &to_usec);
+    if (sniffer->pending &&
+        time_us - sniffer->pending_time >= (uint64_t) to_sec * 1000000 + to_usec) {
+        expire_request(sniffer);
+    }
+
+    return nb_frames;
+}
+
+/* Waits for bytes on the connected context and decodes them. The silence
+   ending a frame is the one of modbus_rtu_get_frame_silence(), it must include
+   the latency of a USB adapter. Returns the number of frames or -1. */
+int modbus_sniffer_run_once(modbus_sniffer_t *sniffer)
+{
+    uint8_t data[MODBUS_RTU_MAX_ADU_LENGTH];
+    modbus_t *ctx;
+    fd_set rset;
+    struct timeval tv;
+    int rc;
+
+    if (sniffer == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ctx = sniffer->ctx;
+    if (ctx->s < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (sniffer->length > 0) {
+        int silence = modbus_rtu_get_frame_silence(ctx);
+
+        tv.tv_sec = silence / 1000000;
+        tv.tv_usec = silence % 1000000;
+    } else {
+        tv = ctx->response_timeout;
+    }
+
+    FD_ZERO(&rset);
+    FD_SET(ctx->s, &rset);
+    rc = ctx->backend->select(ctx, &rset, &tv, MODBUS_RTU_MAX_ADU_LENGTH);
+    if (rc == -1) {
+        if (errno == ETIMEDOUT) {
+            return modbus_sniffer_flush(sniffer, _modbus_get_time_us());
+        }
+        _error_print(ctx, "select");
+        return -1;
+    }
+
+    rc = ctx->backend->recv(ctx, data, sizeof(data));
+    if (rc == 0) {
+        errno = ECONNRESET;
+        rc = -1;
+    }
+    if (rc == -1) {
+        _error_print(ctx, "read");
+        return -1;
+    }
+
+    return modbus_sniffer_feed(sniffer, data, rc, _modbus_get_time_us());
+}
+
+int modbus_sniffer_run(modbus_sniffer_t *sniffer)
+{
+    if (sniffer == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sniffer->stop_requested = FALSE;
+    while (!sniffer->stop_requested) {
+        if (modbus_sniffer_run_once(sniffer) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Can be called by the frame callback or another thread, in the latter case
+   the sniffer stops after its current wait */
+void modbus_sniffer_stop(modbus_sniffer_t *sniffer)
+{
+    if (sniffer == NULL) {
+        return;
+    }
+
+    sniffer->stop_requested = TRUE;
+}
+
+int modbus_sniffer_get_slave_stats(modbus_sniffer_t *sniffer,
+                                   int slave,
+                                   modbus_sniffer_slave_stats_t *stats)
+{
+    if (sniffer == NULL || slave < 0 || slave > SNIFFER_MAX_SLAVE || stats == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *stats = sniffer->slaves[slave];
+    if (stats->nb_responses == 0) {
+        stats->min_response_time_us = 0;
+    }
+
+    return 0;
+}
+
+void modbus_sniffer_get_stats(modbus_sniffer_t *sniffer, modbus_sniffer_stats_t *stats)
+{
+    if (sniffer == NULL || stats == NULL) {
+        return;
+    }
+
+    *stats = sniffer->stats;
+}
+
+void modbus_sniffer_reset_stats(modbus_sniffer_t *sniffer)
+{
+    int i;
+
+    if (sniffer == NULL) {
+        return;
+    }
+
+    memset(&sniffer->stats, 0, sizeof(modbus_sniffer_stats_t));
+    for (i = 0; i <= SNIFFER_MAX_SLAVE; i++) {
+        reset_slave_stats(&sniffer->slaves[i]);
+    }
+}
+
+void modbus_sniffer_free(modbus_sniffer_t *sniffer)
+{
+    free(sniffer);
+}
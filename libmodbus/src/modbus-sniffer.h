@@ -0,0 +1,83 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_SNIFFER_H
+#define MODBUS_SNIFFER_H
+
+#include "modbus.h"
+
+MODBUS_BEGIN_DECLS
+
+/* Passive monitor of a RTU line: the requests of the master and the responses
+   of the slaves are decoded from the received bytes, nothing is ever sent */
+typedef struct _modbus_sniffer modbus_sniffer_t;
+
+#define MODBUS_SNIFFER_REQUEST  0
+#define MODBUS_SNIFFER_RESPONSE 1
+/* Bytes discarded to find the start of the next frame */
+#define MODBUS_SNIFFER_GARBAGE  2
+
+typedef struct {
+    /* MODBUS_SNIFFER_* */
+    int type;
+    /* -1 for garbage */
+    int slave;
+    int function;
+    /* Whole frame with its CRC */
+    const uint8_t *data;
+    int length;
+    /* Reception time of the last byte (us) */
+    uint64_t time_us;
+    /* Delay between the end of the request and the end of its response (us),
+       0 for the other frames */
+    uint32_t response_time_us;
+} modbus_sniffed_frame_t;
+
+typedef struct {
+    uint32_t nb_requests;
+    uint32_t nb_responses;
+    /* Responses with an exception code, counted in nb_responses too */
+    uint32_t nb_exceptions;
+    /* Requests without response before the response timeout of the context */
+    uint32_t nb_timeouts;
+    uint32_t min_response_time_us;
+    uint32_t max_response_time_us;
+    uint64_t sum_response_time_us;
+} modbus_sniffer_slave_stats_t;
+
+typedef struct {
+    uint64_t nb_bytes;
+    uint32_t nb_frames;
+    uint32_t nb_garbage_bytes;
+} modbus_sniffer_stats_t;
+
+typedef void (*modbus_sniffer_frame_cb)(modbus_sniffer_t *sniffer,
+                                        const modbus_sniffed_frame_t *frame,
+                                        void *user_data);
+
+MODBUS_API modbus_sniffer_t *modbus_sniffer_new(modbus_t *ctx);
+MODBUS_API void modbus_sniffer_set_frame_callback(modbus_sniffer_t *sniffer,
+                                                  modbus_sniffer_frame_cb frame_cb,
+                                                  void *user_data);
+MODBUS_API int modbus_sniffer_feed(modbus_sniffer_t *sniffer,
+                                   const uint8_t *data,
+                                   int length,
+                                   uint64_t time_us);
+MODBUS_API int modbus_sniffer_flush(modbus_sniffer_t *sniffer, uint64_t time_us);
+MODBUS_API int modbus_sniffer_run_once(modbus_sniffer_t *sniffer);
+MODBUS_API int modbus_sniffer_run(modbus_sniffer_t *sniffer);
+MODBUS_API void modbus_sniffer_stop(modbus_sniffer_t *sniffer);
+MODBUS_API int modbus_sniffer_get_slave_stats(modbus_sniffer_t *sniffer,
+                                              int slave,
+                                              modbus_sniffer_slave_stats_t *stats);
+MODBUS_API void modbus_sniffer_get_stats(modbus_sniffer_t *sniffer,
+                                         modbus_sniffer_stats_t *stats);
+MODBUS_API void modbus_sniffer_reset_stats(modbus_sniffer_t *sniffer);
+MODBUS_API void modbus_sniffer_free(modbus_sniffer_t *sniffer);
+
+MODBUS_END_DECLS
+
+#endif /* MODBUS_SNIFFER_H */
@@ -0,0 +1,63 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_SPARSE_PRIVATE_H
+#define MODBUS_SPARSE_PRIVATE_H
+
+#include <stdint.h>
+
+#include "modbus.h"
+
+/* Addresses per page */
+#define _MODBUS_SPARSE_PAGE_SHIFT 7
+#define _MODBUS_SPARSE_PAGE_SIZE  (1 << _MODBUS_SPARSE_PAGE_SHIFT)
+#define _MODBUS_SPARSE_NB_PAGES   (65536 >> _MODBUS_SPARSE_PAGE_SHIFT)
+
+typedef struct {
+    int start;
+    int end;
+} _modbus_range_t;
+
+typedef struct {
+    /* The pages not written yet are NULL and read as zeros. A page stores a
+       byte (ON/OFF) per bit or a uint16_t per register. */
+    void *pages[_MODBUS_SPARSE_NB_PAGES];
+    /* Valid addresses [start, end[, sorted and merged */
+    _modbus_range_t *ranges;
+    int nb_ranges;
+    int max_ranges;
+} _modbus_sparse_table_t;
+
+struct _modbus_sparse {
+    _modbus_sparse_table_t tables[MODBUS_TABLE_INPUT_REGISTERS + 1];
+};
+
+struct _modbus_sparse *_modbus_sparse_new(void);
+void _modbus_sparse_free(struct _modbus_sparse *sparse);
+int _modbus_sparse_add_range(struct _modbus_sparse *sparse,
+                             modbus_table_t table,
+                             int start,
+                             int nb);
+/* Returns TRUE if the nb addresses from addr are in the ranges of the table */
+int _modbus_sparse_is_valid(const struct _modbus_sparse *sparse,
+                            modbus_table_t table,
+                            int addr,
+                            int nb);
+/* Copies nb values of the table (uint8_t for bits, uint16_t for registers),
+   the write allocates the missing pages first and fails with ENOMEM without
+   writing anything. */
+void _modbus_sparse_read(const struct _modbus_sparse *sparse,
+                         modbus_table_t table,
+                         int addr,
+                         int nb,
+                         void *dest);
+int _modbus_sparse_write(struct _modbus_sparse *sparse,
+                         modbus_table_t table,
+                         int addr,
+                         int nb,
+                         const void *src);
+
+#endif /* MODBUS_SPARSE_PRIVATE_H */
@@ -0,0 +1,191 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Storage of the sparse mappings (MODBUS_MAPPING_SPARSE): each table covers
+ * the 65536 addresses with pages allocated on the first write, so the memory
+ * is proportional to the values written and not to the extent of the ranges.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modbus-sparse-private.h"
+
+static size_t value_size(modbus_table_t table)
+{
+    return (table == MODBUS_TABLE_BITS || table == MODBUS_TABLE_INPUT_BITS)
+               ? sizeof(uint8_t)
+               : sizeof(uint16_t);
+}
+
+struct _modbus_sparse *_modbus_sparse_new(void)
+{
+    struct _modbus_sparse *sparse;
+
+    sparse = (struct _modbus_sparse *) calloc(1, sizeof(struct _modbus_sparse));
+    if (sparse == NULL) {
+        errno = ENOMEM;
+    }
+
+    return sparse;
+}
+
+void _modbus_sparse_free(struct _modbus_sparse *sparse)
+{
+    int table;
+    int i;
+
+    if (sparse == NULL) {
+        return;
+    }
+
+    for (table = 0; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+        for (i = 0; i < _MODBUS_SPARSE_NB_PAGES; i++) {
+            free(sparse->tables[table].pages[i]);
+        }
+        free(sparse->tables[table].ranges);
+    }
+    free(sparse);
+}
+
+int _modbus_sparse_add_range(struct _modbus_sparse *sparse,
+                             modbus_table_t table,
+                             int start,
+                             int nb)
+{
+    _modbus_sparse_table_t *t = &sparse->tables[table];
+    int i;
+    int n;
+
+    if (t->nb_ranges == t->max_ranges) {
+        int max_ranges = t->max_ranges ? t->max_ranges * 2 : 4;
+        _modbus_range_t *ranges;
+
+        ranges = (_modbus_range_t *) realloc(t->ranges, max_ranges * sizeof(_modbus_range_t));
+        if (ranges == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        t->ranges = ranges;
+        t->max_ranges = max_ranges;
+    }
+
+    /* Inserted in the order of the start addresses */
+    for (i = t->nb_ranges; i > 0 && t->ranges[i - 1].start > start; i--) {
+        t->ranges[i] = t->ranges[i - 1];
+    }
+    t->ranges[i].start = start;
+    t->ranges[i].end = start + nb;
+    t->nb_ranges++;
+
+    /* Merges the overlapping and adjacent ranges so a request is valid if it's
+       in a single range */
+    n = 0;
+    for (i = 0; i < t->nb_ranges; i++) {
+        if (n > 0 && t->ranges[i].start <= t->ranges[n - 1].end) {
+            if (t->ranges[i].end > t->ranges[n - 1].end) {
+                t->ranges[n - 1].end = t->ranges[i].end;
+            }
+        } else {
+            t->ranges[n++] = t->ranges[i];
+        }
+    }
+    t->nb_ranges = n;
+
+    return 0;
+}
+
+int _modbus_sparse_is_valid(const struct _modbus_sparse *sparse,
+                            modbus_table_t table,
+                            int addr,
+                            int nb)
+{
+    const _modbus_sparse_table_t *t = &sparse->tables[table];
+    int low = 0;
+    int high = t->nb_ranges;
+
+    /* Last range starting at or before the address */
+    while (low < high) {
+        int mid = (low + high) / 2;
+
+        if (t->ranges[mid].start <= addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low > 0 && addr + nb <= t->ranges[low - 1].end;
+}
+
+void _modbus_sparse_read(const struct _modbus_sparse *sparse,
+                         modbus_table_t table,
+                         int addr,
+                         int nb,
+                         void *dest)
+{
+    const _modbus_sparse_table_t *t = &sparse->tables[table];
+    size_t size = value_size(table);
+    uint8_t *p = (uint8_t *) dest;
+
+    while (nb > 0) {
+        const uint8_t *page = (const uint8_t *) t->pages[addr >> _MODBUS_SPARSE_PAGE_SHIFT];
+        int offset = addr & (_MODBUS_SPARSE_PAGE_SIZE - 1);
+        int n = _MODBUS_SPARSE_PAGE_SIZE - offset;
+
+        if (n > nb) {
+            n = nb;
+        }
+        if (page == NULL) {
+            memset(p, 0, n * size);
+        } else {
+            memcpy(p, page + offset * size, n * size);
+        }
+        p += n * size;
+        addr += n;
+        nb -= n;
+    }
+}
+
+int _modbus_sparse_write(struct _modbus_sparse *sparse,
+                         modbus_table_t table,
+                         int addr,
+                         int nb,
+                         const void *src)
+{
+    _modbus_sparse_table_t *t = &sparse->tables[table];
+    size_t size = value_size(table);
+    const uint8_t *p = (const uint8_t *) src;
+    int first = addr >> _MODBUS_SPARSE_PAGE_SHIFT;
+    int last = (addr + nb - 1) >> _MODBUS_SPARSE_PAGE_SHIFT;
+    int i;
+
+    for (i = first; i <= last; i++) {
+        if (t->pages[i] == NULL) {
+            t->pages[i] = calloc(_MODBUS_SPARSE_PAGE_SIZE, size);
+            if (t->pages[i] == NULL) {
+                errno = ENOMEM;
+                return -1;
+            }
+        }
+    }
+
+    while (nb > 0) {
+        uint8_t *page = (uint8_t *) t->pages[addr >> _MODBUS_SPARSE_PAGE_SHIFT];
+        int offset = addr & (_MODBUS_SPARSE_PAGE_SIZE - 1);
+        int n = _MODBUS_SPARSE_PAGE_SIZE - offset;
+
+        if (n > nb) {
+            n = nb;
+        }
+        memcpy(page + offset * size, p, n * size);
+        p += n * size;
+        addr += n;
+        nb -= n;
+    }
+
+    return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef MODBUS_SWAP_PRIVATE_H
+#define MODBUS_SWAP_PRIVATE_H
+
+#include <stdint.h>
+
+/* Writes nb registers in the big-endian order of the wire, dest is not
+ * required to be aligned. */
+void _modbus_encode_registers(uint8_t *dest, const uint16_t *src, int nb);
+
+/* Reads nb big-endian registers from the wire, src is not required to be
+ * aligned. */
+void _modbus_decode_registers(uint16_t *dest, const uint8_t *src, int nb);
+
+/* Implementations swapping the two bytes of nb 16-bit values, exposed for the
+ * tests. The vector ones fall back on a narrower implementation when the CPU
+ * doesn't support them. */
+void _modbus_swap16_scalar(uint8_t *dest, const uint8_t *src, int nb);
+void _modbus_swap16_vector128(uint8_t *dest, const uint8_t *src, int nb);
+void _modbus_swap16_vector256(uint8_t *dest, const uint8_t *src, int nb);
+void _modbus_swap16(uint8_t *dest, const uint8_t *src, int nb);
+
+#endif /* MODBUS_SWAP_PRIVATE_H */
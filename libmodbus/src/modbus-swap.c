@@ -0,0 +1,176 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ * Conversion of the registers between the host and the big-endian order of
+ * the wire.
+ *
+ * On a little-endian host, the two bytes of each register are swapped:
+ * - scalar: one register per iteration,
+ * - vector128: 8 registers per iteration with PSHUFB (SSSE3) or REV16 (NEON),
+ * - vector256: 16 registers per iteration with VPSHUFB (AVX2).
+ * The widest one available on the CPU is selected at the first call.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+// clang-format off
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define SWAP16_X86
+# include <immintrin.h>
+#elif defined(__ARM_NEON)
+# define SWAP16_NEON
+# include <arm_neon.h>
+#endif
+// clang-format on
+
+#include "modbus-swap-private.h"
+
+void _modbus_swap16_scalar(uint8_t *dest, const uint8_t *src, int nb)
+{
+    int i;
+
+    for (i = 0; i < nb; i++) {
+        uint8_t hi = src[i << 1];
+
+        dest[i << 1] = src[(i << 1) + 1];
+        dest[(i << 1) + 1] = hi;
+    }
+}
+
+#if defined(SWAP16_X86)
+__attribute__((target("ssse3"))) static void
+swap16_ssse3(uint8_t *dest, const uint8_t *src, int nb)
+{
+    const __m128i mask = _mm_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+
+    for (; nb >= 8; nb -= 8, src += 16, dest += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) src);
+        _mm_storeu_si128((__m128i *) dest, _mm_shuffle_epi8(v, mask));
+    }
+    _modbus_swap16_scalar(dest, src, nb);
+}
+
+__attribute__((target("avx2"))) static void
+swap16_avx2(uint8_t *dest, const uint8_t *src, int nb)
+{
+    const __m256i mask = _mm256_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+                                         14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+
+    for (; nb >= 16; nb -= 16, src += 32, dest += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) src);
+        _mm256_storeu_si256((__m256i *) dest, _mm256_shuffle_epi8(v, mask));
+    }
+    if (nb >= 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *) src);
+        _mm_storeu_si128((__m128i *) dest,
+                         _mm_shuffle_epi8(v, _mm256_castsi256_si128(mask)));
+        nb -= 8;
+        src += 16;
+        dest += 16;
+    }
+    _modbus_swap16_scalar(dest, src, nb);
+}
+
+static int has_ssse3(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+
+static int has_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+void _modbus_swap16_vector128(uint8_t *dest, const uint8_t *src, int nb)
+{
+    if (has_ssse3()) {
+        swap16_ssse3(dest, src, nb);
+    } else {
+        _modbus_swap16_scalar(dest, src, nb);
+    }
+}
+
+void _modbus_swap16_vector256(uint8_t *dest, const uint8_t *src, int nb)
+{
+    if (has_avx2()) {
+        swap16_avx2(dest, src, nb);
+    } else {
+        _modbus_swap16_vector128(dest, src, nb);
+    }
+}
+#elif defined(SWAP16_NEON)
+void _modbus_swap16_vector128(uint8_t *dest, const uint8_t *src, int nb)
+{
+    for (; nb >= 8; nb -= 8, src += 16, dest += 16) {
+        vst1q_u8(dest, vrev16q_u8(vld1q_u8(src)));
+    }
+    _modbus_swap16_scalar(dest, src, nb);
+}
+
+void _modbus_swap16_vector256(uint8_t *dest, const uint8_t *src, int nb)
+{
+    _modbus_swap16_vector128(dest, src, nb);
+}
+#else
+void _modbus_swap16_vector128(uint8_t *dest, const uint8_t *src, int nb)
+{
+    _modbus_swap16_scalar(dest, src, nb);
+}
+
+void _modbus_swap16_vector256(uint8_t *dest, const uint8_t *src, int nb)
+{
+    _modbus_swap16_scalar(dest, src, nb);
+}
+#endif
+
+static void swap16_dispatch(uint8_t *dest, const uint8_t *src, int nb);
+
+/* Selected implementation, the first call resolves it */
+static void (*swap16_impl)(uint8_t *dest, const uint8_t *src, int nb) = swap16_dispatch;
+
+static void swap16_dispatch(uint8_t *dest, const uint8_t *src, int nb)
+{
+#if defined(SWAP16_X86)
+    if (has_avx2()) {
+        swap16_impl = swap16_avx2;
+    } else if (has_ssse3()) {
+        swap16_impl = swap16_ssse3;
+    } else {
+        swap16_impl = _modbus_swap16_scalar;
+    }
+#elif defined(SWAP16_NEON)
+    swap16_impl = _modbus_swap16_vector128;
+#else
+    swap16_impl = _modbus_swap16_scalar;
+#endif
+
+    swap16_impl(dest, src, nb);
+}
+
+void _modbus_swap16(uint8_t *dest, const uint8_t *src, int nb)
+{
+    swap16_impl(dest, src, nb);
+}
+
+void _modbus_encode_registers(uint8_t *dest, const uint16_t *src, int nb)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memcpy(dest, src, nb * 2);
+#else
+    swap16_impl(dest, (const uint8_t *) src, nb);
+#endif
+}
+
+void _modbus_decode_registers(uint16_t *dest, const uint8_t *src, int nb)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memcpy(dest, src, nb * 2);
+#else
+    swap16_impl((uint8_t *) dest, src, nb);
+#endif
+}
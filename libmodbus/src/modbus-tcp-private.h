@@ -25,6 +25,8 @@ typedef struct _modbus_tcp {
     int port;
     /* IP address */
     char ip[16];
+    /* Listening sockets are created with SO_REUSEPORT */
+    int reuse_port;
 } modbus_tcp_t;
 
 typedef struct _modbus_tcp_pi {
@@ -36,6 +38,11 @@ typedef struct _modbus_tcp_pi {
     char *node;
     /* Service */
     char *service;
+    /* Listening sockets are created with SO_REUSEPORT */
+    int reuse_port;
 } modbus_tcp_pi_t;
 
+/* Sets TCP_NODELAY on the socket, shared with the server of modbus-server.c */
+int _modbus_tcp_set_nodelay(int s);
+
 #endif /* MODBUS_TCP_PRIVATE_H */
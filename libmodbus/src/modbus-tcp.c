@@ -34,6 +34,7 @@
 #else
 # include <sys/socket.h>
 # include <sys/ioctl.h>
+# include <sys/uio.h>
 
 #if defined(__OpenBSD__) || (defined(__FreeBSD__) && __FreeBSD__ < 5)
 # define OS_BSD
@@ -167,6 +168,20 @@ static int _modbus_tcp_send_msg_pre(uint8_t *req, int req_length)
     return req_length;
 }
 
+static int _modbus_tcp_send_msg_pre_data(uint8_t *req,
+                                         int req_length,
+                                         const uint8_t *data,
+                                         int data_length,
+                                         uint8_t *checksum)
+{
+    (void) data;
+    (void) checksum;
+    _modbus_tcp_send_msg_pre(req, req_length + data_length);
+
+    /* No checksum in TCP */
+    return 0;
+}
+
 static ssize_t _modbus_tcp_send(modbus_t *ctx, const uint8_t *req, int req_length)
 {
     /* MSG_NOSIGNAL
@@ -176,6 +191,68 @@ static ssize_t _modbus_tcp_send(modbus_t *ctx, const uint8_t *req, int req_lengt
     return send(ctx->s, (const char *) req, req_length, MSG_NOSIGNAL);
 }
 
+static ssize_t _modbus_tcp_send_parts(modbus_t *ctx, const msg_part_t *parts, int nb_parts)
+{
+#if defined(_WIN32)
+    WSABUF buffers[_MODBUS_MSG_PARTS_MAX];
+    DWORD n_bytes;
+    int i;
+
+    for (i = 0; i < nb_parts; i++) {
+        buffers[i].buf = (char *) parts[i].data;
+        buffers[i].len = parts[i].length;
+    }
+
+    if (WSASend(ctx->s, buffers, nb_parts, &n_bytes, 0, NULL, NULL) != 0) {
+        return -1;
+    }
+
+    return n_bytes;
+#else
+    struct iovec iov[_MODBUS_MSG_PARTS_MAX];
+    struct msghdr msg;
+    ssize_t sent = 0;
+    ssize_t rc;
+    int i;
+
+    for (i = 0; i < nb_parts; i++) {
+        iov[i].iov_base = (void *) parts[i].data;
+        iov[i].iov_len = parts[i].length;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nb_parts;
+
+    /* A short write happens when the send buffer of the socket is full, the
+       remaining bytes are sent by the next calls */
+    while (msg.msg_iovlen > 0) {
+        /* See MSG_NOSIGNAL in _modbus_tcp_send */
+        rc = sendmsg(ctx->s, &msg, MSG_NOSIGNAL);
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        sent += rc;
+
+        /* Skips the parts sent */
+        while (msg.msg_iovlen > 0 && (size_t) rc >= msg.msg_iov->iov_len) {
+            rc -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (uint8_t *) msg.msg_iov->iov_base + rc;
+            msg.msg_iov->iov_len -= rc;
+        }
+    }
+
+    return sent;
+#endif
+}
+
 static int _modbus_tcp_receive(modbus_t *ctx, uint8_t *req)
 {
     return _modbus_receive_msg(ctx, req, MSG_INDICATION);
@@ -222,15 +299,37 @@ static int _modbus_tcp_pre_check_confirmation(modbus_t *ctx,
     return 0;
 }
 
+/* Several sockets can listen on the same port, the kernel distributes the
+   incoming connections between them */
+static int _modbus_tcp_set_reuse_port(int s)
+{
+#ifdef SO_REUSEPORT
+    int enable = 1;
+
+    return setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (char *) &enable, sizeof(enable));
+#else
+    errno = ENOPROTOOPT;
+    return -1;
+#endif
+}
+
+/* Responses and requests must not be delayed by the Nagle algorithm, several
+   of them can be sent without waiting (pipelining) */
+int _modbus_tcp_set_nodelay(int s)
+{
+    int option = 1;
+
+    /* SOL_TCP = IPPROTO_TCP */
+    return setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const void *) &option, sizeof(int));
+}
+
 static int _modbus_tcp_set_ipv4_options(int s)
 {
     int rc;
     int option;
 
     /* Set the TCP no delay flag */
-    /* SOL_TCP = IPPROTO_TCP */
-    option = 1;
-    rc = setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const void *) &option, sizeof(int));
+    rc = _modbus_tcp_set_nodelay(s);
     if (rc == -1) {
         return -1;
     }
@@ -542,6 +641,11 @@ int modbus_tcp_listen(modbus_t *ctx, int nb_connection)
         return -1;
     }
 
+    if (ctx_tcp->reuse_port && _modbus_tcp_set_reuse_port(new_s) == -1) {
+        close(new_s);
+        return -1;
+    }
+
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
     /* If the modbus port is < to 1024, we need the setuid root. */
@@ -651,6 +755,9 @@ int modbus_tcp_pi_listen(modbus_t *ctx, int nb_connection)
             int enable = 1;
             rc =
                 setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (void *) &enable, sizeof(enable));
+            if (rc == 0 && ctx_tcp_pi->reuse_port) {
+                rc = _modbus_tcp_set_reuse_port(s);
+            }
             if (rc != 0) {
                 close(s);
                 if (ctx->debug) {
@@ -700,6 +807,9 @@ int modbus_tcp_accept(modbus_t *ctx, int *s)
         return -1;
     }
 
+    /* The context now serves a new connection */
+    _modbus_reset_rx(ctx);
+
     addrlen = sizeof(addr);
 #ifdef HAVE_ACCEPT4
     /* Inherit socket flags and use accept4 call */
@@ -712,6 +822,12 @@ int modbus_tcp_accept(modbus_t *ctx, int *s)
         return -1;
     }
 
+    if (_modbus_tcp_set_nodelay(ctx->s) == -1) {
+        close(ctx->s);
+        ctx->s = -1;
+        return -1;
+    }
+
     if (ctx->debug) {
         char buf[INET_ADDRSTRLEN];
         if (inet_ntop(AF_INET, &(addr.sin_addr), buf, INET_ADDRSTRLEN) == NULL) {
@@ -734,6 +850,9 @@ int modbus_tcp_pi_accept(modbus_t *ctx, int *s)
         return -1;
     }
 
+    /* The context now serves a new connection */
+    _modbus_reset_rx(ctx);
+
     addrlen = sizeof(addr);
 #ifdef HAVE_ACCEPT4
     /* Inherit socket flags and use accept4 call */
@@ -746,6 +865,12 @@ int modbus_tcp_pi_accept(modbus_t *ctx, int *s)
         return -1;
     }
 
+    if (_modbus_tcp_set_nodelay(ctx->s) == -1) {
+        close(ctx->s);
+        ctx->s = -1;
+        return -1;
+    }
+
     if (ctx->debug) {
         char buf[INET6_ADDRSTRLEN];
         if (inet_ntop(AF_INET6, &(addr.sin6_addr), buf, INET6_ADDRSTRLEN) == NULL) {
@@ -814,7 +939,9 @@ const modbus_backend_t _modbus_tcp_backend = {
     _modbus_tcp_build_response_basis,
     _modbus_tcp_prepare_response_tid,
     _modbus_tcp_send_msg_pre,
+    _modbus_tcp_send_msg_pre_data,
     _modbus_tcp_send,
+    _modbus_tcp_send_parts,
     _modbus_tcp_receive,
     _modbus_tcp_recv,
     _modbus_tcp_check_integrity,
@@ -824,7 +951,8 @@ const modbus_backend_t _modbus_tcp_backend = {
     _modbus_tcp_close,
     _modbus_tcp_flush,
     _modbus_tcp_select,
-    _modbus_tcp_free
+    _modbus_tcp_free,
+    NULL
 };
 
 const modbus_backend_t _modbus_tcp_pi_backend = {
@@ -837,7 +965,9 @@ const modbus_backend_t _modbus_tcp_pi_backend = {
     _modbus_tcp_build_response_basis,
     _modbus_tcp_prepare_response_tid,
     _modbus_tcp_send_msg_pre,
+    _modbus_tcp_send_msg_pre_data,
     _modbus_tcp_send,
+    _modbus_tcp_send_parts,
     _modbus_tcp_receive,
     _modbus_tcp_recv,
     _modbus_tcp_check_integrity,
@@ -847,7 +977,8 @@ const modbus_backend_t _modbus_tcp_pi_backend = {
     _modbus_tcp_close,
     _modbus_tcp_flush,
     _modbus_tcp_select,
-    _modbus_tcp_pi_free
+    _modbus_tcp_pi_free,
+    NULL
 };
 
 // clang-format on
@@ -912,6 +1043,7 @@ modbus_t *modbus_new_tcp(const char *ip, int port)
     }
     ctx_tcp->port = port;
     ctx_tcp->t_id = 0;
+    ctx_tcp->reuse_port = FALSE;
 
     return ctx;
 }
@@ -969,6 +1101,33 @@ modbus_t *modbus_new_tcp_pi(const char *node, const char *service)
     }
 
     ctx_tcp_pi->t_id = 0;
+    ctx_tcp_pi->reuse_port = FALSE;
 
     return ctx;
 }
+
+/* Enables SO_REUSEPORT on the sockets created by modbus_tcp_listen and
+   modbus_tcp_pi_listen so each thread or process can have its own listening
+   socket on the same port. */
+int modbus_tcp_set_reuse_port(modbus_t *ctx, int enable)
+{
+    if (ctx == NULL || ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_TCP) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#ifndef SO_REUSEPORT
+    if (enable) {
+        errno = ENOPROTOOPT;
+        return -1;
+    }
+#endif
+
+    if (ctx->backend == &_modbus_tcp_pi_backend) {
+        ((modbus_tcp_pi_t *) ctx->backend_data)->reuse_port = enable ? TRUE : FALSE;
+    } else {
+        ((modbus_tcp_t *) ctx->backend_data)->reuse_port = enable ? TRUE : FALSE;
+    }
+
+    return 0;
+}
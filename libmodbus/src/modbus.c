@@ -17,10 +17,22 @@
 #ifndef _MSC_VER
 #include <unistd.h>
 #endif
+#ifndef _WIN32
+#include <sched.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include <config.h>
 
 #include "modbus-private.h"
+#include "modbus-callback-private.h"
+#include "modbus-shm-private.h"
+#include "modbus-sparse-private.h"
+#include "modbus-swap-private.h"
 #include "modbus.h"
 
 /* Internal use */
@@ -34,13 +46,6 @@ const unsigned int libmodbus_version_micro = LIBMODBUS_VERSION_MICRO;
 /* Max between RTU and TCP max adu length (so TCP) */
 #define MAX_MESSAGE_LENGTH 260
 
-/* 3 steps are used to parse the query */
-typedef enum {
-    _STEP_FUNCTION,
-    _STEP_META,
-    _STEP_DATA
-} _step_t;
-
 const char *modbus_strerror(int errnum)
 {
     switch (errnum) {
@@ -108,16 +113,39 @@ static void _sleep_response_timeout(modbus_t *ctx)
 #endif
 }
 
+static int frame_silence(modbus_t *ctx)
+{
+    return (ctx->backend->frame_silence != NULL) ? ctx->backend->frame_silence(ctx) : 0;
+}
+
+/* Discards the end of an invalid message (MODBUS_ERROR_RECOVERY_PROTOCOL),
+   nothing remains when the frames are delimited by silences */
+static void flush_invalid_msg(modbus_t *ctx)
+{
+    if (frame_silence(ctx) == 0) {
+        _sleep_response_timeout(ctx);
+        modbus_flush(ctx);
+    }
+}
+
 int modbus_flush(modbus_t *ctx)
 {
     int rc;
+    int pending;
 
     if (ctx == NULL) {
         errno = EINVAL;
         return -1;
     }
 
+    /* The bytes already read from the link are discarded too */
+    pending = ctx->rx_end - ctx->rx_start;
+    _modbus_reset_rx(ctx);
+
     rc = ctx->backend->flush(ctx);
+    if (rc != -1) {
+        rc += pending;
+    }
     if (rc != -1 && ctx->debug) {
         /* Not all backends are able to return the number of bytes flushed */
         printf("Bytes flushed (%d)\n", rc);
@@ -161,6 +189,37 @@ static unsigned int compute_response_length_from_request(modbus_t *ctx, uint8_t
     return offset + length + ctx->backend->checksum_length;
 }
 
+/* Restores the link after a failed send (MODBUS_ERROR_RECOVERY_LINK) */
+static void recover_send_error(modbus_t *ctx)
+{
+#ifdef _WIN32
+    const int wsa_err = WSAGetLastError();
+    if (wsa_err == WSAENETRESET || wsa_err == WSAENOTCONN || wsa_err == WSAENOTSOCK ||
+        wsa_err == WSAESHUTDOWN || wsa_err == WSAEHOSTUNREACH ||
+        wsa_err == WSAECONNABORTED || wsa_err == WSAECONNRESET ||
+        wsa_err == WSAETIMEDOUT) {
+        modbus_close(ctx);
+        _sleep_response_timeout(ctx);
+        modbus_connect(ctx);
+    } else {
+        _sleep_response_timeout(ctx);
+        modbus_flush(ctx);
+    }
+#else
+    int saved_errno = errno;
+
+    if ((errno == EBADF || errno == ECONNRESET || errno == EPIPE)) {
+        modbus_close(ctx);
+        _sleep_response_timeout(ctx);
+        modbus_connect(ctx);
+    } else {
+        _sleep_response_timeout(ctx);
+        modbus_flush(ctx);
+    }
+    errno = saved_errno;
+#endif
+}
+
 /* Sends a request/response */
 static int send_msg(modbus_t *ctx, uint8_t *msg, int msg_length)
 {
@@ -182,32 +241,7 @@ static int send_msg(modbus_t *ctx, uint8_t *msg, int msg_length)
         if (rc == -1) {
             _error_print(ctx, NULL);
             if (ctx->error_recovery & MODBUS_ERROR_RECOVERY_LINK) {
-#ifdef _WIN32
-                const int wsa_err = WSAGetLastError();
-                if (wsa_err == WSAENETRESET || wsa_err == WSAENOTCONN ||
-                    wsa_err == WSAENOTSOCK || wsa_err == WSAESHUTDOWN ||
-                    wsa_err == WSAEHOSTUNREACH || wsa_err == WSAECONNABORTED ||
-                    wsa_err == WSAECONNRESET || wsa_err == WSAETIMEDOUT) {
-                    modbus_close(ctx);
-                    _sleep_response_timeout(ctx);
-                    modbus_connect(ctx);
-                } else {
-                    _sleep_response_timeout(ctx);
-                    modbus_flush(ctx);
-                }
-#else
-                int saved_errno = errno;
-
-                if ((errno == EBADF || errno == ECONNRESET || errno == EPIPE)) {
-                    modbus_close(ctx);
-                    _sleep_response_timeout(ctx);
-                    modbus_connect(ctx);
-                } else {
-                    _sleep_response_timeout(ctx);
-                    modbus_flush(ctx);
-                }
-                errno = saved_errno;
-#endif
+                recover_send_error(ctx);
             }
         }
     } while ((ctx->error_recovery & MODBUS_ERROR_RECOVERY_LINK) && rc == -1);
@@ -220,6 +254,65 @@ static int send_msg(modbus_t *ctx, uint8_t *msg, int msg_length)
     return rc;
 }
 
+/* Sends a message whose data (e.g. the values to write) is not stored after
+   the header in msg. The parts are handed over to the backend in one call so
+   the data is never copied into a frame. */
+static int
+send_msg_data(modbus_t *ctx, uint8_t *msg, int msg_length, const uint8_t *data, int data_length)
+{
+    msg_part_t parts[_MODBUS_MSG_PARTS_MAX];
+    /* Large enough for the longest checksum (CRC of RTU) */
+    uint8_t checksum[2];
+    int checksum_length;
+    int nb_parts = 0;
+    int length;
+    int rc;
+    int i;
+
+    checksum_length =
+        ctx->backend->send_msg_pre_data(msg, msg_length, data, data_length, checksum);
+
+    parts[nb_parts].data = msg;
+    parts[nb_parts++].length = msg_length;
+    if (data_length > 0) {
+        parts[nb_parts].data = data;
+        parts[nb_parts++].length = data_length;
+    }
+    if (checksum_length > 0) {
+        parts[nb_parts].data = checksum;
+        parts[nb_parts++].length = checksum_length;
+    }
+    length = msg_length + data_length + checksum_length;
+
+    if (ctx->debug) {
+        int j;
+
+        for (i = 0; i < nb_parts; i++) {
+            for (j = 0; j < parts[i].length; j++)
+                printf("[%.2X]", parts[i].data[j]);
+        }
+        printf("\n");
+    }
+
+    /* Same recovery than send_msg */
+    do {
+        rc = ctx->backend->send_parts(ctx, parts, nb_parts);
+        if (rc == -1) {
+            _error_print(ctx, NULL);
+            if (ctx->error_recovery & MODBUS_ERROR_RECOVERY_LINK) {
+                recover_send_error(ctx);
+            }
+        }
+    } while ((ctx->error_recovery & MODBUS_ERROR_RECOVERY_LINK) && rc == -1);
+
+    if (rc > 0 && rc != length) {
+        errno = EMBBADDATA;
+        return -1;
+    }
+
+    return rc;
+}
+
 int modbus_send_raw_request(modbus_t *ctx, const uint8_t *raw_req, int raw_req_length)
 {
     sft_t sft;
@@ -302,7 +395,7 @@ static uint8_t compute_meta_length_after_function(int function, msg_type_t msg_t
 
 /* Computes the length to read after the meta information (address, count, etc) */
 static int
-compute_data_length_after_meta(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
+compute_data_length_after_meta(modbus_t *ctx, const uint8_t *msg, msg_type_t msg_type)
 {
     int function = msg[ctx->backend->header_length];
     int length;
@@ -335,9 +428,174 @@ compute_data_length_after_meta(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
     return length;
 }
 
+/* Computes the length of the message starting at msg from the available bytes.
+   The returned value is the length of the whole message when it can be
+   deduced from the available bytes, otherwise it's the length to reach to go
+   further in the parsing so a value greater than available means more bytes
+   must be received. Returns -1 and sets errno to EMBBADDATA if the message
+   can't be valid. */
+int _modbus_compute_msg_length(modbus_t *ctx,
+                               const uint8_t *msg,
+                               int available,
+                               msg_type_t msg_type)
+{
+    const int offset = ctx->backend->header_length;
+    int length;
+
+    /* At the first step, we want to reach the function code because all
+     * packets contain this information. */
+    length = offset + 1;
+    if (available < length) {
+        return length;
+    }
+
+    if (ctx->backend->backend_type == _MODBUS_BACKEND_TYPE_TCP) {
+        int min_length;
+
+        /* The MBAP header provides the number of following bytes (unit
+         * identifier and PDU) */
+        length = 6 + ((msg[4] << 8) | msg[5]);
+        if (length < offset + 1 || length > (int) ctx->backend->max_adu_length) {
+            errno = EMBBADDATA;
+            return -1;
+        }
+
+        if (available < length) {
+            return length;
+        }
+
+        /* The message is complete, checks it's long enough for its function */
+        min_length = offset + 1 + compute_meta_length_after_function(msg[offset], msg_type);
+        if (min_length <= length) {
+            min_length += compute_data_length_after_meta(ctx, msg, msg_type);
+        }
+        if (min_length > length) {
+            errno = EMBBADDATA;
+            return -1;
+        }
+
+        return length;
+    }
+
+    length += compute_meta_length_after_function(msg[offset], msg_type);
+    if (available < length) {
+        return length;
+    }
+
+    length += compute_data_length_after_meta(ctx, msg, msg_type);
+    if (length > (int) ctx->backend->max_adu_length) {
+        errno = EMBBADDATA;
+        return -1;
+    }
+
+    return length;
+}
+
+void _modbus_reset_rx(modbus_t *ctx)
+{
+    ctx->rx_start = 0;
+    ctx->rx_end = 0;
+}
+
+/* Moves the message of msg_length bytes at the beginning of the receive buffer
+   to msg and checks its integrity */
+static int take_msg(modbus_t *ctx, uint8_t *msg, int msg_length)
+{
+    int rc;
+
+    memcpy(msg, ctx->rx_buffer + ctx->rx_start, msg_length);
+    ctx->rx_start += msg_length;
+    if (ctx->rx_start == ctx->rx_end) {
+        _modbus_reset_rx(ctx);
+    }
+
+    /* Display the hex code of each character received */
+    if (ctx->debug) {
+        int i;
+        for (i = 0; i < msg_length; i++)
+            printf("<%.2X>", msg[i]);
+        printf("\n");
+    }
+
+    rc = ctx->backend->check_integrity(ctx, msg, msg_length);
+    if (rc == -1) {
+        /* Resynchronizes on the next bytes received */
+        _modbus_reset_rx(ctx);
+    }
+
+    return rc;
+}
+
+/* Receives a frame delimited by a silence of the line: the bytes are read
+   until none is received during silence microseconds. The frames of unknown
+   functions are received and an incomplete frame is rejected by its checksum
+   as soon as the line is silent. */
+static int receive_frame(modbus_t *ctx, uint8_t *msg, struct timeval *p_tv, int silence)
+{
+    fd_set rset;
+    struct timeval tv;
+    int too_long = FALSE;
+    int msg_length;
+    int rc;
+
+    FD_ZERO(&rset);
+    FD_SET(ctx->s, &rset);
+
+    for (;;) {
+        rc = ctx->backend->select(ctx, &rset, p_tv, ctx->backend->max_adu_length);
+        if (rc == -1) {
+            if (errno == ETIMEDOUT && (ctx->rx_end > ctx->rx_start || too_long)) {
+                /* End of the frame */
+                break;
+            }
+            _error_print(ctx, "select");
+            _modbus_reset_rx(ctx);
+            return -1;
+        }
+
+        rc = ctx->backend->recv(
+            ctx, ctx->rx_buffer + ctx->rx_end, _MODBUS_RX_BUFFER_LENGTH - ctx->rx_end);
+        if (rc == 0) {
+            errno = ECONNRESET;
+            rc = -1;
+        }
+        if (rc == -1) {
+            _error_print(ctx, "read");
+            _modbus_reset_rx(ctx);
+            return -1;
+        }
+
+        ctx->rx_end += rc;
+        if (ctx->rx_end - ctx->rx_start > (int) ctx->backend->max_adu_length) {
+            /* The bytes are dropped until the end of the frame */
+            too_long = TRUE;
+            _modbus_reset_rx(ctx);
+        }
+
+        tv.tv_sec = silence / 1000000;
+        tv.tv_usec = silence % 1000000;
+        p_tv = &tv;
+    }
+
+    msg_length = ctx->rx_end - ctx->rx_start;
+    if (too_long || msg_length < (int) (ctx->backend->header_length + 1 +
+                                        ctx->backend->checksum_length)) {
+        _modbus_reset_rx(ctx);
+        errno = EMBBADDATA;
+        _error_print(ctx, "invalid frame length");
+        return -1;
+    }
+
+    return take_msg(ctx, msg, msg_length);
+}
+
 /* Waits a response from a modbus server or a request from a modbus client.
    This function blocks if there is no replies (3 timeouts).
 
+   The bytes available on the link are read at once in the receive buffer of
+   the context and the message is extracted from it, the remaining bytes are
+   kept for the next call (pipelined messages).
+
    The function shall return the number of received characters and the received
    message in an array of uint8_t if successful. Otherwise it shall return -1
    and errno is set to one of the values defined below:
@@ -346,16 +604,15 @@ compute_data_length_after_meta(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
    - ETIMEDOUT
    - read() or recv() error codes
 */
-
-int _modbus_receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
+static int
+receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type, struct timeval *p_tv)
 {
     int rc;
     fd_set rset;
     struct timeval tv;
-    struct timeval *p_tv;
-    unsigned int length_to_read;
-    int msg_length = 0;
-    _step_t step;
+    int available;
+    int msg_length;
+    int silence;
 #ifdef _WIN32
     int wsa_err;
 #endif
@@ -375,39 +632,56 @@ int _modbus_receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
         return -1;
     }
 
+    silence = frame_silence(ctx);
+    if (silence > 0) {
+        return receive_frame(ctx, msg, p_tv, silence);
+    }
+
     /* Add a file descriptor to the set */
     FD_ZERO(&rset);
     FD_SET(ctx->s, &rset);
 
-    /* We need to analyse the message step by step.  At the first step, we want
-     * to reach the function code because all packets contain this
-     * information. */
-    step = _STEP_FUNCTION;
-    length_to_read = ctx->backend->header_length + 1;
-
-    if (msg_type == MSG_INDICATION) {
-        /* Wait for a message, we don't know when the message will be
-         * received */
-        if (ctx->indication_timeout.tv_sec == 0 && ctx->indication_timeout.tv_usec == 0) {
-            /* By default, the indication timeout isn't set */
-            p_tv = NULL;
-        } else {
-            /* Wait for an indication (name of a received request by a server, see schema)
-             */
-            tv.tv_sec = ctx->indication_timeout.tv_sec;
-            tv.tv_usec = ctx->indication_timeout.tv_usec;
-            p_tv = &tv;
-        }
-    } else {
-        tv.tv_sec = ctx->response_timeout.tv_sec;
-        tv.tv_usec = ctx->response_timeout.tv_usec;
+    if (ctx->rx_end > ctx->rx_start &&
+        (ctx->byte_timeout.tv_sec > 0 || ctx->byte_timeout.tv_usec > 0)) {
+        /* The beginning of the message has already been received (kept by the
+           previous call), the remaining bytes are waited as after a read */
+        tv.tv_sec = ctx->byte_timeout.tv_sec;
+        tv.tv_usec = ctx->byte_timeout.tv_usec;
         p_tv = &tv;
     }
 
-    while (length_to_read != 0) {
-        rc = ctx->backend->select(ctx, &rset, p_tv, length_to_read);
+    for (;;) {
+        available = ctx->rx_end - ctx->rx_start;
+        msg_length = _modbus_compute_msg_length(
+            ctx, ctx->rx_buffer + ctx->rx_start, available, msg_type);
+        if (msg_length == -1) {
+            _error_print(ctx, "invalid message length");
+            _modbus_reset_rx(ctx);
+            return -1;
+        }
+
+        if (msg_length <= available) {
+            /* The whole message is in the buffer */
+            break;
+        }
+
+        /* Moves the beginning of the message to the start of the buffer to
+         * have room for the remaining bytes */
+        if (ctx->rx_start > 0) {
+            memmove(ctx->rx_buffer, ctx->rx_buffer + ctx->rx_start, available);
+            ctx->rx_start = 0;
+            ctx->rx_end = available;
+        }
+
+        rc = ctx->backend->select(ctx, &rset, p_tv, msg_length - available);
         if (rc == -1) {
             _error_print(ctx, "select");
+            /* The end of an incomplete message can still be received on a TCP
+             * stream, otherwise the received bytes are useless */
+            if (errno != ETIMEDOUT ||
+                ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_TCP) {
+                _modbus_reset_rx(ctx);
+            }
             if (ctx->error_recovery & MODBUS_ERROR_RECOVERY_LINK) {
 #ifdef _WIN32
                 wsa_err = WSAGetLastError();
@@ -433,7 +707,9 @@ int _modbus_receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
             return -1;
         }
 
-        rc = ctx->backend->recv(ctx, msg + msg_length, length_to_read);
+        /* Reads as many bytes as possible */
+        rc = ctx->backend->recv(
+            ctx, ctx->rx_buffer + ctx->rx_end, _MODBUS_RX_BUFFER_LENGTH - ctx->rx_end);
         if (rc == 0) {
             errno = ECONNRESET;
             rc = -1;
@@ -441,6 +717,7 @@ int _modbus_receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
 
         if (rc == -1) {
             _error_print(ctx, "read");
+            _modbus_reset_rx(ctx);
 #ifdef _WIN32
             wsa_err = WSAGetLastError();
             if ((ctx->error_recovery & MODBUS_ERROR_RECOVERY_LINK) &&
@@ -466,44 +743,9 @@ int _modbus_receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
             return -1;
         }
 
-        /* Display the hex code of each character received */
-        if (ctx->debug) {
-            int i;
-            for (i = 0; i < rc; i++)
-                printf("<%.2X>", msg[msg_length + i]);
-        }
-
-        /* Sums bytes received */
-        msg_length += rc;
-        /* Computes remaining bytes */
-        length_to_read -= rc;
-
-        if (length_to_read == 0) {
-            switch (step) {
-            case _STEP_FUNCTION:
-                /* Function code position */
-                length_to_read = compute_meta_length_after_function(
-                    msg[ctx->backend->header_length], msg_type);
-                if (length_to_read != 0) {
-                    step = _STEP_META;
-                    break;
-                } /* else switches straight to the next step */
-            case _STEP_META:
-                length_to_read = compute_data_length_after_meta(ctx, msg, msg_type);
-                if ((msg_length + length_to_read) > ctx->backend->max_adu_length) {
-                    errno = EMBBADDATA;
-                    _error_print(ctx, "too many data");
-                    return -1;
-                }
-                step = _STEP_DATA;
-                break;
-            default:
-                break;
-            }
-        }
+        ctx->rx_end += rc;
 
-        if (length_to_read > 0 &&
-            (ctx->byte_timeout.tv_sec > 0 || ctx->byte_timeout.tv_usec > 0)) {
+        if (ctx->byte_timeout.tv_sec > 0 || ctx->byte_timeout.tv_usec > 0) {
             /* If there is no character in the buffer, the allowed timeout
                interval between two consecutive bytes is defined by
                byte_timeout */
@@ -515,10 +757,34 @@ int _modbus_receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
            expiration of response timeout (for CONFIRMATION only) */
     }
 
-    if (ctx->debug)
-        printf("\n");
+    return take_msg(ctx, msg, msg_length);
+}
+
+int _modbus_receive_msg(modbus_t *ctx, uint8_t *msg, msg_type_t msg_type)
+{
+    struct timeval tv;
+    struct timeval *p_tv;
+
+    if (msg_type == MSG_INDICATION) {
+        /* Wait for a message, we don't know when the message will be
+         * received */
+        if (ctx->indication_timeout.tv_sec == 0 && ctx->indication_timeout.tv_usec == 0) {
+            /* By default, the indication timeout isn't set */
+            p_tv = NULL;
+        } else {
+            /* Wait for an indication (name of a received request by a server, see schema)
+             */
+            tv.tv_sec = ctx->indication_timeout.tv_sec;
+            tv.tv_usec = ctx->indication_timeout.tv_usec;
+            p_tv = &tv;
+        }
+    } else {
+        tv.tv_sec = ctx->response_timeout.tv_sec;
+        tv.tv_usec = ctx->response_timeout.tv_usec;
+        p_tv = &tv;
+    }
 
-    return ctx->backend->check_integrity(ctx, msg, msg_length);
+    return receive_msg(ctx, msg, msg_type, p_tv);
 }
 
 /* Receive the request from a modbus master */
@@ -550,7 +816,11 @@ int modbus_receive_confirmation(modbus_t *ctx, uint8_t *rsp)
     return _modbus_receive_msg(ctx, rsp, MSG_CONFIRMATION);
 }
 
-static int check_confirmation(modbus_t *ctx, uint8_t *req, uint8_t *rsp, int rsp_length)
+/* Checks the response of a request, the end of an invalid response is flushed
+   (MODBUS_ERROR_RECOVERY_PROTOCOL) only when recover is set as the other bytes
+   of the link belong to other responses when several requests are in flight */
+static int
+check_response(modbus_t *ctx, uint8_t *req, uint8_t *rsp, int rsp_length, int recover)
 {
     int rc;
     int rsp_length_computed;
@@ -560,9 +830,8 @@ static int check_confirmation(modbus_t *ctx, uint8_t *req, uint8_t *rsp, int rsp
     if (ctx->backend->pre_check_confirmation) {
         rc = ctx->backend->pre_check_confirmation(ctx, req, rsp, rsp_length);
         if (rc == -1) {
-            if (ctx->error_recovery & MODBUS_ERROR_RECOVERY_PROTOCOL) {
-                _sleep_response_timeout(ctx);
-                modbus_flush(ctx);
+            if (recover && (ctx->error_recovery & MODBUS_ERROR_RECOVERY_PROTOCOL)) {
+                flush_invalid_msg(ctx);
             }
             return -1;
         }
@@ -609,9 +878,8 @@ static int check_confirmation(modbus_t *ctx, uint8_t *req, uint8_t *rsp, int rsp
                     function,
                     req[offset]);
             }
-            if (ctx->error_recovery & MODBUS_ERROR_RECOVERY_PROTOCOL) {
-                _sleep_response_timeout(ctx);
-                modbus_flush(ctx);
+            if (recover && (ctx->error_recovery & MODBUS_ERROR_RECOVERY_PROTOCOL)) {
+                flush_invalid_msg(ctx);
             }
             errno = EMBBADDATA;
             return -1;
@@ -682,9 +950,8 @@ static int check_confirmation(modbus_t *ctx, uint8_t *req, uint8_t *rsp, int rsp
                         req_nb_value);
             }
 
-            if (ctx->error_recovery & MODBUS_ERROR_RECOVERY_PROTOCOL) {
-                _sleep_response_timeout(ctx);
-                modbus_flush(ctx);
+            if (recover && (ctx->error_recovery & MODBUS_ERROR_RECOVERY_PROTOCOL)) {
+                flush_invalid_msg(ctx);
             }
 
             errno = EMBBADDATA;
@@ -698,9 +965,8 @@ static int check_confirmation(modbus_t *ctx, uint8_t *req, uint8_t *rsp, int rsp
                 rsp_length,
                 rsp_length_computed);
         }
-        if (ctx->error_recovery & MODBUS_ERROR_RECOVERY_PROTOCOL) {
-            _sleep_response_timeout(ctx);
-            modbus_flush(ctx);
+        if (recover && (ctx->error_recovery & MODBUS_ERROR_RECOVERY_PROTOCOL)) {
+            flush_invalid_msg(ctx);
         }
         errno = EMBBADDATA;
         rc = -1;
@@ -709,16 +975,48 @@ static int check_confirmation(modbus_t *ctx, uint8_t *req, uint8_t *rsp, int rsp
     return rc;
 }
 
+static int check_confirmation(modbus_t *ctx, uint8_t *req, uint8_t *rsp, int rsp_length)
+{
+    return check_response(ctx, req, rsp, rsp_length, TRUE);
+}
+
+
 static int
 response_io_status(uint8_t *tab_io_status, int address, int nb, uint8_t *rsp, int offset)
 {
     int shift = 0;
     /* Instead of byte (not allowed in Win32) */
     int one_byte = 0;
-    int i;
+    int i = address;
+
+    /* 16 statuses give 2 bytes of the response */
+#if defined(__SSE2__)
+    for (; i + 16 <= address + nb; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (tab_io_status + i));
+        /* The MSB of each byte is set by the comparison to OFF */
+        int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+
+        rsp[offset++] = mask & 0xFF;
+        rsp[offset++] = (mask >> 8) & 0xFF;
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    {
+        static const uint8_t weights[16] = {
+            1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+        const uint8x16_t w = vld1q_u8(weights);
+
+        for (; i + 16 <= address + nb; i += 16) {
+            uint8x16_t v = vld1q_u8(tab_io_status + i);
+
+            v = vandq_u8(vtstq_u8(v, v), w);
+            rsp[offset++] = vaddv_u8(vget_low_u8(v));
+            rsp[offset++] = vaddv_u8(vget_high_u8(v));
+        }
+    }
+#endif
 
-    for (i = address; i < address + nb; i++) {
-        one_byte |= tab_io_status[i] << shift;
+    for (; i < address + nb; i++) {
+        one_byte |= (tab_io_status[i] ? ON : OFF) << shift;
         if (shift == 7) {
             /* Byte is full */
             rsp[offset++] = one_byte;
@@ -734,18 +1032,393 @@ response_io_status(uint8_t *tab_io_status, int address, int nb, uint8_t *rsp, in
     return offset;
 }
 
-/* Build the exception response */
-static int response_exception(modbus_t *ctx,
-                              sft_t *sft,
-                              int exception_code,
-                              uint8_t *rsp,
-                              unsigned int to_flush,
-                              const char *template,
-                              ...)
+/* Same as response_io_status() for a table of packed bits */
+static int
+response_packed_bits(const uint8_t *tab_bits, int address, int nb, uint8_t *rsp, int offset)
 {
-    int rsp_length;
+    const uint8_t *src = tab_bits + address / 8;
+    int shift = address % 8;
+    int nb_bytes = (nb / 8) + ((nb % 8) ? 1 : 0);
+    int i;
 
-    /* Print debug message */
+    if (shift == 0) {
+        memcpy(rsp + offset, src, nb_bytes);
+    } else {
+        /* The packed table has a spare byte to read the last word */
+        for (i = 0; i < nb_bytes; i++) {
+            rsp[offset + i] = ((src[i + 1] << 8) | src[i]) >> shift;
+        }
+    }
+    if (nb % 8) {
+        rsp[offset + nb_bytes - 1] &= (1 << (nb % 8)) - 1;
+    }
+
+    return offset + nb_bytes;
+}
+
+/* Writes nb bits of the packed bytes tab_byte at address in a table of packed
+   bits */
+static void
+set_packed_bits(uint8_t *tab_bits, int address, int nb, const uint8_t *tab_byte)
+{
+    uint8_t *dest = tab_bits + address / 8;
+    int shift = address % 8;
+    int nb_bytes = (nb / 8) + ((nb % 8) ? 1 : 0);
+    int i;
+
+    for (i = 0; i < nb_bytes; i++) {
+        unsigned int mask = (i == nb_bytes - 1 && (nb % 8)) ? (1 << (nb % 8)) - 1 : 0xFF;
+        unsigned int value = (tab_byte[i] & mask) << shift;
+
+        /* Each byte of the request overlaps two bytes of the table */
+        mask <<= shift;
+        dest[i] = (dest[i] & ~mask) | value;
+        dest[i + 1] = (dest[i + 1] & ~(mask >> 8)) | (value >> 8);
+    }
+}
+
+/* Private parts of the mappings (see _modbus_mapping_ext_t). The list is
+   short and only changed when a mapping is created or freed, it's protected
+   by a spinlock and its generation changes on each update so modbus_reply()
+   can keep the private part of the last mapping without locking.
+
+   The generation is stored with release semantics after the update and loaded
+   with acquire semantics: a thread which gets a mapping from the thread that
+   created it (the hand-over synchronizes them) sees at least the generation of
+   its creation, so a mapping allocated at the address of a freed one isn't
+   taken for it. */
+static _modbus_mapping_ext_t *mapping_exts = NULL;
+#ifdef _WIN32
+static volatile LONG mapping_exts_generation = 0;
+static volatile LONG mapping_exts_locked = 0;
+#else
+static unsigned int mapping_exts_generation = 0;
+static char mapping_exts_locked = 0;
+#endif
+
+/* Private part of the mappings built by hand */
+static const _modbus_mapping_ext_t mapping_ext_none;
+
+static void mapping_exts_lock(void)
+{
+#ifdef _WIN32
+    while (InterlockedExchange(&mapping_exts_locked, 1) != 0) {
+        Sleep(0);
+    }
+#else
+    while (__atomic_test_and_set(&mapping_exts_locked, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+#endif
+}
+
+static void mapping_exts_unlock(void)
+{
+#ifdef _WIN32
+    InterlockedExchange(&mapping_exts_locked, 0);
+#else
+    __atomic_clear(&mapping_exts_locked, __ATOMIC_RELEASE);
+#endif
+}
+
+static unsigned int mapping_exts_load_generation(void)
+{
+#ifdef _WIN32
+    return (unsigned int) InterlockedCompareExchange(&mapping_exts_generation, 0, 0);
+#else
+    return __atomic_load_n(&mapping_exts_generation, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/* Called with the lock held, after the update of the list */
+static void mapping_exts_next_generation(void)
+{
+#ifdef _WIN32
+    InterlockedIncrement(&mapping_exts_generation);
+#else
+    __atomic_store_n(&mapping_exts_generation,
+                     __atomic_load_n(&mapping_exts_generation, __ATOMIC_RELAXED) + 1,
+                     __ATOMIC_RELEASE);
+#endif
+}
+
+/* Returns the private part of the mapping or NULL */
+static _modbus_mapping_ext_t *mapping_ext_find(const modbus_mapping_t *mb_mapping)
+{
+    _modbus_mapping_ext_t *ext;
+
+    mapping_exts_lock();
+    for (ext = mapping_exts; ext != NULL; ext = ext->next) {
+        if (ext->mb_mapping == mb_mapping) {
+            break;
+        }
+    }
+    mapping_exts_unlock();
+
+    return ext;
+}
+
+/* Same as mapping_ext_find() but a mapping without private part gets an empty
+   one, so the flags can always be tested */
+static const _modbus_mapping_ext_t *mapping_ext(const modbus_mapping_t *mb_mapping)
+{
+    const _modbus_mapping_ext_t *ext = mapping_ext_find(mb_mapping);
+
+    return (ext != NULL) ? ext : &mapping_ext_none;
+}
+
+/* Same as mapping_ext() with the cache of the context */
+static const _modbus_mapping_ext_t *mapping_ext_cached(modbus_t *ctx,
+                                                       const modbus_mapping_t *mb_mapping)
+{
+    /* Read before the search, an update during the search is seen next time */
+    unsigned int generation = mapping_exts_load_generation();
+
+    if (ctx->mapping_ext == NULL || ctx->mapping != mb_mapping ||
+        ctx->mapping_ext_generation != generation) {
+        ctx->mapping_ext = mapping_ext(mb_mapping);
+        ctx->mapping = mb_mapping;
+        ctx->mapping_ext_generation = generation;
+    }
+
+    return ctx->mapping_ext;
+}
+
+/* Adds an empty private part to the mapping. Returns NULL and sets errno to
+   ENOMEM on error. */
+static _modbus_mapping_ext_t *mapping_ext_add(const modbus_mapping_t *mb_mapping,
+                                              unsigned int flags)
+{
+    _modbus_mapping_ext_t *ext;
+
+    ext = (_modbus_mapping_ext_t *) calloc(1, sizeof(_modbus_mapping_ext_t));
+    if (ext == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    ext->mb_mapping = mb_mapping;
+    ext->flags = flags;
+
+    mapping_exts_lock();
+    ext->next = mapping_exts;
+    mapping_exts = ext;
+    mapping_exts_next_generation();
+    mapping_exts_unlock();
+
+    return ext;
+}
+
+/* Removes the private part from the list, the parts it refers to are released
+   by the caller */
+static void mapping_ext_remove(_modbus_mapping_ext_t *ext)
+{
+    _modbus_mapping_ext_t **prev;
+
+    mapping_exts_lock();
+    for (prev = &mapping_exts; *prev != NULL; prev = &(*prev)->next) {
+        if (*prev == ext) {
+            *prev = ext->next;
+            break;
+        }
+    }
+    mapping_exts_next_generation();
+    mapping_exts_unlock();
+
+    free(ext);
+}
+
+/* Brackets of the shared memory mappings, see modbus_mapping_write_begin() */
+static int mapping_write_begin(const _modbus_mapping_ext_t *ext, modbus_table_t table)
+{
+    if (ext->flags & MODBUS_MAPPING_SHM) {
+        return _modbus_shm_write_begin(ext->shm, table);
+    }
+
+    return 0;
+}
+
+static void mapping_write_end(const _modbus_mapping_ext_t *ext, modbus_table_t table)
+{
+    if (ext->flags & MODBUS_MAPPING_SHM) {
+        _modbus_shm_write_end(ext->shm, table);
+    }
+}
+
+static int mapping_read_begin(const _modbus_mapping_ext_t *ext,
+                              modbus_table_t table,
+                              uint32_t *generation)
+{
+    if (ext->flags & MODBUS_MAPPING_SHM) {
+        return _modbus_shm_read_begin(ext->shm, table, generation);
+    }
+
+    *generation = 0;
+    return 0;
+}
+
+static int
+mapping_read_retry(const _modbus_mapping_ext_t *ext, modbus_table_t table, uint32_t generation)
+{
+    if (ext->flags & MODBUS_MAPPING_SHM) {
+        return _modbus_shm_read_retry(ext->shm, table, generation);
+    }
+
+    return FALSE;
+}
+
+static int get_mapping_bit(const _modbus_mapping_ext_t *ext, const uint8_t *tab_bits, int i)
+{
+    if (ext->flags & MODBUS_MAPPING_PACKED_BITS) {
+        return (tab_bits[i / 8] >> (i % 8)) & 1;
+    }
+
+    return tab_bits[i] ? ON : OFF;
+}
+
+static void
+set_mapping_bit(const _modbus_mapping_ext_t *ext, uint8_t *tab_bits, int i, int value)
+{
+    if (ext->flags & MODBUS_MAPPING_PACKED_BITS) {
+        if (value) {
+            tab_bits[i / 8] |= 1 << (i % 8);
+        } else {
+            tab_bits[i / 8] &= ~(1 << (i % 8));
+        }
+    } else {
+        tab_bits[i] = value ? ON : OFF;
+    }
+}
+
+/* Checks the valid ranges of a sparse mapping, the other mappings only have
+   the bounds of their tables. The values of a request can't be partly in a
+   callback range. */
+static int mapping_out_of_ranges(const _modbus_mapping_ext_t *ext,
+                                 modbus_table_t table,
+                                 int address,
+                                 int nb)
+{
+    return ((ext->flags & MODBUS_MAPPING_SPARSE) &&
+            !_modbus_sparse_is_valid(ext->sparse, table, address, nb)) ||
+           ((ext->flags & MODBUS_MAPPING_CALLBACKS) &&
+            _modbus_callbacks_find(ext->callbacks, table, address, nb) != NULL);
+}
+
+/* Returns the callback range serving the nb values from address or NULL when
+   they're stored in the tables */
+static const _modbus_callback_t *mapping_callback(const _modbus_mapping_ext_t *ext,
+                                                  modbus_table_t table,
+                                                  int address,
+                                                  int nb)
+{
+    const _modbus_callback_t *callback;
+
+    if (!(ext->flags & MODBUS_MAPPING_CALLBACKS)) {
+        return NULL;
+    }
+
+    callback = _modbus_callbacks_find(ext->callbacks, table, address, nb);
+    if (callback == NULL || address < callback->start || address + nb > callback->end) {
+        return NULL;
+    }
+
+    return callback;
+}
+
+/* Returns 0 or the exception code of the callback */
+static int callback_read(const _modbus_callback_t *callback,
+                         modbus_table_t table,
+                         int address,
+                         int nb,
+                         void *dest)
+{
+    if (callback->read == NULL) {
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    }
+
+    return callback->read(callback->user_data, table, address, nb, dest);
+}
+
+static int callback_write(const _modbus_callback_t *callback,
+                          modbus_table_t table,
+                          int address,
+                          int nb,
+                          const void *src)
+{
+    if (callback->write == NULL) {
+        return MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS;
+    }
+
+    return callback->write(callback->user_data, table, address, nb, src);
+}
+
+/* Writes registers to the callback range, the pages of a sparse mapping or
+   the table. Returns 0, the exception code of the callback or -1 when a
+   sparse mapping is out of memory. */
+static int mapping_write_registers(modbus_mapping_t *mb_mapping,
+                                   const _modbus_mapping_ext_t *ext,
+                                   const _modbus_callback_t *callback,
+                                   int address,
+                                   int nb,
+                                   const uint16_t *src)
+{
+    if (callback != NULL) {
+        return callback_write(callback, MODBUS_TABLE_REGISTERS, address, nb, src);
+    }
+    if (ext->flags & MODBUS_MAPPING_SPARSE) {
+        return _modbus_sparse_write(ext->sparse, MODBUS_TABLE_REGISTERS, address, nb, src);
+    }
+
+    if (mapping_write_begin(ext, MODBUS_TABLE_REGISTERS) == -1) {
+        return -1;
+    }
+    memcpy(mb_mapping->tab_registers + address - mb_mapping->start_registers,
+           src,
+           nb * sizeof(uint16_t));
+    mapping_write_end(ext, MODBUS_TABLE_REGISTERS);
+
+    return 0;
+}
+
+static int mapping_read_registers(const modbus_mapping_t *mb_mapping,
+                                  const _modbus_mapping_ext_t *ext,
+                                  const _modbus_callback_t *callback,
+                                  int address,
+                                  int nb,
+                                  uint16_t *dest)
+{
+    uint32_t generation;
+    int rc;
+
+    if (callback != NULL) {
+        return callback_read(callback, MODBUS_TABLE_REGISTERS, address, nb, dest);
+    }
+    if (ext->flags & MODBUS_MAPPING_SPARSE) {
+        _modbus_sparse_read(ext->sparse, MODBUS_TABLE_REGISTERS, address, nb, dest);
+        return 0;
+    }
+
+    do {
+        rc = mapping_read_begin(ext, MODBUS_TABLE_REGISTERS, &generation);
+        memcpy(dest,
+               mb_mapping->tab_registers + address - mb_mapping->start_registers,
+               nb * sizeof(uint16_t));
+    } while (rc == 0 && mapping_read_retry(ext, MODBUS_TABLE_REGISTERS, generation));
+
+    return rc;
+}
+
+/* Build the exception response */
+static int response_exception(modbus_t *ctx,
+                              sft_t *sft,
+                              int exception_code,
+                              uint8_t *rsp,
+                              unsigned int to_flush,
+                              const char *template,
+                              ...)
+{
+    int rsp_length;
+
+    /* Print debug message */
     if (ctx->debug) {
         va_list ap;
 
@@ -756,8 +1429,7 @@ static int response_exception(modbus_t *ctx,
 
     /* Flush if required */
     if (to_flush) {
-        _sleep_response_timeout(ctx);
-        modbus_flush(ctx);
+        flush_invalid_msg(ctx);
     }
 
     /* Build exception response */
@@ -785,6 +1457,11 @@ int modbus_reply(modbus_t *ctx,
     uint16_t address;
     uint8_t rsp[MAX_MESSAGE_LENGTH];
     int rsp_length = 0;
+    /* Exception code returned by a callback, negative on a failure of a
+       callback or when a sparse mapping is out of memory */
+    int rc = 0;
+    const _modbus_callback_t *callback;
+    const _modbus_mapping_ext_t *ext;
     sft_t sft;
 
     if (ctx == NULL) {
@@ -801,6 +1478,26 @@ int modbus_reply(modbus_t *ctx,
     sft.function = function;
     sft.t_id = ctx->backend->prepare_response_tid(req, &req_length);
 
+    if (ctx->units != NULL) {
+        mb_mapping = ctx->units[slave];
+        if (mb_mapping == NULL) {
+            /* No device answers on a serial line, a gateway reports the
+               missing device */
+            if (ctx->backend->backend_type == _MODBUS_BACKEND_TYPE_RTU) {
+                return 0;
+            }
+            rsp_length = response_exception(ctx,
+                                            &sft,
+                                            MODBUS_EXCEPTION_GATEWAY_TARGET,
+                                            rsp,
+                                            FALSE,
+                                            "No mapping for the unit %d\n",
+                                            slave);
+            return send_msg(ctx, rsp, rsp_length);
+        }
+    }
+    ext = mapping_ext_cached(ctx, mb_mapping);
+
     /* Data are flushed on illegal number of values errors. */
     switch (function) {
     case MODBUS_FC_READ_COILS:
@@ -809,12 +1506,14 @@ int modbus_reply(modbus_t *ctx,
         int start_bits = is_input ? mb_mapping->start_input_bits : mb_mapping->start_bits;
         int nb_bits = is_input ? mb_mapping->nb_input_bits : mb_mapping->nb_bits;
         uint8_t *tab_bits = is_input ? mb_mapping->tab_input_bits : mb_mapping->tab_bits;
+        modbus_table_t table = is_input ? MODBUS_TABLE_INPUT_BITS : MODBUS_TABLE_BITS;
         const char *const name = is_input ? "read_input_bits" : "read_bits";
         int nb = (req[offset + 3] << 8) + req[offset + 4];
         /* The mapping can be shifted to reduce memory consumption and it
            doesn't always start at address zero. */
         int mapping_address = address - start_bits;
 
+        callback = mapping_callback(ext, table, address, nb);
         if (nb < 1 || MODBUS_MAX_READ_BITS < nb) {
             rsp_length = response_exception(ctx,
                                             &sft,
@@ -825,7 +1524,9 @@ int modbus_reply(modbus_t *ctx,
                                             nb,
                                             name,
                                             MODBUS_MAX_READ_BITS);
-        } else if (mapping_address < 0 || (mapping_address + nb) > nb_bits) {
+        } else if (callback == NULL &&
+                   (mapping_address < 0 || (mapping_address + nb) > nb_bits ||
+                    mapping_out_of_ranges(ext, table, address, nb))) {
             rsp_length = response_exception(ctx,
                                             &sft,
                                             MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS,
@@ -837,8 +1538,50 @@ int modbus_reply(modbus_t *ctx,
         } else {
             rsp_length = ctx->backend->build_response_basis(&sft, rsp);
             rsp[rsp_length++] = (nb / 8) + ((nb % 8) ? 1 : 0);
-            rsp_length =
-                response_io_status(tab_bits, mapping_address, nb, rsp, rsp_length);
+            if (callback != NULL) {
+                uint8_t status[MODBUS_MAX_READ_BITS];
+
+                rc = callback_read(callback, table, address, nb, status);
+                if (rc == 0) {
+                    rsp_length = response_io_status(status, 0, nb, rsp, rsp_length);
+                }
+            } else if (ext->flags & MODBUS_MAPPING_SPARSE) {
+                uint8_t status[MODBUS_MAX_READ_BITS];
+
+                _modbus_sparse_read(ext->sparse, table, address, nb, status);
+                rsp_length = response_io_status(status, 0, nb, rsp, rsp_length);
+            } else if (ext->flags & MODBUS_MAPPING_PACKED_BITS) {
+                rsp_length =
+                    response_packed_bits(tab_bits, mapping_address, nb, rsp, rsp_length);
+            } else {
+                int length;
+                uint32_t generation;
+
+                do {
+                    rc = mapping_read_begin(ext, table, &generation);
+                    length =
+                        response_io_status(tab_bits, mapping_address, nb, rsp, rsp_length);
+                } while (rc == 0 && mapping_read_retry(ext, table, generation));
+                rsp_length = length;
+            }
+            if (rc > 0) {
+                rsp_length = response_exception(ctx,
+                                                &sft,
+                                                rc,
+                                                rsp,
+                                                FALSE,
+                                                "Exception %d of the callback in %s\n",
+                                                rc,
+                                                name);
+            } else if (rc < 0) {
+                rsp_length = response_exception(ctx,
+                                                &sft,
+                                                MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE,
+                                                rsp,
+                                                FALSE,
+                                                "Server failure in %s\n",
+                                                name);
+            }
         }
     } break;
     case MODBUS_FC_READ_HOLDING_REGISTERS:
@@ -850,12 +1593,14 @@ int modbus_reply(modbus_t *ctx,
             is_input ? mb_mapping->nb_input_registers : mb_mapping->nb_registers;
         uint16_t *tab_registers =
             is_input ? mb_mapping->tab_input_registers : mb_mapping->tab_registers;
+        modbus_table_t table = is_input ? MODBUS_TABLE_INPUT_REGISTERS : MODBUS_TABLE_REGISTERS;
         const char *const name = is_input ? "read_input_registers" : "read_registers";
         int nb = (req[offset + 3] << 8) + req[offset + 4];
         /* The mapping can be shifted to reduce memory consumption and it
            doesn't always start at address zero. */
         int mapping_address = address - start_registers;
 
+        callback = mapping_callback(ext, table, address, nb);
         if (nb < 1 || MODBUS_MAX_READ_REGISTERS < nb) {
             rsp_length = response_exception(ctx,
                                             &sft,
@@ -866,7 +1611,9 @@ int modbus_reply(modbus_t *ctx,
                                             nb,
                                             name,
                                             MODBUS_MAX_READ_REGISTERS);
-        } else if (mapping_address < 0 || (mapping_address + nb) > nb_registers) {
+        } else if (callback == NULL &&
+                   (mapping_address < 0 || (mapping_address + nb) > nb_registers ||
+                    mapping_out_of_ranges(ext, table, address, nb))) {
             rsp_length = response_exception(ctx,
                                             &sft,
                                             MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS,
@@ -876,20 +1623,57 @@ int modbus_reply(modbus_t *ctx,
                                             mapping_address < 0 ? address : address + nb,
                                             name);
         } else {
-            int i;
-
             rsp_length = ctx->backend->build_response_basis(&sft, rsp);
             rsp[rsp_length++] = nb << 1;
-            for (i = mapping_address; i < mapping_address + nb; i++) {
-                rsp[rsp_length++] = tab_registers[i] >> 8;
-                rsp[rsp_length++] = tab_registers[i] & 0xFF;
+            if (callback != NULL) {
+                uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+
+                rc = callback_read(callback, table, address, nb, registers);
+                if (rc == 0) {
+                    _modbus_encode_registers(rsp + rsp_length, registers, nb);
+                }
+            } else if (ext->flags & MODBUS_MAPPING_SPARSE) {
+                uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+
+                _modbus_sparse_read(ext->sparse, table, address, nb, registers);
+                _modbus_encode_registers(rsp + rsp_length, registers, nb);
+            } else {
+                uint32_t generation;
+
+                do {
+                    rc = mapping_read_begin(ext, table, &generation);
+                    _modbus_encode_registers(
+                        rsp + rsp_length, tab_registers + mapping_address, nb);
+                } while (rc == 0 && mapping_read_retry(ext, table, generation));
+            }
+            rsp_length += nb << 1;
+            if (rc > 0) {
+                rsp_length = response_exception(ctx,
+                                                &sft,
+                                                rc,
+                                                rsp,
+                                                FALSE,
+                                                "Exception %d of the callback in %s\n",
+                                                rc,
+                                                name);
+            } else if (rc < 0) {
+                rsp_length = response_exception(ctx,
+                                                &sft,
+                                                MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE,
+                                                rsp,
+                                                FALSE,
+                                                "Server failure in %s\n",
+                                                name);
             }
         }
     } break;
     case MODBUS_FC_WRITE_SINGLE_COIL: {
         int mapping_address = address - mb_mapping->start_bits;
 
-        if (mapping_address < 0 || mapping_address >= mb_mapping->nb_bits) {
+        callback = mapping_callback(ext, MODBUS_TABLE_BITS, address, 1);
+        if (callback == NULL &&
+            (mapping_address < 0 || mapping_address >= mb_mapping->nb_bits ||
+             mapping_out_of_ranges(ext, MODBUS_TABLE_BITS, address, 1))) {
             rsp_length = response_exception(ctx,
                                             &sft,
                                             MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS,
@@ -901,9 +1685,39 @@ int modbus_reply(modbus_t *ctx,
             int data = (req[offset + 3] << 8) + req[offset + 4];
 
             if (data == 0xFF00 || data == 0x0) {
-                mb_mapping->tab_bits[mapping_address] = data ? ON : OFF;
-                memcpy(rsp, req, req_length);
-                rsp_length = req_length;
+                uint8_t value = data ? ON : OFF;
+
+                if (callback != NULL) {
+                    rc = callback_write(callback, MODBUS_TABLE_BITS, address, 1, &value);
+                } else if (ext->flags & MODBUS_MAPPING_SPARSE) {
+                    rc = _modbus_sparse_write(
+                        ext->sparse, MODBUS_TABLE_BITS, address, 1, &value);
+                } else {
+                    rc = mapping_write_begin(ext, MODBUS_TABLE_BITS);
+                    if (rc == 0) {
+                        set_mapping_bit(ext, mb_mapping->tab_bits, mapping_address, value);
+                        mapping_write_end(ext, MODBUS_TABLE_BITS);
+                    }
+                }
+                if (rc > 0) {
+                    rsp_length = response_exception(ctx,
+                                                    &sft,
+                                                    rc,
+                                                    rsp,
+                                                    FALSE,
+                                                    "Exception %d of the callback in write_bit\n",
+                                                    rc);
+                } else if (rc < 0) {
+                    rsp_length = response_exception(ctx,
+                                                    &sft,
+                                                    MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE,
+                                                    rsp,
+                                                    FALSE,
+                                                    "Server failure in write_bit\n");
+                } else {
+                    memcpy(rsp, req, req_length);
+                    rsp_length = req_length;
+                }
             } else {
                 rsp_length = response_exception(
                     ctx,
@@ -920,7 +1734,10 @@ int modbus_reply(modbus_t *ctx,
     case MODBUS_FC_WRITE_SINGLE_REGISTER: {
         int mapping_address = address - mb_mapping->start_registers;
 
-        if (mapping_address < 0 || mapping_address >= mb_mapping->nb_registers) {
+        callback = mapping_callback(ext, MODBUS_TABLE_REGISTERS, address, 1);
+        if (callback == NULL &&
+            (mapping_address < 0 || mapping_address >= mb_mapping->nb_registers ||
+             mapping_out_of_ranges(ext, MODBUS_TABLE_REGISTERS, address, 1))) {
             rsp_length =
                 response_exception(ctx,
                                    &sft,
@@ -930,11 +1747,39 @@ int modbus_reply(modbus_t *ctx,
                                    "Illegal data address 0x%0X in write_register\n",
                                    address);
         } else {
-            int data = (req[offset + 3] << 8) + req[offset + 4];
+            uint16_t data = (req[offset + 3] << 8) + req[offset + 4];
 
-            mb_mapping->tab_registers[mapping_address] = data;
-            memcpy(rsp, req, req_length);
-            rsp_length = req_length;
+            if (callback != NULL) {
+                rc = callback_write(callback, MODBUS_TABLE_REGISTERS, address, 1, &data);
+            } else if (ext->flags & MODBUS_MAPPING_SPARSE) {
+                rc = _modbus_sparse_write(
+                    ext->sparse, MODBUS_TABLE_REGISTERS, address, 1, &data);
+            } else {
+                rc = mapping_write_begin(ext, MODBUS_TABLE_REGISTERS);
+                if (rc == 0) {
+                    mb_mapping->tab_registers[mapping_address] = data;
+                    mapping_write_end(ext, MODBUS_TABLE_REGISTERS);
+                }
+            }
+            if (rc > 0) {
+                rsp_length = response_exception(ctx,
+                                                &sft,
+                                                rc,
+                                                rsp,
+                                                FALSE,
+                                                "Exception %d of the callback in write_register\n",
+                                                rc);
+            } else if (rc < 0) {
+                rsp_length = response_exception(ctx,
+                                                &sft,
+                                                MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE,
+                                                rsp,
+                                                FALSE,
+                                                "Server failure in write_register\n");
+            } else {
+                memcpy(rsp, req, req_length);
+                rsp_length = req_length;
+            }
         }
     } break;
     case MODBUS_FC_WRITE_MULTIPLE_COILS: {
@@ -942,6 +1787,7 @@ int modbus_reply(modbus_t *ctx,
         int nb_bits = req[offset + 5];
         int mapping_address = address - mb_mapping->start_bits;
 
+        callback = mapping_callback(ext, MODBUS_TABLE_BITS, address, nb);
         if (nb < 1 || MODBUS_MAX_WRITE_BITS < nb || nb_bits * 8 < nb) {
             /* May be the indication has been truncated on reading because of
              * invalid address (eg. nb is 0 but the request contains values to
@@ -955,7 +1801,9 @@ int modbus_reply(modbus_t *ctx,
                                    "Illegal number of values %d in write_bits (max %d)\n",
                                    nb,
                                    MODBUS_MAX_WRITE_BITS);
-        } else if (mapping_address < 0 || (mapping_address + nb) > mb_mapping->nb_bits) {
+        } else if (callback == NULL &&
+                   (mapping_address < 0 || (mapping_address + nb) > mb_mapping->nb_bits ||
+                    mapping_out_of_ranges(ext, MODBUS_TABLE_BITS, address, nb))) {
             rsp_length = response_exception(ctx,
                                             &sft,
                                             MODBUS_EXCEPTION_ILLEGAL_DATA_ADDRESS,
@@ -965,13 +1813,49 @@ int modbus_reply(modbus_t *ctx,
                                             mapping_address < 0 ? address : address + nb);
         } else {
             /* 6 = byte count */
-            modbus_set_bits_from_bytes(
-                mb_mapping->tab_bits, mapping_address, nb, &req[offset + 6]);
+            if (callback != NULL) {
+                uint8_t status[MODBUS_MAX_WRITE_BITS];
+
+                modbus_set_bits_from_bytes(status, 0, nb, &req[offset + 6]);
+                rc = callback_write(callback, MODBUS_TABLE_BITS, address, nb, status);
+            } else if (ext->flags & MODBUS_MAPPING_SPARSE) {
+                uint8_t status[MODBUS_MAX_WRITE_BITS];
+
+                modbus_set_bits_from_bytes(status, 0, nb, &req[offset + 6]);
+                rc = _modbus_sparse_write(
+                    ext->sparse, MODBUS_TABLE_BITS, address, nb, status);
+            } else if (ext->flags & MODBUS_MAPPING_PACKED_BITS) {
+                set_packed_bits(mb_mapping->tab_bits, mapping_address, nb, &req[offset + 6]);
+            } else {
+                rc = mapping_write_begin(ext, MODBUS_TABLE_BITS);
+                if (rc == 0) {
+                    modbus_set_bits_from_bytes(
+                        mb_mapping->tab_bits, mapping_address, nb, &req[offset + 6]);
+                    mapping_write_end(ext, MODBUS_TABLE_BITS);
+                }
+            }
 
-            rsp_length = ctx->backend->build_response_basis(&sft, rsp);
-            /* 4 to copy the bit address (2) and the quantity of bits */
-            memcpy(rsp + rsp_length, req + rsp_length, 4);
-            rsp_length += 4;
+            if (rc > 0) {
+                rsp_length = response_exception(ctx,
+                                                &sft,
+                                                rc,
+                                                rsp,
+                                                FALSE,
+                                                "Exception %d of the callback in write_bits\n",
+                                                rc);
+            } else if (rc < 0) {
+                rsp_length = response_exception(ctx,
+                                                &sft,
+                                                MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE,
+                                                rsp,
+                                                FALSE,
+                                                "Server failure in write_bits\n");
+            } else {
+                rsp_length = ctx->backend->build_response_basis(&sft, rsp);
+                /* 4 to copy the bit address (2) and the quantity of bits */
+                memcpy(rsp + rsp_length, req + rsp_length, 4);
+                rsp_length += 4;
+            }
         }
     } break;
     case MODBUS_FC_WRITE_MULTIPLE_REGISTERS: {
@@ -979,6 +1863,7 @@ int modbus_reply(modbus_t *ctx,
         int nb_bytes = req[offset + 5];
         int mapping_address = address - mb_mapping->start_registers;
 
+        callback = mapping_callback(ext, MODBUS_TABLE_REGISTERS, address, nb);
         if (nb < 1 || MODBUS_MAX_WRITE_REGISTERS < nb || nb_bytes != nb * 2) {
             rsp_length = response_exception(
                 ctx,
@@ -989,8 +1874,10 @@ int modbus_reply(modbus_t *ctx,
                 "Illegal number of values %d in write_registers (max %d)\n",
                 nb,
                 MODBUS_MAX_WRITE_REGISTERS);
-        } else if (mapping_address < 0 ||
-                   (mapping_address + nb) > mb_mapping->nb_registers) {
+        } else if (callback == NULL &&
+                   (mapping_address < 0 ||
+                    (mapping_address + nb) > mb_mapping->nb_registers ||
+                    mapping_out_of_ranges(ext, MODBUS_TABLE_REGISTERS, address, nb))) {
             rsp_length =
                 response_exception(ctx,
                                    &sft,
@@ -1000,17 +1887,48 @@ int modbus_reply(modbus_t *ctx,
                                    "Illegal data address 0x%0X in write_registers\n",
                                    mapping_address < 0 ? address : address + nb);
         } else {
-            int i, j;
-            for (i = mapping_address, j = 6; i < mapping_address + nb; i++, j += 2) {
-                /* 6 and 7 = first value */
-                mb_mapping->tab_registers[i] =
-                    (req[offset + j] << 8) + req[offset + j + 1];
+            /* 6 and 7 = first value */
+            if (callback != NULL) {
+                uint16_t registers[MODBUS_MAX_WRITE_REGISTERS];
+
+                _modbus_decode_registers(registers, req + offset + 6, nb);
+                rc = callback_write(callback, MODBUS_TABLE_REGISTERS, address, nb, registers);
+            } else if (ext->flags & MODBUS_MAPPING_SPARSE) {
+                uint16_t registers[MODBUS_MAX_WRITE_REGISTERS];
+
+                _modbus_decode_registers(registers, req + offset + 6, nb);
+                rc = _modbus_sparse_write(
+                    ext->sparse, MODBUS_TABLE_REGISTERS, address, nb, registers);
+            } else {
+                rc = mapping_write_begin(ext, MODBUS_TABLE_REGISTERS);
+                if (rc == 0) {
+                    _modbus_decode_registers(
+                        mb_mapping->tab_registers + mapping_address, req + offset + 6, nb);
+                    mapping_write_end(ext, MODBUS_TABLE_REGISTERS);
+                }
             }
 
-            rsp_length = ctx->backend->build_response_basis(&sft, rsp);
-            /* 4 to copy the address (2) and the no. of registers */
-            memcpy(rsp + rsp_length, req + rsp_length, 4);
-            rsp_length += 4;
+            if (rc > 0) {
+                rsp_length = response_exception(ctx,
+                                                &sft,
+                                                rc,
+                                                rsp,
+                                                FALSE,
+                                                "Exception %d of the callback in write_registers\n",
+                                                rc);
+            } else if (rc < 0) {
+                rsp_length = response_exception(ctx,
+                                                &sft,
+                                                MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE,
+                                                rsp,
+                                                FALSE,
+                                                "Server failure in write_registers\n");
+            } else {
+                rsp_length = ctx->backend->build_response_basis(&sft, rsp);
+                /* 4 to copy the address (2) and the no. of registers */
+                memcpy(rsp + rsp_length, req + rsp_length, 4);
+                rsp_length += 4;
+            }
         }
     } break;
     case MODBUS_FC_REPORT_SLAVE_ID: {
@@ -1039,7 +1957,10 @@ int modbus_reply(modbus_t *ctx,
     case MODBUS_FC_MASK_WRITE_REGISTER: {
         int mapping_address = address - mb_mapping->start_registers;
 
-        if (mapping_address < 0 || mapping_address >= mb_mapping->nb_registers) {
+        callback = mapping_callback(ext, MODBUS_TABLE_REGISTERS, address, 1);
+        if (callback == NULL &&
+            (mapping_address < 0 || mapping_address >= mb_mapping->nb_registers ||
+             mapping_out_of_ranges(ext, MODBUS_TABLE_REGISTERS, address, 1))) {
             rsp_length =
                 response_exception(ctx,
                                    &sft,
@@ -1049,14 +1970,51 @@ int modbus_reply(modbus_t *ctx,
                                    "Illegal data address 0x%0X in write_register\n",
                                    address);
         } else {
-            uint16_t data = mb_mapping->tab_registers[mapping_address];
+            uint16_t data;
             uint16_t and = (req[offset + 3] << 8) + req[offset + 4];
             uint16_t or = (req[offset + 5] << 8) + req[offset + 6];
 
-            data = (data & and) | (or &(~and));
-            mb_mapping->tab_registers[mapping_address] = data;
-            memcpy(rsp, req, req_length);
-            rsp_length = req_length;
+            if (callback != NULL) {
+                rc = callback_read(callback, MODBUS_TABLE_REGISTERS, address, 1, &data);
+                if (rc == 0) {
+                    data = (data & and) | (or &(~and));
+                    rc = callback_write(callback, MODBUS_TABLE_REGISTERS, address, 1, &data);
+                }
+            } else if (ext->flags & MODBUS_MAPPING_SPARSE) {
+                _modbus_sparse_read(
+                    ext->sparse, MODBUS_TABLE_REGISTERS, address, 1, &data);
+                data = (data & and) | (or &(~and));
+                rc = _modbus_sparse_write(
+                    ext->sparse, MODBUS_TABLE_REGISTERS, address, 1, &data);
+            } else {
+                rc = mapping_write_begin(ext, MODBUS_TABLE_REGISTERS);
+                if (rc == 0) {
+                    data = mb_mapping->tab_registers[mapping_address];
+                    data = (data & and) | (or &(~and));
+                    mb_mapping->tab_registers[mapping_address] = data;
+                    mapping_write_end(ext, MODBUS_TABLE_REGISTERS);
+                }
+            }
+            if (rc > 0) {
+                rsp_length = response_exception(ctx,
+                                                &sft,
+                                                rc,
+                                                rsp,
+                                                FALSE,
+                                                "Exception %d of the callback in "
+                                                "mask_write_register\n",
+                                                rc);
+            } else if (rc < 0) {
+                rsp_length = response_exception(ctx,
+                                                &sft,
+                                                MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE,
+                                                rsp,
+                                                FALSE,
+                                                "Server failure in mask_write_register\n");
+            } else {
+                memcpy(rsp, req, req_length);
+                rsp_length = req_length;
+            }
         }
     } break;
     case MODBUS_FC_WRITE_AND_READ_REGISTERS: {
@@ -1066,7 +2024,10 @@ int modbus_reply(modbus_t *ctx,
         int nb_write_bytes = req[offset + 9];
         int mapping_address = address - mb_mapping->start_registers;
         int mapping_address_write = address_write - mb_mapping->start_registers;
+        const _modbus_callback_t *callback_write_range =
+            mapping_callback(ext, MODBUS_TABLE_REGISTERS, address_write, nb_write);
 
+        callback = mapping_callback(ext, MODBUS_TABLE_REGISTERS, address, nb);
         if (nb_write < 1 || MODBUS_MAX_WR_WRITE_REGISTERS < nb_write || nb < 1 ||
             MODBUS_MAX_WR_READ_REGISTERS < nb || nb_write_bytes != nb_write * 2) {
             rsp_length = response_exception(
@@ -1081,10 +2042,14 @@ int modbus_reply(modbus_t *ctx,
                 nb,
                 MODBUS_MAX_WR_WRITE_REGISTERS,
                 MODBUS_MAX_WR_READ_REGISTERS);
-        } else if (mapping_address < 0 ||
-                   (mapping_address + nb) > mb_mapping->nb_registers ||
-                   mapping_address_write < 0 ||
-                   (mapping_address_write + nb_write) > mb_mapping->nb_registers) {
+        } else if ((callback == NULL &&
+                    (mapping_address < 0 || (mapping_address + nb) > mb_mapping->nb_registers ||
+                     mapping_out_of_ranges(ext, MODBUS_TABLE_REGISTERS, address, nb))) ||
+                   (callback_write_range == NULL &&
+                    (mapping_address_write < 0 ||
+                     (mapping_address_write + nb_write) > mb_mapping->nb_registers ||
+                     mapping_out_of_ranges(
+                         ext, MODBUS_TABLE_REGISTERS, address_write, nb_write)))) {
             rsp_length = response_exception(
                 ctx,
                 &sft,
@@ -1095,24 +2060,63 @@ int modbus_reply(modbus_t *ctx,
                 "write_and_read_registers\n",
                 mapping_address < 0 ? address : address + nb,
                 mapping_address_write < 0 ? address_write : address_write + nb_write);
+        } else if (ext->flags & (MODBUS_MAPPING_SPARSE | MODBUS_MAPPING_CALLBACKS)) {
+            uint16_t registers[MODBUS_MAX_WR_READ_REGISTERS];
+
+            /* Write first */
+            _modbus_decode_registers(registers, req + offset + 10, nb_write);
+            rc = mapping_write_registers(
+                mb_mapping, ext, callback_write_range, address_write, nb_write, registers);
+            if (rc == 0) {
+                rc = mapping_read_registers(mb_mapping, ext, callback, address, nb, registers);
+            }
+            if (rc > 0) {
+                rsp_length = response_exception(ctx,
+                                                &sft,
+                                                rc,
+                                                rsp,
+                                                FALSE,
+                                                "Exception %d of the callback in "
+                                                "write_and_read_registers\n",
+                                                rc);
+            } else if (rc < 0) {
+                rsp_length =
+                    response_exception(ctx,
+                                       &sft,
+                                       MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE,
+                                       rsp,
+                                       FALSE,
+                                       "Server failure in write_and_read_registers\n");
+            } else {
+                rsp_length = ctx->backend->build_response_basis(&sft, rsp);
+                rsp[rsp_length++] = nb << 1;
+                _modbus_encode_registers(rsp + rsp_length, registers, nb);
+                rsp_length += nb << 1;
+            }
+        } else if (mapping_write_begin(ext, MODBUS_TABLE_REGISTERS) == -1) {
+            rsp_length =
+                response_exception(ctx,
+                                   &sft,
+                                   MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE,
+                                   rsp,
+                                   FALSE,
+                                   "Server failure in write_and_read_registers\n");
         } else {
-            int i, j;
             rsp_length = ctx->backend->build_response_basis(&sft, rsp);
             rsp[rsp_length++] = nb << 1;
 
-            /* Write first.
+            /* Write first (the table is locked by the previous test).
                10 and 11 are the offset of the first values to write */
-            for (i = mapping_address_write, j = 10; i < mapping_address_write + nb_write;
-                 i++, j += 2) {
-                mb_mapping->tab_registers[i] =
-                    (req[offset + j] << 8) + req[offset + j + 1];
-            }
-
-            /* and read the data for the response */
-            for (i = mapping_address; i < mapping_address + nb; i++) {
-                rsp[rsp_length++] = mb_mapping->tab_registers[i] >> 8;
-                rsp[rsp_length++] = mb_mapping->tab_registers[i] & 0xFF;
-            }
+            _modbus_decode_registers(mb_mapping->tab_registers + mapping_address_write,
+                                     req + offset + 10,
+                                     nb_write);
+
+            /* and read the data for the response, in the same write section
+               so the read values include the written ones */
+            _modbus_encode_registers(
+                rsp + rsp_length, mb_mapping->tab_registers + mapping_address, nb);
+            mapping_write_end(ext, MODBUS_TABLE_REGISTERS);
+            rsp_length += nb << 1;
         }
     } break;
 
@@ -1172,42 +2176,64 @@ int modbus_reply_exception(modbus_t *ctx, const uint8_t *req, unsigned int excep
 }
 
 /* Reads IO status */
-static int read_io_status(modbus_t *ctx, int function, int addr, int nb, uint8_t *dest)
+/* Unpacks nb bits (LSB first) to one byte per bit set to TRUE or FALSE */
+static void decode_bits(uint8_t *dest, const uint8_t *src, int nb)
 {
-    int rc;
-    int req_length;
+    int i;
 
-    uint8_t req[_MIN_REQ_LENGTH];
-    uint8_t rsp[MAX_MESSAGE_LENGTH];
+    for (i = 0; i < nb; i++) {
+        dest[i] = (src[i / 8] & (1 << (i % 8))) ? TRUE : FALSE;
+    }
+}
 
-    req_length = ctx->backend->build_request_basis(ctx, function, addr, nb, req);
+/* Packs nb bits (LSB first) from one byte per bit, returns the byte count */
+static int encode_bits(uint8_t *dest, const uint8_t *src, int nb)
+{
+    int byte_count = (nb / 8) + ((nb % 8) ? 1 : 0);
+    int i;
 
-    rc = send_msg(ctx, req, req_length);
-    if (rc > 0) {
-        int temp, bit;
-        int pos = 0;
-        unsigned int offset;
-        unsigned int offset_end;
+    memset(dest, 0, byte_count);
+    for (i = 0; i < nb; i++) {
+        if (src[i])
+            dest[i / 8] |= 1 << (i % 8);
+    }
 
-        rc = _modbus_receive_msg(ctx, rsp, MSG_CONFIRMATION);
-        if (rc == -1)
+    return byte_count;
+}
+
+/* Returns the big-endian representation of nb registers to send: src itself on
+   a big-endian host, otherwise buffer filled with the swapped values. */
+static const uint8_t *registers_to_data(const uint16_t *src, int nb, uint8_t *buffer)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return (const uint8_t *) src;
+#else
+    _modbus_encode_registers(buffer, src, nb);
+    return buffer;
+#endif
+}
+
+static int read_io_status(modbus_t *ctx, int function, int addr, int nb, uint8_t *dest)
+{
+    int rc;
+    int req_length;
+
+    uint8_t req[_MIN_REQ_LENGTH];
+    uint8_t rsp[MAX_MESSAGE_LENGTH];
+
+    req_length = ctx->backend->build_request_basis(ctx, function, addr, nb, req);
+
+    rc = send_msg(ctx, req, req_length);
+    if (rc > 0) {
+        rc = _modbus_receive_msg(ctx, rsp, MSG_CONFIRMATION);
+        if (rc == -1)
             return -1;
 
         rc = check_confirmation(ctx, req, rsp, rc);
         if (rc == -1)
             return -1;
 
-        offset = ctx->backend->header_length + 2;
-        offset_end = offset + rc;
-        for (unsigned int i = offset; i < offset_end; i++) {
-            /* Shift reg hi_byte to temp */
-            temp = rsp[i];
-
-            for (bit = 0x01; (bit & 0xff) && (pos < nb);) {
-                dest[pos++] = (temp & bit) ? TRUE : FALSE;
-                bit = bit << 1;
-            }
-        }
+        decode_bits(dest, rsp + ctx->backend->header_length + 2, nb);
     }
 
     return rc;
@@ -1295,9 +2321,6 @@ static int read_registers(modbus_t *ctx, int function, int addr, int nb, uint16_
 
     rc = send_msg(ctx, req, req_length);
     if (rc > 0) {
-        unsigned int offset;
-        int i;
-
         rc = _modbus_receive_msg(ctx, rsp, MSG_CONFIRMATION);
         if (rc == -1)
             return -1;
@@ -1306,12 +2329,7 @@ static int read_registers(modbus_t *ctx, int function, int addr, int nb, uint16_
         if (rc == -1)
             return -1;
 
-        offset = ctx->backend->header_length;
-
-        for (i = 0; i < rc; i++) {
-            /* shift reg hi_byte to temp OR with lo_byte */
-            dest[i] = (rsp[offset + 2 + (i << 1)] << 8) | rsp[offset + 3 + (i << 1)];
-        }
+        _modbus_decode_registers(dest, rsp + ctx->backend->header_length + 2, rc);
     }
 
     return rc;
@@ -1423,11 +2441,8 @@ int modbus_write_register(modbus_t *ctx, int addr, const uint16_t value)
 int modbus_write_bits(modbus_t *ctx, int addr, int nb, const uint8_t *src)
 {
     int rc;
-    int i;
     int byte_count;
     int req_length;
-    int bit_check = 0;
-    int pos = 0;
     uint8_t req[MAX_MESSAGE_LENGTH];
 
     if (ctx == NULL) {
@@ -1448,25 +2463,9 @@ int modbus_write_bits(modbus_t *ctx, int addr, int nb, const uint8_t *src)
 
     req_length = ctx->backend->build_request_basis(
         ctx, MODBUS_FC_WRITE_MULTIPLE_COILS, addr, nb, req);
-    byte_count = (nb / 8) + ((nb % 8) ? 1 : 0);
+    byte_count = encode_bits(req + req_length + 1, src, nb);
     req[req_length++] = byte_count;
-
-    for (i = 0; i < byte_count; i++) {
-        int bit;
-
-        bit = 0x01;
-        req[req_length] = 0;
-
-        while ((bit & 0xFF) && (bit_check++ < nb)) {
-            if (src[pos++])
-                req[req_length] |= bit;
-            else
-                req[req_length] &= ~bit;
-
-            bit = bit << 1;
-        }
-        req_length++;
-    }
+    req_length += byte_count;
 
     rc = send_msg(ctx, req, req_length);
     if (rc > 0) {
@@ -1486,10 +2485,11 @@ int modbus_write_bits(modbus_t *ctx, int addr, int nb, const uint8_t *src)
 int modbus_write_registers(modbus_t *ctx, int addr, int nb, const uint16_t *src)
 {
     int rc;
-    int i;
     int req_length;
-    int byte_count;
-    uint8_t req[MAX_MESSAGE_LENGTH];
+    /* Header and byte count, the values are sent from data */
+    uint8_t req[_MIN_REQ_LENGTH + 1];
+    uint8_t buffer[MODBUS_MAX_WRITE_REGISTERS * 2];
+    const uint8_t *data;
 
     if (ctx == NULL) {
         errno = EINVAL;
@@ -1509,15 +2509,10 @@ int modbus_write_registers(modbus_t *ctx, int addr, int nb, const uint16_t *src)
 
     req_length = ctx->backend->build_request_basis(
         ctx, MODBUS_FC_WRITE_MULTIPLE_REGISTERS, addr, nb, req);
-    byte_count = nb * 2;
-    req[req_length++] = byte_count;
+    req[req_length++] = nb * 2;
+    data = registers_to_data(src, nb, buffer);
 
-    for (i = 0; i < nb; i++) {
-        req[req_length++] = src[i] >> 8;
-        req[req_length++] = src[i] & 0x00FF;
-    }
-
-    rc = send_msg(ctx, req, req_length);
+    rc = send_msg_data(ctx, req, req_length, data, nb * 2);
     if (rc > 0) {
         uint8_t rsp[MAX_MESSAGE_LENGTH];
 
@@ -1582,9 +2577,11 @@ int modbus_write_and_read_registers(modbus_t *ctx,
 {
     int rc;
     int req_length;
-    int i;
-    int byte_count;
-    uint8_t req[MAX_MESSAGE_LENGTH];
+    /* Header, write address, quantity and byte count, the values are sent from
+     * data */
+    uint8_t req[_MIN_REQ_LENGTH + 5];
+    uint8_t buffer[MODBUS_MAX_WR_WRITE_REGISTERS * 2];
+    const uint8_t *data;
     uint8_t rsp[MAX_MESSAGE_LENGTH];
 
     if (ctx == NULL) {
@@ -1620,18 +2617,11 @@ int modbus_write_and_read_registers(modbus_t *ctx,
     req[req_length++] = write_addr & 0x00ff;
     req[req_length++] = write_nb >> 8;
     req[req_length++] = write_nb & 0x00ff;
-    byte_count = write_nb * 2;
-    req[req_length++] = byte_count;
+    req[req_length++] = write_nb * 2;
+    data = registers_to_data(src, write_nb, buffer);
 
-    for (i = 0; i < write_nb; i++) {
-        req[req_length++] = src[i] >> 8;
-        req[req_length++] = src[i] & 0x00FF;
-    }
-
-    rc = send_msg(ctx, req, req_length);
+    rc = send_msg_data(ctx, req, req_length, data, write_nb * 2);
     if (rc > 0) {
-        unsigned int offset;
-
         rc = _modbus_receive_msg(ctx, rsp, MSG_CONFIRMATION);
         if (rc == -1)
             return -1;
@@ -1640,16 +2630,13 @@ int modbus_write_and_read_registers(modbus_t *ctx,
         if (rc == -1)
             return -1;
 
-        offset = ctx->backend->header_length;
-        for (i = 0; i < rc; i++) {
-            /* shift reg hi_byte to temp OR with lo_byte */
-            dest[i] = (rsp[offset + 2 + (i << 1)] << 8) | rsp[offset + 3 + (i << 1)];
-        }
+        _modbus_decode_registers(dest, rsp + ctx->backend->header_length + 2, rc);
     }
 
     return rc;
 }
 
+
 /* Send a request to get the slave ID of the device (only available in serial
    communication). */
 int modbus_report_slave_id(modbus_t *ctx, int max_dest, uint8_t *dest)
@@ -1695,190 +2682,1156 @@ int modbus_report_slave_id(modbus_t *ctx, int max_dest, uint8_t *dest)
     return rc;
 }
 
-void _modbus_init_common(modbus_t *ctx)
+/* Returns the time of a monotonic clock in microseconds */
+int64_t _modbus_get_time_us(void)
 {
-    /* Slave and socket are initialized to -1 */
-    ctx->slave = -1;
-    ctx->s = -1;
-
-    ctx->debug = FALSE;
-    ctx->error_recovery = MODBUS_ERROR_RECOVERY_NONE;
-    ctx->quirks = MODBUS_QUIRK_NONE;
-
-    ctx->response_timeout.tv_sec = 0;
-    ctx->response_timeout.tv_usec = _RESPONSE_TIMEOUT;
-
-    ctx->byte_timeout.tv_sec = 0;
-    ctx->byte_timeout.tv_usec = _BYTE_TIMEOUT;
+#ifdef _WIN32
+    return (int64_t) GetTickCount64() * 1000;
+#else
+    struct timespec ts;
 
-    ctx->indication_timeout.tv_sec = 0;
-    ctx->indication_timeout.tv_usec = 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
 }
 
-/* Define the slave number */
-int modbus_set_slave(modbus_t *ctx, int slave)
+/* Checks the function and the number of values of a transaction */
+static int check_transaction(modbus_t *ctx, const modbus_transaction_t *t)
 {
-    if (ctx == NULL) {
+    int max_nb;
+
+    switch (t->function) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+        max_nb = MODBUS_MAX_READ_BITS;
+        break;
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+        max_nb = MODBUS_MAX_READ_REGISTERS;
+        break;
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+    case MODBUS_FC_WRITE_SINGLE_REGISTER:
+        max_nb = 1;
+        break;
+    case MODBUS_FC_WRITE_MULTIPLE_COILS:
+        max_nb = MODBUS_MAX_WRITE_BITS;
+        break;
+    case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+        max_nb = MODBUS_MAX_WRITE_REGISTERS;
+        break;
+    default:
         errno = EINVAL;
         return -1;
     }
 
-    return ctx->backend->set_slave(ctx, slave);
+    if (t->nb > max_nb) {
+        if (ctx->debug) {
+            fprintf(stderr,
+                    "ERROR Too many values in the transaction (%d > %d)\n",
+                    t->nb,
+                    max_nb);
+        }
+        errno = EMBMDATA;
+        return -1;
+    }
+
+    return 0;
 }
 
-int modbus_get_slave(modbus_t *ctx)
+/* Builds the request of a checked transaction, returns the header length. The
+   values to write are returned in data (using buffer when they must be
+   converted) and must be sent after the header. */
+static int build_transaction_request(modbus_t *ctx,
+                                     const modbus_transaction_t *t,
+                                     uint8_t *req,
+                                     uint8_t *buffer,
+                                     const uint8_t **data,
+                                     int *data_length)
 {
-    if (ctx == NULL) {
-        errno = EINVAL;
-        return -1;
+    int req_length;
+    int value;
+    int saved_slave;
+
+    switch (t->function) {
+    case MODBUS_FC_WRITE_SINGLE_COIL:
+        value = *(const uint8_t *) t->src ? 0xFF00 : 0;
+        break;
+    case MODBUS_FC_WRITE_SINGLE_REGISTER:
+        value = *(const uint16_t *) t->src;
+        break;
+    default:
+        value = t->nb;
+        break;
     }
 
-    return ctx->slave;
+    /* The transaction can target another slave than the one of the context */
+    saved_slave = ctx->slave;
+    if (t->slave != -1) {
+        ctx->slave = t->slave;
+    }
+    req_length = ctx->backend->build_request_basis(ctx, t->function, t->addr, value, req);
+    ctx->slave = saved_slave;
+
+    *data = NULL;
+    *data_length = 0;
+    if (t->function == MODBUS_FC_WRITE_MULTIPLE_COILS) {
+        *data_length = encode_bits(buffer, t->src, t->nb);
+        *data = buffer;
+        req[req_length++] = *data_length;
+    } else if (t->function == MODBUS_FC_WRITE_MULTIPLE_REGISTERS) {
+        *data_length = t->nb * 2;
+        *data = registers_to_data(t->src, t->nb, buffer);
+        req[req_length++] = *data_length;
+    }
+
+    return req_length;
 }
 
-int modbus_set_error_recovery(modbus_t *ctx, modbus_error_recovery_mode error_recovery)
+/* Checks the response of a transaction and stores the read values */
+static int decode_transaction_response(modbus_t *ctx,
+                                       modbus_transaction_t *t,
+                                       uint8_t *req,
+                                       uint8_t *rsp,
+                                       int rsp_length)
 {
-    if (ctx == NULL) {
-        errno = EINVAL;
+    const unsigned int offset = ctx->backend->header_length;
+    int rc;
+
+    /* Only the transaction fails, the responses of the other transactions in
+       flight must not be flushed */
+    rc = check_response(ctx, req, rsp, rsp_length, FALSE);
+    if (rc == -1)
         return -1;
+
+    switch (t->function) {
+    case MODBUS_FC_READ_COILS:
+    case MODBUS_FC_READ_DISCRETE_INPUTS:
+        decode_bits(t->dest, rsp + offset + 2, t->nb);
+        /* Number of bits instead of bytes */
+        rc = t->nb;
+        break;
+    case MODBUS_FC_READ_HOLDING_REGISTERS:
+    case MODBUS_FC_READ_INPUT_REGISTERS:
+        _modbus_decode_registers(t->dest, rsp + offset + 2, rc);
+        break;
+    default:
+        break;
     }
 
-    /* The type of modbus_error_recovery_mode is unsigned enum */
-    ctx->error_recovery = (uint8_t) error_recovery;
-    return 0;
+    return rc;
 }
 
-// FIXME Doesn't work under Windows RTU
-int modbus_set_socket(modbus_t *ctx, int s)
+/* Slot of a request waiting for its response */
+typedef struct _async_slot {
+    modbus_transaction_t *transaction;
+    /* Expiration time of the response timeout */
+    int64_t deadline;
+    /* Only the beginning of the request is required to check the response */
+    uint8_t req[_MIN_REQ_LENGTH];
+} async_slot_t;
+
+/* Transactions submitted to a context */
+struct _modbus_async {
+    modbus_complete_t complete;
+    void *user_data;
+    /* Requests sent and waiting for their response */
+    async_slot_t slots[MODBUS_MAX_IN_FLIGHT];
+    int nb_in_flight;
+    /* Circular queue of the transactions to send */
+    modbus_transaction_t **queue;
+    int queue_size;
+    int queue_head;
+    int nb_queued;
+};
+
+static struct _modbus_async *get_async(modbus_t *ctx)
 {
-    if (ctx == NULL) {
-        errno = EINVAL;
-        return -1;
+    if (ctx->async == NULL) {
+        ctx->async = (struct _modbus_async *) calloc(1, sizeof(struct _modbus_async));
+        if (ctx->async == NULL) {
+            errno = ENOMEM;
+        }
     }
 
-    ctx->s = s;
-    return 0;
+    return ctx->async;
 }
 
-int modbus_get_socket(modbus_t *ctx)
+void _modbus_free_async(modbus_t *ctx)
 {
-    if (ctx == NULL) {
-        errno = EINVAL;
-        return -1;
+    if (ctx->async != NULL) {
+        free(ctx->async->queue);
+        free(ctx->async);
+        ctx->async = NULL;
     }
-
-    return ctx->s;
 }
 
-/* Get the timeout interval used to wait for a response */
-int modbus_get_response_timeout(modbus_t *ctx, uint32_t *to_sec, uint32_t *to_usec)
+/* Number of requests sent without waiting for the previous responses, RTU is
+   half-duplex so the requests are sent one by one */
+static int async_window(modbus_t *ctx)
 {
-    if (ctx == NULL) {
-        errno = EINVAL;
-        return -1;
+    if (ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_TCP) {
+        return 1;
     }
 
-    *to_sec = ctx->response_timeout.tv_sec;
-    *to_usec = ctx->response_timeout.tv_usec;
-    return 0;
+    return ctx->max_in_flight;
 }
 
-int modbus_set_response_timeout(modbus_t *ctx, uint32_t to_sec, uint32_t to_usec)
+static void complete_transaction(modbus_t *ctx, modbus_transaction_t *t, int rc, int error)
 {
-    if (ctx == NULL || (to_sec == 0 && to_usec == 0) || to_usec > 999999) {
-        errno = EINVAL;
-        return -1;
+    t->rc = rc;
+    t->error = (rc == -1) ? error : 0;
+    if (ctx->async->complete) {
+        ctx->async->complete(ctx, t, ctx->async->user_data);
     }
+}
 
-    ctx->response_timeout.tv_sec = to_sec;
-    ctx->response_timeout.tv_usec = to_usec;
-    return 0;
+/* Removes the slot i, the callback of its transaction can submit again */
+static void complete_slot(modbus_t *ctx, int i, int rc, int error)
+{
+    struct _modbus_async *async = ctx->async;
+    modbus_transaction_t *t = async->slots[i].transaction;
+
+    async->slots[i] = async->slots[--async->nb_in_flight];
+    complete_transaction(ctx, t, rc, error);
 }
 
-/* Get the timeout interval between two consecutive bytes of a message */
-int modbus_get_byte_timeout(modbus_t *ctx, uint32_t *to_sec, uint32_t *to_usec)
+/* Sends the request of a checked transaction which then waits for its
+   response */
+static int send_transaction(modbus_t *ctx, modbus_transaction_t *t)
 {
-    if (ctx == NULL) {
-        errno = EINVAL;
+    struct _modbus_async *async = ctx->async;
+    /* Header and byte count, the values are sent from data */
+    uint8_t req[_MIN_REQ_LENGTH + 1];
+    uint8_t buffer[MODBUS_MAX_WRITE_REGISTERS * 2];
+    const uint8_t *data;
+    int data_length;
+    async_slot_t *slot;
+    int rc;
+
+    rc = build_transaction_request(ctx, t, req, buffer, &data, &data_length);
+    rc = send_msg_data(ctx, req, rc, data, data_length);
+    if (rc == -1) {
         return -1;
     }
 
-    *to_sec = ctx->byte_timeout.tv_sec;
-    *to_usec = ctx->byte_timeout.tv_usec;
+    slot = &async->slots[async->nb_in_flight++];
+    slot->transaction = t;
+    slot->deadline = _modbus_get_time_us() +
+                     (int64_t) ctx->response_timeout.tv_sec * 1000000 +
+                     ctx->response_timeout.tv_usec;
+    memcpy(slot->req, req, _MIN_REQ_LENGTH);
+
     return 0;
 }
 
-int modbus_set_byte_timeout(modbus_t *ctx, uint32_t to_sec, uint32_t to_usec)
+/* Sends the queued transactions while the window isn't full, returns the
+   number of transactions completed by a failure */
+static int send_queued(modbus_t *ctx)
 {
-    /* Byte timeout can be disabled when both values are zero */
-    if (ctx == NULL || to_usec > 999999) {
-        errno = EINVAL;
-        return -1;
+    struct _modbus_async *async = ctx->async;
+    int nb_completed = 0;
+
+    while (async->nb_queued > 0 && async->nb_in_flight < async_window(ctx)) {
+        modbus_transaction_t *t = async->queue[async->queue_head];
+
+        async->queue_head = (async->queue_head + 1) % async->queue_size;
+        async->nb_queued--;
+        if (send_transaction(ctx, t) == -1) {
+            complete_transaction(ctx, t, -1, errno);
+            nb_completed++;
+        }
     }
 
-    ctx->byte_timeout.tv_sec = to_sec;
-    ctx->byte_timeout.tv_usec = to_usec;
-    return 0;
+    return nb_completed;
 }
 
-/* Get the timeout interval used by the server to wait for an indication from a client */
-int modbus_get_indication_timeout(modbus_t *ctx, uint32_t *to_sec, uint32_t *to_usec)
+/* Reads the bytes available on the link without blocking, returns the number
+   of bytes read (0 if none) or -1 */
+static int recv_available(modbus_t *ctx)
 {
-    if (ctx == NULL) {
-        errno = EINVAL;
+    fd_set rset;
+    struct timeval tv;
+    int available = ctx->rx_end - ctx->rx_start;
+    int rc;
+
+    /* Moves the beginning of the incomplete message to the start of the
+       buffer to have room for the remaining bytes */
+    if (ctx->rx_start > 0) {
+        memmove(ctx->rx_buffer, ctx->rx_buffer + ctx->rx_start, available);
+        ctx->rx_start = 0;
+        ctx->rx_end = available;
+    }
+
+    FD_ZERO(&rset);
+    FD_SET(ctx->s, &rset);
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    rc = ctx->backend->select(ctx, &rset, &tv, 1);
+    if (rc == -1) {
+        return (errno == ETIMEDOUT) ? 0 : -1;
+    }
+
+    rc = ctx->backend->recv(
+        ctx, ctx->rx_buffer + ctx->rx_end, _MODBUS_RX_BUFFER_LENGTH - ctx->rx_end);
+    if (rc == 0) {
+        errno = ECONNRESET;
+        return -1;
+    }
+    if (rc == -1) {
         return -1;
     }
 
-    *to_sec = ctx->indication_timeout.tv_sec;
-    *to_usec = ctx->indication_timeout.tv_usec;
-    return 0;
+    ctx->rx_end += rc;
+    return rc;
 }
 
-int modbus_set_indication_timeout(modbus_t *ctx, uint32_t to_sec, uint32_t to_usec)
+/* Completes the transactions whose response is in the receive buffer, returns
+   the number of completed transactions or -1 if invalid data is received */
+static int process_responses(modbus_t *ctx)
 {
-    /* Indication timeout can be disabled when both values are zero */
-    if (ctx == NULL || to_usec > 999999) {
-        errno = EINVAL;
-        return -1;
+    struct _modbus_async *async = ctx->async;
+    uint8_t rsp[MAX_MESSAGE_LENGTH];
+    int nb_completed = 0;
+
+    while (ctx->rx_end > ctx->rx_start) {
+        uint8_t req[_MIN_REQ_LENGTH];
+        modbus_transaction_t *t;
+        int msg_length;
+        int saved_slave;
+        int rc;
+        int i;
+
+        msg_length = _modbus_compute_msg_length(
+            ctx, ctx->rx_buffer + ctx->rx_start, ctx->rx_end - ctx->rx_start, MSG_CONFIRMATION);
+        if (msg_length == -1) {
+            _error_print(ctx, "invalid message length");
+            return -1;
+        }
+        if (msg_length > ctx->rx_end - ctx->rx_start) {
+            /* Incomplete */
+            break;
+        }
+
+        /* On RTU, the response comes from the slave of the request in flight
+           which can differ from the slave of the context */
+        saved_slave = ctx->slave;
+        if (ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_TCP &&
+            async->nb_in_flight > 0) {
+            ctx->slave = async->slots[0].req[0];
+        }
+        rc = take_msg(ctx, rsp, msg_length);
+        ctx->slave = saved_slave;
+        if (rc == -1) {
+            return -1;
+        }
+        if (rc == 0) {
+            /* Message to ignore */
+            continue;
+        }
+
+        /* Looks for the request of the response */
+        for (i = 0; i < async->nb_in_flight; i++) {
+            if (ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_TCP ||
+                (async->slots[i].req[0] == rsp[0] && async->slots[i].req[1] == rsp[1])) {
+                break;
+            }
+        }
+
+        if (i == async->nb_in_flight) {
+            if (ctx->debug) {
+                fprintf(stderr,
+                        "Response to an unknown transaction (%d)\n",
+                        (rsp[0] << 8) | rsp[1]);
+            }
+            continue;
+        }
+
+        t = async->slots[i].transaction;
+        memcpy(req, async->slots[i].req, _MIN_REQ_LENGTH);
+        rc = decode_transaction_response(ctx, t, req, rsp, msg_length);
+        complete_slot(ctx, i, rc, errno);
+        nb_completed++;
     }
 
-    ctx->indication_timeout.tv_sec = to_sec;
-    ctx->indication_timeout.tv_usec = to_usec;
-    return 0;
+    return nb_completed;
 }
 
-int modbus_get_header_length(modbus_t *ctx)
+/* Completes the transactions whose response timeout has expired */
+static int expire_transactions(modbus_t *ctx)
 {
-    if (ctx == NULL) {
-        errno = EINVAL;
-        return -1;
+    struct _modbus_async *async = ctx->async;
+    int64_t now = _modbus_get_time_us();
+    int nb_completed = 0;
+    int i;
+
+    for (i = 0; i < async->nb_in_flight;) {
+        if (async->slots[i].deadline <= now) {
+            /* The beginning of a late response is useless on a serial line
+             * where the next response can't be distinguished */
+            if (ctx->backend->backend_type != _MODBUS_BACKEND_TYPE_TCP) {
+                _modbus_reset_rx(ctx);
+            }
+            complete_slot(ctx, i, -1, ETIMEDOUT);
+            nb_completed++;
+        } else {
+            i++;
+        }
     }
 
-    return ctx->backend->header_length;
+    return nb_completed;
 }
 
-int modbus_enable_quirks(modbus_t *ctx, unsigned int quirks_mask)
+/* Defines the function called when a transaction submitted by modbus_submit()
+   is completed, user_data is passed to it. */
+int modbus_set_complete_callback(modbus_t *ctx, modbus_complete_t complete, void *user_data)
 {
     if (ctx == NULL) {
         errno = EINVAL;
         return -1;
     }
 
-    /* Enable quirks that have a true value at their index in the mask */
-    ctx->quirks |= quirks_mask;
+    if (get_async(ctx) == NULL) {
+        return -1;
+    }
+
+    ctx->async->complete = complete;
+    ctx->async->user_data = user_data;
     return 0;
 }
 
-int modbus_disable_quirks(modbus_t *ctx, unsigned int quirks_mask)
+/* Submits a transaction without waiting for its response, the request is sent
+   at once if less than max_in_flight requests (see modbus_set_max_in_flight)
+   are waiting for their response, otherwise it's queued. The transaction
+   must stay valid until its completion.
+
+   The responses are received by modbus_process_io() which must be called when
+   the socket returned by modbus_get_socket() is readable or when the delay
+   returned by modbus_get_next_timeout() has expired. The completion callback
+   is then called for each transaction with the same result than
+   modbus_pipeline().
+
+   Returns 0 if successful. Otherwise returns -1 and sets errno, the
+   transaction isn't completed in this case. The responses are delimited by
+   their length so ENOTSUP is returned while the frames are delimited by
+   silences (MODBUS_RTU_FRAMING_SILENCE), modbus_pipeline() can be used
+   instead. */
+int modbus_submit(modbus_t *ctx, modbus_transaction_t *t)
 {
-    if (ctx == NULL) {
+    struct _modbus_async *async;
+
+    if (ctx == NULL || t == NULL) {
         errno = EINVAL;
         return -1;
     }
 
-    /* Disable quirks that have a true value at ther index in the mask */
-    ctx->quirks &= ~quirks_mask;
-    return 0;
+    if (frame_silence(ctx) > 0) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    if (check_transaction(ctx, t) == -1) {
+        return -1;
+    }
+
+    async = get_async(ctx);
+    if (async == NULL) {
+        return -1;
+    }
+
+    if (async->nb_queued == 0 && async->nb_in_flight < async_window(ctx)) {
+        return send_transaction(ctx, t);
+    }
+
+    if (async->nb_queued == async->queue_size) {
+        int size = async->queue_size ? async->queue_size * 2 : 16;
+        modbus_transaction_t **queue;
+        int i;
+
+        queue = (modbus_transaction_t **) malloc(size * sizeof(modbus_transaction_t *));
+        if (queue == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        for (i = 0; i < async->nb_queued; i++) {
+            queue[i] = async->queue[(async->queue_head + i) % async->queue_size];
+        }
+        free(async->queue);
+        async->queue = queue;
+        async->queue_size = size;
+        async->queue_head = 0;
+    }
+
+    async->queue[(async->queue_head + async->nb_queued) % async->queue_size] = t;
+    async->nb_queued++;
+
+    return 0;
+}
+
+/* Processes the submitted transactions without blocking: reads the available
+   bytes, completes the transactions whose response is received or whose
+   response timeout has expired and sends the queued requests.
+
+   Returns the number of completed transactions. On error of the link, the
+   transactions waiting for their response are completed with the error and
+   -1 is returned with errno set, the link can then be closed and connected
+   again before processing the queued transactions. */
+int modbus_process_io(modbus_t *ctx)
+{
+    struct _modbus_async *async;
+    int nb_completed = 0;
+    int error = 0;
+    int rc;
+
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    async = ctx->async;
+    if (async == NULL) {
+        return 0;
+    }
+
+    if (async->nb_in_flight > 0 && !ctx->backend->is_connected(ctx)) {
+        error = ECONNRESET;
+    }
+
+    while (error == 0) {
+        rc = process_responses(ctx);
+        if (rc == -1) {
+            error = errno;
+            break;
+        }
+        nb_completed += rc;
+
+        if (async->nb_in_flight == 0) {
+            break;
+        }
+
+        rc = recv_available(ctx);
+        if (rc == -1) {
+            _error_print(ctx, "read");
+            error = errno;
+        } else if (rc == 0) {
+            break;
+        }
+    }
+
+    if (error) {
+        _modbus_reset_rx(ctx);
+        while (async->nb_in_flight > 0) {
+            complete_slot(ctx, async->nb_in_flight - 1, -1, error);
+            nb_completed++;
+        }
+    }
+
+    nb_completed += expire_transactions(ctx);
+    nb_completed += send_queued(ctx);
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+
+    return nb_completed;
+}
+
+/* Stores the delay until the expiration of the first response timeout.
+   Returns 1 if a response is awaited, 0 if no timeout is running (the values
+   are then set to zero) and -1 on error. */
+int modbus_get_next_timeout(modbus_t *ctx, uint32_t *to_sec, uint32_t *to_usec)
+{
+    struct _modbus_async *async;
+    int64_t deadline;
+    int64_t delay;
+    int i;
+
+    if (ctx == NULL || to_sec == NULL || to_usec == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    async = ctx->async;
+    if (async == NULL || async->nb_in_flight == 0) {
+        *to_sec = 0;
+        *to_usec = 0;
+        return 0;
+    }
+
+    deadline = async->slots[0].deadline;
+    for (i = 1; i < async->nb_in_flight; i++) {
+        if (async->slots[i].deadline < deadline)
+            deadline = async->slots[i].deadline;
+    }
+
+    delay = deadline - _modbus_get_time_us();
+    if (delay < 0) {
+        delay = 0;
+    }
+    *to_sec = delay / 1000000;
+    *to_usec = delay % 1000000;
+
+    return 1;
+}
+
+/* Returns the number of submitted transactions not completed yet */
+int modbus_get_nb_submitted(modbus_t *ctx)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ctx->async == NULL) {
+        return 0;
+    }
+
+    return ctx->async->nb_in_flight + ctx->async->nb_queued;
+}
+
+/* Results of the transactions of modbus_pipeline() */
+typedef struct _pipeline_result {
+    int nb_done;
+    int nb_success;
+} pipeline_result_t;
+
+static void complete_pipeline(modbus_t *ctx, modbus_transaction_t *t, void *user_data)
+{
+    pipeline_result_t *result = (pipeline_result_t *) user_data;
+
+    (void) ctx;
+    result->nb_done++;
+    if (t->rc != -1) {
+        result->nb_success++;
+    }
+}
+
+/* Runs the transactions one by one when the frames are delimited by silences,
+   the responses can't be extracted from the bytes received by
+   modbus_process_io(). Returns the number of successful transactions. */
+static int pipeline_lock_step(modbus_t *ctx, modbus_transaction_t *transactions, int nb)
+{
+    uint8_t req[_MIN_REQ_LENGTH + 1];
+    uint8_t buffer[MODBUS_MAX_WRITE_REGISTERS * 2];
+    uint8_t rsp[MAX_MESSAGE_LENGTH];
+    int nb_success = 0;
+    int i;
+
+    for (i = 0; i < nb; i++) {
+        modbus_transaction_t *t = &transactions[i];
+        const uint8_t *data;
+        int data_length;
+        int saved_slave;
+        int rc;
+
+        rc = check_transaction(ctx, t);
+        if (rc != -1) {
+            rc = build_transaction_request(ctx, t, req, buffer, &data, &data_length);
+            rc = send_msg_data(ctx, req, rc, data, data_length);
+        }
+        if (rc != -1) {
+            /* The response comes from the slave of the request */
+            saved_slave = ctx->slave;
+            ctx->slave = req[0];
+            rc = _modbus_receive_msg(ctx, rsp, MSG_CONFIRMATION);
+            ctx->slave = saved_slave;
+        }
+        if (rc != -1) {
+            rc = decode_transaction_response(ctx, t, req, rsp, rc);
+        }
+
+        t->rc = rc;
+        t->error = (rc == -1) ? errno : 0;
+        if (rc != -1) {
+            nb_success++;
+        }
+    }
+
+    return nb_success;
+}
+
+/* Sends the transactions without waiting for the previous responses, at most
+   max_in_flight requests (see modbus_set_max_in_flight) are pending at the same
+   time. The responses are matched to their requests by transaction identifier
+   so they can be received in any order. RTU is half-duplex so the requests are
+   sent one by one.
+
+   The result of each transaction is stored in its rc field (same value than the
+   corresponding modbus_read_* and modbus_write_* function) and the errno value
+   in its error field when rc is -1.
+
+   When the frames are delimited by silences (MODBUS_RTU_FRAMING_SILENCE), each
+   response is received before the next request is sent.
+
+   Returns the number of successful transactions or -1 if the arguments are
+   invalid or if transactions submitted by modbus_submit() are pending
+   (EBUSY). */
+int modbus_pipeline(modbus_t *ctx, modbus_transaction_t *transactions, int nb)
+{
+    struct _modbus_async *async;
+    pipeline_result_t result = {0, 0};
+    modbus_complete_t saved_complete;
+    void *saved_user_data;
+    int i;
+
+    if (ctx == NULL || nb < 0 || (nb > 0 && transactions == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (nb == 0) {
+        return 0;
+    }
+
+    async = get_async(ctx);
+    if (async == NULL) {
+        return -1;
+    }
+
+    if (async->nb_in_flight > 0 || async->nb_queued > 0) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (frame_silence(ctx) > 0) {
+        return pipeline_lock_step(ctx, transactions, nb);
+    }
+
+    /* The submitted transactions are counted by the pipeline */
+    saved_complete = async->complete;
+    saved_user_data = async->user_data;
+    async->complete = complete_pipeline;
+    async->user_data = &result;
+
+    for (i = 0; i < nb; i++) {
+        if (modbus_submit(ctx, &transactions[i]) == -1) {
+            transactions[i].rc = -1;
+            transactions[i].error = errno;
+            result.nb_done++;
+        }
+    }
+
+    while (result.nb_done < nb) {
+        struct timeval tv;
+        fd_set rset;
+        uint32_t to_sec;
+        uint32_t to_usec;
+
+        modbus_process_io(ctx);
+        if (result.nb_done == nb ||
+            modbus_get_next_timeout(ctx, &to_sec, &to_usec) != 1) {
+            break;
+        }
+
+        /* Waits for the next bytes until the first expiration of a response
+           timeout */
+        FD_ZERO(&rset);
+        FD_SET(ctx->s, &rset);
+        tv.tv_sec = to_sec;
+        tv.tv_usec = to_usec;
+        if (ctx->backend->select(ctx, &rset, &tv, 1) == -1 && errno != ETIMEDOUT) {
+            int error = errno;
+
+            _error_print(ctx, "select");
+            while (async->nb_in_flight > 0) {
+                complete_slot(ctx, async->nb_in_flight - 1, -1, error);
+            }
+        }
+    }
+
+    async->complete = saved_complete;
+    async->user_data = saved_user_data;
+
+    return result.nb_success;
+}
+
+/* Transfers nb values from/to addr in requests of at most max_nb values sent by
+   modbus_pipeline(), size is the size of a value in the arrays. On TCP, all the
+   requests are pipelined (up to MODBUS_MAX_IN_FLIGHT) whatever the window set
+   by modbus_set_max_in_flight. */
+static int transfer_range(modbus_t *ctx,
+                          int function,
+                          int max_nb,
+                          int addr,
+                          int nb,
+                          const void *src,
+                          void *dest,
+                          size_t size)
+{
+    modbus_transaction_t *transactions;
+    int nb_transactions;
+    int saved_max_in_flight;
+    int rc;
+    int i;
+
+    if (ctx == NULL || addr < 0 || nb < 1 || addr + nb > 0x10000) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    nb_transactions = (nb + max_nb - 1) / max_nb;
+    transactions =
+        (modbus_transaction_t *) malloc(nb_transactions * sizeof(modbus_transaction_t));
+    if (transactions == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (i = 0; i < nb_transactions; i++) {
+        const int offset = i * max_nb;
+        modbus_transaction_t *t = &transactions[i];
+
+        t->slave = -1;
+        t->function = function;
+        t->addr = addr + offset;
+        t->nb = (nb - offset < max_nb) ? nb - offset : max_nb;
+        t->src = src ? (const uint8_t *) src + offset * size : NULL;
+        t->dest = dest ? (uint8_t *) dest + offset * size : NULL;
+    }
+
+    saved_max_in_flight = ctx->max_in_flight;
+    if (nb_transactions > ctx->max_in_flight) {
+        ctx->max_in_flight = (nb_transactions < MODBUS_MAX_IN_FLIGHT)
+                                 ? nb_transactions
+                                 : MODBUS_MAX_IN_FLIGHT;
+    }
+    rc = modbus_pipeline(ctx, transactions, nb_transactions);
+    ctx->max_in_flight = saved_max_in_flight;
+    if (rc == nb_transactions) {
+        rc = nb;
+    } else if (rc != -1) {
+        /* Reports the error of the first failed transaction */
+        for (i = 0; transactions[i].rc != -1; i++)
+            ;
+        errno = transactions[i].error;
+        rc = -1;
+    }
+
+    free(transactions);
+
+    return rc;
+}
+
+/* Same as modbus_read_bits but without limit on the number of bits (the
+   requests are split and pipelined, see modbus_pipeline) */
+int modbus_read_bits_range(modbus_t *ctx, int addr, int nb, uint8_t *dest)
+{
+    return transfer_range(
+        ctx, MODBUS_FC_READ_COILS, MODBUS_MAX_READ_BITS, addr, nb, NULL, dest, 1);
+}
+
+int modbus_read_input_bits_range(modbus_t *ctx, int addr, int nb, uint8_t *dest)
+{
+    return transfer_range(ctx,
+                          MODBUS_FC_READ_DISCRETE_INPUTS,
+                          MODBUS_MAX_READ_BITS,
+                          addr,
+                          nb,
+                          NULL,
+                          dest,
+                          1);
+}
+
+int modbus_read_registers_range(modbus_t *ctx, int addr, int nb, uint16_t *dest)
+{
+    return transfer_range(ctx,
+                          MODBUS_FC_READ_HOLDING_REGISTERS,
+                          MODBUS_MAX_READ_REGISTERS,
+                          addr,
+                          nb,
+                          NULL,
+                          dest,
+                          sizeof(uint16_t));
+}
+
+int modbus_read_input_registers_range(modbus_t *ctx, int addr, int nb, uint16_t *dest)
+{
+    return transfer_range(ctx,
+                          MODBUS_FC_READ_INPUT_REGISTERS,
+                          MODBUS_MAX_READ_REGISTERS,
+                          addr,
+                          nb,
+                          NULL,
+                          dest,
+                          sizeof(uint16_t));
+}
+
+int modbus_write_bits_range(modbus_t *ctx, int addr, int nb, const uint8_t *src)
+{
+    return transfer_range(ctx,
+                          MODBUS_FC_WRITE_MULTIPLE_COILS,
+                          MODBUS_MAX_WRITE_BITS,
+                          addr,
+                          nb,
+                          src,
+                          NULL,
+                          1);
+}
+
+int modbus_write_registers_range(modbus_t *ctx, int addr, int nb, const uint16_t *src)
+{
+    return transfer_range(ctx,
+                          MODBUS_FC_WRITE_MULTIPLE_REGISTERS,
+                          MODBUS_MAX_WRITE_REGISTERS,
+                          addr,
+                          nb,
+                          src,
+                          NULL,
+                          sizeof(uint16_t));
+}
+
+void _modbus_init_common(modbus_t *ctx)
+{
+    /* Slave and socket are initialized to -1 */
+    ctx->slave = -1;
+    ctx->s = -1;
+
+    ctx->debug = FALSE;
+    ctx->error_recovery = MODBUS_ERROR_RECOVERY_NONE;
+    ctx->quirks = MODBUS_QUIRK_NONE;
+
+    ctx->response_timeout.tv_sec = 0;
+    ctx->response_timeout.tv_usec = _RESPONSE_TIMEOUT;
+
+    ctx->byte_timeout.tv_sec = 0;
+    ctx->byte_timeout.tv_usec = _BYTE_TIMEOUT;
+
+    ctx->indication_timeout.tv_sec = 0;
+    ctx->indication_timeout.tv_usec = 0;
+
+    ctx->max_in_flight = 1;
+    ctx->async = NULL;
+    ctx->units = NULL;
+    ctx->mapping = NULL;
+    ctx->mapping_ext = NULL;
+    ctx->mapping_ext_generation = 0;
+
+    _modbus_reset_rx(ctx);
+}
+
+/* Serves each unit ID (slave) with its own mapping, units is an array of
+   MODBUS_MAX_UNITS mappings indexed by unit ID, NULL for the units to ignore.
+   The array is used by modbus_reply() in place of its mb_mapping argument and
+   by the RTU backend to filter the requests, units[0] serves the broadcasts.
+   The array isn't copied, NULL restores the single slave ID. */
+int modbus_set_units(modbus_t *ctx, modbus_mapping_t *const *units)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ctx->units = units;
+
+    return 0;
+}
+
+/* Define the slave number */
+int modbus_set_slave(modbus_t *ctx, int slave)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ctx->backend->set_slave(ctx, slave);
+}
+
+int modbus_get_slave(modbus_t *ctx)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ctx->slave;
+}
+
+int modbus_set_error_recovery(modbus_t *ctx, modbus_error_recovery_mode error_recovery)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* The type of modbus_error_recovery_mode is unsigned enum */
+    ctx->error_recovery = (uint8_t) error_recovery;
+    return 0;
+}
+
+// FIXME Doesn't work under Windows RTU
+int modbus_set_socket(modbus_t *ctx, int s)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (s != ctx->s) {
+        /* The buffered bytes belong to the previous socket */
+        _modbus_reset_rx(ctx);
+    }
+
+    ctx->s = s;
+    return 0;
+}
+
+/* Defines the maximum number of requests sent by modbus_pipeline() without
+   waiting for their responses, the server must be able to queue them. */
+int modbus_set_max_in_flight(modbus_t *ctx, int nb)
+{
+    if (ctx == NULL || nb < 1 || nb > MODBUS_MAX_IN_FLIGHT) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ctx->max_in_flight = nb;
+    return 0;
+}
+
+int modbus_get_max_in_flight(modbus_t *ctx)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ctx->max_in_flight;
+}
+
+/* Returns the number of received bytes not yet consumed by modbus_receive() or
+   modbus_receive_confirmation(). A server waiting on the socket with select()
+   must process them before waiting again because they won't make the socket
+   readable. */
+int modbus_get_pending_length(modbus_t *ctx)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ctx->rx_end - ctx->rx_start;
+}
+
+int modbus_get_socket(modbus_t *ctx)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ctx->s;
+}
+
+/* Get the timeout interval used to wait for a response */
+int modbus_get_response_timeout(modbus_t *ctx, uint32_t *to_sec, uint32_t *to_usec)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *to_sec = ctx->response_timeout.tv_sec;
+    *to_usec = ctx->response_timeout.tv_usec;
+    return 0;
+}
+
+int modbus_set_response_timeout(modbus_t *ctx, uint32_t to_sec, uint32_t to_usec)
+{
+    if (ctx == NULL || (to_sec == 0 && to_usec == 0) || to_usec > 999999) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ctx->response_timeout.tv_sec = to_sec;
+    ctx->response_timeout.tv_usec = to_usec;
+    return 0;
+}
+
+/* Get the timeout interval between two consecutive bytes of a message */
+int modbus_get_byte_timeout(modbus_t *ctx, uint32_t *to_sec, uint32_t *to_usec)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *to_sec = ctx->byte_timeout.tv_sec;
+    *to_usec = ctx->byte_timeout.tv_usec;
+    return 0;
+}
+
+int modbus_set_byte_timeout(modbus_t *ctx, uint32_t to_sec, uint32_t to_usec)
+{
+    /* Byte timeout can be disabled when both values are zero */
+    if (ctx == NULL || to_usec > 999999) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ctx->byte_timeout.tv_sec = to_sec;
+    ctx->byte_timeout.tv_usec = to_usec;
+    return 0;
+}
+
+/* Get the timeout interval used by the server to wait for an indication from a client */
+int modbus_get_indication_timeout(modbus_t *ctx, uint32_t *to_sec, uint32_t *to_usec)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *to_sec = ctx->indication_timeout.tv_sec;
+    *to_usec = ctx->indication_timeout.tv_usec;
+    return 0;
+}
+
+int modbus_set_indication_timeout(modbus_t *ctx, uint32_t to_sec, uint32_t to_usec)
+{
+    /* Indication timeout can be disabled when both values are zero */
+    if (ctx == NULL || to_usec > 999999) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ctx->indication_timeout.tv_sec = to_sec;
+    ctx->indication_timeout.tv_usec = to_usec;
+    return 0;
+}
+
+int modbus_get_header_length(modbus_t *ctx)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ctx->backend->header_length;
+}
+
+int modbus_enable_quirks(modbus_t *ctx, unsigned int quirks_mask)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Enable quirks that have a true value at their index in the mask */
+    ctx->quirks |= quirks_mask;
+    return 0;
+}
+
+int modbus_disable_quirks(modbus_t *ctx, unsigned int quirks_mask)
+{
+    if (ctx == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Disable quirks that have a true value at ther index in the mask */
+    ctx->quirks &= ~quirks_mask;
+    return 0;
 }
 
 int modbus_connect(modbus_t *ctx)
@@ -1888,6 +3841,7 @@ int modbus_connect(modbus_t *ctx)
         return -1;
     }
 
+    _modbus_reset_rx(ctx);
     return ctx->backend->connect(ctx);
 }
 
@@ -1897,6 +3851,7 @@ void modbus_close(modbus_t *ctx)
         return;
 
     ctx->backend->close(ctx);
+    _modbus_reset_rx(ctx);
 }
 
 void modbus_free(modbus_t *ctx)
@@ -1904,6 +3859,7 @@ void modbus_free(modbus_t *ctx)
     if (ctx == NULL)
         return;
 
+    _modbus_free_async(ctx);
     ctx->backend->free(ctx);
 }
 
@@ -1918,20 +3874,26 @@ int modbus_set_debug(modbus_t *ctx, int flag)
     return 0;
 }
 
-/* Allocates 4 arrays to store bits, input bits, registers and inputs
-   registers. The pointers are stored in modbus_mapping structure.
+/* Size in bytes of a table of nb_bits bits. A packed table has a spare byte
+   so the bits can be accessed by 16-bit words. */
+static size_t bits_table_size(unsigned int nb_bits, unsigned int flags)
+{
+    if (flags & MODBUS_MAPPING_PACKED_BITS) {
+        return (nb_bits / 8) + ((nb_bits % 8) ? 1 : 0) + 1;
+    }
 
-   The modbus_mapping_new_start_address() function shall return the new allocated
-   structure if successful. Otherwise it shall return NULL and set errno to
-   ENOMEM. */
-modbus_mapping_t *modbus_mapping_new_start_address(unsigned int start_bits,
-                                                   unsigned int nb_bits,
-                                                   unsigned int start_input_bits,
-                                                   unsigned int nb_input_bits,
-                                                   unsigned int start_registers,
-                                                   unsigned int nb_registers,
-                                                   unsigned int start_input_registers,
-                                                   unsigned int nb_input_registers)
+    return nb_bits * sizeof(uint8_t);
+}
+
+static modbus_mapping_t *mapping_new(unsigned int start_bits,
+                                     unsigned int nb_bits,
+                                     unsigned int start_input_bits,
+                                     unsigned int nb_input_bits,
+                                     unsigned int start_registers,
+                                     unsigned int nb_registers,
+                                     unsigned int start_input_registers,
+                                     unsigned int nb_input_registers,
+                                     unsigned int flags)
 {
     modbus_mapping_t *mb_mapping;
 
@@ -1947,12 +3909,12 @@ modbus_mapping_t *modbus_mapping_new_start_address(unsigned int start_bits,
         mb_mapping->tab_bits = NULL;
     } else {
         /* Negative number raises a POSIX error */
-        mb_mapping->tab_bits = (uint8_t *) malloc(nb_bits * sizeof(uint8_t));
+        mb_mapping->tab_bits = (uint8_t *) malloc(bits_table_size(nb_bits, flags));
         if (mb_mapping->tab_bits == NULL) {
             free(mb_mapping);
             return NULL;
         }
-        memset(mb_mapping->tab_bits, 0, nb_bits * sizeof(uint8_t));
+        memset(mb_mapping->tab_bits, 0, bits_table_size(nb_bits, flags));
     }
 
     /* 1X */
@@ -1961,13 +3923,14 @@ modbus_mapping_t *modbus_mapping_new_start_address(unsigned int start_bits,
     if (nb_input_bits == 0) {
         mb_mapping->tab_input_bits = NULL;
     } else {
-        mb_mapping->tab_input_bits = (uint8_t *) malloc(nb_input_bits * sizeof(uint8_t));
+        mb_mapping->tab_input_bits =
+            (uint8_t *) malloc(bits_table_size(nb_input_bits, flags));
         if (mb_mapping->tab_input_bits == NULL) {
             free(mb_mapping->tab_bits);
             free(mb_mapping);
             return NULL;
         }
-        memset(mb_mapping->tab_input_bits, 0, nb_input_bits * sizeof(uint8_t));
+        memset(mb_mapping->tab_input_bits, 0, bits_table_size(nb_input_bits, flags));
     }
 
     /* 4X */
@@ -2007,6 +3970,284 @@ modbus_mapping_t *modbus_mapping_new_start_address(unsigned int start_bits,
     return mb_mapping;
 }
 
+/* Allocates 4 arrays to store bits, input bits, registers and inputs
+   registers. The pointers are stored in modbus_mapping structure.
+
+   The modbus_mapping_new_start_address() function shall return the new allocated
+   structure if successful. Otherwise it shall return NULL and set errno to
+   ENOMEM. */
+modbus_mapping_t *modbus_mapping_new_start_address(unsigned int start_bits,
+                                                   unsigned int nb_bits,
+                                                   unsigned int start_input_bits,
+                                                   unsigned int nb_input_bits,
+                                                   unsigned int start_registers,
+                                                   unsigned int nb_registers,
+                                                   unsigned int start_input_registers,
+                                                   unsigned int nb_input_registers)
+{
+    return mapping_new(start_bits,
+                       nb_bits,
+                       start_input_bits,
+                       nb_input_bits,
+                       start_registers,
+                       nb_registers,
+                       start_input_registers,
+                       nb_input_registers,
+                       0);
+}
+
+/* Same as modbus_mapping_new_start_address() but the bits and input bits are
+   packed 8 per byte (MODBUS_MAPPING_PACKED_BITS), they should be accessed with
+   modbus_mapping_get_bit() and friends. */
+modbus_mapping_t *modbus_mapping_new_packed_bits(unsigned int start_bits,
+                                                 unsigned int nb_bits,
+                                                 unsigned int start_input_bits,
+                                                 unsigned int nb_input_bits,
+                                                 unsigned int start_registers,
+                                                 unsigned int nb_registers,
+                                                 unsigned int start_input_registers,
+                                                 unsigned int nb_input_registers)
+{
+    modbus_mapping_t *mb_mapping;
+
+    mb_mapping = mapping_new(start_bits,
+                             nb_bits,
+                             start_input_bits,
+                             nb_input_bits,
+                             start_registers,
+                             nb_registers,
+                             start_input_registers,
+                             nb_input_registers,
+                             MODBUS_MAPPING_PACKED_BITS);
+    if (mb_mapping == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (mapping_ext_add(mb_mapping, MODBUS_MAPPING_PACKED_BITS) == NULL) {
+        /* Frees the tables as a mapping built by hand */
+        modbus_mapping_free(mb_mapping);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return mb_mapping;
+}
+
+/* Allocates a sparse mapping (MODBUS_MAPPING_SPARSE) without any valid
+   address, the ranges are added with modbus_mapping_add_range(). Returns NULL
+   and sets errno to ENOMEM on error. */
+modbus_mapping_t *modbus_mapping_new_sparse(void)
+{
+    modbus_mapping_t *mb_mapping;
+    _modbus_mapping_ext_t *ext;
+
+    mb_mapping = mapping_new(0, 0, 0, 0, 0, 0, 0, 0, 0);
+    if (mb_mapping == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ext = mapping_ext_add(mb_mapping, MODBUS_MAPPING_SPARSE);
+    if (ext == NULL) {
+        free(mb_mapping);
+        return NULL;
+    }
+
+    ext->sparse = _modbus_sparse_new();
+    if (ext->sparse == NULL) {
+        mapping_ext_remove(ext);
+        free(mb_mapping);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    /* The tables cover the whole address space, the ranges are checked by
+       modbus_reply() */
+    mb_mapping->nb_bits = 65536;
+    mb_mapping->nb_input_bits = 65536;
+    mb_mapping->nb_registers = 65536;
+    mb_mapping->nb_input_registers = 65536;
+
+    return mb_mapping;
+}
+
+/* Builds the mapping of the tables of a shared memory region */
+static modbus_mapping_t *mapping_shm(struct _modbus_shm *shm)
+{
+    const modbus_shm_header_t *header = shm->header;
+    modbus_mapping_t *mb_mapping;
+    _modbus_mapping_ext_t *ext;
+
+    mb_mapping = mapping_new(0, 0, 0, 0, 0, 0, 0, 0, 0);
+    if (mb_mapping == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ext = mapping_ext_add(mb_mapping, MODBUS_MAPPING_SHM);
+    if (ext == NULL) {
+        free(mb_mapping);
+        return NULL;
+    }
+    ext->shm = shm;
+
+    mb_mapping->start_bits = header->tables[MODBUS_TABLE_BITS].start;
+    mb_mapping->nb_bits = header->tables[MODBUS_TABLE_BITS].nb;
+    mb_mapping->tab_bits = (uint8_t *) _modbus_shm_table(shm, MODBUS_TABLE_BITS);
+    mb_mapping->start_input_bits = header->tables[MODBUS_TABLE_INPUT_BITS].start;
+    mb_mapping->nb_input_bits = header->tables[MODBUS_TABLE_INPUT_BITS].nb;
+    mb_mapping->tab_input_bits =
+        (uint8_t *) _modbus_shm_table(shm, MODBUS_TABLE_INPUT_BITS);
+    mb_mapping->start_registers = header->tables[MODBUS_TABLE_REGISTERS].start;
+    mb_mapping->nb_registers = header->tables[MODBUS_TABLE_REGISTERS].nb;
+    mb_mapping->tab_registers = (uint16_t *) _modbus_shm_table(shm, MODBUS_TABLE_REGISTERS);
+    mb_mapping->start_input_registers = header->tables[MODBUS_TABLE_INPUT_REGISTERS].start;
+    mb_mapping->nb_input_registers = header->tables[MODBUS_TABLE_INPUT_REGISTERS].nb;
+    mb_mapping->tab_input_registers =
+        (uint16_t *) _modbus_shm_table(shm, MODBUS_TABLE_INPUT_REGISTERS);
+
+    return mb_mapping;
+}
+
+/* Makes the nb addresses from start of the table valid in a sparse mapping,
+   the ranges can overlap. */
+int modbus_mapping_add_range(modbus_mapping_t *mb_mapping,
+                             modbus_table_t table,
+                             int start,
+                             int nb)
+{
+    const _modbus_mapping_ext_t *ext = mapping_ext(mb_mapping);
+
+    if (mb_mapping == NULL || !(ext->flags & MODBUS_MAPPING_SPARSE) ||
+        table < MODBUS_TABLE_BITS || table > MODBUS_TABLE_INPUT_REGISTERS || start < 0 ||
+        nb < 1 || start + nb > 65536) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return _modbus_sparse_add_range(ext->sparse, table, start, nb);
+}
+
+/* Serves the nb addresses from start of the table with the callbacks, the
+   range can't overlap another callback range of the table. The values of a
+   request must be all in the range or all out of the callback ranges. A NULL
+   callback makes the range read-only or write-only. The ranges are released
+   by modbus_mapping_free(), even for a mapping built by hand. */
+int modbus_mapping_add_callback(modbus_mapping_t *mb_mapping,
+                                modbus_table_t table,
+                                int start,
+                                int nb,
+                                modbus_mapping_read_cb read_cb,
+                                modbus_mapping_write_cb write_cb,
+                                void *user_data)
+{
+    _modbus_mapping_ext_t *ext;
+
+    if (mb_mapping == NULL || table < MODBUS_TABLE_BITS ||
+        table > MODBUS_TABLE_INPUT_REGISTERS || start < 0 || nb < 1 || start + nb > 65536 ||
+        (read_cb == NULL && write_cb == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ext = mapping_ext_find(mb_mapping);
+    if (ext == NULL) {
+        /* Mapping built by hand */
+        ext = mapping_ext_add(mb_mapping, 0);
+        if (ext == NULL) {
+            return -1;
+        }
+    }
+
+    if (!(ext->flags & MODBUS_MAPPING_CALLBACKS)) {
+        ext->callbacks = _modbus_callbacks_new();
+        if (ext->callbacks == NULL) {
+            return -1;
+        }
+        ext->flags |= MODBUS_MAPPING_CALLBACKS;
+    }
+
+    return _modbus_callbacks_add(
+        ext->callbacks, table, start, nb, read_cb, write_cb, user_data);
+}
+
+/* Allocates a mapping whose 4 tables are stored in the shared memory region
+   name (see modbus_shm_header_t), created with zeroed values and the
+   permissions mode (0600 keeps it to the processes of the user). It fails
+   with EEXIST when a region of the same name exists, unless replace is TRUE
+   (the processes mapping the previous region keep it). The region is removed
+   by modbus_mapping_free(). Returns NULL and sets errno on error, ENOSYS when
+   the platform has no POSIX shared memory. */
+modbus_mapping_t *modbus_mapping_new_shm(const char *name,
+                                         unsigned int mode,
+                                         int replace,
+                                         unsigned int start_bits,
+                                         unsigned int nb_bits,
+                                         unsigned int start_input_bits,
+                                         unsigned int nb_input_bits,
+                                         unsigned int start_registers,
+                                         unsigned int nb_registers,
+                                         unsigned int start_input_registers,
+                                         unsigned int nb_input_registers)
+{
+    const unsigned int start[] = {
+        start_bits, start_input_bits, start_registers, start_input_registers};
+    const unsigned int nb[] = {nb_bits, nb_input_bits, nb_registers, nb_input_registers};
+    modbus_mapping_t *mb_mapping;
+    struct _modbus_shm *shm;
+    int table;
+
+    if (name == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    for (table = MODBUS_TABLE_BITS; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+        if (start[table] + nb[table] > 65536) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    shm = _modbus_shm_create(name, mode, replace, start, nb);
+    if (shm == NULL) {
+        return NULL;
+    }
+
+    mb_mapping = mapping_shm(shm);
+    if (mb_mapping == NULL) {
+        _modbus_shm_close(shm);
+    }
+
+    return mb_mapping;
+}
+
+/* Opens the shared memory region created by modbus_mapping_new_shm() in
+   another process, the values are read and written through the returned
+   mapping. modbus_mapping_free() unmaps the region without removing it. */
+modbus_mapping_t *modbus_mapping_open_shm(const char *name)
+{
+    modbus_mapping_t *mb_mapping;
+    struct _modbus_shm *shm;
+
+    if (name == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    shm = _modbus_shm_open(name);
+    if (shm == NULL) {
+        return NULL;
+    }
+
+    mb_mapping = mapping_shm(shm);
+    if (mb_mapping == NULL) {
+        _modbus_shm_close(shm);
+    }
+
+    return mb_mapping;
+}
+
 modbus_mapping_t *modbus_mapping_new(int nb_bits,
                                      int nb_input_bits,
                                      int nb_registers,
@@ -2019,10 +4260,32 @@ modbus_mapping_t *modbus_mapping_new(int nb_bits,
 /* Frees the 4 arrays */
 void modbus_mapping_free(modbus_mapping_t *mb_mapping)
 {
+    _modbus_mapping_ext_t *ext;
+
     if (mb_mapping == NULL) {
         return;
     }
 
+    ext = mapping_ext_find(mb_mapping);
+    if (ext != NULL) {
+        unsigned int flags = ext->flags;
+
+        if (flags & MODBUS_MAPPING_SPARSE) {
+            _modbus_sparse_free(ext->sparse);
+        }
+        if (flags & MODBUS_MAPPING_CALLBACKS) {
+            _modbus_callbacks_free(ext->callbacks);
+        }
+        if (flags & MODBUS_MAPPING_SHM) {
+            /* The tables are in the region */
+            _modbus_shm_close(ext->shm);
+        }
+        mapping_ext_remove(ext);
+        if (flags & MODBUS_MAPPING_SHM) {
+            free(mb_mapping);
+            return;
+        }
+    }
     free(mb_mapping->tab_input_registers);
     free(mb_mapping->tab_registers);
     free(mb_mapping->tab_input_bits);
@@ -2030,6 +4293,219 @@ void modbus_mapping_free(modbus_mapping_t *mb_mapping)
     free(mb_mapping);
 }
 
+/* Returns the index of the address in a table of the mapping or -1 */
+static int mapping_index(int start, int nb, int addr)
+{
+    if (addr < start || addr - start >= nb) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return addr - start;
+}
+
+/* Returns the value (ON/OFF for the bits) at the Modbus address of the table
+   or -1 */
+static int mapping_get(const modbus_mapping_t *mb_mapping, modbus_table_t table, int addr)
+{
+    int i;
+    const _modbus_mapping_ext_t *ext;
+
+    if (mb_mapping == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ext = mapping_ext(mb_mapping);
+    if (ext->flags & MODBUS_MAPPING_SPARSE) {
+        if (addr < 0 || addr > 0xFFFF ||
+            !_modbus_sparse_is_valid(ext->sparse, table, addr, 1)) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (table == MODBUS_TABLE_BITS || table == MODBUS_TABLE_INPUT_BITS) {
+            uint8_t value;
+
+            _modbus_sparse_read(ext->sparse, table, addr, 1, &value);
+            return value ? ON : OFF;
+        } else {
+            uint16_t value;
+
+            _modbus_sparse_read(ext->sparse, table, addr, 1, &value);
+            return value;
+        }
+    }
+
+    switch (table) {
+    case MODBUS_TABLE_BITS:
+        i = mapping_index(mb_mapping->start_bits, mb_mapping->nb_bits, addr);
+        return (i == -1) ? -1 : get_mapping_bit(ext, mb_mapping->tab_bits, i);
+    case MODBUS_TABLE_INPUT_BITS:
+        i = mapping_index(mb_mapping->start_input_bits, mb_mapping->nb_input_bits, addr);
+        return (i == -1) ? -1 : get_mapping_bit(ext, mb_mapping->tab_input_bits, i);
+    case MODBUS_TABLE_REGISTERS:
+        i = mapping_index(mb_mapping->start_registers, mb_mapping->nb_registers, addr);
+        return (i == -1) ? -1 : mb_mapping->tab_registers[i];
+    case MODBUS_TABLE_INPUT_REGISTERS:
+        i = mapping_index(
+            mb_mapping->start_input_registers, mb_mapping->nb_input_registers, addr);
+        return (i == -1) ? -1 : mb_mapping->tab_input_registers[i];
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+/* Sets the value at the Modbus address of the table, a sparse mapping can
+   fail with ENOMEM */
+static int
+mapping_set(modbus_mapping_t *mb_mapping, modbus_table_t table, int addr, uint16_t value)
+{
+    int i;
+    const _modbus_mapping_ext_t *ext;
+
+    if (mb_mapping == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ext = mapping_ext(mb_mapping);
+    if (ext->flags & MODBUS_MAPPING_SPARSE) {
+        if (addr < 0 || addr > 0xFFFF ||
+            !_modbus_sparse_is_valid(ext->sparse, table, addr, 1)) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (table == MODBUS_TABLE_BITS || table == MODBUS_TABLE_INPUT_BITS) {
+            uint8_t status = value ? ON : OFF;
+
+            return _modbus_sparse_write(ext->sparse, table, addr, 1, &status);
+        }
+        return _modbus_sparse_write(ext->sparse, table, addr, 1, &value);
+    }
+
+    switch (table) {
+    case MODBUS_TABLE_BITS:
+        i = mapping_index(mb_mapping->start_bits, mb_mapping->nb_bits, addr);
+        if (i == -1) {
+            return -1;
+        }
+        set_mapping_bit(ext, mb_mapping->tab_bits, i, value);
+        return 0;
+    case MODBUS_TABLE_INPUT_BITS:
+        i = mapping_index(mb_mapping->start_input_bits, mb_mapping->nb_input_bits, addr);
+        if (i == -1) {
+            return -1;
+        }
+        set_mapping_bit(ext, mb_mapping->tab_input_bits, i, value);
+        return 0;
+    case MODBUS_TABLE_REGISTERS:
+        i = mapping_index(mb_mapping->start_registers, mb_mapping->nb_registers, addr);
+        if (i == -1) {
+            return -1;
+        }
+        mb_mapping->tab_registers[i] = value;
+        return 0;
+    case MODBUS_TABLE_INPUT_REGISTERS:
+        i = mapping_index(
+            mb_mapping->start_input_registers, mb_mapping->nb_input_registers, addr);
+        if (i == -1) {
+            return -1;
+        }
+        mb_mapping->tab_input_registers[i] = value;
+        return 0;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+/* The accessors take the Modbus address and support all the layouts of the
+   mapping. The getters of the bits return ON, OFF or -1 on error, the getters
+   of the registers return the value or -1. */
+int modbus_mapping_get_bit(const modbus_mapping_t *mb_mapping, int addr)
+{
+    return mapping_get(mb_mapping, MODBUS_TABLE_BITS, addr);
+}
+
+int modbus_mapping_set_bit(modbus_mapping_t *mb_mapping, int addr, int value)
+{
+    return mapping_set(mb_mapping, MODBUS_TABLE_BITS, addr, value ? ON : OFF);
+}
+
+int modbus_mapping_get_input_bit(const modbus_mapping_t *mb_mapping, int addr)
+{
+    return mapping_get(mb_mapping, MODBUS_TABLE_INPUT_BITS, addr);
+}
+
+int modbus_mapping_set_input_bit(modbus_mapping_t *mb_mapping, int addr, int value)
+{
+    return mapping_set(mb_mapping, MODBUS_TABLE_INPUT_BITS, addr, value ? ON : OFF);
+}
+
+int modbus_mapping_get_register(const modbus_mapping_t *mb_mapping, int addr)
+{
+    return mapping_get(mb_mapping, MODBUS_TABLE_REGISTERS, addr);
+}
+
+int modbus_mapping_set_register(modbus_mapping_t *mb_mapping, int addr, uint16_t value)
+{
+    return mapping_set(mb_mapping, MODBUS_TABLE_REGISTERS, addr, value);
+}
+
+int modbus_mapping_get_input_register(const modbus_mapping_t *mb_mapping, int addr)
+{
+    return mapping_get(mb_mapping, MODBUS_TABLE_INPUT_REGISTERS, addr);
+}
+
+int modbus_mapping_set_input_register(modbus_mapping_t *mb_mapping, int addr, uint16_t value)
+{
+    return mapping_set(mb_mapping, MODBUS_TABLE_INPUT_REGISTERS, addr, value);
+}
+
+/* Brackets the writes of several values of a table of a shared memory
+   mapping so the readers of the other processes never see a part of them.
+   The writers of a table, in all the processes, are serialized. Returns -1
+   and sets errno to ETIMEDOUT when the table stays locked by another writer
+   (a process killed in the middle of a write), 0 otherwise. Nothing is done
+   for the other mappings. */
+int modbus_mapping_write_begin(modbus_mapping_t *mb_mapping, modbus_table_t table)
+{
+    return mapping_write_begin(mapping_ext(mb_mapping), table);
+}
+
+void modbus_mapping_write_end(modbus_mapping_t *mb_mapping, modbus_table_t table)
+{
+    mapping_write_end(mapping_ext(mb_mapping), table);
+}
+
+/* Stores the generation to pass to modbus_mapping_read_retry() once the
+   values of the table are copied:
+
+   do {
+       rc = modbus_mapping_read_begin(mb_mapping, MODBUS_TABLE_REGISTERS, &generation);
+       memcpy(dest, mb_mapping->tab_registers, nb * sizeof(uint16_t));
+   } while (rc == 0 &&
+            modbus_mapping_read_retry(mb_mapping, MODBUS_TABLE_REGISTERS, generation));
+
+   Returns -1 and sets errno to ETIMEDOUT when the table stays locked by a
+   writer, the copy is then invalid. */
+int modbus_mapping_read_begin(const modbus_mapping_t *mb_mapping,
+                              modbus_table_t table,
+                              uint32_t *generation)
+{
+    return mapping_read_begin(mapping_ext(mb_mapping), table, generation);
+}
+
+/* Returns TRUE if the table was written during the copy, the copy has to be
+   done again */
+int modbus_mapping_read_retry(const modbus_mapping_t *mb_mapping,
+                              modbus_table_t table,
+                              uint32_t generation)
+{
+    return mapping_read_retry(mapping_ext(mb_mapping), table, generation);
+}
+
 #ifndef HAVE_STRLCPY
 /*
  * Function strlcpy was originally developed by
@@ -75,6 +75,9 @@ MODBUS_BEGIN_DECLS
 
 #define MODBUS_BROADCAST_ADDRESS 0
 
+/* Number of unit IDs (slave addresses) of modbus_set_units() */
+#define MODBUS_MAX_UNITS 256
+
 /* Modbus_Application_Protocol_V1_1b.pdf (chapter 6 section 1 page 12)
  * Quantity of Coils to read (2 bytes): 1 to 2000 (0x7D0)
  * (chapter 6 section 11 page 29)
@@ -112,6 +115,10 @@ MODBUS_BEGIN_DECLS
  */
 #define MODBUS_MAX_ADU_LENGTH 260
 
+/* Maximum number of requests sent by modbus_pipeline() without waiting for
+ * their responses */
+#define MODBUS_MAX_IN_FLIGHT 256
+
 /* Random number to avoid errno conflicts */
 #define MODBUS_ENOBASE 112345678
 
@@ -156,6 +163,24 @@ extern const unsigned int libmodbus_version_micro;
 
 typedef struct _modbus modbus_t;
 
+/* Tables of a mapping */
+typedef enum {
+    MODBUS_TABLE_BITS = 0,
+    MODBUS_TABLE_INPUT_BITS,
+    MODBUS_TABLE_REGISTERS,
+    MODBUS_TABLE_INPUT_REGISTERS
+} modbus_table_t;
+
+/* Reads nb values of a callback range from addr into dest (uint8_t ON/OFF for
+   bits, uint16_t for registers). Returns 0 on success, the MODBUS_EXCEPTION_*
+   code of the response or -1 on failure (reported as
+   MODBUS_EXCEPTION_SLAVE_OR_SERVER_FAILURE). */
+typedef int (*modbus_mapping_read_cb)(
+    void *user_data, modbus_table_t table, int addr, int nb, void *dest);
+/* Writes nb values of a callback range from src, same return as the read */
+typedef int (*modbus_mapping_write_cb)(
+    void *user_data, modbus_table_t table, int addr, int nb, const void *src);
+
 typedef struct _modbus_mapping_t {
     int nb_bits;
     int start_bits;
@@ -171,6 +196,57 @@ typedef struct _modbus_mapping_t {
     uint16_t *tab_registers;
 } modbus_mapping_t;
 
+/* Layout of the shared memory region of a modbus_mapping_new_shm() mapping: the
+   header is followed by the 4 tables at their offset from the start of the
+   region. The bits are stored one byte per bit (0 or 1), the registers as
+   uint16_t in host byte order.
+
+   The generation of a table is odd while the table is written and advances by
+   2 once written (see modbus_mapping_write_begin()). A reader copying values
+   of a table gets a consistent copy when the generation was even and didn't
+   change during the copy (see modbus_mapping_read_begin()). */
+#define MODBUS_SHM_MAGIC   0x4853424D /* "MBSH" in little endian */
+#define MODBUS_SHM_VERSION 1
+
+typedef struct {
+    uint32_t generation;
+    uint32_t start;
+    uint32_t nb;
+    uint32_t offset;
+} modbus_shm_table_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    /* Size of the region in bytes */
+    uint32_t size;
+    uint32_t reserved;
+    /* Indexed by modbus_table_t */
+    modbus_shm_table_t tables[4];
+} modbus_shm_header_t;
+
+/* Request of modbus_pipeline() and modbus_submit(), src points to the value(s)
+ * to write (uint8_t for bits, uint16_t for registers) and dest to the array of
+ * read values */
+typedef struct _modbus_transaction {
+    /* -1 to use the slave of the context */
+    int slave;
+    int function;
+    int addr;
+    int nb;
+    const void *src;
+    void *dest;
+    /* Free for the caller, not used by libmodbus */
+    void *user_data;
+    /* Results */
+    int rc;
+    int error;
+} modbus_transaction_t;
+
+/* Called by modbus_process_io() when the result of a transaction submitted by
+ * modbus_submit() is known (rc and error fields are set) */
+typedef void (*modbus_complete_t)(modbus_t *ctx, modbus_transaction_t *t, void *user_data);
+
 typedef enum {
     MODBUS_ERROR_RECOVERY_NONE = 0,
     MODBUS_ERROR_RECOVERY_LINK = (1 << 1),
@@ -185,11 +261,13 @@ typedef enum {
 } modbus_quirks;
 
 MODBUS_API int modbus_set_slave(modbus_t *ctx, int slave);
+MODBUS_API int modbus_set_units(modbus_t *ctx, modbus_mapping_t *const *units);
 MODBUS_API int modbus_get_slave(modbus_t *ctx);
 MODBUS_API int modbus_set_error_recovery(modbus_t *ctx,
                                          modbus_error_recovery_mode error_recovery);
 MODBUS_API int modbus_set_socket(modbus_t *ctx, int s);
 MODBUS_API int modbus_get_socket(modbus_t *ctx);
+MODBUS_API int modbus_get_pending_length(modbus_t *ctx);
 
 MODBUS_API int
 modbus_get_response_timeout(modbus_t *ctx, uint32_t *to_sec, uint32_t *to_usec);
@@ -238,6 +316,30 @@ MODBUS_API int modbus_write_and_read_registers(modbus_t *ctx,
                                                uint16_t *dest);
 MODBUS_API int modbus_report_slave_id(modbus_t *ctx, int max_dest, uint8_t *dest);
 
+MODBUS_API int modbus_set_max_in_flight(modbus_t *ctx, int nb);
+MODBUS_API int modbus_get_max_in_flight(modbus_t *ctx);
+MODBUS_API int
+modbus_pipeline(modbus_t *ctx, modbus_transaction_t *transactions, int nb);
+
+MODBUS_API int
+modbus_set_complete_callback(modbus_t *ctx, modbus_complete_t complete, void *user_data);
+MODBUS_API int modbus_submit(modbus_t *ctx, modbus_transaction_t *t);
+MODBUS_API int modbus_process_io(modbus_t *ctx);
+MODBUS_API int modbus_get_next_timeout(modbus_t *ctx, uint32_t *to_sec, uint32_t *to_usec);
+MODBUS_API int modbus_get_nb_submitted(modbus_t *ctx);
+
+MODBUS_API int modbus_read_bits_range(modbus_t *ctx, int addr, int nb, uint8_t *dest);
+MODBUS_API int
+modbus_read_input_bits_range(modbus_t *ctx, int addr, int nb, uint8_t *dest);
+MODBUS_API int
+modbus_read_registers_range(modbus_t *ctx, int addr, int nb, uint16_t *dest);
+MODBUS_API int
+modbus_read_input_registers_range(modbus_t *ctx, int addr, int nb, uint16_t *dest);
+MODBUS_API int
+modbus_write_bits_range(modbus_t *ctx, int addr, int nb, const uint8_t *src);
+MODBUS_API int
+modbus_write_registers_range(modbus_t *ctx, int addr, int nb, const uint16_t *src);
+
 MODBUS_API modbus_mapping_t *
 modbus_mapping_new_start_address(unsigned int start_bits,
                                  unsigned int nb_bits,
@@ -252,8 +354,64 @@ MODBUS_API modbus_mapping_t *modbus_mapping_new(int nb_bits,
                                                 int nb_input_bits,
                                                 int nb_registers,
                                                 int nb_input_registers);
+MODBUS_API modbus_mapping_t *
+modbus_mapping_new_packed_bits(unsigned int start_bits,
+                               unsigned int nb_bits,
+                               unsigned int start_input_bits,
+                               unsigned int nb_input_bits,
+                               unsigned int start_registers,
+                               unsigned int nb_registers,
+                               unsigned int start_input_registers,
+                               unsigned int nb_input_registers);
+MODBUS_API modbus_mapping_t *modbus_mapping_new_sparse(void);
+MODBUS_API int modbus_mapping_add_range(modbus_mapping_t *mb_mapping,
+                                        modbus_table_t table,
+                                        int start,
+                                        int nb);
+MODBUS_API int modbus_mapping_add_callback(modbus_mapping_t *mb_mapping,
+                                           modbus_table_t table,
+                                           int start,
+                                           int nb,
+                                           modbus_mapping_read_cb read_cb,
+                                           modbus_mapping_write_cb write_cb,
+                                           void *user_data);
+MODBUS_API modbus_mapping_t *modbus_mapping_new_shm(const char *name,
+                                                    unsigned int mode,
+                                                    int replace,
+                                                    unsigned int start_bits,
+                                                    unsigned int nb_bits,
+                                                    unsigned int start_input_bits,
+                                                    unsigned int nb_input_bits,
+                                                    unsigned int start_registers,
+                                                    unsigned int nb_registers,
+                                                    unsigned int start_input_registers,
+                                                    unsigned int nb_input_registers);
+MODBUS_API modbus_mapping_t *modbus_mapping_open_shm(const char *name);
 MODBUS_API void modbus_mapping_free(modbus_mapping_t *mb_mapping);
 
+MODBUS_API int modbus_mapping_write_begin(modbus_mapping_t *mb_mapping,
+                                          modbus_table_t table);
+MODBUS_API void modbus_mapping_write_end(modbus_mapping_t *mb_mapping, modbus_table_t table);
+MODBUS_API int modbus_mapping_read_begin(const modbus_mapping_t *mb_mapping,
+                                         modbus_table_t table,
+                                         uint32_t *generation);
+MODBUS_API int modbus_mapping_read_retry(const modbus_mapping_t *mb_mapping,
+                                         modbus_table_t table,
+                                         uint32_t generation);
+
+MODBUS_API int modbus_mapping_get_bit(const modbus_mapping_t *mb_mapping, int addr);
+MODBUS_API int modbus_mapping_set_bit(modbus_mapping_t *mb_mapping, int addr, int value);
+MODBUS_API int modbus_mapping_get_input_bit(const modbus_mapping_t *mb_mapping, int addr);
+MODBUS_API int
+modbus_mapping_set_input_bit(modbus_mapping_t *mb_mapping, int addr, int value);
+MODBUS_API int modbus_mapping_get_register(const modbus_mapping_t *mb_mapping, int addr);
+MODBUS_API int
+modbus_mapping_set_register(modbus_mapping_t *mb_mapping, int addr, uint16_t value);
+MODBUS_API int modbus_mapping_get_input_register(const modbus_mapping_t *mb_mapping,
+                                                 int addr);
+MODBUS_API int
+modbus_mapping_set_input_register(modbus_mapping_t *mb_mapping, int addr, uint16_t value);
+
 MODBUS_API int
 modbus_send_raw_request(modbus_t *ctx, const uint8_t *raw_req, int raw_req_length);
 
@@ -321,7 +479,11 @@ MODBUS_API void modbus_set_float_dcba(float f, uint16_t *dest);
 MODBUS_API void modbus_set_float_badc(float f, uint16_t *dest);
 MODBUS_API void modbus_set_float_cdab(float f, uint16_t *dest);
 
+#include "modbus-planner.h"
 #include "modbus-rtu.h"
+#include "modbus-scheduler.h"
+#include "modbus-server.h"
+#include "modbus-sniffer.h"
 #include "modbus-tcp.h"
 
 MODBUS_END_DECLS
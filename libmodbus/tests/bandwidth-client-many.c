@@ -0,0 +1,217 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <modbus.h>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+/* libmodbus waits for the sockets with select(), each process keeps its
+   descriptors below FD_SETSIZE */
+#define NB_CONNECTIONS_PER_PROCESS 1000
+
+#define NB_REGISTERS 10
+
+typedef struct {
+    int stop;
+    uint32_t nb_completed;
+    uint32_t nb_errors;
+} stats_t;
+
+#if !defined(_WIN32)
+static uint32_t gettime_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint32_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/* Submits the next request of the connection as soon as the response is
+   received */
+static void resubmit(modbus_t *ctx, modbus_transaction_t *t, void *user_data)
+{
+    stats_t *stats = user_data;
+
+    if (t->rc == -1) {
+        stats->nb_errors++;
+    } else {
+        stats->nb_completed++;
+    }
+
+    if (!stats->stop && modbus_submit(ctx, t) == -1) {
+        stats->nb_errors++;
+    }
+}
+
+/* Runs the connections of a process, the results are written in fd */
+static int run_connections(int nb, int duration, int fd)
+{
+    modbus_t **ctxs;
+    modbus_transaction_t *transactions;
+    uint16_t *tab_reg;
+    struct pollfd *fds;
+    stats_t stats;
+    uint32_t start;
+    int nb_connected = 0;
+    int i;
+
+    ctxs = calloc(nb, sizeof(modbus_t *));
+    transactions = calloc(nb, sizeof(modbus_transaction_t));
+    tab_reg = calloc(nb * NB_REGISTERS, sizeof(uint16_t));
+    fds = calloc(nb, sizeof(struct pollfd));
+    if (ctxs == NULL || transactions == NULL || tab_reg == NULL || fds == NULL) {
+        return -1;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    for (i = 0; i < nb; i++) {
+        ctxs[i] = modbus_new_tcp("127.0.0.1", 1502);
+        if (ctxs[i] == NULL || modbus_connect(ctxs[i]) == -1) {
+            fprintf(stderr, "Connection failed: %s\n", modbus_strerror(errno));
+            break;
+        }
+        modbus_set_complete_callback(ctxs[i], resubmit, &stats);
+        nb_connected++;
+
+        fds[i].fd = modbus_get_socket(ctxs[i]);
+        fds[i].events = POLLIN;
+        transactions[i].slave = -1;
+        transactions[i].function = MODBUS_FC_READ_HOLDING_REGISTERS;
+        transactions[i].addr = 0;
+        transactions[i].nb = NB_REGISTERS;
+        transactions[i].dest = tab_reg + i * NB_REGISTERS;
+    }
+
+    if (nb_connected == nb) {
+        for (i = 0; i < nb; i++) {
+            modbus_submit(ctxs[i], &transactions[i]);
+        }
+
+        start = gettime_ms();
+        while (gettime_ms() - start < (uint32_t) duration * 1000) {
+            int rc = poll(fds, nb, 100);
+
+            for (i = 0; i < nb && rc > 0; i++) {
+                if (fds[i].revents == 0) {
+                    continue;
+                }
+                rc--;
+                if (modbus_process_io(ctxs[i]) == -1) {
+                    /* Not polled anymore */
+                    fds[i].fd = -1;
+                }
+            }
+        }
+        stats.stop = 1;
+    } else {
+        stats.nb_errors = 1;
+    }
+
+    if (write(fd, &stats, sizeof(stats)) != sizeof(stats)) {
+        return -1;
+    }
+
+    for (i = 0; i < nb_connected; i++) {
+        modbus_close(ctxs[i]);
+        modbus_free(ctxs[i]);
+    }
+    free(fds);
+    free(tab_reg);
+    free(transactions);
+    free(ctxs);
+
+    return 0;
+}
+#endif
+
+/* Each connection reads NB_REGISTERS holding registers in a loop with the
+   asynchronous API, the total number of transactions per second is printed */
+int main(int argc, char *argv[])
+{
+#if defined(_WIN32)
+    printf("%s isn't supported on Windows\n", argv[0]);
+    return 1;
+#else
+    struct rlimit limit;
+    int nb_connections = 100;
+    int duration = 5;
+    int nb_processes;
+    int pipefd[2];
+    stats_t total;
+    int i;
+
+    if (argc > 1) {
+        nb_connections = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        duration = atoi(argv[2]);
+    }
+    if (nb_connections < 1 || duration < 1) {
+        printf("Usage:\n  %s [connections] [seconds] - Modbus clients to measure the "
+               "transaction rate of a server\n\n",
+               argv[0]);
+        exit(1);
+    }
+
+    /* Each connection uses a file descriptor, raises the soft limit */
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    if (pipe(pipefd) == -1) {
+        perror("pipe");
+        return 1;
+    }
+
+    nb_processes =
+        (nb_connections + NB_CONNECTIONS_PER_PROCESS - 1) / NB_CONNECTIONS_PER_PROCESS;
+    for (i = 0; i < nb_processes; i++) {
+        int nb = nb_connections / nb_processes + (i < nb_connections % nb_processes);
+
+        if (fork() == 0) {
+            close(pipefd[0]);
+            exit(run_connections(nb, duration, pipefd[1]) == -1 ? 1 : 0);
+        }
+    }
+    close(pipefd[1]);
+
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < nb_processes; i++) {
+        stats_t stats;
+
+        if (read(pipefd[0], &stats, sizeof(stats)) != sizeof(stats)) {
+            total.nb_errors++;
+            continue;
+        }
+        total.nb_completed += stats.nb_completed;
+        total.nb_errors += stats.nb_errors;
+    }
+    while (wait(NULL) > 0) {
+    }
+
+    printf("%d connections in %d process(es) during %d s:\n",
+           nb_connections,
+           nb_processes,
+           duration);
+    printf("* %u transactions, %u errors\n", total.nb_completed, total.nb_errors);
+    printf("* %.0f transactions/s\n", (double) total.nb_completed / duration);
+
+    return total.nb_errors ? 1 : 0;
+#endif
+}
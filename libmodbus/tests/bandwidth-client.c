@@ -17,6 +17,7 @@
 #include <modbus.h>
 
 #define G_MSEC_PER_SEC 1000
+#define NB_IN_FLIGHT   16
 
 static uint32_t gettime_ms(void)
 {
@@ -199,8 +200,62 @@ int main(int argc, char *argv[])
     rate = bytes / 1024 * G_MSEC_PER_SEC / (end - start);
     printf("* %.3f ms for %d bytes\n", elapsed, bytes);
     printf("* %d KiB/s\n", rate);
+    printf("\n\n");
+
+    printf("TRANSACTIONS\n\n");
+
+    /* A single register per request so the cost of the transaction itself
+     * (system calls and latency) dominates */
+    nb_points = 1;
+    start = gettime_ms();
+    for (i = 0; i < n_loop; i++) {
+        rc = modbus_read_registers(ctx, 0, nb_points, tab_reg);
+        if (rc == -1) {
+            fprintf(stderr, "%s\n", modbus_strerror(errno));
+            return -1;
+        }
+    }
+    end = gettime_ms();
+    elapsed = end - start;
+
+    rate = n_loop * G_MSEC_PER_SEC / (end - start);
+    printf("Transaction rate:\n");
+    printf("* %d transactions/s\n", rate);
+    printf("* %.3f us per transaction\n", elapsed * 1000 / n_loop);
     printf("\n");
 
+    if (use_backend == TCP) {
+        modbus_transaction_t transactions[NB_IN_FLIGHT];
+
+        /* Same requests sent without waiting for the previous responses */
+        for (i = 0; i < NB_IN_FLIGHT; i++) {
+            transactions[i].slave = -1;
+            transactions[i].function = MODBUS_FC_READ_HOLDING_REGISTERS;
+            transactions[i].addr = 0;
+            transactions[i].nb = nb_points;
+            transactions[i].src = NULL;
+            transactions[i].dest = tab_reg + i;
+        }
+        modbus_set_max_in_flight(ctx, NB_IN_FLIGHT);
+
+        start = gettime_ms();
+        for (i = 0; i < n_loop; i += NB_IN_FLIGHT) {
+            rc = modbus_pipeline(ctx, transactions, NB_IN_FLIGHT);
+            if (rc != NB_IN_FLIGHT) {
+                fprintf(stderr, "%s\n", modbus_strerror(errno));
+                return -1;
+            }
+        }
+        end = gettime_ms();
+        elapsed = end - start;
+
+        rate = n_loop * G_MSEC_PER_SEC / (end - start);
+        printf("Pipelined transaction rate (%d in flight):\n", NB_IN_FLIGHT);
+        printf("* %d transactions/s\n", rate);
+        printf("* %.3f us per transaction\n", elapsed * 1000 / n_loop);
+        printf("\n");
+    }
+
     /* Free the memory */
     free(tab_bit);
     free(tab_reg);
@@ -14,41 +14,34 @@
 #include <modbus.h>
 
 #if defined(_WIN32)
-#include <ws2tcpip.h>
+#include <winsock2.h>
 #else
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <sys/select.h>
 #include <sys/socket.h>
 #endif
 
-#define NB_CONNECTION 5
+#define NB_CONNECTION SOMAXCONN
 
 static modbus_t *ctx = NULL;
+static modbus_server_t *server = NULL;
 static modbus_mapping_t *mb_mapping;
 
 static int server_socket = -1;
 
-static void close_sigint(int dummy)
+static void stop_sigint(int dummy)
 {
-    if (server_socket != -1) {
-        close(server_socket);
-    }
-    modbus_free(ctx);
-    modbus_mapping_free(mb_mapping);
-
-    exit(dummy);
+    (void) dummy;
+    modbus_server_stop(server);
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
-    uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
-    int master_socket;
     int rc;
-    fd_set refset;
-    fd_set rdset;
-    /* Maximum file descriptor number */
-    int fdmax;
+
+    if (argc > 1 && strcmp(argv[1], "uring") != 0) {
+        printf("Usage:\n  %s [uring] - Modbus server to measure data bandwidth\n\n",
+               argv[0]);
+        exit(1);
+    }
 
     ctx = modbus_new_tcp("127.0.0.1", 1502);
 
@@ -67,76 +60,34 @@ int main(void)
         return -1;
     }
 
-    signal(SIGINT, close_sigint);
-
-    /* Clear the reference set of socket */
-    FD_ZERO(&refset);
-    /* Add the server socket */
-    FD_SET(server_socket, &refset);
-
-    /* Keep track of the max file descriptor */
-    fdmax = server_socket;
-
-    for (;;) {
-        rdset = refset;
-        if (select(fdmax + 1, &rdset, NULL, NULL, NULL) == -1) {
-            perror("Server select() failure.");
-            close_sigint(1);
-        }
-
-        /* Run through the existing connections looking for data to be
-         * read */
-        for (master_socket = 0; master_socket <= fdmax; master_socket++) {
-
-            if (!FD_ISSET(master_socket, &rdset)) {
-                continue;
-            }
-
-            if (master_socket == server_socket) {
-                /* A client is asking a new connection */
-                socklen_t addrlen;
-                struct sockaddr_in clientaddr;
-                int newfd;
-
-                /* Handle new connections */
-                addrlen = sizeof(clientaddr);
-                memset(&clientaddr, 0, sizeof(clientaddr));
-                newfd = accept(server_socket, (struct sockaddr *) &clientaddr, &addrlen);
-                if (newfd == -1) {
-                    perror("Server accept() error");
-                } else {
-                    FD_SET(newfd, &refset);
-
-                    if (newfd > fdmax) {
-                        /* Keep track of the maximum */
-                        fdmax = newfd;
-                    }
-                    printf("New connection from %s:%d on socket %d\n",
-                           inet_ntoa(clientaddr.sin_addr),
-                           clientaddr.sin_port,
-                           newfd);
-                }
-            } else {
-                modbus_set_socket(ctx, master_socket);
-                rc = modbus_receive(ctx, query);
-                if (rc > 0) {
-                    modbus_reply(ctx, query, rc, mb_mapping);
-                } else if (rc == -1) {
-                    /* This example server in ended on connection closing or
-                     * any errors. */
-                    printf("Connection closed on socket %d\n", master_socket);
-                    close(master_socket);
-
-                    /* Remove from reference set */
-                    FD_CLR(master_socket, &refset);
-
-                    if (master_socket == fdmax) {
-                        fdmax--;
-                    }
-                }
-            }
-        }
+    /* The connections are handled by the event loop of the server */
+    server = modbus_server_new(ctx, mb_mapping);
+    if (server == NULL || modbus_server_set_listen_socket(server, server_socket) == -1) {
+        fprintf(stderr, "Unable to create the server: %s\n", modbus_strerror(errno));
+        close(server_socket);
+        modbus_free(ctx);
+        return -1;
     }
 
-    return 0;
+    if (argc > 1 && modbus_server_set_engine(server, MODBUS_SERVER_ENGINE_URING) == -1) {
+        fprintf(stderr, "io_uring engine not available: %s\n", modbus_strerror(errno));
+        modbus_server_free(server);
+        close(server_socket);
+        modbus_free(ctx);
+        return -1;
+    }
+
+    signal(SIGINT, stop_sigint);
+
+    rc = modbus_server_run(server);
+    if (rc == -1) {
+        perror("Server failure");
+    }
+
+    modbus_server_free(server);
+    close(server_socket);
+    modbus_mapping_free(mb_mapping);
+    modbus_free(ctx);
+
+    return (rc == -1) ? 1 : 0;
 }
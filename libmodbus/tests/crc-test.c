@@ -0,0 +1,155 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#ifndef _MSC_VER
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modbus-crc-private.h"
+
+/* Largest buffer checked, longer than a RTU frame to cover several folds */
+#define MAX_LENGTH 600
+
+/* Number of bytes computed by each benchmark */
+#define BENCH_BYTES (8 * 1024 * 1024)
+
+typedef uint16_t (*crc16_fn_t)(uint16_t crc, const uint8_t *buffer, int buffer_length);
+
+typedef struct {
+    const char *name;
+    crc16_fn_t fn;
+} crc16_impl_t;
+
+static uint32_t gettime_us(void)
+{
+    struct timeval tv;
+#if !defined(_MSC_VER)
+    gettimeofday(&tv, NULL);
+    return (uint32_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+    return GetTickCount() * 1000;
+#endif
+}
+
+/* Bit by bit definition of the CRC */
+static uint16_t crc16_reference(uint16_t crc, const uint8_t *buffer, int buffer_length)
+{
+    int i;
+
+    while (buffer_length-- > 0) {
+        crc ^= *buffer++;
+        for (i = 0; i < 8; i++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+
+    return crc;
+}
+
+int main(void)
+{
+    crc16_impl_t impls[] = {
+        {"bytewise", _modbus_crc16_bytewise},
+        {"slicing8", _modbus_crc16_slicing8},
+        {"clmul", _modbus_crc16_clmul},
+        {"selected", _modbus_crc16_update},
+    };
+    const int nb_impls = sizeof(impls) / sizeof(impls[0]);
+    const int bench_lengths[] = {8, 64, 256};
+    uint8_t buffer[MAX_LENGTH + 16];
+    int nb_fail = 0;
+    int length;
+    int offset;
+    int i;
+    int j;
+
+    printf("Carry-less multiplication: %s\n", _modbus_crc16_has_clmul() ? "yes" : "no");
+
+    /* Check value of CRC-16/MODBUS */
+    for (i = 0; i < nb_impls; i++) {
+        uint16_t crc = impls[i].fn(0xFFFF, (const uint8_t *) "123456789", 9);
+
+        if (crc != 0x4B37) {
+            printf("FAILED %s check value 0x%04X\n", impls[i].name, crc);
+            nb_fail++;
+        }
+    }
+
+    srand(42);
+    for (i = 0; i < (int) sizeof(buffer); i++) {
+        buffer[i] = rand() & 0xFF;
+    }
+
+    /* Every length at several alignments from a random CRC register */
+    for (offset = 0; offset < 16; offset += 5) {
+        for (length = 0; length <= MAX_LENGTH; length++) {
+            uint16_t init = rand() & 0xFFFF;
+            uint16_t expected = crc16_reference(init, buffer + offset, length);
+
+            for (i = 0; i < nb_impls; i++) {
+                uint16_t crc = impls[i].fn(init, buffer + offset, length);
+
+                if (crc != expected) {
+                    printf("FAILED %s length %d offset %d: 0x%04X instead of 0x%04X\n",
+                           impls[i].name,
+                           length,
+                           offset,
+                           crc,
+                           expected);
+                    nb_fail++;
+                }
+            }
+        }
+    }
+
+    /* A CRC updated part by part is the CRC of the whole buffer */
+    for (length = 0; length <= 256; length++) {
+        uint16_t expected = crc16_reference(0xFFFF, buffer, 256);
+        uint16_t crc = _modbus_crc16_update(0xFFFF, buffer, length);
+
+        crc = _modbus_crc16_update(crc, buffer + length, 256 - length);
+        if (crc != expected) {
+            printf("FAILED update split at %d\n", length);
+            nb_fail++;
+        }
+    }
+
+    if (nb_fail) {
+        printf("\n%d TESTS FAILED\n", nb_fail);
+        return 1;
+    }
+
+    /* Microbenchmark on the frame lengths of RTU */
+    printf("\nCRC16 per frame:\n");
+    for (j = 0; j < (int) (sizeof(bench_lengths) / sizeof(bench_lengths[0])); j++) {
+        const int n_loop = BENCH_BYTES / bench_lengths[j];
+
+        printf("* %3d bytes:", bench_lengths[j]);
+        for (i = 0; i < nb_impls; i++) {
+            volatile uint16_t crc = 0;
+            uint32_t start;
+            uint32_t elapsed;
+            int k;
+
+            start = gettime_us();
+            for (k = 0; k < n_loop; k++) {
+                crc ^= impls[i].fn(0xFFFF, buffer + (k & 7), bench_lengths[j]);
+            }
+            elapsed = gettime_us() - start;
+            printf(" %s %.1f ns", impls[i].name, elapsed * 1000.0 / n_loop);
+        }
+        printf("\n");
+    }
+
+    printf("\nALL TESTS PASS WITH SUCCESS.\n");
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright © Stéphane Raimbault <stephane.raimbault@gmail.com>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdio.h>
+#ifndef _MSC_VER
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "modbus-swap-private.h"
+
+/* Registers of a read response */
+#define MAX_NB 125
+
+/* Number of registers converted by each benchmark */
+#define BENCH_REGISTERS (16 * 1024 * 1024)
+
+typedef void (*swap16_fn_t)(uint8_t *dest, const uint8_t *src, int nb);
+
+typedef struct {
+    const char *name;
+    swap16_fn_t fn;
+} swap16_impl_t;
+
+static uint32_t gettime_us(void)
+{
+    struct timeval tv;
+#if !defined(_MSC_VER)
+    gettimeofday(&tv, NULL);
+    return (uint32_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+    return GetTickCount() * 1000;
+#endif
+}
+
+int main(void)
+{
+    swap16_impl_t impls[] = {
+        {"scalar", _modbus_swap16_scalar},
+        {"vector128", _modbus_swap16_vector128},
+        {"vector256", _modbus_swap16_vector256},
+        {"selected", _modbus_swap16},
+    };
+    const int nb_impls = sizeof(impls) / sizeof(impls[0]);
+    const int bench_nbs[] = {4, 32, 125};
+    uint8_t src[MAX_NB * 2 + 16];
+    uint8_t dest[MAX_NB * 2 + 16];
+    uint16_t registers[MAX_NB + 8];
+    int nb_fail = 0;
+    int nb;
+    int offset;
+    int i;
+    int j;
+
+    srand(42);
+    for (i = 0; i < (int) sizeof(src); i++) {
+        src[i] = rand() & 0xFF;
+    }
+
+    /* Every count at several alignments, the byte after the end is kept */
+    for (offset = 0; offset < 16; offset += 3) {
+        for (nb = 0; nb <= MAX_NB; nb++) {
+            for (i = 0; i < nb_impls; i++) {
+                memset(dest, 0x5A, sizeof(dest));
+                impls[i].fn(dest + offset, src + offset, nb);
+
+                for (j = 0; j < nb; j++) {
+                    if (dest[offset + 2 * j] != src[offset + 2 * j + 1] ||
+                        dest[offset + 2 * j + 1] != src[offset + 2 * j]) {
+                        printf("FAILED %s nb %d offset %d at %d\n",
+                               impls[i].name,
+                               nb,
+                               offset,
+                               j);
+                        nb_fail++;
+                        break;
+                    }
+                }
+                if (dest[offset + 2 * nb] != 0x5A) {
+                    printf("FAILED %s nb %d offset %d overflow\n", impls[i].name, nb, offset);
+                    nb_fail++;
+                }
+            }
+        }
+    }
+
+    /* Registers are read and written in big-endian */
+    for (nb = 0; nb <= MAX_NB; nb++) {
+        _modbus_decode_registers(registers, src + 1, nb);
+        for (j = 0; j < nb; j++) {
+            if (registers[j] != ((src[1 + 2 * j] << 8) | src[2 + 2 * j])) {
+                printf("FAILED decode nb %d at %d\n", nb, j);
+                nb_fail++;
+                break;
+            }
+        }
+
+        _modbus_encode_registers(dest + 1, registers, nb);
+        if (memcmp(dest + 1, src + 1, nb * 2) != 0) {
+            printf("FAILED encode nb %d\n", nb);
+            nb_fail++;
+        }
+    }
+
+    if (nb_fail) {
+        printf("\n%d TESTS FAILED\n", nb_fail);
+        return 1;
+    }
+
+    /* Microbenchmark on the register counts of the requests */
+    printf("Byte swap per request:\n");
+    for (j = 0; j < (int) (sizeof(bench_nbs) / sizeof(bench_nbs[0])); j++) {
+        const int n_loop = BENCH_REGISTERS / bench_nbs[j];
+
+        printf("* %3d registers:", bench_nbs[j]);
+        for (i = 0; i < nb_impls; i++) {
+            uint32_t start;
+            uint32_t elapsed;
+            int k;
+
+            start = gettime_us();
+            for (k = 0; k < n_loop; k++) {
+                impls[i].fn(dest + (k & 7), src + (k & 7), bench_nbs[j]);
+            }
+            elapsed = gettime_us() - start;
+            printf(" %s %.1f ns", impls[i].name, elapsed * 1000.0 / n_loop);
+        }
+        printf("\n");
+    }
+
+    printf("\nALL TESTS PASS WITH SUCCESS.\n");
+
+    return 0;
+}
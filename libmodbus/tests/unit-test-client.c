@@ -9,12 +9,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/select.h>
 #include <unistd.h>
 
 #include "unit-test.h"
 
 const int EXCEPTION_RC = 2;
 
+/* Shared memory region of the local mappings */
+#define UT_CLIENT_SHM_NAME "/unit-test-client"
+
 enum {
     TCP,
     TCP_PI,
@@ -32,6 +36,8 @@ int send_crafted_request(modbus_t *ctx,
                          int backend_offset);
 int equal_dword(uint16_t *tab_reg, const uint32_t value);
 int is_memory_equal(const void *s1, const void *s2, size_t size);
+void count_completion(modbus_t *ctx, modbus_transaction_t *t, void *user_data);
+void stop_scheduler(modbus_scheduler_t *scheduler, int job, int rc, void *user_data);
 
 #define BUG_REPORT(_cond, _format, _args...) \
   printf("\nLine %d: assertion error for '%s': " _format "\n", __LINE__, #_cond, ##_args)
@@ -51,6 +57,22 @@ int is_memory_equal(const void *s1, const void *s2, size_t size)
     return (memcmp(s1, s2, size) == 0);
 }
 
+void count_completion(modbus_t *ctx, modbus_transaction_t *t, void *user_data)
+{
+    (void) ctx;
+    (void) t;
+    (*(int *) user_data)++;
+}
+
+/* Stops the scheduler when the number of polls pointed by user_data is done */
+void stop_scheduler(modbus_scheduler_t *scheduler, int job, int rc, void *user_data)
+{
+    (void) job;
+    (void) rc;
+    if (--(*(int *) user_data) == 0)
+        modbus_scheduler_stop(scheduler);
+}
+
 int equal_dword(uint16_t *tab_reg, const uint32_t value)
 {
     return ((tab_reg[0] == (value >> 16)) && (tab_reg[1] == (value & 0xFFFF)));
@@ -79,6 +101,23 @@ int main(int argc, char *argv[])
     int success = FALSE;
     int old_slave;
     char *ip_or_device;
+    modbus_transaction_t transactions[5];
+    /* Destination of the single register reads of the pipeline test */
+    uint16_t tab_pipeline_registers[2];
+    int nb_completed;
+    modbus_scheduler_t *scheduler = NULL;
+    modbus_job_t job;
+    modbus_job_stats_t job_stats;
+    modbus_scheduler_stats_t scheduler_stats;
+    modbus_planner_t *planner = NULL;
+    modbus_point_t point;
+    double point_value;
+    modbus_sniffer_t *sniffer = NULL;
+    modbus_sniffer_stats_t sniffer_stats;
+    modbus_sniffer_slave_stats_t slave_stats;
+    modbus_mapping_t *shm_mapping = NULL;
+    modbus_mapping_t *shm_other = NULL;
+    uint32_t generation;
 
     if (argc > 1) {
         if (strcmp(argv[1], "tcp") == 0) {
@@ -318,6 +357,53 @@ int main(int argc, char *argv[])
     ASSERT_TRUE(
         tab_rp_registers[0] == 0x17, "FAILED (%0X != %0X)\n", tab_rp_registers[0], 0x17);
 
+    /** CALLBACK RANGE **/
+    printf("\nTEST CALLBACK RANGE:\n");
+
+    rc = modbus_write_registers(
+        ctx, UT_CALLBACK_REGISTERS_ADDRESS, UT_REGISTERS_NB, UT_REGISTERS_TAB);
+    printf("1/7 modbus_write_registers: ");
+    ASSERT_TRUE(rc == UT_REGISTERS_NB, "");
+
+    rc = modbus_read_registers(
+        ctx, UT_CALLBACK_REGISTERS_ADDRESS, UT_REGISTERS_NB, tab_rp_registers);
+    printf("2/7 modbus_read_registers: ");
+    ASSERT_TRUE(rc == UT_REGISTERS_NB, "FAILED (nb points %d)\n", rc);
+    for (i = 0; i < UT_REGISTERS_NB; i++) {
+        ASSERT_TRUE(tab_rp_registers[i] == UT_REGISTERS_TAB[i],
+                    "FAILED (%0X != %0X)\n",
+                    tab_rp_registers[i],
+                    UT_REGISTERS_TAB[i]);
+    }
+
+    /* Written by the callback, read from the table */
+    rc = modbus_write_and_read_registers(ctx,
+                                         UT_CALLBACK_REGISTERS_ADDRESS,
+                                         1,
+                                         tab_rp_registers + 1,
+                                         UT_REGISTERS_ADDRESS,
+                                         1,
+                                         tab_rp_registers);
+    printf("3/7 modbus_write_and_read_registers: ");
+    ASSERT_TRUE(rc == 1, "FAILED (nb points %d)\n", rc);
+
+    rc = modbus_read_registers(ctx, UT_CALLBACK_REGISTERS_ADDRESS - 1, 2, tab_rp_registers);
+    printf("4/7 modbus_read_registers partly in the range: ");
+    ASSERT_TRUE(rc == -1 && errno == EMBXILADD, "");
+
+    rc = modbus_read_registers(
+        ctx, UT_CALLBACK_REGISTERS_ADDRESS, UT_CALLBACK_REGISTERS_NB, tab_rp_registers);
+    printf("5/7 modbus_read_registers with exception of the callback: ");
+    ASSERT_TRUE(rc == -1 && errno == EMBXSBUSY, "");
+
+    rc = modbus_read_registers(ctx, UT_CALLBACK_REGISTERS_ADDRESS + 1, 2, tab_rp_registers);
+    printf("6/7 modbus_read_registers with failure of the callback: ");
+    ASSERT_TRUE(rc == -1 && errno == EMBXSFAIL, "");
+
+    rc = modbus_write_register(ctx, UT_CALLBACK_REGISTERS_ADDRESS + 1, 0x1234);
+    printf("7/7 modbus_write_register with failure of the callback: ");
+    ASSERT_TRUE(rc == -1 && errno == EMBXSFAIL, "");
+
     printf("\nTEST FLOATS\n");
     /** FLOAT **/
     printf("1/4 Set/get float ABCD: ");
@@ -571,6 +657,25 @@ int main(int argc, char *argv[])
         ctx, UT_REGISTERS_ADDRESS_INVALID_TID_OR_SLAVE, 1, tab_rp_registers);
     ASSERT_TRUE(rc == -1, "");
 
+    if (use_backend != RTU) {
+        printf("\nTEST UNITS:\n");
+
+        modbus_set_slave(ctx, UT_UNIT_ID);
+        rc = modbus_read_registers(ctx, UT_REGISTERS_ADDRESS, 1, tab_rp_registers);
+        printf("1/2 Mapping of unit %d: ", UT_UNIT_ID);
+        ASSERT_TRUE(rc == 1 && tab_rp_registers[0] == UT_UNIT_REGISTER,
+                    "FAILED (%0X != %0X)\n",
+                    tab_rp_registers[0],
+                    UT_UNIT_REGISTER);
+
+        modbus_set_slave(ctx, UT_UNIT_ID_MISSING);
+        rc = modbus_read_registers(ctx, UT_REGISTERS_ADDRESS, 1, tab_rp_registers);
+        printf("2/2 No mapping for unit %d: ", UT_UNIT_ID_MISSING);
+        ASSERT_TRUE(rc == -1 && errno == EMBXGTAR, "");
+
+        modbus_set_slave(ctx, old_slave);
+    }
+
     printf("1/2 Report slave ID truncated: \n");
     /* Set a marker to ensure limit is respected */
     tab_rp_bits[NB_REPORT_SLAVE_ID - 1] = 42;
@@ -711,6 +816,328 @@ int main(int argc, char *argv[])
     printf("* modbus_read_registers at special address: ");
     ASSERT_TRUE(rc == -1 && errno == EMBXSBUSY, "");
 
+    /** PIPELINE **/
+    printf("\nTEST PIPELINE:\n");
+    memset(transactions, 0, sizeof(transactions));
+    for (i = 0; i < 5; i++) {
+        transactions[i].slave = -1;
+    }
+    transactions[0].function = MODBUS_FC_WRITE_MULTIPLE_REGISTERS;
+    transactions[0].addr = UT_REGISTERS_ADDRESS;
+    transactions[0].nb = UT_REGISTERS_NB;
+    transactions[0].src = UT_REGISTERS_TAB;
+    transactions[1].function = MODBUS_FC_READ_HOLDING_REGISTERS;
+    transactions[1].addr = UT_REGISTERS_ADDRESS;
+    transactions[1].nb = UT_REGISTERS_NB;
+    transactions[1].dest = tab_rp_registers;
+    transactions[2].function = MODBUS_FC_READ_COILS;
+    transactions[2].addr = UT_BITS_ADDRESS;
+    transactions[2].nb = UT_BITS_NB;
+    transactions[2].dest = tab_rp_bits;
+    /* Illegal data address */
+    transactions[3].function = MODBUS_FC_READ_HOLDING_REGISTERS;
+    transactions[3].addr = 0;
+    transactions[3].nb = 1;
+    transactions[3].dest = &tab_pipeline_registers[0];
+    transactions[4].function = MODBUS_FC_READ_INPUT_REGISTERS;
+    transactions[4].addr = UT_INPUT_REGISTERS_ADDRESS;
+    transactions[4].nb = 1;
+    transactions[4].dest = &tab_pipeline_registers[1];
+
+    rc = modbus_set_max_in_flight(ctx, 0);
+    printf("1/4 Invalid max in flight (zero): ");
+    ASSERT_TRUE(rc == -1 && errno == EINVAL, "");
+
+    modbus_set_max_in_flight(ctx, 4);
+    rc = modbus_pipeline(ctx, transactions, 5);
+    printf("2/4 modbus_pipeline: ");
+    ASSERT_TRUE(rc == 4, "FAILED (nb successful transactions %d)\n", rc);
+
+    printf("3/4 Results in order: ");
+    ASSERT_TRUE(transactions[0].rc == UT_REGISTERS_NB &&
+                    transactions[1].rc == UT_REGISTERS_NB &&
+                    transactions[2].rc == UT_BITS_NB &&
+                    transactions[4].rc == 1,
+                "FAILED (%d, %d, %d, %d)\n",
+                transactions[0].rc,
+                transactions[1].rc,
+                transactions[2].rc,
+                transactions[4].rc);
+    for (i = 0; i < UT_REGISTERS_NB; i++) {
+        ASSERT_TRUE(tab_rp_registers[i] == UT_REGISTERS_TAB[i],
+                    "FAILED (%0X != %0X)\n",
+                    tab_rp_registers[i],
+                    UT_REGISTERS_TAB[i]);
+    }
+    ASSERT_TRUE(tab_pipeline_registers[1] == UT_INPUT_REGISTERS_TAB[0],
+                "FAILED (%0X != %0X)\n",
+                tab_pipeline_registers[1],
+                UT_INPUT_REGISTERS_TAB[0]);
+
+    printf("4/4 Exception of one transaction: ");
+    ASSERT_TRUE(transactions[3].rc == -1 && transactions[3].error == EMBXILADD,
+                "FAILED (%d, %s)\n",
+                transactions[3].rc,
+                modbus_strerror(transactions[3].error));
+
+    /** SUBMIT **/
+    printf("\nTEST SUBMIT:\n");
+    nb_completed = 0;
+    modbus_set_complete_callback(ctx, count_completion, &nb_completed);
+    /* The third transaction is queued */
+    modbus_set_max_in_flight(ctx, 2);
+    for (i = 1; i < 4; i++) {
+        transactions[i].rc = 0;
+        if (modbus_submit(ctx, &transactions[i]) == -1)
+            break;
+    }
+    printf("1/4 modbus_submit: ");
+    ASSERT_TRUE(i == 4 && modbus_get_nb_submitted(ctx) == 3,
+                "FAILED (%d, %d)\n",
+                i,
+                modbus_get_nb_submitted(ctx));
+
+    rc = modbus_pipeline(ctx, transactions, 1);
+    printf("2/4 modbus_pipeline while transactions are submitted: ");
+    ASSERT_TRUE(rc == -1 && errno == EBUSY, "");
+
+    /* Event loop of the caller */
+    while (modbus_get_nb_submitted(ctx) > 0) {
+        struct timeval tv;
+        fd_set rset;
+        uint32_t to_sec;
+        uint32_t to_usec;
+
+        modbus_get_next_timeout(ctx, &to_sec, &to_usec);
+        tv.tv_sec = to_sec;
+        tv.tv_usec = to_usec;
+        FD_ZERO(&rset);
+        FD_SET(modbus_get_socket(ctx), &rset);
+        select(modbus_get_socket(ctx) + 1, &rset, NULL, NULL, &tv);
+        if (modbus_process_io(ctx) == -1)
+            break;
+    }
+    printf("3/4 Completions: ");
+    ASSERT_TRUE(nb_completed == 3 && modbus_get_nb_submitted(ctx) == 0,
+                "FAILED (%d)\n",
+                nb_completed);
+
+    printf("4/4 Results: ");
+    ASSERT_TRUE(transactions[1].rc == UT_REGISTERS_NB &&
+                    transactions[2].rc == UT_BITS_NB && transactions[3].rc == -1 &&
+                    transactions[3].error == EMBXILADD,
+                "FAILED (%d, %d, %d)\n",
+                transactions[1].rc,
+                transactions[2].rc,
+                transactions[3].rc);
+    modbus_set_complete_callback(ctx, NULL, NULL);
+
+    /** RANGES **/
+    printf("\nTEST RANGES:\n");
+    /* The requests are pipelined whatever the window */
+    modbus_set_max_in_flight(ctx, 1);
+    rc = modbus_write_registers_range(
+        ctx, UT_REGISTERS_ADDRESS, UT_REGISTERS_NB, UT_REGISTERS_TAB);
+    printf("1/6 modbus_write_registers_range: ");
+    ASSERT_TRUE(rc == UT_REGISTERS_NB, "FAILED (nb points %d)\n", rc);
+
+    rc = modbus_read_registers_range(
+        ctx, UT_REGISTERS_ADDRESS, UT_REGISTERS_NB, tab_rp_registers);
+    printf("2/6 modbus_read_registers_range: ");
+    ASSERT_TRUE(rc == UT_REGISTERS_NB, "FAILED (nb points %d)\n", rc);
+    for (i = 0; i < UT_REGISTERS_NB; i++) {
+        ASSERT_TRUE(tab_rp_registers[i] == UT_REGISTERS_TAB[i],
+                    "FAILED (%0X != %0X)\n",
+                    tab_rp_registers[i],
+                    UT_REGISTERS_TAB[i]);
+    }
+
+    rc = modbus_read_input_bits_range(
+        ctx, UT_INPUT_BITS_ADDRESS, UT_INPUT_BITS_NB, tab_rp_bits);
+    printf("3/6 modbus_read_input_bits_range: ");
+    ASSERT_TRUE(rc == UT_INPUT_BITS_NB, "FAILED (nb points %d)\n", rc);
+    i = 0;
+    nb_points = UT_INPUT_BITS_NB;
+    while (nb_points > 0) {
+        int nb_bits = (nb_points > 8) ? 8 : nb_points;
+        value = modbus_get_byte_from_bits(tab_rp_bits, i * 8, nb_bits);
+        ASSERT_TRUE(value == UT_INPUT_BITS_TAB[i],
+                    "FAILED (%0X != %0X)\n",
+                    value,
+                    UT_INPUT_BITS_TAB[i]);
+
+        nb_points -= nb_bits;
+        i++;
+    }
+
+    /* Beyond the end of the mapping of the server */
+    rc = modbus_read_input_bits_range(
+        ctx, UT_INPUT_BITS_ADDRESS, UT_INPUT_BITS_NB + 1, tab_rp_bits);
+    printf("4/6 modbus_read_input_bits_range (too many): ");
+    ASSERT_TRUE(rc == -1 && errno == EMBXILADD, "");
+
+    rc = modbus_read_registers_range(ctx, 0xFFFF, 2, tab_rp_registers);
+    printf("5/6 modbus_read_registers_range (beyond 0xFFFF): ");
+    ASSERT_TRUE(rc == -1 && errno == EINVAL, "");
+
+    printf("6/6 Window restored after the ranges: ");
+    ASSERT_TRUE(modbus_get_max_in_flight(ctx) == 1,
+                "FAILED (%d)\n",
+                modbus_get_max_in_flight(ctx));
+
+    /** SCHEDULER **/
+    printf("\nTEST SCHEDULER:\n");
+    scheduler = modbus_scheduler_new(ctx);
+    memset(&job, 0, sizeof(job));
+    job.slave = modbus_get_slave(ctx);
+    job.function = MODBUS_FC_READ_HOLDING_REGISTERS;
+    job.addr = UT_REGISTERS_ADDRESS;
+    job.nb = 1;
+    job.dest = tab_pipeline_registers;
+    rc = modbus_scheduler_add_job(scheduler, &job);
+    printf("1/5 Invalid job (no period): ");
+    ASSERT_TRUE(rc == -1 && errno == EINVAL, "");
+
+    /* Two contiguous reads added before a write of the same registers, the
+       reads have the earliest deadlines */
+    job.period_ms = 20;
+    modbus_scheduler_add_job(scheduler, &job);
+    job.addr = UT_REGISTERS_ADDRESS + 1;
+    job.nb = UT_REGISTERS_NB - 1;
+    job.dest = tab_rp_registers;
+    modbus_scheduler_add_job(scheduler, &job);
+    job.function = MODBUS_FC_WRITE_MULTIPLE_REGISTERS;
+    job.addr = UT_REGISTERS_ADDRESS;
+    job.nb = UT_REGISTERS_NB;
+    job.src = UT_REGISTERS_TAB;
+    job.dest = NULL;
+    modbus_scheduler_add_job(scheduler, &job);
+    memset(tab_rp_registers, 0, UT_REGISTERS_NB * sizeof(uint16_t));
+    tab_pipeline_registers[0] = 0;
+
+    modbus_scheduler_set_write_first(scheduler, TRUE);
+    rc = modbus_scheduler_run_once(scheduler);
+    printf("2/5 Write served first: ");
+    ASSERT_TRUE(rc == 1, "FAILED (%d polls)\n", rc);
+
+    rc = modbus_scheduler_run_once(scheduler);
+    printf("3/5 Contiguous reads merged: ");
+    modbus_scheduler_get_stats(scheduler, &scheduler_stats);
+    ASSERT_TRUE(rc == 2 && scheduler_stats.nb_requests == 2 &&
+                    scheduler_stats.nb_merged == 1,
+                "FAILED (%d polls, %u requests)\n",
+                rc,
+                scheduler_stats.nb_requests);
+    ASSERT_TRUE(tab_pipeline_registers[0] == UT_REGISTERS_TAB[0],
+                "FAILED (%0X != %0X)\n",
+                tab_pipeline_registers[0],
+                UT_REGISTERS_TAB[0]);
+    for (i = 1; i < UT_REGISTERS_NB; i++) {
+        ASSERT_TRUE(tab_rp_registers[i - 1] == UT_REGISTERS_TAB[i],
+                    "FAILED (%0X != %0X)\n",
+                    tab_rp_registers[i - 1],
+                    UT_REGISTERS_TAB[i]);
+    }
+
+    /* Two more periods of the three jobs */
+    nb_completed = 6;
+    modbus_scheduler_set_complete_callback(scheduler, stop_scheduler, &nb_completed);
+    rc = modbus_scheduler_run(scheduler);
+    printf("4/5 modbus_scheduler_run: ");
+    modbus_scheduler_get_job_stats(scheduler, 0, &job_stats);
+    ASSERT_TRUE(rc == 0 && job_stats.nb_polls == 3 && job_stats.nb_errors == 0,
+                "FAILED (%d, %u polls, %u errors)\n",
+                rc,
+                job_stats.nb_polls,
+                job_stats.nb_errors);
+
+    printf("5/5 Bus utilization: ");
+    modbus_scheduler_get_stats(scheduler, &scheduler_stats);
+    ASSERT_TRUE(scheduler_stats.busy_us > 0 &&
+                    scheduler_stats.busy_us <= scheduler_stats.elapsed_us,
+                "FAILED (%llu / %llu us)\n",
+                (unsigned long long) scheduler_stats.busy_us,
+                (unsigned long long) scheduler_stats.elapsed_us);
+    modbus_scheduler_free(scheduler);
+    scheduler = NULL;
+
+    /** PLANNER **/
+    printf("\nTEST PLANNER:\n");
+    planner = modbus_planner_new(ctx);
+    memset(&point, 0, sizeof(point));
+    point.function = MODBUS_FC_READ_HOLDING_REGISTERS;
+    point.type = MODBUS_POINT_BIT;
+    rc = modbus_planner_add_point(planner, &point);
+    printf("1/5 Invalid point (bit of a register): ");
+    ASSERT_TRUE(rc == -1 && errno == EINVAL, "");
+
+    /* Points 0 to 5: the overlapping registers are read by one request, the
+       coils 3 bits apart by one request once a gap is allowed */
+    point.type = MODBUS_POINT_UINT16;
+    point.addr = UT_REGISTERS_ADDRESS;
+    modbus_planner_add_point(planner, &point);
+    point.type = MODBUS_POINT_UINT32;
+    point.addr = UT_REGISTERS_ADDRESS + 1;
+    modbus_planner_add_point(planner, &point);
+    point.type = MODBUS_POINT_INT16;
+    point.order = MODBUS_POINT_BADC;
+    point.addr = UT_REGISTERS_ADDRESS + 2;
+    modbus_planner_add_point(planner, &point);
+    point.function = MODBUS_FC_READ_COILS;
+    point.type = MODBUS_POINT_BIT;
+    point.order = MODBUS_POINT_ABCD;
+    point.addr = UT_BITS_ADDRESS + 3;
+    modbus_planner_add_point(planner, &point);
+    point.addr = UT_BITS_ADDRESS;
+    modbus_planner_add_point(planner, &point);
+    point.function = MODBUS_FC_READ_INPUT_REGISTERS;
+    point.type = MODBUS_POINT_UINT16;
+    point.addr = UT_INPUT_REGISTERS_ADDRESS;
+    modbus_planner_add_point(planner, &point);
+
+    rc = modbus_planner_get_nb_requests(planner);
+    printf("2/5 Requests without gap: ");
+    ASSERT_TRUE(rc == 4, "FAILED (%d requests)\n", rc);
+
+    modbus_planner_set_max_gap(planner, 1);
+    rc = modbus_planner_get_nb_requests(planner);
+    printf("3/5 Requests with a gap of one register: ");
+    ASSERT_TRUE(rc == 3, "FAILED (%d requests)\n", rc);
+
+    rc = modbus_planner_read(planner);
+    printf("4/7 modbus_planner_read: ");
+    ASSERT_TRUE(rc == 0, "FAILED (%s)\n", modbus_strerror(errno));
+    modbus_planner_get_value(planner, 0, &point_value);
+    ASSERT_TRUE(point_value == UT_REGISTERS_TAB[0], "FAILED (%f)\n", point_value);
+    modbus_planner_get_value(planner, 1, &point_value);
+    ASSERT_TRUE(point_value == (double) ((UT_REGISTERS_TAB[1] << 16) | UT_REGISTERS_TAB[2]),
+                "FAILED (%f)\n",
+                point_value);
+    modbus_planner_get_value(planner, 2, &point_value);
+    ASSERT_TRUE(point_value == (int16_t) ((UT_REGISTERS_TAB[2] << 8) | (UT_REGISTERS_TAB[2] >> 8)),
+                "FAILED (%f)\n",
+                point_value);
+    modbus_planner_get_value(planner, 3, &point_value);
+    ASSERT_TRUE(point_value == ((UT_BITS_TAB[0] >> 3) & 1), "FAILED (%f)\n", point_value);
+    modbus_planner_get_value(planner, 4, &point_value);
+    ASSERT_TRUE(point_value == (UT_BITS_TAB[0] & 1), "FAILED (%f)\n", point_value);
+    modbus_planner_get_value(planner, 5, &point_value);
+    ASSERT_TRUE(point_value == UT_INPUT_REGISTERS_TAB[0], "FAILED (%f)\n", point_value);
+
+    /* Outside of the mapping of the server */
+    point.function = MODBUS_FC_READ_HOLDING_REGISTERS;
+    point.addr = 0;
+    modbus_planner_add_point(planner, &point);
+    rc = modbus_planner_read(planner);
+    printf("5/5 Failed request of a point: ");
+    ASSERT_TRUE(rc == -1 && errno == EMBXILADD, "");
+    rc = modbus_planner_get_value(planner, 6, &point_value);
+    ASSERT_TRUE(rc == -1 && errno == EMBXILADD, "");
+    rc = modbus_planner_get_value(planner, 0, &point_value);
+    ASSERT_TRUE(rc == 0 && point_value == UT_REGISTERS_TAB[0], "");
+    modbus_planner_free(planner);
+    planner = NULL;
+
     /** Run a few tests to challenge the server code **/
     if (test_server(ctx, use_backend) == -1) {
         goto close;
@@ -720,6 +1147,107 @@ int main(int argc, char *argv[])
     modbus_free(ctx);
     ctx = NULL;
 
+    /** SNIFFER **/
+    printf("\nTEST SNIFFER:\n");
+    {
+        /* End of a write request then a read request of slave 1 */
+        const uint8_t req1[] = {
+            0x01, 0x06, 0x00, 0x01, 0x01, 0x03, 0x00, 0x00, 0x00, 0x02, 0xC4, 0x0B};
+        const uint8_t rsp1[] = {0x01, 0x03, 0x04, 0x00, 0x0A, 0x00, 0x0B, 0x9B, 0xF6};
+        const uint8_t req2[] = {0x02, 0x03, 0x00, 0x10, 0x00, 0x01, 0x85, 0xFC};
+        const uint8_t rsp2[] = {0x02, 0x83, 0x02, 0x30, 0xF1};
+        const uint8_t req3[] = {0x03, 0x06, 0x00, 0x01, 0x00, 0x05, 0x19, 0xEB};
+        /* Diagnostics request */
+        const uint8_t req4[] = {0x01, 0x08, 0x00, 0x00, 0x12, 0x34, 0xED, 0x7C};
+
+        ctx = modbus_new_rtu("/dev/dummy", 19200, 'N', 8, 1);
+        sniffer = modbus_sniffer_new(ctx);
+
+        rc = modbus_sniffer_feed(sniffer, req1, sizeof(req1), 1000);
+        printf("1/5 Resynchronization on the CRC: ");
+        modbus_sniffer_get_stats(sniffer, &sniffer_stats);
+        ASSERT_TRUE(rc == 1 && sniffer_stats.nb_garbage_bytes == 4,
+                    "FAILED (%d frames, %u garbage bytes)\n",
+                    rc,
+                    sniffer_stats.nb_garbage_bytes);
+
+        modbus_sniffer_feed(sniffer, rsp1, sizeof(rsp1), 3500);
+        printf("2/5 Response time: ");
+        modbus_sniffer_get_slave_stats(sniffer, 1, &slave_stats);
+        ASSERT_TRUE(slave_stats.nb_responses == 1 &&
+                        slave_stats.min_response_time_us == 2500 &&
+                        slave_stats.max_response_time_us == 2500,
+                    "FAILED (%u responses, %u us)\n",
+                    slave_stats.nb_responses,
+                    slave_stats.max_response_time_us);
+
+        modbus_sniffer_feed(sniffer, req2, sizeof(req2), 5000);
+        modbus_sniffer_feed(sniffer, rsp2, sizeof(rsp2), 6000);
+        printf("3/5 Exception response: ");
+        modbus_sniffer_get_slave_stats(sniffer, 2, &slave_stats);
+        ASSERT_TRUE(slave_stats.nb_responses == 1 && slave_stats.nb_exceptions == 1,
+                    "FAILED (%u responses, %u exceptions)\n",
+                    slave_stats.nb_responses,
+                    slave_stats.nb_exceptions);
+
+        /* The next request follows the request without response */
+        modbus_sniffer_feed(sniffer, req3, sizeof(req3), 7000);
+        modbus_sniffer_feed(sniffer, req1 + 4, sizeof(req1) - 4, 9000);
+        printf("4/5 Request without response: ");
+        modbus_sniffer_get_slave_stats(sniffer, 3, &slave_stats);
+        ASSERT_TRUE(slave_stats.nb_requests == 1 && slave_stats.nb_timeouts == 1,
+                    "FAILED (%u requests, %u timeouts)\n",
+                    slave_stats.nb_requests,
+                    slave_stats.nb_timeouts);
+
+        modbus_sniffer_feed(sniffer, rsp1, sizeof(rsp1), 10000);
+        modbus_sniffer_feed(sniffer, req4, sizeof(req4), 11000);
+        rc = modbus_sniffer_flush(sniffer, 12000);
+        printf("5/5 Unknown function ended by the silence: ");
+        modbus_sniffer_get_stats(sniffer, &sniffer_stats);
+        ASSERT_TRUE(rc == 1 && sniffer_stats.nb_frames == 8 &&
+                        sniffer_stats.nb_garbage_bytes == 4,
+                    "FAILED (%d, %u frames, %u garbage bytes)\n",
+                    rc,
+                    sniffer_stats.nb_frames,
+                    sniffer_stats.nb_garbage_bytes);
+        modbus_sniffer_free(sniffer);
+        sniffer = NULL;
+        modbus_free(ctx);
+        ctx = NULL;
+    }
+
+    /* Local shared memory mappings, as a server and another process would do */
+    shm_mapping = modbus_mapping_new_shm(UT_CLIENT_SHM_NAME, 0600, TRUE, 0, 0, 0, 0, 0, 1, 0, 0);
+    if (shm_mapping != NULL) {
+        printf("\nTEST SHARED MEMORY:\n");
+
+        shm_other = modbus_mapping_new_shm(UT_CLIENT_SHM_NAME, 0600, FALSE, 0, 0, 0, 0, 0, 1, 0, 0);
+        printf("1/4 modbus_mapping_new_shm of an existing region: ");
+        ASSERT_TRUE(shm_other == NULL && errno == EEXIST, "");
+
+        shm_other = modbus_mapping_open_shm(UT_CLIENT_SHM_NAME);
+        printf("2/4 modbus_mapping_open_shm: ");
+        ASSERT_TRUE(shm_other != NULL, "FAILED (%s)\n", modbus_strerror(errno));
+
+        /* The writer dies in the middle of the write */
+        rc = modbus_mapping_write_begin(shm_other, MODBUS_TABLE_REGISTERS);
+        ASSERT_TRUE(rc == 0, "FAILED (%s)\n", modbus_strerror(errno));
+        rc = modbus_mapping_write_begin(shm_mapping, MODBUS_TABLE_REGISTERS);
+        printf("3/4 modbus_mapping_write_begin of a locked table: ");
+        ASSERT_TRUE(rc == -1 && errno == ETIMEDOUT, "");
+
+        rc = modbus_mapping_read_begin(shm_mapping, MODBUS_TABLE_REGISTERS, &generation);
+        printf("4/4 modbus_mapping_read_begin of a locked table: ");
+        ASSERT_TRUE(rc == -1 && errno == ETIMEDOUT, "");
+        modbus_mapping_write_end(shm_other, MODBUS_TABLE_REGISTERS);
+
+        modbus_mapping_free(shm_other);
+        shm_other = NULL;
+        modbus_mapping_free(shm_mapping);
+        shm_mapping = NULL;
+    }
+
     /* Test init functions */
     printf("\nTEST INVALID INITIALIZATION:\n");
     ctx = modbus_new_rtu(NULL, 1, 'A', 0, 0);
@@ -735,6 +1263,11 @@ close:
     /* Free the memory */
     free(tab_rp_bits);
     free(tab_rp_registers);
+    modbus_scheduler_free(scheduler);
+    modbus_planner_free(planner);
+    modbus_sniffer_free(sniffer);
+    modbus_mapping_free(shm_other);
+    modbus_mapping_free(shm_mapping);
 
     /* Close the connection */
     modbus_close(ctx);
@@ -15,6 +15,7 @@
 #ifdef _WIN32
 # include <winsock2.h>
 #else
+# include <pthread.h>
 # include <sys/socket.h>
 #endif
 
@@ -26,12 +27,71 @@
 
 #include "unit-test.h"
 
+/* Shared memory region of the shm mapping */
+#define UT_SHM_NAME "/unit-test-server"
+
 enum {
     TCP,
     TCP_PI,
     RTU
 };
 
+/* Values of the callback range, the last one can't be read */
+static int
+read_callback_registers(void *user_data, modbus_table_t table, int addr, int nb, void *dest)
+{
+    const uint16_t *registers = user_data;
+
+    (void) table;
+    if (addr + nb == UT_CALLBACK_REGISTERS_ADDRESS + UT_CALLBACK_REGISTERS_NB) {
+        return MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY;
+    }
+    if (addr == UT_CALLBACK_REGISTERS_ADDRESS + 1) {
+        /* Failure of the device behind the range */
+        return -1;
+    }
+    memcpy(dest, registers + addr - UT_CALLBACK_REGISTERS_ADDRESS, nb * sizeof(uint16_t));
+
+    return 0;
+}
+
+static int write_callback_registers(
+    void *user_data, modbus_table_t table, int addr, int nb, const void *src)
+{
+    uint16_t *registers = user_data;
+
+    (void) table;
+    if (addr == UT_CALLBACK_REGISTERS_ADDRESS + 1) {
+        return -1;
+    }
+    memcpy(registers + addr - UT_CALLBACK_REGISTERS_ADDRESS, src, nb * sizeof(uint16_t));
+
+    return 0;
+}
+
+#ifndef _WIN32
+static int churn_stop = FALSE;
+
+/* Creates and frees mappings while the main thread replies so the private
+   parts of the mappings change under modbus_reply() */
+static void *churn_mappings(void *arg)
+{
+    (void) arg;
+
+    while (!__atomic_load_n(&churn_stop, __ATOMIC_ACQUIRE)) {
+        modbus_mapping_t *mapping = modbus_mapping_new_sparse();
+
+        if (mapping != NULL) {
+            modbus_mapping_add_range(mapping, MODBUS_TABLE_REGISTERS, 0, 1);
+        }
+        modbus_mapping_free(mapping);
+        usleep(100);
+    }
+
+    return NULL;
+}
+#endif
+
 int main(int argc, char *argv[])
 {
     int s = -1;
@@ -43,6 +103,17 @@ int main(int argc, char *argv[])
     uint8_t *query;
     int header_length;
     char *ip_or_device;
+    int packed_bits;
+    int sparse;
+    int shm;
+    modbus_mapping_t *inputs_mapping;
+    uint16_t callback_registers[MODBUS_MAX_READ_REGISTERS] = {0};
+    modbus_mapping_t *units[MODBUS_MAX_UNITS];
+    modbus_mapping_t *unit_mapping = NULL;
+#ifndef _WIN32
+    pthread_t churn_thread;
+    int churn = FALSE;
+#endif
 
     if (argc > 1) {
         if (strcmp(argv[1], "tcp") == 0) {
@@ -53,8 +124,11 @@ int main(int argc, char *argv[])
             use_backend = RTU;
         } else {
             printf("Modbus server for unit testing.\n");
-            printf("Usage:\n  %s [tcp|tcppi|rtu] [<ip or device>]\n", argv[0]);
-            printf("Eg. tcp 127.0.0.1 or rtu /dev/ttyUSB0\n\n");
+            printf("Usage:\n  %s [tcp|tcppi|rtu] [<ip or device>] [packed|sparse|shm]\n", argv[0]);
+            printf("Eg. tcp 127.0.0.1 or rtu /dev/ttyUSB0\n");
+            printf("packed stores the bits of the mapping 8 per byte\n");
+            printf("sparse stores the mapping in pages allocated on write\n");
+            printf("shm stores the mapping in the shared memory region %s\n\n", UT_SHM_NAME);
             return -1;
         }
     } else {
@@ -80,6 +154,10 @@ int main(int argc, char *argv[])
         }
     }
 
+    packed_bits = (argc > 3 && strcmp(argv[3], "packed") == 0);
+    sparse = (argc > 3 && strcmp(argv[3], "sparse") == 0);
+    shm = (argc > 3 && strcmp(argv[3], "shm") == 0);
+
     if (use_backend == TCP) {
         ctx = modbus_new_tcp(ip_or_device, 1502);
         query = malloc(MODBUS_TCP_MAX_ADU_LENGTH);
@@ -96,14 +174,58 @@ int main(int argc, char *argv[])
 
     modbus_set_debug(ctx, TRUE);
 
-    mb_mapping = modbus_mapping_new_start_address(UT_BITS_ADDRESS,
-                                                  UT_BITS_NB,
-                                                  UT_INPUT_BITS_ADDRESS,
-                                                  UT_INPUT_BITS_NB,
-                                                  UT_REGISTERS_ADDRESS,
-                                                  UT_REGISTERS_NB_MAX,
-                                                  UT_INPUT_REGISTERS_ADDRESS,
-                                                  UT_INPUT_REGISTERS_NB);
+    if (sparse) {
+        mb_mapping = modbus_mapping_new_sparse();
+        if (mb_mapping != NULL) {
+            modbus_mapping_add_range(mb_mapping, MODBUS_TABLE_BITS, UT_BITS_ADDRESS, UT_BITS_NB);
+            modbus_mapping_add_range(
+                mb_mapping, MODBUS_TABLE_INPUT_BITS, UT_INPUT_BITS_ADDRESS, UT_INPUT_BITS_NB);
+            /* Overlapping and adjacent ranges are merged */
+            modbus_mapping_add_range(mb_mapping,
+                                     MODBUS_TABLE_REGISTERS,
+                                     UT_REGISTERS_ADDRESS + UT_REGISTERS_NB_MAX / 2,
+                                     UT_REGISTERS_NB_MAX / 2);
+            modbus_mapping_add_range(mb_mapping,
+                                     MODBUS_TABLE_REGISTERS,
+                                     UT_REGISTERS_ADDRESS,
+                                     UT_REGISTERS_NB_MAX / 2 + 1);
+            modbus_mapping_add_range(mb_mapping,
+                                     MODBUS_TABLE_INPUT_REGISTERS,
+                                     UT_INPUT_REGISTERS_ADDRESS,
+                                     UT_INPUT_REGISTERS_NB);
+        }
+    } else if (shm) {
+        /* A region left by a killed server is replaced */
+        mb_mapping = modbus_mapping_new_shm(UT_SHM_NAME,
+                                            0600,
+                                            TRUE,
+                                            UT_BITS_ADDRESS,
+                                            UT_BITS_NB,
+                                            UT_INPUT_BITS_ADDRESS,
+                                            UT_INPUT_BITS_NB,
+                                            UT_REGISTERS_ADDRESS,
+                                            UT_REGISTERS_NB_MAX,
+                                            UT_INPUT_REGISTERS_ADDRESS,
+                                            UT_INPUT_REGISTERS_NB);
+    } else if (packed_bits) {
+        mb_mapping = modbus_mapping_new_packed_bits(UT_BITS_ADDRESS,
+                                                    UT_BITS_NB,
+                                                    UT_INPUT_BITS_ADDRESS,
+                                                    UT_INPUT_BITS_NB,
+                                                    UT_REGISTERS_ADDRESS,
+                                                    UT_REGISTERS_NB_MAX,
+                                                    UT_INPUT_REGISTERS_ADDRESS,
+                                                    UT_INPUT_REGISTERS_NB);
+    } else {
+        mb_mapping = modbus_mapping_new_start_address(UT_BITS_ADDRESS,
+                                                      UT_BITS_NB,
+                                                      UT_INPUT_BITS_ADDRESS,
+                                                      UT_INPUT_BITS_NB,
+                                                      UT_REGISTERS_ADDRESS,
+                                                      UT_REGISTERS_NB_MAX,
+                                                      UT_INPUT_REGISTERS_ADDRESS,
+                                                      UT_INPUT_REGISTERS_NB);
+    }
     if (mb_mapping == NULL) {
         fprintf(stderr, "Failed to allocate the mapping: %s\n", modbus_strerror(errno));
         modbus_free(ctx);
@@ -113,13 +235,69 @@ int main(int argc, char *argv[])
     /* Examples from PI_MODBUS_300.pdf.
        Only the read-only input values are assigned. */
 
+    /* Served by callbacks whatever the kind of mapping */
+    modbus_mapping_add_callback(mb_mapping,
+                                MODBUS_TABLE_REGISTERS,
+                                UT_CALLBACK_REGISTERS_ADDRESS,
+                                UT_CALLBACK_REGISTERS_NB,
+                                read_callback_registers,
+                                write_callback_registers,
+                                callback_registers);
+
+    /* The input values of the shared memory region are written through
+       another mapping of the region, as another process would do */
+    inputs_mapping = shm ? modbus_mapping_open_shm(UT_SHM_NAME) : mb_mapping;
+    if (inputs_mapping == NULL) {
+        fprintf(stderr, "Failed to open the mapping: %s\n", modbus_strerror(errno));
+        modbus_mapping_free(mb_mapping);
+        modbus_free(ctx);
+        return -1;
+    }
+
     /* Initialize input values that's can be only done server side. */
-    modbus_set_bits_from_bytes(
-        mb_mapping->tab_input_bits, 0, UT_INPUT_BITS_NB, UT_INPUT_BITS_TAB);
+    modbus_mapping_write_begin(inputs_mapping, MODBUS_TABLE_INPUT_BITS);
+    if (packed_bits || sparse) {
+        for (i = 0; i < UT_INPUT_BITS_NB; i++) {
+            modbus_mapping_set_input_bit(inputs_mapping,
+                                         UT_INPUT_BITS_ADDRESS + i,
+                                         (UT_INPUT_BITS_TAB[i / 8] >> (i % 8)) & 1);
+        }
+    } else {
+        modbus_set_bits_from_bytes(
+            inputs_mapping->tab_input_bits, 0, UT_INPUT_BITS_NB, UT_INPUT_BITS_TAB);
+    }
+    modbus_mapping_write_end(inputs_mapping, MODBUS_TABLE_INPUT_BITS);
 
     /* Initialize values of INPUT REGISTERS */
+    modbus_mapping_write_begin(inputs_mapping, MODBUS_TABLE_INPUT_REGISTERS);
     for (i = 0; i < UT_INPUT_REGISTERS_NB; i++) {
-        mb_mapping->tab_input_registers[i] = UT_INPUT_REGISTERS_TAB[i];
+        modbus_mapping_set_input_register(
+            inputs_mapping, UT_INPUT_REGISTERS_ADDRESS + i, UT_INPUT_REGISTERS_TAB[i]);
+    }
+    modbus_mapping_write_end(inputs_mapping, MODBUS_TABLE_INPUT_REGISTERS);
+
+    if (inputs_mapping != mb_mapping) {
+        modbus_mapping_free(inputs_mapping);
+    }
+
+    /* In TCP, the units are served by the mapping except UT_UNIT_ID which has
+       its own and UT_UNIT_ID_MISSING which has none */
+    if (use_backend != RTU) {
+        unit_mapping = modbus_mapping_new_start_address(0, 0, 0, 0, UT_REGISTERS_ADDRESS, 1, 0, 0);
+        if (unit_mapping == NULL) {
+            fprintf(stderr, "Failed to allocate the mapping: %s\n", modbus_strerror(errno));
+            modbus_mapping_free(mb_mapping);
+            modbus_free(ctx);
+            return -1;
+        }
+        unit_mapping->tab_registers[0] = UT_UNIT_REGISTER;
+
+        for (i = 0; i < MODBUS_MAX_UNITS; i++) {
+            units[i] = mb_mapping;
+        }
+        units[UT_UNIT_ID] = unit_mapping;
+        units[UT_UNIT_ID_MISSING] = NULL;
+        modbus_set_units(ctx, units);
     }
 
     if (use_backend == TCP) {
@@ -137,6 +315,10 @@ int main(int argc, char *argv[])
         }
     }
 
+#ifndef _WIN32
+    churn = (pthread_create(&churn_thread, NULL, churn_mappings, NULL) == 0);
+#endif
+
     for (;;) {
         do {
             rc = modbus_receive(ctx, query);
@@ -214,11 +396,19 @@ int main(int argc, char *argv[])
 
     printf("Quit the loop: %s\n", modbus_strerror(errno));
 
+#ifndef _WIN32
+    if (churn) {
+        __atomic_store_n(&churn_stop, TRUE, __ATOMIC_RELEASE);
+        pthread_join(churn_thread, NULL);
+    }
+#endif
+
     if (use_backend == TCP) {
         if (s != -1) {
             close(s);
         }
     }
+    modbus_mapping_free(unit_mapping);
     modbus_mapping_free(mb_mapping);
     free(query);
     /* For RTU */
@@ -27,6 +27,9 @@
 
 #define SERVER_ID         17
 #define INVALID_SERVER_ID 18
+/* Units of the TCP server with their own mapping and without mapping */
+#define UT_UNIT_ID         32
+#define UT_UNIT_ID_MISSING 33
 
 const uint16_t UT_BITS_ADDRESS = 0x130;
 const uint16_t UT_BITS_NB = 0x25;
@@ -59,6 +62,14 @@ const uint16_t UT_INPUT_REGISTERS_ADDRESS = 0x108;
 const uint16_t UT_INPUT_REGISTERS_NB = 0x1;
 const uint16_t UT_INPUT_REGISTERS_TAB[] = { 0x000A };
 
+/* Holding registers served by the callbacks of the server, a read of the last
+   one is answered with a SLAVE_OR_SERVER_BUSY exception */
+const uint16_t UT_CALLBACK_REGISTERS_ADDRESS = 0x300;
+const uint16_t UT_CALLBACK_REGISTERS_NB = 0x10;
+
+/* Value of the register at UT_REGISTERS_ADDRESS of UT_UNIT_ID */
+const uint16_t UT_UNIT_REGISTER = 0x5A5A;
+
 /*
  * This float value is 0x47F12000 (in big-endian format).
  * In Little-endian(intel) format, it will be stored in memory as follows:
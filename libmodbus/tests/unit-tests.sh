@@ -5,15 +5,25 @@ server_log=unit-test-server.log
 
 rm -f $client_log $server_log
 
-echo "Starting server"
-./unit-test-server > $server_log 2>&1 &
+# The suite is run on a mapping of bytes, a mapping of packed bits, a sparse
+# mapping and a mapping in shared memory
+for mapping in bytes packed sparse shm; do
+    echo "Starting server ($mapping)"
+    ./unit-test-server tcp 127.0.0.1 $mapping >> $server_log 2>&1 &
 
-sleep 1
+    sleep 1
 
-echo "Starting client"
-./unit-test-client > $client_log 2>&1
-rc=$?
+    echo "Starting client"
+    ./unit-test-client >> $client_log 2>&1
+    rc=$?
 
-killall unit-test-server
-exit $rc
+    killall unit-test-server
+    if [ $rc -ne 0 ]; then
+        break
+    fi
+done
+
+# The killed server didn't remove its shared memory region
+rm -f /dev/shm/unit-test-server
 
+exit $rc
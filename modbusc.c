@@ -28,6 +28,8 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include <argtable3.h>
 
@@ -37,6 +39,8 @@
 #include "mbu-common.h"
 
 #define PROGMANE "modbusc"
+/* Serial lines polled by one process */
+#define MAX_LINES 16
 
 typedef enum {
     FuncNone =          -1,
@@ -62,9 +66,87 @@ typedef union {
     uint16_t *data16;
 } Data;
 
+typedef enum {
+    /* Big-endian registers or packed bits, as in the Modbus PDU */
+    FileRaw,
+    /* Hexadecimal values separated by spaces, commas or lines */
+    FileHex,
+    /* Decimal values separated by spaces, commas or lines */
+    FileCsv
+} FileFormat;
+
 int process_request(modbus_t* ctx, int addrStart, int addrEnd, int func, int reg, int nb, WriteDataType dataType, Data data, const char* prefixScan);
+int process_scan(modbus_t* ctx, int addrStart, int addrEnd, int func, int reg, int nb, WriteDataType dataType, Data data);
+void print_success(bool isWriteFunction, int nb, WriteDataType dataType, Data data);
+int process_poll(modbus_t** ctxs, const char** devices, int nbLines, int addr, int func, int reg, int nb, WriteDataType dataType, Data data, int period);
+void print_poll(modbus_scheduler_t *scheduler, int job, int rc, void *user_data);
+void *run_poll(void *arg);
+void stop_poll(int dummy);
+int process_sniff(modbus_t* ctx, bool dump);
+void print_frame(modbus_sniffer_t *sniffer, const modbus_sniffed_frame_t *frame, void *user_data);
+void stop_sniff(int dummy);
+int process_map(modbus_t* ctx, const char* fileName, int maxGap);
+int process_write_file(modbus_t* ctx, int func, int reg, int nb, const char* fileName, FileFormat format);
+int process_read_file(modbus_t* ctx, int func, int reg, int nb, const char* fileName, FileFormat format);
 
 int verbose = 0;
+/* Scans stop at the first slave which responds */
+bool firstOnly = false;
+
+/* Poll mode: each line has its own thread and bus scheduler */
+typedef struct {
+    const char *device;
+    modbus_scheduler_t *scheduler;
+    bool isWriteFunction;
+    int nb;
+    WriteDataType dataType;
+    Data data;
+    pthread_t thread;
+} PollLine;
+
+static PollLine *pollLines = NULL;
+static int nbPollLines = 0;
+/* The lines print their results from their own threads */
+static pthread_mutex_t printLock = PTHREAD_MUTEX_INITIALIZER;
+/* Stopped by SIGINT */
+static modbus_sniffer_t *activeSniffer = NULL;
+
+/* Keywords of a map file */
+typedef struct {
+    const char *name;
+    int value;
+} MapKeyword;
+
+static const MapKeyword mapTables[] = {
+    {"coil", MODBUS_FC_READ_COILS},
+    {"di", MODBUS_FC_READ_DISCRETE_INPUTS},
+    {"hr", MODBUS_FC_READ_HOLDING_REGISTERS},
+    {"ir", MODBUS_FC_READ_INPUT_REGISTERS},
+    {NULL, -1}
+};
+
+static const MapKeyword mapTypes[] = {
+    {"bit", MODBUS_POINT_BIT},
+    {"uint16", MODBUS_POINT_UINT16},
+    {"int16", MODBUS_POINT_INT16},
+    {"uint32", MODBUS_POINT_UINT32},
+    {"int32", MODBUS_POINT_INT32},
+    {"float", MODBUS_POINT_FLOAT},
+    {NULL, -1}
+};
+
+static const MapKeyword mapOrders[] = {
+    {"abcd", MODBUS_POINT_ABCD},
+    {"dcba", MODBUS_POINT_DCBA},
+    {"badc", MODBUS_POINT_BADC},
+    {"cdab", MODBUS_POINT_CDAB},
+    {NULL, -1}
+};
+
+typedef struct {
+    char name[64];
+    int type;
+} MapPoint;
 
 int main(int argc, char **argv)
 {
@@ -94,12 +176,18 @@ int main(int argc, char **argv)
     struct arg_int *dwrite = arg_intn("w", "write",                 "<n>", 0, 123,                      "Data to write");
     struct arg_int *count  = arg_int0("c", "count",                 "<reg>",                            "Data read count");
     struct arg_int *tout   = arg_int0("o", "timeout",               "<ms>",                             "Request timeout");
+    struct arg_int *poll   = arg_int0(NULL, "poll",                 "<ms>",                             "Repeat the request every <ms> until Ctrl-C");
+    struct arg_lit *first  = arg_lit0(NULL, "first",                                                    "Stop the scan at the first response");
+    struct arg_file *wfile = arg_file0(NULL, "write-file",          "<file>",                           "Write the values of a file (-f 15|16)");
+    struct arg_file *rfile = arg_file0(NULL, "read-file",           "<file>",                           "Read <count> values into a file (-f 1-4)");
+    struct arg_rex *format = arg_rex0(NULL, "format",    "^raw$|^hex$|^csv$",
+                                                                    "<raw|hex|csv>=raw",ARG_REX_ICASE,  "Format of the data file");
     struct arg_lit *base1  = arg_lit0("1", "base-1",                                                    "Base 1 addressing");
     struct arg_lit *debug  = arg_litn("v", "verbose",                      0, 2,                        "Enable verbpse output");
     struct arg_lit *help   = arg_lit0("h", "help",                                                      "Print this help and exit");
     /* RTU */
     struct arg_rex *rtu    = arg_rex1(NULL, NULL,        "rtu",   NULL,               ARG_REX_ICASE,  NULL);
-    struct arg_str *dev    = arg_str1("d", "dev",                   "<device>",                         "Serial device");
+    struct arg_str *dev    = arg_strn("d", "dev",                   "<device>", 1, MAX_LINES,           "Serial device (repeat for several lines)");
     struct arg_int *baud   = arg_intn("b", "baud",                  "<n>", 1, 16,                       "Baud rate");
     struct arg_rex *dbit   = arg_rex0(NULL, "data-bits", "^7$|^8$", "<7|8>=8",          ARG_REX_ICASE,  "Data bits");
     struct arg_rex *sbit   = arg_rex0(NULL, "stop-bits", "^1$|^2$", "<1|2>=1",          ARG_REX_ICASE,  "Stop bits");
@@ -112,12 +200,31 @@ int main(int argc, char **argv)
     struct arg_rex *ip     = arg_rex0("i", "addr", "^([0-9]{1,3}\\.){3}([0-9]{1,3})$",
                                                                     "<IP>=127.0.0.1",   ARG_REX_ICASE,  "Device IP address");
     struct arg_end *end2    = arg_end(20);
+    /* RTU bus monitor */
+    struct arg_lit *sniff  = arg_lit1(NULL, "sniff",                                                    "Monitor the bus until Ctrl-C");
+    struct arg_lit *dump   = arg_lit0("x", "dump",                                                      "Print the frames");
+    struct arg_int *silence= arg_int0(NULL, "silence",              "<us>",                             "Silence ending a frame (t3.5)");
+    struct arg_end *end3    = arg_end(20);
+    /* Map file read */
+    struct arg_file *map   = arg_file1(NULL, "map",                 "<file>",                           "Read the points of a map file");
+    struct arg_rem *map1   = arg_rem("",                                                                "Line: <name> <coil|di|hr|ir> <reg>");
+    struct arg_rem *map2   = arg_rem("",                                                                "      <bit|uint16|int16|uint32|int32|float>");
+    struct arg_rem *map3   = arg_rem("",                                                                "      [abcd|dcba|badc|cdab]");
+    struct arg_int *gap    = arg_int0(NULL, "max-gap",              "<n>=0",                            "Unused registers read to save a request");
+    struct arg_end *end4    = arg_end(20);
+    struct arg_end *end5    = arg_end(20);
 
     void* argtable1[] = {rtu, addr, addr1, reg, func, func1, func2, func3, func4, func5, func6, func7, func8,
-                            dev, baud, dbit, sbit, parity, dwrite, count, tout, base1, debug, help, end1};
+                            dev, baud, dbit, sbit, parity, dwrite, count, tout, poll, first, wfile, rfile, format, base1, debug, help, end1};
 
     void* argtable2[] = {tcp, addr, addr1, reg, func, func1, func2, func3, func4, func5, func6, func7, func8,
-                            port, ip, dwrite, count, tout, base1, debug, help, end2};
+                            port, ip, dwrite, count, tout, poll, wfile, rfile, format, base1, debug, help, end2};
+
+    void* argtable3[] = {rtu, sniff, dev, baud, dbit, sbit, parity, dump, silence, tout, debug, help, end3};
+
+    void* argtable4[] = {rtu, map, map1, map2, map3, addr, dev, baud, dbit, sbit, parity, gap, tout, debug, help, end4};
+
+    void* argtable5[] = {tcp, map, map1, map2, map3, addr, port, ip, gap, tout, debug, help, end5};
 
     /* defaults */
     count->ival[0]      = 1;
@@ -126,9 +233,14 @@ int main(int argc, char **argv)
     sbit->sval[0]       = "1";
     port->ival[0]       = 502;
     ip->sval[0]         = "127.0.0.1";
+    gap->ival[0]        = 0;
+    format->sval[0]     = "raw";
 
     int nerrors1 = arg_parse(argc,argv,argtable1);
     int nerrors2 = arg_parse(argc,argv,argtable2);
+    int nerrors3 = arg_parse(argc,argv,argtable3);
+    int nerrors4 = arg_parse(argc,argv,argtable4);
+    int nerrors5 = arg_parse(argc,argv,argtable5);
 
     /* array defaults */
     if(parity->count == 0) {
@@ -139,7 +251,16 @@ int main(int argc, char **argv)
     /* special case: '--help' takes precedence over error reporting */
     if (help->count) {
         printf("Modbus client utils.\n\n");
-        if (rtu->count) {
+        if (rtu->count && sniff->count) {
+            arg_print_syntax(stdout, argtable3, "\n");
+            arg_print_glossary(stdout, argtable3, "  %-30s %s\n");
+        } else if (rtu->count && map->count) {
+            arg_print_syntax(stdout, argtable4, "\n");
+            arg_print_glossary(stdout, argtable4, "  %-30s %s\n");
+        } else if (tcp->count && map->count) {
+            arg_print_syntax(stdout, argtable5, "\n");
+            arg_print_glossary(stdout, argtable5, "  %-30s %s\n");
+        } else if (rtu->count) {
             arg_print_syntax(stdout, argtable1, "\n");
             arg_print_glossary(stdout, argtable1, "  %-30s %s\n");
         } else if (tcp->count) {
@@ -151,7 +272,28 @@ int main(int argc, char **argv)
         return 0;
     }
     /* If the parser returned any errors then display them and exit */
-    if (rtu->count) {
+    if (rtu->count && sniff->count) {
+        if(nerrors3) {
+            /* Display the error details contained in the arg_end struct.*/
+            arg_print_errors(stdout, end3, PROGMANE" rtu --sniff");
+            printf("Try '%s --help' for more information.\n", PROGMANE" rtu --sniff");
+            exit(EXIT_FAILURE);
+        }
+    } else if (rtu->count && map->count) {
+        if(nerrors4) {
+            /* Display the error details contained in the arg_end struct.*/
+            arg_print_errors(stdout, end4, PROGMANE" rtu --map");
+            printf("Try '%s --help' for more information.\n", PROGMANE" rtu --map");
+            exit(EXIT_FAILURE);
+        }
+    } else if (tcp->count && map->count) {
+        if(nerrors5) {
+            /* Display the error details contained in the arg_end struct.*/
+            arg_print_errors(stdout, end5, PROGMANE" tcp --map");
+            printf("Try '%s --help' for more information.\n", PROGMANE" tcp --map");
+            exit(EXIT_FAILURE);
+        }
+    } else if (rtu->count) {
         if(nerrors1) {
             /* Display the error details contained in the arg_end struct.*/
             arg_print_errors(stdout, end1, PROGMANE" rtu");
@@ -169,10 +311,62 @@ int main(int argc, char **argv)
         printf("Missing <rtu|tcp> command.\n");
         printf("usage 1: %s ", PROGMANE);  arg_print_syntax(stdout,argtable1,"\n");
         printf("usage 2: %s ", PROGMANE);  arg_print_syntax(stdout,argtable2,"\n");
+        printf("usage 3: %s ", PROGMANE);  arg_print_syntax(stdout,argtable3,"\n");
+        printf("usage 4: %s ", PROGMANE);  arg_print_syntax(stdout,argtable4,"\n");
+        printf("usage 5: %s ", PROGMANE);  arg_print_syntax(stdout,argtable5,"\n");
         exit(EXIT_FAILURE);
     }
 
     verbose = debug->count;
+    firstOnly = first->count > 0;
+
+    if (sniff->count) {
+        ctx = modbus_new_rtu(dev->sval[0],
+                baud->ival[0], toupper(parity->sval[0][0]), getInt(dbit->sval[0], 0), getInt(sbit->sval[0], 0));
+        modbus_set_debug(ctx, verbose > 1);
+        modbus_set_response_timeout(ctx, 0, tout->ival[0] * 1000);
+        if (silence->count)
+            modbus_rtu_set_frame_silence(ctx, silence->ival[0]);
+        /* Optional, the bytes are timed more accurately */
+        modbus_rtu_set_low_latency(ctx, 1);
+
+        if (modbus_connect(ctx)) {
+            fprintf(stderr, "Connection failed: %s\n",
+                    modbus_strerror(errno));
+            modbus_free(ctx);
+            return -1;
+        }
+
+        int ret = process_sniff(ctx, dump->count || verbose);
+
+        modbus_close(ctx);
+        modbus_free(ctx);
+        exit(ret ? EXIT_FAILURE : 0);
+    }
+
+    if (map->count) {
+        if (rtu->count)
+            ctx = modbus_new_rtu(dev->sval[0],
+                    baud->ival[0], toupper(parity->sval[0][0]), getInt(dbit->sval[0], 0), getInt(sbit->sval[0], 0));
+        else
+            ctx = modbus_new_tcp(ip->sval[0], port->ival[0]);
+        modbus_set_debug(ctx, rtu->count ? verbose > 1 : verbose);
+        modbus_set_response_timeout(ctx, 0, tout->ival[0] * 1000);
+        modbus_set_slave(ctx, getInt(addr->sval[0], 0));
+
+        if (modbus_connect(ctx)) {
+            fprintf(stderr, "Connection failed: %s\n",
+                    modbus_strerror(errno));
+            modbus_free(ctx);
+            return -1;
+        }
+
+        int ret = process_map(ctx, map->filename[0], gap->ival[0]);
+
+        modbus_close(ctx);
+        modbus_free(ctx);
+        exit(ret ? EXIT_FAILURE : 0);
+    }
 
     bool addrScan = false;
     int addrStart;
@@ -192,6 +386,54 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
+    if(poll->count && (addrScan || poll->ival[0] <= 0 || func->ival[0] == ReadDiscreteInput)) {
+        printf("%s:Polling needs a single address, a positive period and a function other than 0x02.\n", PROGMANE);
+        exit(EXIT_FAILURE);
+    }
+
+    if (wfile->count || rfile->count) {
+        if (addrScan || poll->count || (wfile->count && rfile->count)) {
+            printf("%s:A data file needs a single address, no polling and one direction.\n", PROGMANE);
+            exit(EXIT_FAILURE);
+        }
+
+        FileFormat fileFormat = FileRaw;
+        if (toupper(format->sval[0][0]) == 'H')
+            fileFormat = FileHex;
+        else if (toupper(format->sval[0][0]) == 'C')
+            fileFormat = FileCsv;
+
+        if (rtu->count)
+            ctx = modbus_new_rtu(dev->sval[0],
+                    baud->ival[0], toupper(parity->sval[0][0]), getInt(dbit->sval[0], 0), getInt(sbit->sval[0], 0));
+        else
+            ctx = modbus_new_tcp(ip->sval[0], port->ival[0]);
+        modbus_set_debug(ctx, rtu->count ? verbose > 1 : verbose);
+        modbus_set_response_timeout(ctx, 0, tout->ival[0] * 1000);
+        modbus_set_slave(ctx, addrStart);
+        /* The requests of the blocks are pipelined on TCP */
+        modbus_set_max_in_flight(ctx, MODBUS_MAX_IN_FLIGHT);
+
+        if (modbus_connect(ctx)) {
+            fprintf(stderr, "Connection failed: %s\n",
+                    modbus_strerror(errno));
+            modbus_free(ctx);
+            return -1;
+        }
+
+        int ret;
+        if (wfile->count)
+            ret = process_write_file(ctx, func->ival[0], reg->ival[0], count->count ? count->ival[0] : 0,
+                                     wfile->filename[0], fileFormat);
+        else
+            ret = process_read_file(ctx, func->ival[0], reg->ival[0], count->ival[0],
+                                    rfile->filename[0], fileFormat);
+
+        modbus_close(ctx);
+        modbus_free(ctx);
+        exit(ret ? EXIT_FAILURE : 0);
+    }
+
     //choose write data type
     switch (func->ival[0]) {
     case(ReadCoils):
@@ -271,39 +513,89 @@ int main(int argc, char **argv)
             printf("\n");
     }
 
-    if (rtu->count) {
+    if (poll->count) {
+        modbus_t *ctxs[MAX_LINES];
+        int nbLines = rtu->count ? dev->count : 1;
+        int ret = 0;
+
+        /* All the lines are connected before the polling starts */
+        for (int i = 0; i < nbLines; i++) {
+            if (rtu->count)
+                ctxs[i] = modbus_new_rtu(dev->sval[i],
+                        baud->ival[0], toupper(parity->sval[0][0]), getInt(dbit->sval[0], 0), getInt(sbit->sval[0], 0));
+            else
+                ctxs[i] = modbus_new_tcp(ip->sval[0], port->ival[0]);
+            modbus_set_debug(ctxs[i], rtu->count ? verbose > 1 : verbose);
+            modbus_set_response_timeout(ctxs[i], 0, tout->ival[0] * 1000);
+            if (modbus_connect(ctxs[i])) {
+                fprintf(stderr, "Connection failed: %s\n",
+                        modbus_strerror(errno));
+                modbus_free(ctxs[i]);
+                nbLines = i;
+                ret = -1;
+                break;
+            }
+        }
+
+        if (ret == 0)
+            ret = process_poll(ctxs, rtu->count ? dev->sval : NULL, nbLines, addrStart, func->ival[0], reg->ival[0], readWriteNo, wDataType, data, poll->ival[0]);
+
+        //cleanup
+        for (int i = 0; i < nbLines; i++) {
+            modbus_close(ctxs[i]);
+            modbus_free(ctxs[i]);
+        }
+        if (ret)
+            exit(EXIT_FAILURE);
+    } else if (rtu->count) {
         char prefix[32] = {0};
         int prefixLen = 0;
         bool scanMode = baud->count > 1 || parity->count > 1;
 
-        for (int i = 0; i < baud->count; i++) {
-            if(scanMode) {
-                sprintf(prefix, "Baudrate:%d ", baud->ival[i]);
-                prefixLen = strlen(prefix);
+        for (int d = 0; d < dev->count; d++) {
+            /* Several lines are processed one after the other */
+            if (dev->count > 1) {
+                printf("Device:%s\n", dev->sval[d]);
             }
-            for (int j = 0; j < parity->count; j++) {
-                if(scanMode)
-                    sprintf(prefix + prefixLen, "Parity:%c ", toupper(parity->sval[j][0]));
-                ctx = modbus_new_rtu(dev->sval[0],
-                        baud->ival[i], toupper(parity->sval[j][0]), getInt(dbit->sval[0], 0), getInt(sbit->sval[0], 0));
-                modbus_set_debug(ctx, verbose > 1);
-                modbus_set_response_timeout(ctx, 0, tout->ival[0] * 1000);
-
-                //issue the request
-                int ret = -1;
-                if (modbus_connect(ctx)) {
-                    fprintf(stderr, "Connection failed: %s\n",
-                            modbus_strerror(errno));
-                    modbus_free(ctx);
-                    return -1;
-                }
+            ctx = modbus_new_rtu(dev->sval[d],
+                    baud->ival[0], toupper(parity->sval[0][0]), getInt(dbit->sval[0], 0), getInt(sbit->sval[0], 0));
+            modbus_set_debug(ctx, verbose > 1);
+            modbus_set_response_timeout(ctx, 0, tout->ival[0] * 1000);
 
-                process_request(ctx, addrStart, addrEnd, func->ival[0], reg->ival[0], readWriteNo, wDataType, data, prefix);
-
-                //cleanup
-                modbus_close(ctx);
+            if (modbus_connect(ctx)) {
+                fprintf(stderr, "Connection failed: %s\n",
+                        modbus_strerror(errno));
                 modbus_free(ctx);
+                return -1;
+            }
+
+            /* The device stays open, only the line settings change between
+               two combinations of the scan */
+            bool found = false;
+            for (int i = 0; i < baud->count && !found; i++) {
+                if(scanMode) {
+                    sprintf(prefix, "Baudrate:%d ", baud->ival[i]);
+                    prefixLen = strlen(prefix);
+                }
+                for (int j = 0; j < parity->count && !found; j++) {
+                    if(scanMode)
+                        sprintf(prefix + prefixLen, "Parity:%c ", toupper(parity->sval[j][0]));
+                    if (modbus_rtu_set_line(ctx,
+                            baud->ival[i], toupper(parity->sval[j][0]), getInt(dbit->sval[0], 0), getInt(sbit->sval[0], 0))) {
+                        fprintf(stderr, "%sLine setting failed: %s\n", prefix,
+                                modbus_strerror(errno));
+                        continue;
+                    }
+
+                    //issue the request
+                    int nbFound = process_request(ctx, addrStart, addrEnd, func->ival[0], reg->ival[0], readWriteNo, wDataType, data, prefix);
+                    found = firstOnly && nbFound > 0;
+                }
             }
+
+            //cleanup
+            modbus_close(ctx);
+            modbus_free(ctx);
         }
     } else {
         ctx = modbus_new_tcp(ip->sval[0], port->ival[0]);
@@ -319,7 +611,11 @@ int main(int argc, char **argv)
             return -1;
         }
 
-        process_request(ctx, addrStart, addrEnd, func->ival[0], reg->ival[0], readWriteNo, wDataType, data, "");
+        /* Reading discrete inputs is not implemented yet */
+        if (addrScan && func->ival[0] != ReadDiscreteInput)
+            process_scan(ctx, addrStart, addrEnd, func->ival[0], reg->ival[0], readWriteNo, wDataType, data);
+        else
+            process_request(ctx, addrStart, addrEnd, func->ival[0], reg->ival[0], readWriteNo, wDataType, data, "");
 
         //cleanup
         modbus_close(ctx);
@@ -341,9 +637,11 @@ int main(int argc, char **argv)
     exit(0);
 }
 
+/* Returns the number of slaves which responded */
 int process_request(modbus_t* ctx, int addrStart, int addrEnd, int func, int reg, int nb, WriteDataType dataType, Data data, const char* prefixScan)
 {
     int ret = -1;
+    int nbFound = 0;
     bool isWriteFunction = false;
     bool addrScan = addrEnd != addrStart;
     for (int i = addrStart; i <= addrEnd; i++) {
@@ -387,27 +685,601 @@ int process_request(modbus_t* ctx, int addrStart, int addrEnd, int func, int reg
             printf("%sAddress:%d\n", prefixScan, i);
         if (ret == nb) {//success
             ret = 0;
-            if (isWriteFunction)
-                printf("SUCCESS: written %d elements!\n", nb);
-            else {
-                printf("SUCCESS: read %d of elements:\n\tData: ", nb);
-                int i = 0;
-                if (DataInt == dataType) {
-                    printf("0x%04x\n", data.dataInt);
-                }
-                else {
-                    const char Format8[] = "0x%02x ";
-                    const char Format16[] = "0x%04x ";
-                    const char *format = ((Data8Array == dataType) ? Format8 : Format16);
-                    for (; i < nb; ++i) {
-                        printf(format, (Data8Array == dataType) ? data.data8[i] : data.data16[i]);
-                    }
-                    printf("\n");
-                }
-            }
+            nbFound++;
+            print_success(isWriteFunction, nb, dataType, data);
+            if (firstOnly)
+                break;
         }
         else if (!addrScan){
             printf("ERROR occured, ret:%d, %s\n", ret, modbus_strerror(errno));
         }
     }
+    return nbFound;
+}
+
+void print_success(bool isWriteFunction, int nb, WriteDataType dataType, Data data)
+{
+    if (isWriteFunction)
+        printf("SUCCESS: written %d elements!\n", nb);
+    else {
+        printf("SUCCESS: read %d of elements:\n\tData: ", nb);
+        int i = 0;
+        if (DataInt == dataType) {
+            printf("0x%04x\n", data.dataInt);
+        }
+        else {
+            const char Format8[] = "0x%02x ";
+            const char Format16[] = "0x%04x ";
+            const char *format = ((Data8Array == dataType) ? Format8 : Format16);
+            for (; i < nb; ++i) {
+                printf(format, (Data8Array == dataType) ? data.data8[i] : data.data16[i]);
+            }
+            printf("\n");
+        }
+    }
+}
+
+/* TCP address scan: the probes of all addresses are sent back-to-back, each one
+ * with its own transaction ID, and the responses are matched as they arrive, so
+ * the absent units all time out together instead of one after the other. */
+int process_scan(modbus_t* ctx, int addrStart, int addrEnd, int func, int reg, int nb, WriteDataType dataType, Data data)
+{
+    int nbAddr = addrEnd - addrStart + 1;
+    bool isWriteFunction = func != ReadCoils && func != ReadHoldingRegisters && func != ReadInputRegisters;
+    size_t size = (Data8Array == dataType) ? sizeof(uint8_t) : sizeof(uint16_t);
+    uint8_t value8 = data.dataInt;
+    uint16_t value16 = data.dataInt;
+    uint8_t *dest = NULL;
+    modbus_transaction_t *transactions;
+
+    transactions = calloc(nbAddr, sizeof(modbus_transaction_t));
+    if (!isWriteFunction)
+        dest = malloc(nbAddr * nb * size);
+    if (transactions == NULL || (!isWriteFunction && dest == NULL)) {
+        printf("Data alloc error!\n");
+        free(transactions);
+        free(dest);
+        return -1;
+    }
+
+    for (int i = 0; i < nbAddr; i++) {
+        modbus_transaction_t *t = &transactions[i];
+
+        t->slave = addrStart + i;
+        t->function = func;
+        t->addr = reg;
+        t->nb = nb;
+        if (isWriteFunction) {
+            if (WriteSingleCoil == func)
+                t->src = &value8;
+            else if (WriteSingleRegister == func)
+                t->src = &value16;
+            else
+                t->src = (Data8Array == dataType) ? (const void *)data.data8 : (const void *)data.data16;
+        } else {
+            t->dest = dest + i * nb * size;
+        }
+    }
+
+    /* All the probes are in flight at once (as many as libmodbus allows) */
+    modbus_set_max_in_flight(ctx, nbAddr < MODBUS_MAX_IN_FLIGHT ? nbAddr : MODBUS_MAX_IN_FLIGHT);
+    int ret = modbus_pipeline(ctx, transactions, nbAddr);
+
+    for (int i = 0; i < nbAddr; i++) {
+        modbus_transaction_t *t = &transactions[i];
+
+        if (verbose || t->rc == nb)
+            printf("Address:%d\n", t->slave);
+        if (t->rc == nb) {
+            Data result = data;
+
+            if (Data8Array == dataType && !isWriteFunction)
+                result.data8 = t->dest;
+            else if (Data16Array == dataType && !isWriteFunction)
+                result.data16 = t->dest;
+            print_success(isWriteFunction, nb, dataType, result);
+        } else if (verbose) {
+            printf("ERROR occured, ret:%d, %s\n", t->rc, modbus_strerror(t->error));
+        }
+    }
+
+    free(transactions);
+    free(dest);
+    return ret;
+}
+
+void stop_sniff(int dummy)
+{
+    (void) dummy;
+    modbus_sniffer_stop(activeSniffer);
+}
+
+void print_frame(modbus_sniffer_t *sniffer, const modbus_sniffed_frame_t *frame, void *user_data)
+{
+    uint64_t *firstTime = user_data;
+
+    (void) sniffer;
+    if (*firstTime == 0)
+        *firstTime = frame->time_us;
+
+    printf("%12.6f ", (frame->time_us - *firstTime) / 1e6);
+    if (frame->type == MODBUS_SNIFFER_REQUEST)
+        printf("REQ Address:%-3d Func:0x%02x            ", frame->slave, frame->function);
+    else if (frame->type == MODBUS_SNIFFER_RESPONSE)
+        printf("RSP Address:%-3d Func:0x%02x %8.3f ms ", frame->slave, frame->function,
+                frame->response_time_us / 1000.0);
+    else
+        printf("??? %-38s", "");
+    for (int i = 0; i < frame->length; i++)
+        printf(" %02x", frame->data[i]);
+    printf("\n");
+}
+
+/* RTU bus monitor: the frames on the line are decoded by the sniffer of
+ * libmodbus (nothing is sent) and the statistics of each slave are printed
+ * on Ctrl-C. */
+int process_sniff(modbus_t* ctx, bool dump)
+{
+    uint64_t firstTime = 0;
+    modbus_sniffer_stats_t stats;
+
+    activeSniffer = modbus_sniffer_new(ctx);
+    if (activeSniffer == NULL) {
+        printf("Sniffer error: %s\n", modbus_strerror(errno));
+        return -1;
+    }
+    if (dump)
+        modbus_sniffer_set_frame_callback(activeSniffer, print_frame, &firstTime);
+
+    signal(SIGINT, stop_sniff);
+    int ret = modbus_sniffer_run(activeSniffer);
+    signal(SIGINT, SIG_DFL);
+    if (ret == -1)
+        printf("ERROR occured, %s\n", modbus_strerror(errno));
+
+    modbus_sniffer_get_stats(activeSniffer, &stats);
+    printf("\nBytes:%llu Frames:%u Garbage bytes:%u\n",
+            (unsigned long long)stats.nb_bytes, stats.nb_frames, stats.nb_garbage_bytes);
+    printf("Address Requests Responses Exceptions Timeouts  Min(ms)  Avg(ms)  Max(ms)\n");
+    for (int i = 0; i <= 247; i++) {
+        modbus_sniffer_slave_stats_t slave;
+
+        modbus_sniffer_get_slave_stats(activeSniffer, i, &slave);
+        if (slave.nb_requests == 0 && slave.nb_responses == 0)
+            continue;
+        printf("%7d %8u %9u %10u %8u %8.3f %8.3f %8.3f\n", i,
+                slave.nb_requests, slave.nb_responses, slave.nb_exceptions, slave.nb_timeouts,
+                slave.min_response_time_us / 1000.0,
+                slave.nb_responses ? slave.sum_response_time_us / 1000.0 / slave.nb_responses : 0.0,
+                slave.max_response_time_us / 1000.0);
+    }
+
+    modbus_sniffer_free(activeSniffer);
+    activeSniffer = NULL;
+    return ret;
+}
+
+void stop_poll(int dummy)
+{
+    (void) dummy;
+    for (int i = 0; i < nbPollLines; i++)
+        modbus_scheduler_stop(pollLines[i].scheduler);
+}
+
+void print_poll(modbus_scheduler_t *scheduler, int job, int rc, void *user_data)
+{
+    PollLine *line = user_data;
+
+    (void) scheduler;
+    (void) job;
+    pthread_mutex_lock(&printLock);
+    if (line->device)
+        printf("Device:%s ", line->device);
+    if (rc == -1)
+        printf("ERROR occured, %s\n", modbus_strerror(errno));
+    else
+        print_success(line->isWriteFunction, line->nb, line->dataType, line->data);
+    pthread_mutex_unlock(&printLock);
+}
+
+void *run_poll(void *arg)
+{
+    PollLine *line = arg;
+
+    if (modbus_scheduler_run(line->scheduler) == -1) {
+        pthread_mutex_lock(&printLock);
+        printf("ERROR occured, %s\n", modbus_strerror(errno));
+        pthread_mutex_unlock(&printLock);
+    }
+
+    return NULL;
+}
+
+/* Poll mode: the request is repeated every period on each line by a bus
+ * scheduler running in its own thread, so the lines are polled at the same
+ * time. The statistics of each line are printed on Ctrl-C. */
+int process_poll(modbus_t** ctxs, const char** devices, int nbLines, int addr, int func, int reg, int nb, WriteDataType dataType, Data data, int period)
+{
+    bool isWriteFunction = func != ReadCoils && func != ReadHoldingRegisters && func != ReadInputRegisters;
+    size_t size = (Data8Array == dataType) ? sizeof(uint8_t) : sizeof(uint16_t);
+    uint8_t value8 = data.dataInt;
+    uint16_t value16 = data.dataInt;
+    modbus_job_t job;
+    int ret = 0;
+
+    pollLines = calloc(nbLines, sizeof(PollLine));
+    if (pollLines == NULL) {
+        printf("Data alloc error!\n");
+        return -1;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.slave = addr;
+    job.function = func;
+    job.addr = reg;
+    job.nb = nb;
+    job.period_ms = period;
+    if (isWriteFunction) {
+        if (WriteSingleCoil == func)
+            job.src = &value8;
+        else if (WriteSingleRegister == func)
+            job.src = &value16;
+        else
+            job.src = (Data8Array == dataType) ? (const void *)data.data8 : (const void *)data.data16;
+    }
+
+    for (int i = 0; i < nbLines; i++) {
+        PollLine *line = &pollLines[i];
+
+        line->device = devices ? devices[i] : NULL;
+        line->isWriteFunction = isWriteFunction;
+        line->nb = nb;
+        line->dataType = dataType;
+        line->data = data;
+        line->scheduler = modbus_scheduler_new(ctxs[i]);
+        nbPollLines++;
+        if (!isWriteFunction) {
+            /* Each line reads in its own buffer */
+            job.dest = malloc(nb * size);
+            if (Data8Array == dataType)
+                line->data.data8 = job.dest;
+            else
+                line->data.data16 = job.dest;
+        }
+        if (line->scheduler == NULL || (!isWriteFunction && job.dest == NULL) ||
+            modbus_scheduler_add_job(line->scheduler, &job) == -1) {
+            printf("Poll error: %s\n", modbus_strerror(errno));
+            ret = -1;
+            break;
+        }
+        modbus_scheduler_set_complete_callback(line->scheduler, print_poll, line);
+    }
+
+    if (ret == 0) {
+        signal(SIGINT, stop_poll);
+        for (int i = 0; i < nbPollLines; i++)
+            pthread_create(&pollLines[i].thread, NULL, run_poll, &pollLines[i]);
+        for (int i = 0; i < nbPollLines; i++)
+            pthread_join(pollLines[i].thread, NULL);
+        signal(SIGINT, SIG_DFL);
+
+        printf("\n");
+        for (int i = 0; i < nbPollLines; i++) {
+            modbus_job_stats_t stats;
+
+            modbus_scheduler_get_job_stats(pollLines[i].scheduler, 0, &stats);
+            if (pollLines[i].device)
+                printf("Device:%s ", pollLines[i].device);
+            printf("Polls:%u Errors:%u Overruns:%u Latency(ms) min:%.3f avg:%.3f max:%.3f\n",
+                    stats.nb_polls, stats.nb_errors, stats.nb_overruns,
+                    stats.min_latency_us / 1000.0,
+                    stats.nb_polls ? stats.sum_latency_us / 1000.0 / stats.nb_polls : 0.0,
+                    stats.max_latency_us / 1000.0);
+        }
+    }
+
+    for (int i = 0; i < nbPollLines; i++) {
+        modbus_scheduler_free(pollLines[i].scheduler);
+        if (!isWriteFunction)
+            free(pollLines[i].data.data8);
+    }
+    free(pollLines);
+    pollLines = NULL;
+    nbPollLines = 0;
+
+    return ret;
+}
+
+static int find_keyword(const MapKeyword *keywords, const char *name)
+{
+    for (; keywords->name; keywords++) {
+        if (strcmp(keywords->name, name) == 0)
+            return keywords->value;
+    }
+    return -1;
+}
+
+/* Map file read: the points are read with the minimal number of requests by the
+ * read planner of libmodbus then printed with their names. A line of the file
+ * is "<name> <table> <reg> <type> [order]", the lines beginning with '#' are
+ * comments. */
+int process_map(modbus_t* ctx, const char* fileName, int maxGap)
+{
+    FILE *file = fopen(fileName, "r");
+    if (file == NULL) {
+        printf("Can't open %s: %s\n", fileName, strerror(errno));
+        return -1;
+    }
+
+    modbus_planner_t *planner = modbus_planner_new(ctx);
+    MapPoint *points = NULL;
+    int nbPoints = 0;
+    int ret = 0;
+    char line[256];
+    int lineNo = 0;
+
+    if (planner == NULL) {
+        printf("Map error: %s\n", modbus_strerror(errno));
+        fclose(file);
+        return -1;
+    }
+    modbus_planner_set_max_gap(planner, maxGap);
+    while (ret == 0 && fgets(line, sizeof(line), file)) {
+        char name[64], table[16], type[16], order[16] = "abcd";
+        modbus_point_t point;
+        int n;
+
+        lineNo++;
+        n = sscanf(line, "%63s %15s %i %15s %15s", name, table, &point.addr, type, order);
+        if (n <= 0 || name[0] == '#')
+            continue;
+
+        if (n < 4) {
+            printf("%s:%d: invalid point\n", fileName, lineNo);
+            ret = -1;
+            break;
+        }
+        point.function = find_keyword(mapTables, table);
+        point.type = find_keyword(mapTypes, type);
+        point.order = find_keyword(mapOrders, order);
+        if (point.function == -1 || point.type == -1 || point.order == -1 ||
+                modbus_planner_add_point(planner, &point) == -1) {
+            printf("%s:%d: invalid point\n", fileName, lineNo);
+            ret = -1;
+            break;
+        }
+
+        MapPoint *newPoints = realloc(points, (nbPoints + 1) * sizeof(MapPoint));
+        if (newPoints == NULL) {
+            ret = -1;
+            break;
+        }
+        points = newPoints;
+        strcpy(points[nbPoints].name, name);
+        points[nbPoints].type = point.type;
+        nbPoints++;
+    }
+    fclose(file);
+
+    if (ret == 0 && verbose) {
+        int nbRequests = modbus_planner_get_nb_requests(planner);
+
+        printf("Points:%d Requests:%d\n", nbPoints, nbRequests);
+        for (int i = 0; i < nbRequests; i++) {
+            int function, reg, nb;
+
+            modbus_planner_get_request(planner, i, &function, &reg, &nb);
+            printf("Func:0x%02x Reg:%d Count:%d\n", function, reg, nb);
+        }
+    }
+
+    if (ret == 0) {
+        ret = modbus_planner_read(planner);
+        for (int i = 0; i < nbPoints; i++) {
+            double value;
+
+            if (modbus_planner_get_value(planner, i, &value) == -1)
+                printf("%s ERROR %s\n", points[i].name, modbus_strerror(errno));
+            else if (points[i].type == MODBUS_POINT_FLOAT)
+                printf("%s %g\n", points[i].name, value);
+            else
+                printf("%s %.0f\n", points[i].name, value);
+        }
+    }
+
+    free(points);
+    modbus_planner_free(planner);
+    return ret;
+}
+
+/* Returns the content of a file in a buffer to free */
+static uint8_t *load_file(const char* fileName, size_t *size)
+{
+    FILE *file = fopen(fileName, "rb");
+    uint8_t *buffer = NULL;
+    long length;
+
+    if (file == NULL) {
+        printf("Can't open %s: %s\n", fileName, strerror(errno));
+        return NULL;
+    }
+    if (fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) >= 0 &&
+            fseek(file, 0, SEEK_SET) == 0) {
+        /* One more byte to end the text formats */
+        buffer = malloc(length + 1);
+        if (buffer && fread(buffer, 1, length, file) == (size_t)length) {
+            buffer[length] = 0;
+            *size = length;
+        } else {
+            free(buffer);
+            buffer = NULL;
+        }
+    }
+    if (buffer == NULL)
+        printf("Can't read %s\n", fileName);
+    fclose(file);
+    return buffer;
+}
+
+/* Bulk write: the values of the file are written from reg by
+ * modbus_write_bits_range() or modbus_write_registers_range(), the requests of
+ * maximal size are pipelined on TCP. nb limits the number of values written
+ * when not 0. */
+int process_write_file(modbus_t* ctx, int func, int reg, int nb, const char* fileName, FileFormat format)
+{
+    bool bits = func == WriteMultipleCoils;
+    size_t size;
+    int nbValues = 0;
+    int ret = -1;
+
+    if (func != WriteMultipleCoils && func != WriteMultipleRegisters) {
+        printf("%s:A data file is written with the function 0x0f or 0x10.\n", PROGMANE);
+        return -1;
+    }
+
+    uint8_t *content = load_file(fileName, &size);
+    if (content == NULL)
+        return -1;
+
+    /* 8 bits per byte of a raw bit file, otherwise 2 bytes per register or at
+     * least one digit and one separator per value of a text file */
+    size_t maxValues = (format == FileRaw && bits) ? size * 8 : size / 2 + 1;
+    uint16_t *values = malloc(maxValues * sizeof(uint16_t));
+    if (values == NULL)
+        goto out;
+
+    if (format == FileRaw) {
+        if (bits) {
+            nbValues = size * 8;
+            for (int i = 0; i < nbValues; i++)
+                values[i] = (content[i / 8] >> (i % 8)) & 1;
+        } else {
+            if (size % 2) {
+                printf("%s: odd number of bytes\n", fileName);
+                goto out;
+            }
+            nbValues = size / 2;
+            for (int i = 0; i < nbValues; i++)
+                values[i] = (content[2 * i] << 8) | content[2 * i + 1];
+        }
+    } else {
+        char *token = (char *)content;
+        char *end;
+
+        for (;;) {
+            token += strspn(token, " ,;\t\r\n");
+            if (*token == 0)
+                break;
+            unsigned long value = strtoul(token, &end, format == FileHex ? 16 : 10);
+            if (end == token || !strchr(" ,;\t\r\n", *end) || value > (bits ? 1 : 0xFFFF)) {
+                printf("%s: invalid value at offset %d\n", fileName, (int)(token - (char *)content));
+                goto out;
+            }
+            values[nbValues++] = value;
+            token = end;
+        }
+    }
+
+    if (nb > 0 && nb < nbValues)
+        nbValues = nb;
+    if (nbValues == 0) {
+        printf("%s: no value to write\n", fileName);
+        goto out;
+    }
+
+    if (bits) {
+        /* One byte per bit for libmodbus */
+        uint8_t *src = (uint8_t *)values;
+        for (int i = 0; i < nbValues; i++)
+            src[i] = values[i];
+        ret = modbus_write_bits_range(ctx, reg, nbValues, src);
+    } else {
+        ret = modbus_write_registers_range(ctx, reg, nbValues, values);
+    }
+
+    if (ret == nbValues) {
+        printf("SUCCESS: written %d elements!\n", nbValues);
+        ret = 0;
+    } else {
+        printf("ERROR occured, ret:%d, %s\n", ret, modbus_strerror(errno));
+        ret = -1;
+    }
+
+out:
+    free(values);
+    free(content);
+    return ret;
+}
+
+/* Bulk read: nb values from reg are read by the modbus_read_*_range() functions
+ * and saved in the file. */
+int process_read_file(modbus_t* ctx, int func, int reg, int nb, const char* fileName, FileFormat format)
+{
+    bool bits = func == ReadCoils || func == ReadDiscreteInput;
+    int ret;
+
+    if (func < ReadCoils || func > ReadInputRegisters || nb < 1) {
+        printf("%s:A data file is read with the functions 0x01 to 0x04 and a count.\n", PROGMANE);
+        return -1;
+    }
+
+    uint16_t *values = malloc(nb * sizeof(uint16_t));
+    uint8_t *dest = (uint8_t *)values;
+    if (values == NULL)
+        return -1;
+
+    switch (func) {
+    case(ReadCoils):
+        ret = modbus_read_bits_range(ctx, reg, nb, dest);
+        break;
+    case(ReadDiscreteInput):
+        ret = modbus_read_input_bits_range(ctx, reg, nb, dest);
+        break;
+    case(ReadHoldingRegisters):
+        ret = modbus_read_registers_range(ctx, reg, nb, values);
+        break;
+    default:
+        ret = modbus_read_input_registers_range(ctx, reg, nb, values);
+        break;
+    }
+    if (ret != nb) {
+        printf("ERROR occured, ret:%d, %s\n", ret, modbus_strerror(errno));
+        free(values);
+        return -1;
+    }
+
+    FILE *file = fopen(fileName, "wb");
+    if (file == NULL) {
+        printf("Can't open %s: %s\n", fileName, strerror(errno));
+        free(values);
+        return -1;
+    }
+
+    for (int i = 0; i < nb; i++) {
+        int value = bits ? dest[i] : values[i];
+
+        if (format == FileRaw) {
+            if (bits && i % 8 == 0)
+                fputc(modbus_get_byte_from_bits(dest, i, nb - i < 8 ? nb - i : 8), file);
+            else if (!bits) {
+                fputc(value >> 8, file);
+                fputc(value & 0xFF, file);
+            }
+        } else if (format == FileHex) {
+            fprintf(file, bits ? "%x" : "%04x", value);
+            fputc((i % 8 == 7 || i == nb - 1) ? '\n' : ' ', file);
+        } else {
+            fprintf(file, "%d\n", value);
+        }
+    }
+
+    ret = 0;
+    if (fclose(file) != 0) {
+        printf("Can't write %s: %s\n", fileName, strerror(errno));
+        ret = -1;
+    } else {
+        printf("SUCCESS: read %d elements into %s\n", nb, fileName);
+    }
+    free(values);
+    return ret;
 }
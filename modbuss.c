@@ -39,53 +39,304 @@
 #include <signal.h>
 
 #include <argtable3.h>
+#include <pthread.h>
 
 #include "mbu-common.h"
 
 #if defined(_WIN32)
 #include <ws2tcpip.h>
 #else
-#include <sys/select.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
 #endif
 
 #define PROGMANE "modbuss"
-#define NB_CONNECTION    10
+/* Listen backlog, connections are accepted as fast as they arrive */
+#define NB_CONNECTION    SOMAXCONN
+/* Serial lines served by one process */
+#define MAX_SERIAL       16
+
+/* A worker serves the connections of its own listening socket */
+typedef struct {
+    modbus_t *ctx;
+    modbus_server_t *server;
+    int socket;
+    pthread_t thread;
+} worker_t;
 
 static modbus_t *ctx = NULL;
 static modbus_mapping_t *mb_mapping;
 
-static int server_socket = -1;
+/* Mappings of the units declared with --unit, indexed by unit ID */
+static modbus_mapping_t *units[MODBUS_MAX_UNITS];
+
+/* A serial worker serves the requests received on its own line */
+typedef struct {
+    modbus_t *ctx;
+    const char *device;
+    pthread_t thread;
+} serial_worker_t;
+
+static worker_t *workers = NULL;
+static int nb_workers = 0;
+static serial_worker_t *serial_workers = NULL;
+static int nb_serial_workers = 0;
+static volatile int stop_requested = 0;
+/* The workers share the mapping */
+static pthread_rwlock_t mapping_lock = PTHREAD_RWLOCK_INITIALIZER;
+static int shared_mapping = 0;
+
+static void stop_sigint(int dummy)
+{
+    int i;
 
-static void close_sigint(int dummy)
+    (void) dummy;
+    stop_requested = 1;
+    for (i = 0; i < nb_workers; i++) {
+        modbus_server_stop(workers[i].server);
+    }
+}
+
+static void lock_mapping(void *user_data, int exclusive)
 {
-    if (server_socket != -1) {
-        close(server_socket);
+    if (exclusive) {
+        pthread_rwlock_wrlock((pthread_rwlock_t *) user_data);
+    } else {
+        pthread_rwlock_rdlock((pthread_rwlock_t *) user_data);
     }
-    modbus_free(ctx);
-    modbus_mapping_free(mb_mapping);
+}
+
+static void unlock_mapping(void *user_data, int exclusive)
+{
+    (void) exclusive;
+    pthread_rwlock_unlock((pthread_rwlock_t *) user_data);
+}
 
-    exit(dummy);
+/* Declares a range "<co|di|hr|ir>:<first>[-<last>]" of the sparse mapping */
+static int add_range(modbus_mapping_t *mapping, const char *spec)
+{
+    static const char *names[] = {"co", "di", "hr", "ir"};
+    modbus_table_t table;
+    char *end;
+    long first;
+    long last;
+
+    for (table = MODBUS_TABLE_BITS; table <= MODBUS_TABLE_INPUT_REGISTERS; table++) {
+        if (strncmp(spec, names[table], 2) == 0 && spec[2] == ':')
+            break;
+    }
+    if (table > MODBUS_TABLE_INPUT_REGISTERS)
+        return -1;
+
+    first = strtol(spec + 3, &end, 0);
+    if (end == spec + 3)
+        return -1;
+    last = first;
+    if (*end == '-') {
+        const char *s = end + 1;
+
+        last = strtol(s, &end, 0);
+        if (end == s)
+            return -1;
+    }
+    if (*end != '\0' || last < first)
+        return -1;
+
+    return modbus_mapping_add_range(mapping, table, first, last - first + 1);
+}
+
+/* Declares the units "<first>[-<last>][:<co>,<di>,<hr>,<ir>]", nb keeps the
+   default sizes when they aren't given */
+static int parse_unit(const char *spec, int *first, int *last, int nb[4])
+{
+    char *end;
+    int i;
+
+    *first = strtol(spec, &end, 0);
+    if (end == spec)
+        return -1;
+    *last = *first;
+    if (*end == '-') {
+        const char *s = end + 1;
+
+        *last = strtol(s, &end, 0);
+        if (end == s)
+            return -1;
+    }
+    if (*end == ':') {
+        for (i = 0; i < 4; i++) {
+            const char *s = end + 1;
+
+            nb[i] = strtol(s, &end, 0);
+            if (end == s || nb[i] < 0 || *end != (i < 3 ? ',' : '\0'))
+                return -1;
+        }
+    }
+    if (*end != '\0' || *first < 0 || *last < *first || *last >= MODBUS_MAX_UNITS)
+        return -1;
+
+    return 0;
+}
+
+/* Allocates a mapping of nb coils, discrete inputs, holding registers and
+   input registers, or a sparse mapping of the ranges */
+static modbus_mapping_t *new_mapping(const int nb[4], int packed, const char *shm_name,
+                                     int shm_replace, const struct arg_str *range)
+{
+    modbus_mapping_t *mapping;
+    int i;
+
+    if (range->count) {
+        mapping = modbus_mapping_new_sparse();
+        for (i = 0; mapping != NULL && i < range->count; i++) {
+            if (add_range(mapping, range->sval[i]) == -1) {
+                fprintf(stderr, "Invalid range: %s\n", range->sval[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+    } else if (shm_name != NULL) {
+        mapping = modbus_mapping_new_shm(shm_name, 0600, shm_replace,
+                                         0, nb[0], 0, nb[1], 0, nb[2], 0, nb[3]);
+    } else if (packed) {
+        mapping = modbus_mapping_new_packed_bits(0, nb[0], 0, nb[1], 0, nb[2], 0, nb[3]);
+    } else {
+        mapping = modbus_mapping_new(nb[0], nb[1], nb[2], nb[3]);
+    }
+    if (mapping == NULL) {
+        fprintf(stderr, "Failed to allocate the mapping: %s\n",
+                modbus_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    return mapping;
+}
+
+/* Serves the requests of a serial line until SIGINT, the line is reopened
+   after a failure (USB adapter unplugged...) */
+static void *run_serial_worker(void *arg)
+{
+    serial_worker_t *worker = arg;
+    modbus_t *ctx = worker->ctx;
+    uint8_t query[MODBUS_RTU_MAX_ADU_LENGTH];
+    int rc;
+
+    while (!stop_requested) {
+        if (modbus_connect(ctx)) {
+            fprintf(stderr, "%s: connection failed: %s\n", worker->device,
+                    modbus_strerror(errno));
+            break;
+        }
+
+        while (!stop_requested) {
+            rc = modbus_receive(ctx, query);
+            if (rc > 0) {
+                /* Only the read functions leave the mapping unchanged */
+                int exclusive = query[modbus_get_header_length(ctx)] >
+                                MODBUS_FC_READ_INPUT_REGISTERS;
+
+                /* rc is the query size */
+                if (shared_mapping)
+                    lock_mapping(&mapping_lock, exclusive);
+                modbus_reply(ctx, query, rc, mb_mapping);
+                if (shared_mapping)
+                    unlock_mapping(&mapping_lock, exclusive);
+            } else if (rc == -1 && errno != ETIMEDOUT && errno < MODBUS_ENOBASE) {
+                /* The invalid requests are ignored, not the line errors */
+                break;
+            }
+        }
+        if (!stop_requested) {
+            printf("%s disconnected: %s\n", worker->device, modbus_strerror(errno));
+            sleep(1);
+        }
+        modbus_close(ctx);
+    }
+
+    return NULL;
+}
+
+/* Creates the context of each serial device, the context of the first one is
+   given when it already exists */
+static int new_serial_workers(const struct arg_str *devices, modbus_t *first,
+                              int baud, char parity, int data_bit, int stop_bit,
+                              int debug, int slave, int with_units)
+{
+    int i;
+
+    serial_workers = calloc(devices->count, sizeof(serial_worker_t));
+    if (serial_workers == NULL)
+        return -1;
+
+    for (i = 0; i < devices->count; i++) {
+        serial_worker_t *worker = &serial_workers[i];
+
+        worker->device = devices->sval[i];
+        if (i == 0 && first != NULL) {
+            worker->ctx = first;
+        } else {
+            worker->ctx = modbus_new_rtu(worker->device, baud, parity, data_bit, stop_bit);
+            if (worker->ctx == NULL) {
+                fprintf(stderr, "%s: %s\n", worker->device, modbus_strerror(errno));
+                return -1;
+            }
+            modbus_set_debug(worker->ctx, debug);
+            modbus_set_slave(worker->ctx, slave);
+            if (with_units)
+                modbus_set_units(worker->ctx, units);
+        }
+        /* The workers check regularly if they must stop */
+        modbus_set_indication_timeout(worker->ctx, 1, 0);
+        nb_serial_workers++;
+    }
+
+    return 0;
+}
+
+static void free_serial_workers(modbus_t *first)
+{
+    int i;
+
+    for (i = 0; i < nb_serial_workers; i++) {
+        if (serial_workers[i].ctx != first)
+            modbus_free(serial_workers[i].ctx);
+    }
+    free(serial_workers);
+}
+
+static void *run_worker(void *arg)
+{
+    worker_t *worker = arg;
+
+    if (modbus_server_run(worker->server) == -1) {
+        perror("Server failure");
+    }
+
+    return NULL;
 }
 
 int main(int argc, char **argv)
 {
     int c;
     int ok;
-    int rc;
+    int rc = 0;
 
     struct arg_int *addr   = arg_int0("a", "addr",              "<n>=1",                                "Slave address");
     struct arg_int *co     = arg_int0(NULL,"co",                "<n>=100",                              "Coils");
     struct arg_int *di     = arg_int0(NULL,"di",                "<n>=100",                              "Discrete inputs");
     struct arg_int *hr     = arg_int0(NULL,"hr",                "<n>=100",                              "Holding registers");
     struct arg_int *ir     = arg_int0(NULL,"ir",                "<n>=100",                              "Input registers");
+    struct arg_lit *packed = arg_lit0(NULL,"packed",                                                    "Store coils and discrete inputs 8 per byte");
+    struct arg_str *shm    = arg_str0(NULL,"shm",               "<name>",                               "Store the mapping in the shared memory region <name>");
+    struct arg_lit *shmrep = arg_lit0(NULL,"shm-replace",                                               "Replace an existing region of the same name");
+    struct arg_str *range  = arg_strn(NULL,"range",             "<co|di|hr|ir>:<first>[-<last>]", 0, 100,
+                                                                                                        "Valid addresses of a sparse mapping (replaces --co/--di/--hr/--ir)");
+    struct arg_str *unit   = arg_strn(NULL,"unit",              "<first>[-<last>][:<co>,<di>,<hr>,<ir>]", 0, MODBUS_MAX_UNITS,
+                                                                                                        "Units served with their own mapping (replaces --addr)");
     struct arg_lit *debug  = arg_lit0("v", "verbose",                                                   "Enable verbpse output");
     struct arg_lit *help   = arg_lit0("h", "help",                                                      "Print this help and exit");
     /* RTU */
     struct arg_rex *rtu    = arg_rex1(NULL, NULL,   "rtu",      NULL,                   ARG_REX_ICASE,  NULL);
-    struct arg_str *dev    = arg_str1("d", "dev",               "<device>",                             "Serial device");
+    struct arg_str *dev    = arg_strn("d", "dev",               "<device>", 1, MAX_SERIAL,              "Serial device (repeat to serve several lines)");
     struct arg_int *baud   = arg_int1("b", "baud",              "<n>",                                  "Baud rate");
     struct arg_rex *dbit   = arg_rex0(NULL, "data-bits", "7|8",  "<7|8>=8",             ARG_REX_ICASE,  "Data bits");
     struct arg_rex *sbit   = arg_rex0(NULL, "stop-bits", "1|2",  "<1|2>=1",             ARG_REX_ICASE,  "Stop bits");
@@ -97,11 +348,18 @@ int main(int argc, char **argv)
     struct arg_int *port   = arg_int0("p", "port",              "<port>=502",                           "Socket listening port");
     struct arg_rex *ip     = arg_rex0("i", "addr", "^([0-9]{1,3}\\.){3}([0-9]{1,3})$",
                                                                 "<IP>=127.0.0.1",       ARG_REX_ICASE,  "Device IP address");
+    struct arg_int *threads = arg_int0("t", "threads",          "<n>=1",                                "Server threads (SO_REUSEPORT listeners)");
+    struct arg_rex *engine = arg_rex0(NULL, "engine", "epoll|uring",
+                                                                "<epoll|uring>=epoll",  ARG_REX_ICASE,  "Event engine (uring needs Linux >= 6.0)");
+    struct arg_str *sdev   = arg_strn("d", "dev",               "<device>", 0, MAX_SERIAL,              "Serial device served too (repeat to serve several lines)");
+    struct arg_int *sbaud  = arg_int0("b", "baud",              "<n>=19200",                            "Baud rate of the serial devices");
+    struct arg_rex *sparity= arg_rex0(NULL, "parity", "N|E|O",  "<N|E|O>=E",            ARG_REX_ICASE,  "Parity of the serial devices");
     struct arg_end *end2    = arg_end(20);
 
-    void* argtable1[] = {rtu, addr, co, di, hr, ir, dev, baud, dbit, sbit, parity, debug, help, end1};
+    void* argtable1[] = {rtu, addr, co, di, hr, ir, packed, shm, shmrep, range, unit, dev, baud, dbit, sbit, parity, debug, help, end1};
 
-    void* argtable2[] = {tcp, addr, co, di, hr, ir, port, ip, debug, help, end2};
+    void* argtable2[] = {tcp, addr, co, di, hr, ir, packed, shm, shmrep, range, unit, port, ip, threads, engine,
+                            sdev, sbaud, dbit, sbit, sparity, debug, help, end2};
 
     /* defaults */
     addr->ival[0] = 1;
@@ -109,6 +367,12 @@ int main(int argc, char **argv)
     di->ival[0] = 100;
     hr->ival[0] = 100;
     ir->ival[0] = 100;
+    threads->ival[0] = 1;
+    dbit->sval[0] = "8";
+    sbit->sval[0] = "1";
+    parity->sval[0] = "E";
+    sbaud->ival[0] = 19200;
+    sparity->sval[0] = "E";
 
     int nerrors1 = arg_parse(argc,argv,argtable1);
     int nerrors2 = arg_parse(argc,argv,argtable2);
@@ -154,128 +418,214 @@ int main(int argc, char **argv)
     }
 
     //prepare mapping
-    mb_mapping = modbus_mapping_new(co->ival[0], di->ival[0], hr->ival[0], ir->ival[0]);
-    if (mb_mapping == NULL) {
-        fprintf(stderr, "Failed to allocate the mapping: %s\n",
-                modbus_strerror(errno));
+    int nb[4] = {co->ival[0], di->ival[0], hr->ival[0], ir->ival[0]};
+
+    /* The ranges give a private sparse mapping */
+    if (range->count && (packed->count || shm->count || shmrep->count)) {
+        fprintf(stderr, "Invalid options: --range can't be used with --packed, --shm or --shm-replace\n");
         exit(EXIT_FAILURE);
     }
-    if (debug->count)
+
+    if (unit->count) {
+        for (c = 0; c < unit->count; c++) {
+            int unit_nb[4] = {nb[0], nb[1], nb[2], nb[3]};
+            int first, last, u;
+
+            if (parse_unit(unit->sval[c], &first, &last, unit_nb) == -1) {
+                fprintf(stderr, "Invalid unit: %s\n", unit->sval[c]);
+                exit(EXIT_FAILURE);
+            }
+            for (u = first; u <= last; u++) {
+                char name[256];
+
+                /* Each unit has its own region */
+                if (shm->count)
+                    snprintf(name, sizeof(name), "%s.%d", shm->sval[0], u);
+                modbus_mapping_free(units[u]);
+                units[u] = new_mapping(
+                    unit_nb, packed->count, shm->count ? name : NULL, shmrep->count, range);
+            }
+        }
+    } else {
+        mb_mapping = new_mapping(
+            nb, packed->count, shm->count ? shm->sval[0] : NULL, shmrep->count, range);
+    }
+    if (debug->count && range->count) {
+        printf("Ranges: \n");
+        for (c = 0; c < range->count; c++)
+            printf("\t%s\n", range->sval[c]);
+    } else if (debug->count)
         printf("Ranges: \n \tCoils: 0-0x%04x\n\tDigital inputs: 0-0x%04x\n\tHolding registers: 0-0x%04x\n\tInput registers: 0-0x%04x\n",
                co->ival[0], di->ival[0], hr->ival[0], ir->ival[0]);
+    if (debug->count && shm->count)
+        printf("Shared memory region: %s\n", shm->sval[0]);
+    if (debug->count && unit->count) {
+        printf("Units: \n");
+        for (c = 0; c < unit->count; c++)
+            printf("\t%s\n", unit->sval[c]);
+    }
 
     modbus_set_debug(ctx, debug->count);
     modbus_set_slave(ctx, addr->ival[0]);
+    if (unit->count)
+        modbus_set_units(ctx, units);
 
     if (rtu->count) {
-        for(;;) {
-
-            if (modbus_connect(ctx)) {
-                break;
-            }
+        int i;
 
-            for (;;) {
-                uint8_t query[MODBUS_RTU_MAX_ADU_LENGTH];
+        /* A thread per serial line, the first one is served by this thread */
+        if (new_serial_workers(dev, ctx, baud->ival[0], toupper(parity->sval[0][0]),
+                               getInt(dbit->sval[0], 0), getInt(sbit->sval[0], 0),
+                               debug->count, addr->ival[0], unit->count) == -1) {
+            rc = -1;
+        } else {
+            shared_mapping = nb_serial_workers > 1;
+            signal(SIGINT, stop_sigint);
 
-                rc = modbus_receive(ctx, query);
-                if (rc > 0) {
-                    /* rc is the query size */
-                    modbus_reply(ctx, query, rc, mb_mapping);
-                } else if (rc == -1) {
-                    /* Connection closed by the client or error */
-                    break;
-                }
+            for (i = 1; i < nb_serial_workers; i++) {
+                pthread_create(&serial_workers[i].thread, NULL, run_serial_worker, &serial_workers[i]);
+            }
+            run_serial_worker(&serial_workers[0]);
+            /* The other lines are stopped when the first one fails */
+            stop_requested = 1;
+            for (i = 1; i < nb_serial_workers; i++) {
+                pthread_join(serial_workers[i].thread, NULL);
             }
-            printf("Client disconnected: %s\n", modbus_strerror(errno));
+            signal(SIGINT, SIG_DFL);
         }
+        free_serial_workers(ctx);
     } else {
-        uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
-        int master_socket;
-        fd_set refset;
-        fd_set rdset;
-        /* Maximum file descriptor number */
-        int fdmax;
-
-        server_socket = modbus_tcp_listen(ctx, NB_CONNECTION);
-        if (server_socket == -1) {
-            fprintf(stderr, "Unable to listen TCP connection\n");
+#if !defined(_WIN32)
+        struct rlimit limit;
+
+        /* Each connection uses a file descriptor, raises the soft limit */
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+#endif
+
+        int i;
+
+        if (threads->ival[0] < 1) {
+            fprintf(stderr, "Invalid number of threads %d\n", threads->ival[0]);
             modbus_free(ctx);
             return -1;
         }
 
-        signal(SIGINT, close_sigint);
+        workers = calloc(threads->ival[0], sizeof(worker_t));
+        if (workers == NULL) {
+            modbus_free(ctx);
+            return -1;
+        }
 
-        /* Clear the reference set of socket */
-        FD_ZERO(&refset);
-        /* Add the server socket */
-        FD_SET(server_socket, &refset);
+        /* The serial lines are served by their own threads beside the TCP
+         * connections */
+        if (sdev->count &&
+            new_serial_workers(sdev, NULL, sbaud->ival[0], toupper(sparity->sval[0][0]),
+                               getInt(dbit->sval[0], 0), getInt(sbit->sval[0], 0),
+                               debug->count, addr->ival[0], unit->count) == -1) {
+            free_serial_workers(NULL);
+            free(workers);
+            modbus_free(ctx);
+            return -1;
+        }
+        shared_mapping = threads->ival[0] + nb_serial_workers > 1;
+
+        /* Each worker has its own context, listening socket and event loop,
+         * the kernel spreads the connections between the listening sockets */
+        for (i = 0; i < threads->ival[0]; i++) {
+            worker_t *worker = &workers[i];
+
+            worker->socket = -1;
+            if (i == 0) {
+                worker->ctx = ctx;
+            } else {
+                worker->ctx = modbus_new_tcp(ip->sval[0], port->ival[0]);
+                if (worker->ctx == NULL) {
+                    break;
+                }
+                modbus_set_debug(worker->ctx, debug->count);
+                modbus_set_slave(worker->ctx, addr->ival[0]);
+                if (unit->count)
+                    modbus_set_units(worker->ctx, units);
+            }
+            nb_workers++;
 
-        /* Keep track of the max file descriptor */
-        fdmax = server_socket;
+            if (threads->ival[0] > 1 && modbus_tcp_set_reuse_port(worker->ctx, TRUE) == -1) {
+                fprintf(stderr, "SO_REUSEPORT is not supported: %s\n", modbus_strerror(errno));
+                break;
+            }
 
-        for (;;) {
-            rdset = refset;
-            if (select(fdmax+1, &rdset, NULL, NULL, NULL) == -1) {
-                perror("Server select() failure.");
-                close_sigint(1);
+            worker->socket = modbus_tcp_listen(worker->ctx, NB_CONNECTION);
+            if (worker->socket == -1) {
+                fprintf(stderr, "Unable to listen TCP connection\n");
+                break;
             }
 
-            /* Run through the existing connections looking for data to be
-             * read */
-            for (master_socket = 0; master_socket <= fdmax; master_socket++) {
+            /* All the connections are served by the event loop of the server */
+            worker->server = modbus_server_new(worker->ctx, mb_mapping);
+            if (worker->server == NULL ||
+                modbus_server_set_listen_socket(worker->server, worker->socket) == -1) {
+                fprintf(stderr, "Unable to create the server: %s\n", modbus_strerror(errno));
+                break;
+            }
 
-                if (!FD_ISSET(master_socket, &rdset)) {
-                    continue;
+            if (engine->count && toupper(engine->sval[0][0]) == 'U' &&
+                modbus_server_set_engine(worker->server, MODBUS_SERVER_ENGINE_URING) == -1) {
+                /* The default engine is kept */
+                if (i == 0) {
+                    fprintf(stderr, "io_uring engine not available (%s), using epoll\n",
+                            modbus_strerror(errno));
                 }
+            }
 
-                if (master_socket == server_socket) {
-                    /* A client is asking a new connection */
-                    socklen_t addrlen;
-                    struct sockaddr_in clientaddr;
-                    int newfd;
-
-                    /* Handle new connections */
-                    addrlen = sizeof(clientaddr);
-                    memset(&clientaddr, 0, sizeof(clientaddr));
-                    newfd = accept(server_socket, (struct sockaddr *)&clientaddr, &addrlen);
-                    if (newfd == -1) {
-                        perror("Server accept() error");
-                    } else {
-                        FD_SET(newfd, &refset);
-
-                        if (newfd > fdmax) {
-                            /* Keep track of the maximum */
-                            fdmax = newfd;
-                        }
-                        printf("New connection from %s:%d on socket %d\n",
-                            inet_ntoa(clientaddr.sin_addr), clientaddr.sin_port, newfd);
-                    }
-                } else {
-                    modbus_set_socket(ctx, master_socket);
-                    rc = modbus_receive(ctx, query);
-                    if (rc > 0) {
-                        modbus_reply(ctx, query, rc, mb_mapping);
-                    } else if (rc == -1) {
-                        /* This example server in ended on connection closing or
-                         * any errors. */
-                        printf("Connection closed on socket %d\n", master_socket);
-                        close(master_socket);
-
-                        /* Remove from reference set */
-                        FD_CLR(master_socket, &refset);
-
-                        if (master_socket == fdmax) {
-                            fdmax--;
-                        }
-                    }
-                }
+            if (shared_mapping) {
+                modbus_server_set_lock(worker->server, lock_mapping, unlock_mapping, &mapping_lock);
             }
         }
+
+        if (i == threads->ival[0]) {
+            signal(SIGINT, stop_sigint);
+
+            for (i = 0; i < nb_serial_workers; i++) {
+                pthread_create(&serial_workers[i].thread, NULL, run_serial_worker, &serial_workers[i]);
+            }
+            for (i = 1; i < nb_workers; i++) {
+                pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+            }
+            run_worker(&workers[0]);
+            /* The other workers are stopped when the first one fails */
+            stop_sigint(0);
+            for (i = 1; i < nb_workers; i++) {
+                pthread_join(workers[i].thread, NULL);
+            }
+            for (i = 0; i < nb_serial_workers; i++) {
+                pthread_join(serial_workers[i].thread, NULL);
+            }
+            signal(SIGINT, SIG_DFL);
+        } else {
+            rc = -1;
+        }
+
+        for (i = nb_workers - 1; i >= 0; i--) {
+            modbus_server_free(workers[i].server);
+            if (workers[i].socket != -1) {
+                close(workers[i].socket);
+            }
+            if (i > 0) {
+                modbus_free(workers[i].ctx);
+            }
+        }
+        free(workers);
+        free_serial_workers(NULL);
     }
 
     modbus_mapping_free(mb_mapping);
+    for (c = 0; c < MODBUS_MAX_UNITS; c++)
+        modbus_mapping_free(units[c]);
     modbus_close(ctx);
     modbus_free(ctx);
 
-    return 0;
+    return (rc == -1) ? -1 : 0;
 }